@@ -0,0 +1,113 @@
+﻿#pragma once
+
+#include "frustumCulling.hpp"
+#include <glm/glm.hpp>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class ThreadPool;
+
+    // 一组物体AABB上的BVH，物体用构建时的下标表示
+    // 分桶SAH构建，上层在调用线程里划分，物体数少于阈值的子树交给线程池并行构建
+    // 物体移动时只更新路径上的节点（refit），SAH代价超过构建时的一定倍数后重新构建
+    // 无效的包围盒（max < min）不进树，视锥查询总是返回它们
+    class BoundingVolumeHierarchy
+    {
+    public:
+        struct Bounds
+        {
+            glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+            glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+            bool isValid() const { return max.x >= min.x && max.y >= min.y && max.z >= min.z; }
+            void unionBounds(const Bounds& other);
+            float surfaceArea() const;
+        };
+
+        static const uint32_t MaxLeafSize = 4;
+        static const uint32_t BinCount = 16;
+        // 并行构建时每个子树任务的最少物体数
+        static const uint32_t ParallelSubtreeSize = 1024;
+        // refit之后SAH代价超过构建时的倍数就重新构建
+        static constexpr float RebuildCostRatio = 1.5f;
+
+        // threadPool为空时全部在调用线程里构建
+        void build(const std::vector<Bounds>& objectBounds, ThreadPool* threadPool = nullptr);
+
+        uint32_t getObjectCount() const { return static_cast<uint32_t>(objectBounds.size()); }
+        const Bounds& getObjectBounds(uint32_t object) const { return objectBounds[object]; }
+
+        // 修改一个物体的包围盒，在下次refit时更新树；有效性变化时需要重新build
+        void setObjectBounds(uint32_t object, const Bounds& bounds);
+
+        // 只更新被修改物体所在的路径，返回是否因为质量下降重新构建了
+        bool refit(ThreadPool* threadPool = nullptr);
+
+        // 所有有效物体的包围盒
+        Bounds getRootBounds() const;
+
+        // 相对根节点面积归一化的SAH代价，越小越好
+        float getCost() const;
+        float getBuildCost() const { return buildCost; }
+
+        // 和视锥相交的物体，顺序不定；整个在视锥内的子树不再逐个测试
+        void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& outObjects) const;
+
+        // 和包围盒相交的物体
+        void queryBounds(const Bounds& bounds, std::vector<uint32_t>& outObjects) const;
+
+        // 由近到远访问射线经过的物体，intersect返回是否命中并写入更近的t，返回最近命中的物体，没有时为-1
+        // intersect为空时直接用物体的包围盒求交
+        int32_t raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const std::function<bool(uint32_t object, float& t)>& intersect = nullptr) const;
+
+    private:
+        // 内部节点count为0，左右子节点是leftFirst和leftFirst + 1；叶子的物体是indices[leftFirst, leftFirst + count)
+        struct Node
+        {
+            Bounds bounds;
+            uint32_t leftFirst = 0;
+            uint32_t count = 0;
+        };
+
+        // 构建时按叶子顺序原地划分，包围盒和中心跟着一起移动，访问是连续的
+        struct BuildReference
+        {
+            Bounds bounds;
+            glm::vec3 centroid;
+            uint32_t object;
+        };
+
+        struct BuildTask
+        {
+            uint32_t node;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        // 按SAH划分references[first, first + count)，不值得划分时返回false
+        bool split(uint32_t first, uint32_t count, const Bounds& bounds, uint32_t& leftCount);
+        void buildSubtree(std::vector<Node>& outNodes, uint32_t nodeIndex, uint32_t first, uint32_t count);
+        Bounds computeReferenceBounds(uint32_t first, uint32_t count) const;
+        Bounds computeLeafBounds(const Node& leaf) const;
+        float nodeCost(const Node& node) const;
+        void updateTopology();
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> indices;          // 叶子引用的物体，按叶子连续存放
+        std::vector<Bounds> objectBounds;
+        std::vector<BuildReference> references;
+        std::vector<uint32_t> unboundedObjects;
+
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> objectLeaves;     // 物体所在的叶子，不在树里时为~0u
+        std::vector<uint32_t> dirtyObjects;
+        std::vector<uint8_t> dirtyNodes;
+
+        // 没有归一化的SAH代价，refit时逐节点增减
+        float unnormalizedCost = 0.0f;
+        float buildCost = 0.0f;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+
+namespace VulkanEngine
+{
+    // 从viewProj提取的6个平面，法线朝内，dot(n, p) + w >= 0代表在平面内侧
+    struct Frustum
+    {
+        std::array<glm::vec4, 6> planes;
+
+        // 深度范围是[0, 1]，和GLM_FORCE_DEPTH_ZERO_TO_ONE一致
+        static Frustum fromViewProj(const glm::mat4& viewProj);
+    };
+
+    struct CullingStats
+    {
+        uint32_t tested = 0;
+        uint32_t visible = 0;
+        uint32_t culled = 0;
+    };
+
+    // GPU遮挡剔除的统计，顺序和shader里的计数一致
+    struct OcclusionCullingStats
+    {
+        uint32_t tested = 0;
+        uint32_t prepassDrawn = 0;      // 第一阶段按上一帧可见集合画进Hi-Z的数量
+        uint32_t frustumCulled = 0;
+        uint32_t occluded = 0;
+        uint32_t visible = 0;
+    };
+
+    // CPU软件遮挡剔除的统计
+    struct SoftwareOcclusionStats
+    {
+        uint32_t occluderMeshes = 0;
+        uint32_t occluderTriangles = 0;
+        uint32_t tested = 0;
+        uint32_t occluded = 0;
+    };
+
+    // 包围盒按SoA存放，中心和半长各3个float数组，长度补齐到8的倍数
+    // 一次测试8个（AVX）或2x4个（SSE、NEON），没有SIMD时逐个测试
+    class FrustumCuller
+    {
+    public:
+        static const uint32_t Width = 8;
+
+        void resize(uint32_t count);
+        // 无效的包围盒当作总是可见
+        void setBounds(uint32_t index, const glm::vec3& min, const glm::vec3& max);
+
+        uint32_t getCount() const { return count; }
+
+        // 可见的下标按从小到大写进visible
+        void cull(const Frustum& frustum, std::vector<uint32_t>& visible, CullingStats& stats) const;
+
+    private:
+        void cullScalar(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visible) const;
+
+        uint32_t count = 0;
+
+        std::vector<float> centerX;
+        std::vector<float> centerY;
+        std::vector<float> centerZ;
+        std::vector<float> extentX;
+        std::vector<float> extentY;
+        std::vector<float> extentZ;
+    };
+}
\ No newline at end of file
@@ -10,15 +10,20 @@ namespace VulkanEngine
 	class UIPass : public VulkanRenderPass
 	{
 	public:
-		void init(VulkanRenderer* vulkanRender, VulkanRenderPass* mainPass, uint32_t subpassIndex, VulkanRenderSceneData* sceneData);
+		void init(VulkanRenderer* vulkanRender, VkRenderPass targetRenderPass, uint32_t subpassIndex, VulkanRenderSceneData* sceneData);
 		void postInit() override;
 
 		void draw(VkCommandBuffer commandBuffer, uint32_t vertexSize) override;
-		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize) override;
+		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) override;
+		void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) override;
+		void drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) override;
 		void clear() override;
 
 	private:
 		void uploadFonts();
+		void drawMemoryPanel();
+		void drawCullingPanel();
+		void drawLightingPanel();
 		VulkanRenderPass* mainPass = nullptr;
 	};
 
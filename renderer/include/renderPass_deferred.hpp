@@ -6,27 +6,76 @@
 
 namespace VulkanEngine
 {
+	// 延迟光照的像素分类，每类一个特化的光照管线，和shader里的LIGHTING_CLASS_*一致
+	// compute光照：deferredTileClassify.comp读存下来的gbuffer按16x16的tile分类，每类按tile列表间接dispatch
+	//   Unshadowed是tile里所有几何体都背对方向光或者都超出最后一个级联
+	// subpass光照：gbuffer读不到，只能按深度分类，画三个全屏三角形靠深度测试在片元着色器之前剔除
+	//   Shadowed只是深度在最后一个级联以内，背光的像素也会做阴影过滤；Unshadowed的三角形也覆盖天空，在shader里丢弃
+	// gbuffer.frag只写一种shadingModel，两条路径都不按shadingModel分类
+	enum class DeferredLightingClass : int32_t
+	{
+		Sky = 0,		// 没有几何体，只采样天空盒
+		Unshadowed,		// 不查方向光的阴影图
+		Shadowed,
+		Count,
+	};
+
 	class DeferredRenderPass : public VulkanRenderPass
 	{
 	public:
 		void init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData) override;
 		void postInit() override;
 
-		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize) override;
+		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) override;
+		void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) override;
+		void drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) override;
 		void draw(VkCommandBuffer commandBuffer, uint32_t vertexSize) override;
 		void clear() override;
 
 		void recreate();
 
+		// 光照subpass里依次画三类像素，调用前需要绑定好光照的descriptorSet
+		// shadowRangeDepth是最后一个阴影级联远端在深度缓冲里的值
+		void drawLighting(VkCommandBuffer commandBuffer, float shadowRangeDepth);
+
+		// compute光照：gbuffer的renderPass结束之后录制，调用前需要在compute上绑定好光照的descriptorSet
+		// 先给tile分类，再每类间接dispatch一次
+		void dispatchLighting(VkCommandBuffer commandBuffer);
+
+		bool isComputeLighting() const { return computeLighting; }
+
+		// gbuffer所在的framebuffer，subpass光照时和交换链一一对应
+		VkFramebuffer getGBufferFrameBuffer(uint32_t swapChainImageIndex) const;
+		// FXAA和UI所在的renderPass和subpass
+		VkRenderPass getPostRenderPass() const;
+		uint32_t getPostSubpass() const;
+
+		// subpass光照时是整个renderPass的framebuffer，compute光照时只有FXAA和UI
 		std::vector<VkFramebuffer> swapChainFrameBuffers;
 
 	private:
 
 		void setupAttachments();
+		void setupLightingTileBuffer();
 		void setupRenderPass();
+		void setupComputeLightingRenderPasses();
 		void setupFrameBuffers();
 		void setupDescriptorSetLayout();
 		void setupPipelines();
 		void setupDescriptorSet();
+
+		// 创建时按sceneData->computeDeferredLighting确定，交换链重建时不变，UI的管线依赖FXAA所在的renderPass
+		// compute光照时renderPass只有gbuffer，gbuffer和深度存下来给compute读，FXAA单独一个postRenderPass
+		bool computeLighting = false;
+		VkRenderPass postRenderPass = VK_NULL_HANDLE;
+
+		// 和renderPipelines[1]共用layout，Shadowed类就是renderPipelines[1].pipeline
+		std::array<VkPipeline, static_cast<size_t>(DeferredLightingClass::Count)> lightingPipelines = {};
+
+		// compute光照的tile分类，和光照共用layout，分类结果和间接dispatch的参数都在lightingTileBuffer里
+		// 布局见shaders/deferredLightingTiles.h，大小按交换链算，重建时跟着重建
+		VkPipeline tileClassifyPipeline = VK_NULL_HANDLE;
+		VkBuffer lightingTileBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory lightingTileMemory = VK_NULL_HANDLE;
 	};
 }
\ No newline at end of file
@@ -4,16 +4,45 @@
 
 namespace VulkanEngine
 {
+	// 方向光的级联阴影，每个级联是阴影图的一层，各自一个framebuffer和descriptorSet
+	// frameBuffers[i]和descriptorInfos[i]对应第i个级联
+	// 有动态投射物的级联先把静态投射物画进静态缓存，每次重画时复制过来再叠加动态投射物
+	// 三个renderPass只有load/store和layout不同，framebuffer和管线可以通用
 	class DirectionalLightShadowMapRenderPass : public VulkanRenderPass
 	{
 	public:
 		void init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData) override;
 		void postInit() override;
 
-		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize) override;
+		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) override;
+		void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) override;
+		void drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) override;
 		void draw(VkCommandBuffer commandBuffer, uint32_t vertexSize) override;
 		void clear() override;
 
+		// 场景的meshDrawDataResource扩容之后重写每个set里引用它的binding
+		void updateMeshDrawDataDescriptors();
+
+		uint32_t getCascadeCount() const { return cascadeCount; }
+
+		// 所有级联的2D_ARRAY深度视图和比较采样器，光照pass采样用
+		VkImageView getShadowMapView() const { return shadowMapAttachment.imageView; }
+		VkSampler getShadowSampler() const { return shadowSampler; }
+
+		// 清空后画静态投射物，结束时静态缓存的这一层处于TRANSFER_SRC
+		VkRenderPass getStaticRenderPass() const { return staticRenderPass; }
+		// 在复制过来的静态阴影上继续画动态投射物
+		VkRenderPass getDynamicRenderPass() const { return dynamicRenderPass; }
+		// 静态缓存第一次用到时才创建
+		VkFramebuffer getStaticFrameBuffer(uint32_t cascade);
+
+		// 静态缓存的一层复制到阴影图的同一层，之后用getDynamicRenderPass开始该级联
+		void copyStaticCascade(VkCommandBuffer commandBuffer, uint32_t cascade);
+
+		// 光栅化时的深度偏移，代替shader里的固定bias
+		float depthBiasConstant = 1.25f;
+		float depthBiasSlope = 1.75f;
+
 	private:
 		void setupAttachments();
 		void setupRenderPass();
@@ -21,9 +50,21 @@ namespace VulkanEngine
 		void setupFrameBuffers();
 		void setupDescriptorSetLayout();
 		void setupDescriptorSet();
+		void setupStaticCache();
+		// 只有第一个附件描述不同
+		VkRenderPass createShadowRenderPass(const VkAttachmentDescription& attachment, const VkSubpassDependency* dependencies);
+
+		uint32_t shadowMapSize = 2048;
+		uint32_t cascadeCount = 1;
 
-		uint32_t shadowMapSize = 4096;
+		VulkanFrameBufferAttachment shadowMapAttachment;
+		std::vector<VkImageView> cascadeViews;
+		VkSampler shadowSampler = VK_NULL_HANDLE;
 
-		VulkanFrameBufferAttachment depthAttachment;
+		VkRenderPass staticRenderPass = VK_NULL_HANDLE;
+		VkRenderPass dynamicRenderPass = VK_NULL_HANDLE;
+		VulkanFrameBufferAttachment staticCacheAttachment;
+		std::vector<VkImageView> staticCacheViews;
+		std::vector<VkFramebuffer> staticFrameBuffers;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include "vulkanRenderPass.hpp"
+
+namespace VulkanEngine
+{
+	// 点光源和聚光灯的阴影图集，整张图集一个framebuffer，每块用自己的视口和裁剪画
+	// 聚光灯一块，点光源立方体的六个面各一块；块的分配和缓存在VulkanRenderSceneData::updateLocalLightShadows
+	// descriptorInfos[frameIndex * MaxShadowAtlasUpdates + i]对应这一帧的第i个更新，读uniformShadowAtlasResource里自己的那一段
+	class LocalLightShadowAtlasRenderPass : public VulkanRenderPass
+	{
+	public:
+		void init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData) override;
+		void postInit() override;
+
+		void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) override;
+		void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) override;
+		void drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) override;
+		void draw(VkCommandBuffer commandBuffer, uint32_t vertexSize) override;
+		void clear() override;
+
+		// 场景的meshDrawDataResource扩容之后重写每个set里引用它的binding
+		void updateMeshDrawDataDescriptors();
+
+		uint32_t getAtlasSize() const { return atlasSize; }
+
+		VkImageView getAtlasView() const { return atlasAttachment.imageView; }
+		VkSampler getAtlasSampler() const { return atlasSampler; }
+
+		// 清空整张图集，图集第一次使用时没有有效的内容和layout
+		VkRenderPass getResetRenderPass() const { return resetRenderPass; }
+
+		// 设置这一块的视口和裁剪并把它清成最远深度，之后画的投射物只会落在这一块里
+		void beginTile(VkCommandBuffer commandBuffer, const ShadowAtlasAllocator::Tile& tile);
+
+		float depthBiasConstant = 1.25f;
+		float depthBiasSlope = 1.75f;
+
+	private:
+		void setupAttachments();
+		void setupRenderPass();
+		void setupPipelines();
+		void setupFrameBuffers();
+		void setupDescriptorSetLayout();
+		void setupDescriptorSet();
+
+		uint32_t atlasSize = 4096;
+
+		VulkanFrameBufferAttachment atlasAttachment;
+		VkSampler atlasSampler = VK_NULL_HANDLE;
+
+		VkRenderPass resetRenderPass = VK_NULL_HANDLE;
+	};
+}
\ No newline at end of file
@@ -7,8 +7,13 @@
 #include "renderPass_forwardLight.hpp"
 #include "renderPass_UI.hpp"
 #include "renderPass_directionalLightShadow.hpp"
+#include "renderPass_localLightShadow.hpp"
 #include "renderPass_deferred.hpp"
 #include "vulkanScene.hpp"
+#include "vulkanRenderQueue.hpp"
+#include "vulkanOcclusionCulling.hpp"
+#include "vulkanLightClustering.hpp"
+#include "softwareOcclusionCulling.hpp"
 
 #include <chrono>
 
@@ -24,6 +29,15 @@ namespace VulkanEngine
         void drawFrame();
         void quit();
     private:
+        // 构建、排序并写好一个pass的indirect buffer，要在GPU剔除和录制之前完成，reuseSceneCommands并且队列缓存了该帧下标的命令时跳过
+        void buildRenderQueue(VulkanRenderQueue& queue, RenderQueuePass pass, const glm::mat4& viewProj, const std::vector<uint32_t>& visibleMeshes, const RenderQueueBindings& bindings);
+
+        // 录制一个pass的队列，按parallelRecording选择inline录制或者多线程录制secondary commandBuffer
+        // reuseSceneCommands时直接执行该帧下标缓存的commandBuffer，该帧下标没有录制过的队列重新录制并缓存
+        void recordRenderQueue(VkCommandBuffer commandBuffer, VulkanRenderQueue& queue, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, uint32_t subpass, VkFramebuffer framebuffer, bool drawUI);
+
+        // 影响场景命令的状态，变化时缓存的commandBuffer失效
+        uint64_t getRecordCacheKey();
 
         std::string basePath;
         VulkanRenderer* vulkanRenderer = nullptr;
@@ -31,10 +45,36 @@ namespace VulkanEngine
         UIPass* UIRenderPass = nullptr;
         MainRenderPass* mainRenderPass = nullptr;
         DirectionalLightShadowMapRenderPass* directionalLightShadowMapPass = nullptr;
+        LocalLightShadowAtlasRenderPass* localLightShadowAtlasPass = nullptr;
         DeferredRenderPass* deferredRenderPass = nullptr;
 
         VulkanRenderSceneData* sceneData = nullptr;
 
+        // 每个阴影级联和主视角各一个，forward和gbuffer只会用到其中一个
+        // shadowQueues画级联的静态投射物，shadowDynamicQueues画叠加在静态缓存上的动态投射物
+        std::array<VulkanRenderQueue, MaxShadowCascades> shadowQueues;
+        std::array<VulkanRenderQueue, MaxShadowCascades> shadowDynamicQueues;
+        VulkanRenderQueue opaqueQueue;
+        // 这一帧要重画的阴影图集块，每块一个，每帧都重新构建并inline录制
+        std::array<VulkanRenderQueue, MaxShadowAtlasUpdates> shadowAtlasQueues;
+
+        // 阴影图和静态缓存里每一层当前内容对应的key，静态缓存没有有效内容时为~0
+        std::array<uint64_t, MaxShadowCascades> shadowContentKeys;
+        std::array<uint64_t, MaxShadowCascades> shadowStaticKeys;
+        // 阴影图集还没有清空过，第一帧要用resetRenderPass
+        bool shadowAtlasInitialized = false;
+
+        // 主视角队列的GPU遮挡剔除
+        VulkanOcclusionCuller occlusionCuller;
+        // 没有GPU剔除时的CPU遮挡剔除
+        SoftwareOcclusionCuller softwareOcclusionCuller;
+        // 点光源和聚光灯按簇分配
+        VulkanLightClusterer lightClusterer;
+
+        // record-once模式下每个帧下标缓存的场景命令对应的状态
+        std::array<uint64_t, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> recordCacheKeys;
+        bool reuseSceneCommands = false;
+
         std::chrono::steady_clock::time_point lastFrmeTime;
     };
 }
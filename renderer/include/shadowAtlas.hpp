@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace VulkanEngine
+{
+    // 正方形阴影图集的四叉树分配器，块的边长是atlasSize / 2^level，只能是2的幂
+    // 分配时取同一级的空闲块，没有就拆分上一级；释放时四个兄弟块都空闲就合并回上一级
+    class ShadowAtlasAllocator
+    {
+    public:
+        // 图集里的一块，像素坐标
+        struct Tile
+        {
+            uint32_t x = 0;
+            uint32_t y = 0;
+            uint32_t size = 0;
+
+            bool isValid() const { return size > 0; }
+            bool operator==(const Tile& other) const { return x == other.x && y == other.y && size == other.size; }
+            bool operator!=(const Tile& other) const { return !(*this == other); }
+        };
+
+        void init(uint32_t atlasSize, uint32_t minTileSize);
+
+        // 清空所有分配
+        void reset();
+
+        // size会被规整到[minTileSize, atlasSize]内的2的幂，空间不够时返回false
+        bool allocate(uint32_t size, Tile& outTile);
+        void free(const Tile& tile);
+
+        uint32_t getAtlasSize() const { return atlasSize; }
+        uint32_t getMinTileSize() const { return minTileSize; }
+
+        // 已分配的面积占整个图集的比例
+        float getUsage() const;
+
+        // 不超过size的最大2的幂，再规整到[minTileSize, atlasSize]
+        uint32_t clampTileSize(uint32_t size) const;
+
+    private:
+        uint32_t getLevel(uint32_t size) const;
+        bool allocateLevel(uint32_t level, uint32_t& outX, uint32_t& outY);
+        void freeLevel(uint32_t level, uint32_t x, uint32_t y);
+
+        static uint32_t pack(uint32_t x, uint32_t y) { return (x << 16) | y; }
+
+        uint32_t atlasSize = 0;
+        uint32_t minTileSize = 0;
+        uint64_t allocatedArea = 0;
+
+        // 每一级的空闲块，x和y打包成一个uint32
+        std::vector<std::vector<uint32_t>> freeBlocks;
+    };
+}
\ No newline at end of file
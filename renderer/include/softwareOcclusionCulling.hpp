@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include "frustumCulling.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class ThreadPool;
+    class VulkanRenderSceneData;
+    struct Box;
+
+    // CPU上的软件遮挡剔除，GPU剔除不可用时使用
+    // 从视锥剔除后的mesh里按屏幕面积挑几个大的遮挡体，在三角形预算内光栅化到一张低分辨率深度
+    // 深度按32x16的tile分给线程，每个tile额外保存最远的深度，测试时整块挡住的tile不再逐像素比较
+    class SoftwareOcclusionCuller
+    {
+    public:
+        static const uint32_t Width = 256;
+        static const uint32_t Height = 128;
+        static const uint32_t TileWidth = 32;
+        static const uint32_t TileHeight = 16;
+        static const uint32_t TilesX = Width / TileWidth;
+        static const uint32_t TilesY = Height / TileHeight;
+
+        void init(ThreadPool* threadPool);
+
+        // 把被挡住的mesh从visibleMeshes里去掉，保持原来的顺序
+        void cull(VulkanRenderSceneData* sceneData, const glm::mat4& viewProj, uint32_t triangleBudget, std::vector<uint32_t>& visibleMeshes, SoftwareOcclusionStats& stats);
+
+    private:
+        // 边函数和深度都写成a * x + b * y + c，x、y是像素坐标
+        struct ScreenTriangle
+        {
+            float edgeA[3];
+            float edgeB[3];
+            float edgeC[3];
+            float depthA;
+            float depthB;
+            float depthC;
+            int32_t minX;
+            int32_t minY;
+            int32_t maxX;       // 不包含
+            int32_t maxY;
+        };
+
+        // 返回画进去的三角形数
+        uint32_t addOccluder(VulkanRenderSceneData* sceneData, uint32_t meshIndex, const glm::mat4& viewProj);
+        void rasterizeTile(uint32_t tileIndex);
+        bool isOccluded(const Box& box, const glm::mat4& viewProj) const;
+
+        ThreadPool* threadPool = nullptr;
+
+        std::vector<float> depth;           // 每个像素最近的遮挡体深度
+        std::vector<float> tileMaxDepth;    // 每个tile里最远的深度
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<uint32_t>> tileBins;
+
+        std::vector<glm::vec4> clipPositions;
+        std::vector<std::pair<float, uint32_t>> occluderCandidates;
+        std::vector<uint8_t> occluded;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace VulkanEngine
+{
+    // 固定数量的工作线程，一次只执行一个parallelFor
+    class ThreadPool
+    {
+    public:
+        // task是任务下标，thread是执行该任务的工作线程下标，可以用来索引线程独占的资源
+        using TaskFunction = std::function<void(uint32_t task, uint32_t thread)>;
+
+        ~ThreadPool();
+
+        void init(uint32_t threadCount);
+        void shutdown();
+
+        uint32_t getThreadCount() const { return static_cast<uint32_t>(threads.size()); }
+
+        // 把[0, taskCount)分给工作线程，阻塞到全部完成，只能在一个线程里调用
+        void parallelFor(uint32_t taskCount, const TaskFunction& function);
+
+    private:
+        void workerLoop(uint32_t threadIndex);
+
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable doneCondition;
+
+        const TaskFunction* currentFunction = nullptr;
+        uint32_t taskCount = 0;
+        std::atomic<uint32_t> nextTask{ 0 };
+        uint32_t finishedTasks = 0;
+        // 还在处理当前任务的线程数，归零之前不能开始下一次parallelFor
+        uint32_t activeThreads = 0;
+        uint64_t jobSerial = 0;
+        bool stopping = false;
+    };
+}
\ No newline at end of file
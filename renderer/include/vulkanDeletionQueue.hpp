@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderer;
+
+    // 延迟销毁队列
+    // 入队时记录当前正在录制的帧序号，等到所有不晚于该帧提交的fence都signal之后再真正销毁，避免整卡等待
+    class VulkanDeletionQueue
+    {
+    public:
+        void init(VulkanRenderer* vulkanRenderer);
+
+        void destroyBuffer(VkBuffer buffer);
+        void destroyImage(VkImage image);
+        void destroyImageView(VkImageView imageView);
+        void destroySampler(VkSampler sampler);
+        void destroyFramebuffer(VkFramebuffer framebuffer);
+        void freeDescriptorSet(VkDescriptorSet descriptorSet);
+        void freeMemory(VkDeviceMemory memory);
+
+        // 其他类型的资源
+        void push(std::function<void()>&& deleter);
+
+        // 帧提交之后调用，记录该fence对应的帧序号
+        void onFrameSubmitted(uint32_t frameIndex);
+
+        // 销毁fence已经signal的资源，每帧调用
+        void collect();
+
+        // 销毁全部资源，调用前需要保证GPU空闲
+        void flush();
+
+        uint64_t getCurrentFrameSerial() const { return currentFrameSerial; }
+        size_t getPendingCount();
+
+    private:
+        uint64_t getCompletedFrameSerial();
+
+        struct PendingDeletion
+        {
+            uint64_t frameSerial;
+            std::function<void()> deleter;
+        };
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+
+        std::mutex mutex;
+        std::deque<PendingDeletion> pendingDeletions;
+
+        // 当前正在录制的帧序号，从1开始
+        uint64_t currentFrameSerial = 1;
+        // 每个inflight fence最后一次提交的帧序号，0代表从未提交
+        std::vector<uint64_t> fenceFrameSerials;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderer;
+
+    // 可增长的descriptor分配器
+    // 常驻set从带FREE标志的pool链分配，pool不够时自动新建；每帧的临时set从帧pool分配，整帧reset
+    // 另外提供按layout+绑定资源缓存的set，相同材质共享同一个set
+    class VulkanDescriptorAllocator
+    {
+    public:
+        void init(VulkanRenderer* vulkanRenderer);
+        void cleanup();
+
+        // 常驻set
+        VkResult allocate(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet);
+        void free(VkDescriptorSet descriptorSet);
+
+        // 每帧的临时set，下一次用到同一帧下标时在beginPresent里resetFrame，之后失效，不需要也不能单独free
+        VkResult allocateFrame(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet, uint32_t frameIndex);
+        void resetFrame(uint32_t frameIndex);
+
+        // 写入信息的dstSet由这里填写，相同layout和资源返回同一个set，引用计数
+        VkDescriptorSet getOrCreateCachedSet(VkDescriptorSetLayout layout, std::vector<VkWriteDescriptorSet> writes);
+        void releaseCachedSet(VkDescriptorSet descriptorSet);
+
+        uint32_t getPoolCount();
+        uint32_t getCachedSetCount();
+
+    public:
+        // 第一个pool的set数量，之后每次翻倍直到maxSetsPerPool
+        uint32_t initialSetsPerPool = 64;
+        uint32_t maxSetsPerPool = 4096;
+        uint32_t framePoolSets = 256;
+
+    private:
+        struct PoolSizeRatio
+        {
+            VkDescriptorType type;
+            float ratio;
+        };
+
+        struct FramePools
+        {
+            std::vector<VkDescriptorPool> pools;
+            uint32_t currentPool = 0;
+        };
+
+        struct CachedSet
+        {
+            VkDescriptorSet descriptorSet;
+            uint32_t refCount;
+        };
+
+        struct CacheKeyHash
+        {
+            size_t operator()(const std::vector<uint64_t>& key) const;
+        };
+
+        VkDescriptorPool createPool(uint32_t maxSets, VkDescriptorPoolCreateFlags flags);
+        VkResult allocateFromPool(VkDescriptorPool pool, VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet);
+        // 调用者已经持有mutex
+        VkResult allocateLocked(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet);
+        static bool needNewPool(VkResult result);
+        static std::vector<uint64_t> makeCacheKey(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes);
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+        VkDevice device = VK_NULL_HANDLE;
+
+        std::mutex mutex;
+
+        // 常驻pool链，最后一个是当前分配的pool
+        std::vector<VkDescriptorPool> pools;
+        uint32_t nextSetsPerPool = 64;
+        std::unordered_map<VkDescriptorSet, VkDescriptorPool> setOwners;
+
+        std::vector<FramePools> framePools;
+
+        std::unordered_map<std::vector<uint64_t>, CachedSet, CacheKeyHash> cachedSets;
+        std::unordered_map<VkDescriptorSet, std::vector<uint64_t>> cachedSetKeys;
+
+        static const std::vector<PoolSizeRatio> poolSizeRatios;
+    };
+}
\ No newline at end of file
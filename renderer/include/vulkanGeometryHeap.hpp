@@ -0,0 +1,140 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderer;
+
+    // 以元素为单位的区间分配器，best-fit，释放时合并相邻的空闲区间
+    class RangeAllocator
+    {
+    public:
+        static const uint32_t InvalidOffset = ~0u;
+
+        void init(uint32_t capacity);
+        void grow(uint32_t newCapacity);
+
+        uint32_t allocate(uint32_t count);
+        // 只在limit之前的空闲区间里找，压缩时用来把数据往前搬
+        uint32_t allocateBelow(uint32_t count, uint32_t limit);
+        void free(uint32_t offset, uint32_t count);
+
+        uint32_t getCapacity() const { return capacity; }
+        uint32_t getUsed() const { return used; }
+        uint32_t getFreeRangeCount() const { return static_cast<uint32_t>(freeByOffset.size()); }
+        uint32_t getLargestFreeRange() const;
+
+    private:
+        void insertFreeRange(uint32_t offset, uint32_t count);
+        // 和前后相邻的空闲区间合并后再插入
+        void mergeFreeRange(uint32_t offset, uint32_t count);
+        void eraseFreeRange(std::map<uint32_t, uint32_t>::iterator iter);
+        void takeFromFreeRange(std::map<uint32_t, uint32_t>::iterator iter, uint32_t count);
+
+        uint32_t capacity = 0;
+        uint32_t used = 0;
+
+        std::map<uint32_t, uint32_t> freeByOffset;          // offset -> count
+        std::multimap<uint32_t, uint32_t> freeBySize;       // count -> offset
+    };
+
+    using GeometryHandle = uint32_t;
+    const GeometryHandle InvalidGeometryHandle = ~0u;
+
+    struct GeometryAllocation
+    {
+        // 都以元素为单位，可以直接作为vkCmdDrawIndexed的vertexOffset和firstIndex
+        uint32_t vertexOffset = 0;
+        uint32_t vertexCount = 0;
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+    };
+
+    // 全场景共用的顶点/索引缓冲，mesh可以在运行时加入和移除
+    // 移除的区间等到用到它的帧执行完才回收，空洞过多时每帧搬动一部分mesh进行压缩
+    // 扩容、上传和压缩的拷贝按录制顺序执行，所以帧录制期间的上传要走帧的commandBuffer
+    class VulkanGeometryHeap
+    {
+    public:
+        void init(VulkanRenderer* vulkanRenderer, uint32_t vertexStride, uint32_t vertexCapacity, uint32_t indexCapacity);
+        void cleanup();
+
+        // 返回的偏移立即可用，数据在flushUploads或compact时才上传
+        GeometryHandle addMesh(const void* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount);
+        void removeMesh(GeometryHandle handle);
+
+        // 扩容并上传加入的mesh数据，commandBuffer为空时单独提交并等待完成
+        void flushUploads(VkCommandBuffer commandBuffer = VK_NULL_HANDLE);
+
+        // 每帧在renderpass开始之前调用，先上传新的mesh，再把高地址的mesh搬到前面的空洞里
+        void compact(VkCommandBuffer commandBuffer);
+
+        const GeometryAllocation& getAllocation(GeometryHandle handle) const { return allocations[handle]; }
+
+        VkBuffer getVertexBuffer() const { return vertexBuffer.buffer; }
+        VkBuffer getIndexBuffer() const { return indexBuffer.buffer; }
+        uint32_t getVertexStride() const { return vertexStride; }
+
+        uint32_t getMeshCount() const { return meshCount; }
+        // mesh的偏移有变化时递增，用来判断缓存的绘制参数是否需要重建
+        uint64_t getLayoutVersion() const { return layoutVersion; }
+        const RangeAllocator& getVertexAllocator() const { return *vertexAllocator; }
+        const RangeAllocator& getIndexAllocator() const { return *indexAllocator; }
+
+    public:
+        bool compactionEnabled = true;
+        // 每帧最多搬动的字节数
+        VkDeviceSize compactionBytesPerFrame = 4 * 1024 * 1024;
+        // 空闲区间数达到该值才开始压缩
+        uint32_t compactionFreeRangeThreshold = 4;
+
+    private:
+        struct HeapBuffer
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+        };
+
+        struct PendingUpload
+        {
+            GeometryHandle handle;
+            std::vector<char> vertexData;
+            std::vector<uint32_t> indexData;
+        };
+
+        void createHeapBuffer(HeapBuffer& heapBuffer, VkDeviceSize size, VkBufferUsageFlags usage);
+        void recordGrowth(VkCommandBuffer commandBuffer, HeapBuffer& heapBuffer, uint32_t& bufferCapacity, uint32_t newCapacity, uint32_t elementSize, VkBufferUsageFlags usage);
+        void recordUploads(VkCommandBuffer commandBuffer);
+        void recordTransferBarrier(VkCommandBuffer commandBuffer);
+        void releaseRange(const std::shared_ptr<RangeAllocator>& allocator, uint32_t offset, uint32_t count);
+
+        // 把某一类数据往前搬，返回搬动的字节数
+        VkDeviceSize compactRanges(bool vertex, VkDeviceSize byteBudget, std::vector<VkBufferCopy>& regions);
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+
+        uint32_t vertexStride = 0;
+
+        HeapBuffer vertexBuffer;
+        HeapBuffer indexBuffer;
+        // buffer实际的容量，分配器先扩容，buffer在下次上传时再跟上
+        uint32_t vertexBufferCapacity = 0;
+        uint32_t indexBufferCapacity = 0;
+
+        // 延迟回收的lambda持有分配器，heap清理之后也不会访问悬空指针
+        std::shared_ptr<RangeAllocator> vertexAllocator;
+        std::shared_ptr<RangeAllocator> indexAllocator;
+
+        std::vector<GeometryAllocation> allocations;
+        std::vector<bool> allocationUsed;
+        std::vector<GeometryHandle> freeHandles;
+        uint32_t meshCount = 0;
+        uint64_t layoutVersion = 0;
+
+        std::vector<PendingUpload> pendingUploads;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include "vulkanRenderer.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderSceneData;
+
+    // 从一张等距柱状投影的HDR环境图或者六个cube面在GPU上生成IBL用到的图，所有compute录制在一个commandBuffer里一次提交：
+    // 1. 环境图转成cube map（六个面直接上传）并blit出mip链，后面的重要性采样按样本的pdf选mip
+    // 2. specular cube的每一级mip对应一个粗糙度，GGX重要性采样预过滤
+    // 3. 余弦加权的半球积分得到irradiance cube
+    // 4. split sum的BRDF LUT，和环境图无关
+    // 只在加载时用一次，中间资源在提交完成后就销毁
+    class VulkanIBLPrecomputer
+    {
+    public:
+        static const uint32_t EnvironmentSize = 512;
+        static const uint32_t SpecularSize = 256;
+        static const uint32_t SpecularMipLevels = 9;        // 光照shader里lod = roughness * 8.0
+        static const uint32_t IrradianceSize = 32;
+        static const uint32_t BrdfLUTSize = 256;
+
+        // 结果写到sceneData的IBLSpecularBox、IBLIrradianceBox和brdfLUTTexture
+        // 图形队列不支持compute或者读不到环境图时返回false，不创建任何输出
+        bool precompute(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData, const std::string& environmentPath);
+
+        // 同上，输入是按层顺序排好的六个面，面的边长就是环境cube的尺寸
+        bool precomputeFromCube(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData, const std::array<std::string, 6>& facePaths);
+
+    private:
+        // 和iblPrecompute.h里的PushConstants一致
+        struct PushConstants
+        {
+            float roughness;
+            float intensity;
+            uint32_t sampleCount;
+            uint32_t padding;
+        };
+
+        struct Image
+        {
+            VkImage image = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;              // 采样用的view，cube或者2D
+        };
+
+        // 图形队列不支持compute时返回false
+        bool init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData);
+        void createPipelines();
+        void destroyResources();
+
+        void createStagingBuffer(VkDeviceSize size);
+        // rgb乘上scale转成半精度，每个像素两个uint32
+        static void packHalfPixels(const float* pixels, size_t pixelCount, float scale, uint32_t* halfPixels);
+
+        // environmentImage的第0级已经写好并处于TRANSFER_SRC，blit出其余mip，生成三张输出，提交后交给sceneData
+        void filterEnvironment(VkCommandBuffer commandBuffer, uint32_t environmentSize, uint32_t environmentMipLevels);
+
+        // layers为6时创建cube map
+        void createImage(Image& image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layers, VkImageUsageFlags usage);
+
+        // 单独一级mip的storage view和descriptorSet，提交完成后一起销毁
+        VkDescriptorSet createDescriptorSet(VkImageView sampledView, VkImage storageImage, uint32_t mip, uint32_t layers);
+
+        void dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet descriptorSet, const PushConstants& pushConstants, uint32_t size, uint32_t layers);
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+        VulkanRenderSceneData* sceneData = nullptr;
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline equirectToCubePipeline = VK_NULL_HANDLE;
+        VkPipeline prefilterSpecularPipeline = VK_NULL_HANDLE;
+        VkPipeline irradiancePipeline = VK_NULL_HANDLE;
+        VkPipeline brdfLUTPipeline = VK_NULL_HANDLE;
+        VkSampler environmentSampler = VK_NULL_HANDLE;
+
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+        Image equirectImage;
+        Image environmentImage;
+        std::vector<VkImageView> storageViews;
+        std::vector<VkDescriptorSet> descriptorSets;
+    };
+}
\ No newline at end of file
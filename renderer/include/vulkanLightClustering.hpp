@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include "vulkanRenderer.hpp"
+
+#include <array>
+
+namespace VulkanEngine
+{
+    class VulkanRenderSceneData;
+
+    // 分簇光照的光源分配：compute把视锥按屏幕分块、深度按对数分片，每个簇一个线程，
+    // 和所有点光源、聚光灯求交，写出每个簇的光源列表，forward和deferred的光照shader都按簇读取
+    // 图形队列不支持compute时只把每个簇的数量清零，局部光源不生效
+    class VulkanLightClusterer
+    {
+    public:
+        void init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData);
+        void cleanup();
+
+        bool isSupported() const { return supported; }
+
+        // 场景pass开始之前在主commandBuffer里录制，光源和簇参数要已经上传
+        void dispatch(VkCommandBuffer commandBuffer);
+
+    private:
+        VulkanRenderer* vulkanRenderer = nullptr;
+        VulkanRenderSceneData* sceneData = nullptr;
+
+        bool supported = false;
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        // 每个飞行帧读lightResource和uniformClustersResource里自己的那一段
+        std::array<VkDescriptorSet, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> descriptorSets = {};
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include <array>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace VulkanEngine
+{
+    // 显存分类统计
+    enum class MemoryCategory : uint32_t
+    {
+        Texture = 0,
+        Geometry,
+        RenderTarget,
+        Uniform,
+        Staging,
+        Count
+    };
+
+    // 每个heap的预算和用量，有VK_EXT_memory_budget时来自驱动，否则来自自身统计
+    struct MemoryHeapBudget
+    {
+        VkMemoryHeapFlags flags = 0;
+        VkDeviceSize size = 0;
+        VkDeviceSize budget = 0;
+        VkDeviceSize usage = 0;
+        VkDeviceSize trackedBytes = 0;      // 通过VulkanRenderer分配的部分
+    };
+
+    // 超出预算时回调的信息，heapIndex为-1时代表是分类预算
+    struct MemoryBudgetExceededInfo
+    {
+        int32_t heapIndex = -1;
+        MemoryCategory category = MemoryCategory::Count;
+        VkDeviceSize usage = 0;
+        VkDeviceSize budget = 0;
+    };
+
+    class VulkanMemoryTracker
+    {
+    public:
+        static const uint32_t categoryCount = static_cast<uint32_t>(MemoryCategory::Count);
+
+        void init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetSupported);
+
+        // 所有VkDeviceMemory都从这里分配、释放
+        VkResult allocate(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory, MemoryCategory category);
+        void free(VkDeviceMemory& memory);
+
+        // 每帧调用，刷新heap预算，定期输出日志，检查预算
+        void update();
+        void logSummary();
+
+        // 0代表不限制
+        void setCategoryBudget(MemoryCategory category, VkDeviceSize budget);
+
+        VkDeviceSize getCategoryBytes(MemoryCategory category);
+        uint32_t getCategoryAllocationCount(MemoryCategory category);
+        VkDeviceSize getCategoryBudget(MemoryCategory category);
+        VkDeviceSize getTotalBytes();
+        std::vector<MemoryHeapBudget> getHeapBudgets();
+        bool isMemoryBudgetSupported() const { return memoryBudgetSupported; }
+
+        static const char* getCategoryName(MemoryCategory category);
+
+    public:
+        std::function<void(const MemoryBudgetExceededInfo&)> budgetExceededCallback;
+
+        // heap使用量超过预算的比例就回调
+        float heapBudgetThreshold = 0.9f;
+        // 每隔多少帧输出一次日志，0为不输出
+        uint32_t logIntervalFrames = 1000;
+
+    private:
+        void queryHeapBudgets();
+
+        struct Allocation
+        {
+            VkDeviceSize size;
+            MemoryCategory category;
+            uint32_t heapIndex;
+        };
+
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkDevice device = VK_NULL_HANDLE;
+        VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+        bool memoryBudgetSupported = false;
+        PFN_vkGetPhysicalDeviceMemoryProperties2KHR _vkGetPhysicalDeviceMemoryProperties2KHR = nullptr;
+
+        std::mutex mutex;
+        std::unordered_map<VkDeviceMemory, Allocation> allocations;
+        std::array<VkDeviceSize, categoryCount> categoryBytes = {};
+        std::array<uint32_t, categoryCount> categoryAllocationCounts = {};
+        std::array<VkDeviceSize, categoryCount> categoryBudgets = {};
+        std::array<bool, categoryCount> categoryOverBudget = {};
+
+        std::vector<MemoryHeapBudget> heapBudgets;
+        std::vector<bool> heapOverBudget;
+
+        uint64_t frameCount = 0;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include "vulkanRenderer.hpp"
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderQueue;
+    class VulkanRenderSceneData;
+
+    // 主视角的GPU视锥和Hi-Z遮挡剔除，两阶段：
+    // 1. 把上一帧判定可见的mesh用当前矩阵画进一张低分辨率深度，compute逐级取max生成Hi-Z
+    // 2. 用Hi-Z重新测试队列里的所有draw，结果作为下一帧的可见集合，可见的draw按材质段压缩写进indirect buffer
+    // 第一阶段画的都是真实存在的几何体，所以新出现的物体在当帧就能通过测试，不会闪烁
+    // 需要multiDrawIndirect和drawIndirectFirstInstance，有VK_KHR_draw_indirect_count时压缩输出，否则被剔除的draw写instanceCount为0
+    class VulkanOcclusionCuller
+    {
+    public:
+        static const uint32_t HiZWidth = 512;
+        static const uint32_t HiZHeight = 256;
+
+        void init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData);
+        void cleanup();
+
+        bool isSupported() const { return supported; }
+
+        // 场景的meshDrawDataResource扩容之后重写prepass的set，cull的set每帧都会重写
+        void updateMeshDrawDataDescriptor();
+
+        // queue prepare之后、queue所在的renderPass开始之前在主commandBuffer里录制，并把输出设置为queue的绘制来源
+        // 同时读回该帧下标上一次的统计写到sceneData->occlusionCullingStats
+        void cull(VkCommandBuffer commandBuffer, VulkanRenderQueue& queue, const glm::mat4& viewProj);
+
+    private:
+        struct Buffer
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            void* mapped = nullptr;
+            VkDeviceSize size = 0;
+        };
+
+        struct FrameResources
+        {
+            Buffer prepassCommands;         // 第一阶段的绘制参数
+            Buffer outputCommands;          // 第二阶段的绘制参数，给场景pass用
+            Buffer drawCounts;              // 每个材质段可见的draw数量
+            Buffer itemBatches;             // 每个draw所属材质段的下标和起点
+            Buffer stats;
+            VkDescriptorSet prepassSet = VK_NULL_HANDLE;   // 这两个set每帧从descriptorAllocator的帧pool分配
+            VkDescriptorSet cullSet = VK_NULL_HANDLE;
+            bool statsValid = false;
+        };
+
+        struct CullPushConstants
+        {
+            glm::mat4 viewProj;
+            uint32_t itemCount;
+            uint32_t phase;
+            uint32_t compact;
+            uint32_t mipCount;
+            glm::vec2 hizSize;
+        };
+
+        void createHiZResources();
+        void createPrepass();
+        void createComputePipelines();
+
+        // 容量不够时换一个更大的buffer，旧的交给延迟销毁队列，返回是否重新创建
+        bool reserveBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible);
+        void destroyBuffer(Buffer& buffer);
+        void updateCullSet(VkDescriptorSet descriptorSet, VkBuffer inputCommands, const FrameResources& frame, VkBuffer outputCommands);
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+        VulkanRenderSceneData* sceneData = nullptr;
+
+        bool supported = false;
+        bool compact = false;
+
+        // Hi-Z，第0级同时是第一阶段的color attachment
+        uint32_t hizMipCount = 0;
+        VkImage hizImage = VK_NULL_HANDLE;
+        VkDeviceMemory hizMemory = VK_NULL_HANDLE;
+        VkImageView hizView = VK_NULL_HANDLE;
+        std::vector<VkImageView> hizMipViews;
+        VkSampler hizSampler = VK_NULL_HANDLE;
+
+        // 第一阶段的深度
+        VkImage depthImage = VK_NULL_HANDLE;
+        VkDeviceMemory depthMemory = VK_NULL_HANDLE;
+        VkImageView depthView = VK_NULL_HANDLE;
+
+        VkRenderPass prepassRenderPass = VK_NULL_HANDLE;
+        VkFramebuffer prepassFramebuffer = VK_NULL_HANDLE;
+        VkDescriptorSetLayout prepassSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSet prepassSet = VK_NULL_HANDLE;
+        VkPipelineLayout prepassPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline prepassPipeline = VK_NULL_HANDLE;
+
+        VkDescriptorSetLayout hizBuildSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> hizBuildSets;      // 第i个生成第i+1级
+        VkPipelineLayout hizBuildPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline hizBuildPipeline = VK_NULL_HANDLE;
+
+        VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+        // 每个mesh上一次第二阶段的结果，跨帧保留
+        Buffer visibility;
+        bool visibilityReset = true;
+
+        std::array<FrameResources, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> frames;
+    };
+}
\ No newline at end of file
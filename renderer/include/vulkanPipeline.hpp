@@ -2,6 +2,7 @@
 
 #include "vulkan/vulkan.h"
 #include "vulkanRenderer.hpp"
+#include <string>
 #include <vector>
 
 namespace VulkanEngine
@@ -10,6 +11,8 @@ namespace VulkanEngine
 	{
 	public:
 		// TODO:暂时只支持非透明，后面需要再继续加参数
+		// fragShaderCode为空时只有顶点着色器，用于只写深度的pass；depthBias不为0时开启深度偏移
+		// fragSpecializationInfo是片元着色器的specialization constant，depthCompareOp只在depthTest时生效
 		static void createPipeline(
 			VulkanRenderer* vulkanRender,
 			VkPipeline& pipeline,
@@ -26,6 +29,12 @@ namespace VulkanEngine
 			std::vector<VkDynamicState>& dynamicStates,
 			uint32_t attachmentCount,
 			VkPipelineColorBlendAttachmentState* colorBlendAttachmentState,
-			bool depthTest, bool depthWrite);
+			bool depthTest, bool depthWrite,
+			float depthBiasConstant = 0.0f, float depthBiasSlope = 0.0f,
+			const VkSpecializationInfo* fragSpecializationInfo = nullptr,
+			VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS);
+
+		// 从spv文件创建compute管线，shaderModule创建完就销毁
+		static VkPipeline createComputePipeline(VulkanRenderer* vulkanRender, VkPipelineLayout layout, const std::string& path, const VkSpecializationInfo* specializationInfo = nullptr);
 	};
 }
\ No newline at end of file
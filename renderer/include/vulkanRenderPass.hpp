@@ -47,7 +47,10 @@ namespace VulkanEngine
 		virtual void init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData);
 		virtual void postInit() = 0;
 
-		virtual void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize) = 0;
+		virtual void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) = 0;
+		virtual void drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) = 0;
+		// draw数量由GPU写在countBuffer里，需要VK_KHR_draw_indirect_count
+		virtual void drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) = 0;
 		virtual void draw(VkCommandBuffer commandBuffer, uint32_t vertexSize) = 0;
 		virtual void clear() = 0;
 
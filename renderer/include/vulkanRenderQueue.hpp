@@ -0,0 +1,162 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include "vulkanRenderer.hpp"
+#include <glm/glm.hpp>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderPass;
+    class VulkanRenderSceneData;
+    struct MeshDrawInfo;
+
+    enum class RenderQueuePass : uint32_t
+    {
+        Shadow = 0,
+        Forward,
+        GBuffer,
+    };
+
+    struct DrawItem
+    {
+        uint64_t sortKey = 0;
+        uint32_t meshIndex = 0;
+    };
+
+    // 录制时需要的绑定信息，除材质set外整个pass只绑定一次
+    struct RenderQueueBindings
+    {
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> descriptorSets;
+        // 材质set所在的位置，-1代表没有材质set
+        int32_t materialSetIndex = -1;
+    };
+
+    // 连续使用同一材质的一段draw
+    struct DrawBatch
+    {
+        uint32_t itemBegin = 0;
+        uint32_t itemCount = 0;
+        VkDescriptorSet materialSet = VK_NULL_HANDLE;
+    };
+
+    // 排序后的绘制队列
+    // 排序键从高到低：pass(4) | pipeline(8) | material(16) | depth(16) | mesh(20)，相同材质连续绘制，同材质内从近到远
+    // 录制时把排好序的draw写进每帧的indirect buffer，同材质的一段只用一次vkCmdDrawIndexedIndirect提交
+    // firstInstance填mesh下标，shader用gl_InstanceIndex去MeshDrawData里取model矩阵
+    // 材质段可以分给多个线程录制成secondary commandBuffer
+    class VulkanRenderQueue
+    {
+    public:
+        static const uint32_t PassBits = 4;
+        static const uint32_t PipelineBits = 8;
+        static const uint32_t MaterialBits = 16;
+        static const uint32_t DepthBits = 16;
+        static const uint32_t MeshBits = 20;
+
+        static uint64_t makeSortKey(RenderQueuePass pass, uint32_t pipeline, uint32_t material, uint32_t depth, uint32_t mesh);
+
+        void init(VulkanRenderer* vulkanRenderer);
+        void cleanup();
+
+        // viewProj是该pass的投影矩阵，用w分量作为深度
+        // visibleMeshes是剔除后的mesh下标，为空指针时加入所有mesh
+        // sortByDepth为false时深度位填0，顺序只由材质和mesh决定，和相机无关
+        void build(RenderQueuePass pass, uint32_t pipeline, VulkanRenderSceneData* sceneData, const glm::mat4& viewProj, const std::vector<uint32_t>* visibleMeshes = nullptr, bool sortByDepth = true);
+
+        // 按键值做LSD基数排序，每轮16位，所有键都相同的那一轮直接跳过
+        void sort();
+
+        // 主线程里写当前帧的indirect buffer并划分材质段，sort之后、录制之前调用
+        void prepare(const RenderQueueBindings& bindings);
+
+        // GPU剔除输出的绘制参数，布局和indirect buffer相同，设置后录制时从这里读取
+        // countBuffer里是每个材质段的draw数量，为空时绘制整段，被剔除的draw由instanceCount为0跳过
+        void setGpuDrawSource(VkBuffer commandBuffer, VkBuffer countBuffer);
+
+        // 每帧的indirect buffer只有一份，同一帧内每个队列只能录制一次
+        void record(VkCommandBuffer commandBuffer, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings);
+
+        // 材质段分给录制线程，每个线程录成一个继承subpass的secondary commandBuffer，追加到outCommandBuffers
+        // 调用方需要以SECONDARY_COMMAND_BUFFERS开始该subpass，再统一vkCmdExecuteCommands
+        // cache为true时从cachedSecondaryCommandBuffers录制并记下结果，之后同一帧下标可以直接复用
+        void recordSecondary(std::vector<VkCommandBuffer>& outCommandBuffers, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, uint32_t subpass, VkFramebuffer framebuffer, bool cache = false);
+
+        // 追加当前帧下标上次缓存的commandBuffer，对应的indirect buffer内容也保持不变
+        void appendCachedCommandBuffers(std::vector<VkCommandBuffer>& outCommandBuffers) const;
+
+        // 当前帧下标是否录制过缓存，某一帧没有录制的队列（比如跳过的阴影级联）不能直接复用
+        bool hasCachedCommandBuffers() const { return cachedFrames[vulkanRenderer->currentFrameIndex]; }
+        // cachedSecondaryCommandBuffers重置该帧下标时调用
+        void clearCachedCommandBuffers(uint32_t frameIndex);
+
+        const std::vector<DrawItem>& getItems() const { return items; }
+        const std::vector<DrawBatch>& getBatches() const { return batches; }
+
+        // 当前帧下标的indirect buffer，不支持firstInstance时为空
+        VkBuffer getIndirectBuffer() const { return indirectBuffers[vulkanRenderer->currentFrameIndex].buffer; }
+
+        // 上一次录制的统计
+        uint32_t getDrawCount() const { return drawCount; }
+        uint32_t getMaterialBindCount() const { return materialBindCount; }
+        uint32_t getDrawCallCount() const { return drawCallCount; }
+
+    public:
+        // 每个线程至少分到的材质段数，太少时不值得拆分
+        uint32_t minBatchesPerThread = 16;
+
+    private:
+        struct IndirectBuffer
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDrawIndexedIndirectCommand* commands = nullptr;
+            uint32_t capacity = 0;
+        };
+
+        struct RecordStats
+        {
+            uint32_t drawCount = 0;
+            uint32_t materialBindCount = 0;
+            uint32_t drawCallCount = 0;
+        };
+
+        void recordBatches(VkCommandBuffer commandBuffer, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, size_t batchBegin, size_t batchEnd, RecordStats& stats) const;
+        void applyStats(const RecordStats& stats);
+
+        uint32_t getMaterialID(VkDescriptorSet materialSet);
+        void reserveIndirectBuffer(IndirectBuffer& indirectBuffer, uint32_t commandCount);
+        VkDescriptorSet getMaterialSet(const DrawItem& item) const;
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+
+        VulkanRenderSceneData* sceneData = nullptr;
+
+        std::vector<DrawItem> items;
+        std::vector<DrawItem> sortBuffer;
+        std::vector<float> depths;
+
+        // 材质set到排序键里材质编号的映射，编号按首次出现的顺序分配
+        std::unordered_map<VkDescriptorSet, uint32_t> materialIDs;
+
+        std::array<IndirectBuffer, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> indirectBuffers;
+        IndirectBuffer* currentIndirectBuffer = nullptr;
+        const std::vector<MeshDrawInfo>* drawInfos = nullptr;
+
+        std::vector<DrawBatch> batches;
+
+        VkBuffer gpuCommandBuffer = VK_NULL_HANDLE;
+        VkBuffer gpuCountBuffer = VK_NULL_HANDLE;
+
+        std::array<std::vector<VkCommandBuffer>, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> cachedCommandBuffers;
+        std::array<bool, VulkanRenderer::MAX_FRAMES_IN_FLIGHT> cachedFrames = {};
+
+        uint32_t drawCount = 0;
+        uint32_t materialBindCount = 0;
+        uint32_t drawCallCount = 0;
+    };
+}
\ No newline at end of file
@@ -2,6 +2,11 @@
 #include "window.hpp"
 #include "vulkan/vulkan.h"
 #include "vulkanStruct.hpp"
+#include "vulkanMemoryTracker.hpp"
+#include "vulkanDeletionQueue.hpp"
+#include "vulkanDescriptorAllocator.hpp"
+#include "vulkanSecondaryCommandBuffers.hpp"
+#include "threadPool.hpp"
 #include <array>
 #include <functional>
 #include <map>
@@ -40,6 +45,8 @@ namespace VulkanEngine
         void cmdEndRenderPass(VkCommandBuffer commandBuffer);
         void cmdBindPipeline(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint, VkPipeline pipeline);
         void cmdBindDescriptorSets(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint, VkPipelineLayout pipelineLayout, uint32_t firstSet, uint32_t descriptorSetCount, VkDescriptorSet* descriptorSets, uint32_t dynamicOffsetCount, const uint32_t* pDynamicOffsets);
+        void cmdExecuteCommands(VkCommandBuffer commandBuffer, const std::vector<VkCommandBuffer>& secondaryCommandBuffers);
+        void cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride);
 
         // resource
         VkShaderModule createShaderModule(const std::vector<char>& code);
@@ -57,8 +64,26 @@ namespace VulkanEngine
             VkImageCreateFlags imageCreateFlags,
             uint32_t arrayLayers,
             uint32_t miplevels,
+            VkSampleCountFlagBits numSamples = VK_SAMPLE_COUNT_1_BIT,
+            MemoryCategory memoryCategory = MemoryCategory::Texture);
+
+        // 只创建image，不分配内存
+        void createImageHandle(
+            uint32_t imageWidth,
+            uint32_t imageHeight,
+            VkFormat format,
+            VkImageTiling imageTiling,
+            VkImageUsageFlags imageUsageFlags,
+            VkImage& image,
+            VkImageCreateFlags imageCreateFlags,
+            uint32_t arrayLayers,
+            uint32_t miplevels,
             VkSampleCountFlagBits numSamples = VK_SAMPLE_COUNT_1_BIT);
 
+        // 只在renderpass内部使用的attachment，支持的话用lazily allocated内存
+        VkImageUsageFlags getTransientAttachmentUsage() const;
+        VkMemoryPropertyFlags getTransientAttachmentMemoryProperty() const;
+
         void createTextureImage(
             VkImage& image,
             VkImageView& imageView,
@@ -100,7 +125,12 @@ namespace VulkanEngine
             VkBufferUsageFlags usage,
             VkMemoryPropertyFlags properties,
             VkBuffer& buffer,
-            VkDeviceMemory& bufferMemory);
+            VkDeviceMemory& bufferMemory,
+            MemoryCategory memoryCategory = MemoryCategory::Staging);
+
+        // 所有显存的分配释放都要走这里，以便统计
+        VkResult allocateMemory(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory, MemoryCategory memoryCategory);
+        void freeMemory(VkDeviceMemory& memory);
 
         void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
@@ -143,6 +173,7 @@ namespace VulkanEngine
 
         PFN_vkCmdBeginDebugUtilsLabelEXT _vkCmdBeginDebugUtilsLabelEXT;
         PFN_vkCmdEndDebugUtilsLabelEXT   _vkCmdEndDebugUtilsLabelEXT;
+        PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCountKHR = nullptr;
 
         void pushEvnet(VkCommandBuffer& commandBuffer, const char* name, const float* color);
         void popEvent(VkCommandBuffer& commandBuffer);
@@ -157,13 +188,14 @@ namespace VulkanEngine
         void createLogicalDevice();
         void createCommandPool();
         void createCommandBuffers();
+        void createRecordThreads();
         void createDescriptorPool();
         void createSyncPrimitives();
 
         // swapChain
         void clearSwapChain();
         void recreateSwapchain();
-        void createSwapchain();
+        void createSwapchain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
         void createSwapchainImageViews();
         void createFramebufferImageAndView();
 
@@ -199,10 +231,20 @@ namespace VulkanEngine
         std::array<VkCommandPool, MAX_FRAMES_IN_FLIGHT> commandPools; // inflight command pool
         std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> commandBuffers;
 
+        // 多线程录制，secondaryCommandBuffers的最后一个线程下标留给主线程
+        ThreadPool recordThreadPool;
+        VulkanSecondaryCommandBuffers secondaryCommandBuffers;
+        // 跨帧复用的secondary commandBuffer，由使用方在内容失效时reset对应帧
+        VulkanSecondaryCommandBuffers cachedSecondaryCommandBuffers;
+        uint32_t getMainThreadRecordIndex() const { return recordThreadPool.getThreadCount(); }
+        uint32_t maxRecordThreads = 8;
+
+        // 每次重建交换链时递增，缓存的commandBuffer据此判断pipeline和framebuffer是否变化
+        uint64_t swapchainVersion = 0;
+
         // descriptor
-        uint32_t maxVertexBlendingMeshCount = 256;
-        uint32_t maxMaterialCount = 256;
-        VkDescriptorPool descriptorPool;
+        VkDescriptorPool descriptorPool;        // 仅ImGui使用
+        VulkanDescriptorAllocator descriptorAllocator;
 
         // sync
         VkSemaphore imageAvailableForRenderSemaphores[MAX_FRAMES_IN_FLIGHT];
@@ -210,6 +252,20 @@ namespace VulkanEngine
         VkSemaphore imageAvailableForTextureCopySemaphores[MAX_FRAMES_IN_FLIGHT];
         VkFence isFrameInFlightFences[MAX_FRAMES_IN_FLIGHT];
 
+        // memory
+        bool physicalDeviceProperties2Supported = false;
+        bool memoryBudgetSupported = false;
+        bool lazilyAllocatedMemorySupported = false;    // tile-based GPU上transient attachment可以不占显存
+        VulkanMemoryTracker memoryTracker;
+
+        // indirect draw
+        bool multiDrawIndirectSupported = false;            // 一次vkCmdDrawIndexedIndirect提交多个draw
+        bool drawIndirectFirstInstanceSupported = false;    // 间接绘制的firstInstance可以非0，shader靠它取mesh数据
+        bool drawIndirectCountSupported = false;            // VK_KHR_draw_indirect_count，draw数量可以由GPU写入
+
+        // 延迟销毁，等对应帧的fence signal之后才真正释放
+        VulkanDeletionQueue deletionQueue;
+
         // sampler
         std::map<uint32_t, VkSampler> mipmapSamplerMap;
         VkSampler nearestSampler = VK_NULL_HANDLE;
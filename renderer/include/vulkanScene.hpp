@@ -5,6 +5,10 @@
 #include <array>
 #include "camera.hpp"
 #include "vulkanRenderer.hpp"
+#include "vulkanGeometryHeap.hpp"
+#include "frustumCulling.hpp"
+#include "boundingVolumeHierarchy.hpp"
+#include "shadowAtlas.hpp"
 #include <map>
 
 namespace VulkanEngine
@@ -42,19 +46,179 @@ namespace VulkanEngine
 		UniformBufferObjectFS viewAndLight;
 	};
 
-	struct alignas(64) UniformBufferDynamicObject
+	// 每个mesh的绘制数据，放在storage buffer里，shader用gl_InstanceIndex取
+	// 间接绘制的firstInstance就是mesh的下标，所以这里和meshes一一对应
+	struct MeshDrawData
 	{
 		glm::mat4 model = glm::mat4(1.0f);
+		uint32_t materialIndex = 0;
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		int32_t vertexOffset = 0;
 	};
 
+	// mesh的世界包围盒，GPU剔除用，和meshes一一对应，min.w为0代表无效
+	struct MeshBoundsData
+	{
+		glm::vec4 min = glm::vec4(0.0f);
+		glm::vec4 max = glm::vec4(0.0f);
+	};
+
+	// 方向光阴影的级联数上限，shader里MAX_SHADOW_CASCADES和它一致
+	const uint32_t MaxShadowCascades = 4;
+	// 每个级联的阴影pass用uniformShadowResource里的一段，间隔取所有设备minUniformBufferOffsetAlignment的上限
+	const uint32_t ShadowCascadeUniformStride = 256;
+
 	struct UnifromBufferObjectShadowProjView
 	{
 		glm::mat4 projectView = glm::mat4(1.0f);
 	};
 
+	// 光照shader选择级联用
+	struct UniformBufferObjectShadowCascades
+	{
+		glm::mat4 cascadeProjView[MaxShadowCascades];
+		glm::vec4 cascadeSplits = glm::vec4(0.0f);		// 每个级联在相机前方的最远距离
+		glm::vec4 viewDepthPlane = glm::vec4(0.0f);		// 相机前方的距离 = dot(xyz, worldPos) + w
+		glm::vec4 cascadeWorldSizes = glm::vec4(0.0f);	// 正交投影覆盖的宽度，PCSS把半影换算成uv
+		glm::vec4 cascadeDepthRanges = glm::vec4(0.0f);	// 深度0到1对应的世界距离
+		int32_t cascadeCount = 0;
+		int32_t padding[3];
+	};
+
+	// 和shader里的SHADOW_FILTER_*一致
+	enum class ShadowFilter : int32_t
+	{
+		HardwarePCF = 0,
+		Poisson,
+		PCSS,
+	};
+
+	// 光照shader的specialization constant，constant_id依次为0、1、2
+	struct ShadowFilterConstants
+	{
+		int32_t filter = 0;
+		int32_t tapCount = 16;
+		float lightSize = 0.02f;
+	};
+
+	// 一个级联的投射物按是否移动过分开，key和阴影图里的内容对应，相同就不用重画
+	struct ShadowCascadeCache
+	{
+		std::vector<uint32_t> staticCasters;
+		std::vector<uint32_t> dynamicCasters;
+		uint64_t staticKey = 0;		// 投影和静态投射物
+		uint64_t contentKey = 0;	// staticKey加上动态投射物和它们的变换
+	};
+
+	// 阴影缓存每帧的结果，由renderer写入
+	struct ShadowCacheStats
+	{
+		uint32_t redrawnCascades = 0;
+		uint32_t cachedCascades = 0;
+		uint32_t staticRedraws = 0;		// 重画了静态缓存的级联
+		uint32_t dynamicCasters = 0;	// 画在静态缓存副本上的投射物
+	};
+
+	// 分簇光照的网格和容量，shader里CLUSTER_GRID_*、MAX_LIGHTS_PER_CLUSTER和它们一致
+	const uint32_t MaxLocalLights = 1024;
+	const uint32_t ClusterGridX = 16;
+	const uint32_t ClusterGridY = 9;
+	const uint32_t ClusterGridZ = 24;
+	const uint32_t ClusterCount = ClusterGridX * ClusterGridY * ClusterGridZ;
+	const uint32_t MaxLightsPerCluster = 128;
+
+	// 和shader里的LIGHT_TYPE_*一致
+	enum class LightType : uint32_t
+	{
+		Point = 0,
+		Spot,
+	};
+
+	// 点光源和聚光灯，世界空间
+	struct LocalLight
+	{
+		LightType type = LightType::Point;
+		glm::vec3 position = glm::vec3(0.0f);
+		glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+		glm::vec3 color = glm::vec3(1.0f);
+		float intensity = 1.0f;
+		float range = 5.0f;				// 超出半径不受影响
+		float innerConeAngle = 0.0f;	// 弧度，聚光灯用
+		float outerConeAngle = 0.5f;
+		bool castShadows = true;		// 按重要性排在前面的才会分到阴影图集
+	};
+
+	// 和shader里的LightData一致
+	struct LightData
+	{
+		glm::vec4 positionRange = glm::vec4(0.0f);
+		glm::vec4 colorType = glm::vec4(0.0f);
+		glm::vec4 directionCosOuter = glm::vec4(0.0f);
+		glm::vec4 spotParams = glm::vec4(0.0f);		// 角度衰减的缩放和偏移，外角的sin，阴影图集里第一块的下标，没有阴影时为-1
+	};
+
+	// lightResource里每个飞行帧一段，图集块的下标每帧都可能变
+	const uint32_t LightBufferStride = (sizeof(LightData) * MaxLocalLights + 255) / 256 * 256;
+
+	// 局部光源的阴影图集，聚光灯占一块，点光源的立方体六个面各占一块
+	const uint32_t MaxShadowAtlasTiles = 256;
+	// 每帧最多重画的块数，每块在uniformShadowAtlasResource里占ShadowCascadeUniformStride，每个飞行帧各有一组
+	const uint32_t MaxShadowAtlasUpdates = 24;
+
+	// 和shader里的ShadowAtlasTile一致
+	struct ShadowAtlasTileData
+	{
+		glm::mat4 projView = glm::mat4(1.0f);
+		glm::vec4 rect = glm::vec4(0.0f);			// 块在图集里的uv偏移和缩放
+	};
+
+	// shadowAtlasTileResource里每个飞行帧一段，按storage buffer的offset对齐取整
+	const uint32_t ShadowAtlasTileBufferStride = (sizeof(ShadowAtlasTileData) * MaxShadowAtlasTiles + 255) / 256 * 256;
+
+	// 一个局部光源在图集里的块，矩阵和key对应图集里已经画好的内容
+	struct LocalLightShadow
+	{
+		std::array<ShadowAtlasAllocator::Tile, 6> tiles;
+		std::array<glm::mat4, 6> projViews;
+		uint32_t tileCount = 0;		// 聚光灯1，点光源6，没有分到图集时为0
+		uint64_t contentKey = 0;
+		bool valid = false;			// 图集里有和projViews一致的内容
+	};
+
+	// 这一帧要画进图集的块，由renderer按顺序画
+	struct ShadowAtlasUpdate
+	{
+		ShadowAtlasAllocator::Tile tile;
+		glm::mat4 projView = glm::mat4(1.0f);
+		std::vector<uint32_t> casters;
+	};
+
+	struct ShadowAtlasStats
+	{
+		uint32_t shadowedLights = 0;
+		uint32_t tiles = 0;
+		uint32_t updatedTiles = 0;
+		uint32_t cachedLights = 0;		// 内容没变沿用上次的光源
+		uint32_t deferredLights = 0;	// 超出每帧预算推迟到之后的光源
+		float usage = 0.0f;
+	};
+
+	// 和shader里的ClusterData一致
+	struct UniformBufferObjectClusters
+	{
+		glm::mat4 view = glm::mat4(1.0f);
+		glm::vec4 projParams = glm::vec4(0.0f);		// tan(半视角)的x和y，near，far
+		glm::vec4 sliceParams = glm::vec4(0.0f);	// 深度切片的缩放和偏移，屏幕尺寸的倒数
+		glm::uvec4 gridSize = glm::uvec4(0);		// xyz是网格尺寸，w是光源数量
+	};
+
+	// uniformClustersResource里每个飞行帧一段，按uniform buffer的offset对齐取整
+	const uint32_t ClusterUniformStride = (sizeof(UniformBufferObjectClusters) + 255) / 256 * 256;
+
 	struct VulkanDescriptor
 	{
-		VkDescriptorSetLayout layout;
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
 		std::vector<VkDescriptorSet> descriptorSet;			// 多个的设计是为了多帧用的
 	};
 
@@ -111,7 +275,7 @@ namespace VulkanEngine
 		
 		//TODO:用统一属性和材质描述
 		//VulkanResource materialUniform;
-		VkDescriptorSet descriptorSet;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;		// 来自descriptorAllocator的缓存，可能和其他材质共用
 
 		void createDescriptorSet(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData);
 	};
@@ -137,6 +301,9 @@ namespace VulkanEngine
 		glm::vec3 getCenter();
 		glm::vec3 getSize();
 		bool isValid() const;
+
+		// 变换后的轴对齐包围盒
+		Box transform(const glm::mat4& matrix) const;
 	};
 
 	struct Mesh
@@ -145,6 +312,23 @@ namespace VulkanEngine
 		std::vector<Vertex> vertices;
 		std::vector<uint32_t> indices;
 		PBRMaterial* material = nullptr;
+		GeometryHandle geometry = InvalidGeometryHandle;		// 在geometryHeap中的位置
+
+		Box localBounds;		// 模型空间，导入时确定
+		Box worldBounds;		// 包含场景rotate的世界空间，由场景更新
+
+		// 节点被setNodeTransform移动过之后为true，阴影画在静态缓存的副本上，不让静态阴影跟着重画
+		bool dynamicShadowCaster = false;
+
+		void computeLocalBounds();
+	};
+
+	// 每个mesh预先算好的绘制参数，对应vkCmdDrawIndexed的参数
+	struct MeshDrawInfo
+	{
+		uint32_t indexCount = 0;
+		uint32_t firstIndex = 0;
+		int32_t vertexOffset = 0;
 	};
 
 	class VulkanRenderSceneData
@@ -155,17 +339,58 @@ namespace VulkanEngine
 		// 配置好场景数据后调用
 		void setupRenderData();
 
-		void createDirectionalLightShadowDescriptorSet(VkImageView& directionalLightShadowView);
+		// 运行时加入/移除mesh的几何数据
+		void addMeshGeometry(Mesh* mesh);
+		void removeMeshGeometry(Mesh* mesh);
+
+		// 每个pass绑定一次共享的顶点和索引缓冲
+		void bindGeometry(VkCommandBuffer commandBuffer);
+
+		// 和meshes一一对应，geometryHeap布局变化时才重建
+		const std::vector<MeshDrawInfo>& getMeshDrawInfos();
+
+		// 光照管线片元着色器的specialization，指向场景里的成员，创建管线时读取
+		const VkSpecializationInfo* getShadowFilterSpecializationInfo();
+
+		// 最后一个阴影级联的远端在深度缓冲里的值，延迟光照按它区分要不要查阴影图，始终小于天空的1
+		float getShadowRangeDepth() const;
+
+		// 阴影图是深度格式，directionalLightShadowSampler需要开启比较，PCSS另外用不比较的采样器读原始深度
+		void createDirectionalLightShadowDescriptorSet(VkImageView& directionalLightShadowView, VkSampler directionalLightShadowSampler, VkImageView& localLightShadowAtlasView, VkSampler localLightShadowAtlasSampler);
 
 		void createDeferredUniformDescriptorSet();
 
+		// meshDrawDatas和meshes对齐，运行时加入的mesh超出容量时扩容并重写uniformDescriptor
+		// 返回true时其它引用meshDrawDataResource的descriptor也要重写，在updateUniformRenderData之前调用
+		bool reserveMeshBuffers();
+
 		// TODO:场景非uniform数据更新后续再处理
 		void updateUniformRenderData();
 
+		// 上传光源和每块阴影的数据，阴影的两份数据写在这一帧下标自己的那一段，要在等待这一帧的fence之后调用
+		void uploadLocalLights();
+
+		// 对相机和每个阴影级联的视锥各做一次剔除，结果是按下标排好的可见mesh列表
+		void cullMeshes();
+
+		// 可见列表的最终结果（包括之后的软件遮挡剔除）和上次提交的不同时递增visibilityVersion，构建队列之前调用
+		void updateVisibilityVersion();
+
+		// 修改节点的局部变换，同时更新子树的世界变换，包围盒在下次使用时重新合并
+		// 子树里的mesh从此按动态阴影投射物处理
+		void setNodeTransform(Node* node, const glm::mat4& localTransform);
+
+		// 所有mesh世界包围盒的并集，包含rotate，取自meshBVH的根节点
 		Box getSceneBounds();
 
+		// 世界空间的射线和mesh三角形求交，返回最近的mesh下标和距离（以direction的长度为单位），没有命中时返回-1
+		int32_t pickMesh(const glm::vec3& origin, const glm::vec3& direction, float& distance);
+
 		void lookAtSceneCenter();
 
+		// 在场景包围盒里随机放置count个点光源，每4个里有一个朝下的聚光灯
+		void scatterLocalLights(uint32_t count, uint32_t seed = 1);
+
 		void clear();
 
 		VulkanDescriptor uniformDescriptor;
@@ -181,6 +406,9 @@ namespace VulkanEngine
 		CubeMap* IBLSpecularBox = nullptr;
 		CubeMap* IBLIrradianceBox = nullptr;
 		Texture* brdfLUTTexture = nullptr;
+		// 等距柱状投影的HDR环境图，设置后IBL的三张图都在GPU上从它生成
+		// 默认为空，从sky目录里天空盒的六个面生成；compute不可用时才读预先烘焙好的图
+		std::string environmentMapPath;
 
 		std::string shaderName;
 		std::string shaderVSFliePath;
@@ -190,46 +418,164 @@ namespace VulkanEngine
 
 		std::string deferredLightingVSFilePath;
 		std::string deferredLightingFSFilePath;
+		std::string deferredLightingCSFilePath;
+		std::string deferredTileClassifyCSFilePath;
 
 		std::string FXAAVSFilePath;
 		std::string FXAAFSFilePath;
 
 		std::string shadowVSFilePath;
+		// 阴影pass只写深度不再使用，Hi-Z的prepass用它把深度写进颜色
 		std::string shadowFSFilePath;
 
+		std::string hizBuildCSFilePath;
+		std::string occlusionCullingCSFilePath;
+
+		std::string lightClusteringCSFilePath;
+
+		std::string iblEquirectToCubeCSFilePath;
+		std::string iblPrefilterSpecularCSFilePath;
+		std::string iblIrradianceCSFilePath;
+		std::string iblBrdfLUTCSFilePath;
+
 		CameraController cameraController;
 
-		VulkanResource vertexResource;
-		VulkanResource indexResource;
+		VulkanGeometryHeap geometryHeap;
+		std::vector<MeshDrawInfo> meshDrawInfos;
+		uint64_t meshDrawInfoVersion = ~0ull;
+
+		// mesh、材质等会影响绘制命令的内容变化时递增，修改meshes或材质后需要手动递增
+		uint64_t contentVersion = 0;
 
 		VulkanResource uniformResource;
 		UniformBufferObjectVS uniformBufferVSObject;
 		UniformBufferObjectFS uniformBufferFSObject;
 
-		VulkanResource uniformDynamicResource;
-		std::vector<UniformBufferDynamicObject> uniformBufferDynamicObjects;
+		VulkanResource meshDrawDataResource;
+		std::vector<MeshDrawData> meshDrawDatas;
 
+		// 包围盒变化时整体上传
+		VulkanResource meshBoundsResource;
+
+		// 上面两个buffer能放下的mesh数，扩容时换成新的buffer并递增meshBufferVersion
+		uint32_t meshBufferCapacity = 0;
+		uint64_t meshBufferVersion = 0;
+
+		// 级联数和每个级联的分辨率在阴影pass创建时确定，级联数取值2~MaxShadowCascades
+		uint32_t shadowCascadeCount = 3;
+		uint32_t shadowCascadeSize = 2048;
+		// 级联划分在均匀和对数分布之间的插值，越大近处的级联越小
+		float shadowCascadeSplitLambda = 0.75f;
+		// 阴影覆盖的最远距离，不超过相机的far
+		float shadowDistance = 64.0f;
+
+		// 阴影过滤在光照管线创建时编进shader，之后修改不会生效
+		ShadowFilter shadowFilter = ShadowFilter::Poisson;
+		uint32_t shadowFilterTaps = 16;		// 泊松和PCSS的采样数，8或16
+		float shadowLightSize = 0.02f;		// 光源角半径的正切，越大PCSS的半影越宽
+
+		// 级联的投影和投射物都没变时沿用上一次的阴影图，关闭时每帧重画
+		bool shadowCaching = true;
+		std::array<ShadowCascadeCache, MaxShadowCascades> shadowCascadeCaches;
+		ShadowCacheStats shadowCacheStats;
+
+		// 每个级联的投影矩阵，按ShadowCascadeUniformStride存放
 		VulkanResource uniformShadowResource;
-		UnifromBufferObjectShadowProjView uniformBufferShadowVSObject;
+		std::array<UnifromBufferObjectShadowProjView, MaxShadowCascades> uniformBufferShadowVSObjects;
+		VulkanResource uniformShadowCascadesResource;
+		UniformBufferObjectShadowCascades uniformBufferShadowCascadesObject;
 		VulkanDescriptor directionalLightShadowDescriptor;
 
+		// 超过MaxLocalLights的部分不上传
+		std::vector<LocalLight> localLights;
+		// 这两个每个飞行帧各占一段，分别按LightBufferStride和ClusterUniformStride存放
+		VulkanResource lightResource;
+		VulkanResource uniformClustersResource;
+		UniformBufferObjectClusters uniformBufferClustersObject;
+		// 每个簇的光源数量，后面跟着每个簇MaxLightsPerCluster个光源下标，由compute每帧写入
+		VulkanResource clusterGridResource;
+
+		// 局部光源阴影，图集尺寸在图集pass创建时确定
+		bool localLightShadows = true;
+		uint32_t shadowAtlasSize = 4096;
+		uint32_t maxShadowedLocalLights = 16;
+		uint32_t shadowAtlasUpdateBudget = 12;		// 每帧最多重画的块数，不超过MaxShadowAtlasUpdates
+		std::vector<LocalLightShadow> localLightShadowStates;
+		std::vector<ShadowAtlasUpdate> shadowAtlasUpdates;
+		ShadowAtlasStats shadowAtlasStats;
+		// 光照shader读的每块矩阵和位置，每个飞行帧占ShadowAtlasTileBufferStride，directionalLightShadowDescriptor每帧一个set
+		VulkanResource shadowAtlasTileResource;
+		// 图集pass每个更新槽位的投影矩阵，按ShadowCascadeUniformStride存放，每个飞行帧MaxShadowAtlasUpdates个槽位
+		VulkanResource uniformShadowAtlasResource;
+
+		// deferred的光照改用compute，按屏幕tile剔除光源，在deferred pass创建时确定，之后修改不会生效
+		bool computeDeferredLighting = false;
+
 		VulkanResource deferredUniformResource;
 		DeferredUniformBufferObject deferredUniformObject;
 		VulkanDescriptor deferredUniformDescriptor;
 
 		glm::mat4 rotate = glm::mat4(1.0);
 
+		bool frustumCulling = true;
+		std::vector<uint32_t> cameraVisibleMeshes;
+		std::array<std::vector<uint32_t>, MaxShadowCascades> shadowVisibleMeshes;
+		CullingStats cameraCullingStats;
+		std::array<CullingStats, MaxShadowCascades> shadowCullingStats;
+		// 任一可见列表和上一帧不同时递增
+		uint64_t visibilityVersion = 0;
+
+		// GPU剔除不可用时在CPU上光栅化遮挡体，剔除cameraVisibleMeshes
+		bool softwareOcclusionCulling = true;
+		uint32_t occluderTriangleBudget = 20000;
+		SoftwareOcclusionStats softwareOcclusionStats;
+
+		// 主视角的GPU遮挡剔除，统计来自同一帧下标上一次的回读
+		bool gpuOcclusionCulling = true;
+		OcclusionCullingStats occlusionCullingStats;
+
 	private:
+		// 内容、节点变换或rotate变化后重新计算mesh的世界包围盒和场景包围盒，并写入meshCuller
+		void updateMeshBounds();
+		void updateWorldTransform(Node* node);
+		// 把相机视锥按距离分段，每段用一个贴合的正交投影，投影中心对齐到阴影图的texel
+		void updateShadowCascades();
+		// 剔除之后把每个级联的投射物按静态和动态分开，算出对应的key
+		void updateShadowCascadeCaches();
+		// 按屏幕上的大小给局部光源分配图集块，选出这一帧要重画的块
+		void updateLocalLightShadows();
+		// 按capacity创建meshDrawDataResource和meshBoundsResource
+		void createMeshBuffers(uint32_t capacity);
+		void writeMeshDrawDataDescriptor();
+
+		FrustumCuller meshCuller;
+		// mesh数量较多时视锥剔除走BVH，少的时候逐个SIMD测试更快
+		static const size_t BVHCullingMeshCount = 512;
+		BoundingVolumeHierarchy meshBVH;
+		Box sceneBounds;
+		uint64_t transformVersion = 0;
+		uint64_t meshBoundsVersion = ~0ull;
+		uint64_t meshBoundsTransformVersion = ~0ull;
+		ShadowFilterConstants shadowFilterConstants;
+		std::array<VkSpecializationMapEntry, 3> shadowFilterMapEntries;
+		VkSpecializationInfo shadowFilterSpecializationInfo = {};
+		glm::mat4 meshBoundsRotate = glm::mat4(1.0f);
+		std::vector<uint32_t> submittedCameraMeshes;
+		std::array<std::vector<uint32_t>, MaxShadowCascades> submittedShadowMeshes;
+		ShadowAtlasAllocator shadowAtlasAllocator;
+		std::vector<ShadowAtlasTileData> shadowAtlasTileDatas;
+		std::vector<int32_t> localLightFirstTiles;
+
 		VulkanRenderer* vulkanRenderer = nullptr;
 
 	public:
 
-		void createVertexData();
-		void createIndexData();
+		void createGeometryData();
 
 		void createUniformBufferData();
 		void createUniformDescriptorSet();
 
+		void createIBLTextures();
 		void createIBLDescriptor();
 
 		void createPBRDescriptorLayout();
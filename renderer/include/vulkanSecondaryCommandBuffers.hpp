@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include "vulkan/vulkan.h"
+#include <vector>
+
+namespace VulkanEngine
+{
+    class VulkanRenderer;
+
+    // 多线程录制用的secondary commandBuffer
+    // 每个线程每个inflight帧一个command pool，帧开始时整池reset，commandBuffer复用不释放
+    // reusable的实例录制的commandBuffer可以多次提交，只在内容失效时才reset
+    class VulkanSecondaryCommandBuffers
+    {
+    public:
+        void init(VulkanRenderer* vulkanRenderer, uint32_t threadCount, bool reusable = false);
+        void cleanup();
+
+        void resetFrame(uint32_t frameIndex);
+
+        // 只能在threadIndex对应的线程里调用，继承renderPass的subpass，framebuffer可以为空
+        VkCommandBuffer begin(uint32_t threadIndex, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer);
+        void end(VkCommandBuffer commandBuffer);
+
+        uint32_t getThreadCount() const { return static_cast<uint32_t>(threadPools.size()); }
+        uint32_t getRecordedCount(uint32_t frameIndex) const;
+
+    private:
+        struct FramePool
+        {
+            VkCommandPool commandPool = VK_NULL_HANDLE;
+            std::vector<VkCommandBuffer> commandBuffers;
+            uint32_t usedCount = 0;
+        };
+
+        VulkanRenderer* vulkanRenderer = nullptr;
+        VkCommandBufferUsageFlags usageFlags = 0;
+
+        // [线程][帧]
+        std::vector<std::vector<FramePool>> threadPools;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,580 @@
+﻿#include "boundingVolumeHierarchy.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace VulkanEngine
+{
+    // SAH里遍历一个节点和测试一个物体的相对代价
+    static const float TraversalCost = 1.0f;
+
+    void BoundingVolumeHierarchy::Bounds::unionBounds(const Bounds& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    float BoundingVolumeHierarchy::Bounds::surfaceArea() const
+    {
+        if (!isValid())
+        {
+            return 0.0f;
+        }
+        glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // 射线和包围盒在[0, maxT]内的进入距离
+    static bool intersectBounds(const BoundingVolumeHierarchy::Bounds& bounds, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxT, float& entryT)
+    {
+        glm::vec3 t0 = (bounds.min - origin) * inverseDirection;
+        glm::vec3 t1 = (bounds.max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+        entryT = enter;
+        return enter <= exit;
+    }
+
+    BoundingVolumeHierarchy::Bounds BoundingVolumeHierarchy::computeReferenceBounds(uint32_t first, uint32_t count) const
+    {
+        Bounds bounds;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            bounds.unionBounds(references[i].bounds);
+        }
+        return bounds;
+    }
+
+    BoundingVolumeHierarchy::Bounds BoundingVolumeHierarchy::computeLeafBounds(const Node& leaf) const
+    {
+        Bounds bounds;
+        for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++)
+        {
+            bounds.unionBounds(objectBounds[indices[i]]);
+        }
+        return bounds;
+    }
+
+    float BoundingVolumeHierarchy::nodeCost(const Node& node) const
+    {
+        return node.bounds.surfaceArea() * (node.count == 0 ? TraversalCost : static_cast<float>(node.count));
+    }
+
+    bool BoundingVolumeHierarchy::split(uint32_t first, uint32_t count, const Bounds& bounds, uint32_t& leftCount)
+    {
+        if (count <= 1)
+        {
+            return false;
+        }
+
+        Bounds centroidBounds;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            centroidBounds.min = glm::min(centroidBounds.min, references[i].centroid);
+            centroidBounds.max = glm::max(centroidBounds.max, references[i].centroid);
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        uint32_t bestSplit = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f)
+            {
+                continue;
+            }
+
+            Bounds binBounds[BinCount];
+            uint32_t binCounts[BinCount] = {};
+            float scale = BinCount / extent;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                const BuildReference& reference = references[i];
+                uint32_t bin = std::min(BinCount - 1, static_cast<uint32_t>((reference.centroid[axis] - centroidBounds.min[axis]) * scale));
+                binCounts[bin]++;
+                binBounds[bin].unionBounds(reference.bounds);
+            }
+
+            // 从右往左累计，第s个分割面右边是[s, BinCount)
+            float rightAreas[BinCount];
+            uint32_t rightCounts[BinCount];
+            Bounds accumulated;
+            uint32_t accumulatedCount = 0;
+            for (uint32_t bin = BinCount - 1; bin > 0; bin--)
+            {
+                accumulated.unionBounds(binBounds[bin]);
+                accumulatedCount += binCounts[bin];
+                rightAreas[bin] = accumulated.surfaceArea();
+                rightCounts[bin] = accumulatedCount;
+            }
+
+            accumulated = Bounds();
+            accumulatedCount = 0;
+            for (uint32_t bin = 1; bin < BinCount; bin++)
+            {
+                accumulated.unionBounds(binBounds[bin - 1]);
+                accumulatedCount += binCounts[bin - 1];
+                if (accumulatedCount == 0 || rightCounts[bin] == 0)
+                {
+                    continue;
+                }
+
+                float cost = accumulated.surfaceArea() * accumulatedCount + rightAreas[bin] * rightCounts[bin];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = bin;
+                }
+            }
+        }
+
+        // 所有中心重合，分不开
+        if (bestAxis < 0)
+        {
+            return false;
+        }
+
+        // 物体不多时只有SAH更优才划分，多了则总是划分以限制叶子大小
+        float area = bounds.surfaceArea();
+        if (count <= MaxLeafSize && TraversalCost * area + bestCost >= area * count)
+        {
+            return false;
+        }
+
+        float extent = centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis];
+        float scale = BinCount / extent;
+        float axisMin = centroidBounds.min[bestAxis];
+        auto middle = std::partition(references.begin() + first, references.begin() + first + count, [&](const BuildReference& reference) {
+            uint32_t bin = std::min(BinCount - 1, static_cast<uint32_t>((reference.centroid[bestAxis] - axisMin) * scale));
+            return bin < bestSplit;
+        });
+
+        leftCount = static_cast<uint32_t>(middle - (references.begin() + first));
+        return leftCount > 0 && leftCount < count;
+    }
+
+    void BoundingVolumeHierarchy::buildSubtree(std::vector<Node>& outNodes, uint32_t nodeIndex, uint32_t first, uint32_t count)
+    {
+        Bounds bounds = computeReferenceBounds(first, count);
+        outNodes[nodeIndex].bounds = bounds;
+
+        uint32_t leftCount = 0;
+        if (!split(first, count, bounds, leftCount))
+        {
+            outNodes[nodeIndex].leftFirst = first;
+            outNodes[nodeIndex].count = count;
+            return;
+        }
+
+        // 先分配再递归，不能持有outNodes里元素的引用
+        uint32_t left = static_cast<uint32_t>(outNodes.size());
+        outNodes.emplace_back();
+        outNodes.emplace_back();
+        outNodes[nodeIndex].leftFirst = left;
+        outNodes[nodeIndex].count = 0;
+
+        buildSubtree(outNodes, left, first, leftCount);
+        buildSubtree(outNodes, left + 1, first + leftCount, count - leftCount);
+    }
+
+    void BoundingVolumeHierarchy::build(const std::vector<Bounds>& bounds, ThreadPool* threadPool)
+    {
+        objectBounds = bounds;
+        uint32_t objectCount = static_cast<uint32_t>(objectBounds.size());
+
+        nodes.clear();
+        indices.clear();
+        references.clear();
+        unboundedObjects.clear();
+        dirtyObjects.clear();
+        for (uint32_t i = 0; i < objectCount; i++)
+        {
+            const Bounds& objectBound = objectBounds[i];
+            if (objectBound.isValid())
+            {
+                references.push_back({ objectBound, (objectBound.min + objectBound.max) * 0.5f, i });
+            }
+            else
+            {
+                unboundedObjects.push_back(i);
+            }
+        }
+
+        if (!references.empty())
+        {
+            uint32_t referenceCount = static_cast<uint32_t>(references.size());
+            nodes.reserve(referenceCount * 2);
+            nodes.emplace_back();
+
+            // 上层在调用线程里划分，直到子树足够小、数量够分给所有线程
+            bool parallel = threadPool != nullptr && threadPool->getThreadCount() > 0;
+            uint32_t subtreeSize = parallel ? std::max(ParallelSubtreeSize, referenceCount / (threadPool->getThreadCount() * 8)) : referenceCount;
+            std::vector<BuildTask> stack = { { 0, 0, referenceCount } };
+            std::vector<BuildTask> jobs;
+            while (!stack.empty())
+            {
+                BuildTask task = stack.back();
+                stack.pop_back();
+
+                if (task.count <= subtreeSize)
+                {
+                    jobs.push_back(task);
+                    continue;
+                }
+
+                Bounds nodeBounds = computeReferenceBounds(task.first, task.count);
+                nodes[task.node].bounds = nodeBounds;
+
+                uint32_t leftCount = 0;
+                if (!split(task.first, task.count, nodeBounds, leftCount))
+                {
+                    nodes[task.node].leftFirst = task.first;
+                    nodes[task.node].count = task.count;
+                    continue;
+                }
+
+                uint32_t left = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+                nodes.emplace_back();
+                nodes[task.node].leftFirst = left;
+                nodes[task.node].count = 0;
+
+                stack.push_back({ left, task.first, leftCount });
+                stack.push_back({ left + 1, task.first + leftCount, task.count - leftCount });
+            }
+
+            if (jobs.size() == 1)
+            {
+                buildSubtree(nodes, jobs[0].node, jobs[0].first, jobs[0].count);
+            }
+            else
+            {
+                // 每个子树建在自己的数组里，第0个是子树根，之后按偏移拼到nodes后面
+                std::vector<std::vector<Node>> subtrees(jobs.size());
+                threadPool->parallelFor(static_cast<uint32_t>(jobs.size()), [&](uint32_t job, uint32_t /*thread*/) {
+                    subtrees[job].reserve(jobs[job].count * 2);
+                    subtrees[job].emplace_back();
+                    buildSubtree(subtrees[job], 0, jobs[job].first, jobs[job].count);
+                });
+
+                for (size_t job = 0; job < jobs.size(); job++)
+                {
+                    const std::vector<Node>& subtree = subtrees[job];
+                    uint32_t base = static_cast<uint32_t>(nodes.size());
+                    auto relocate = [base](Node node) {
+                        if (node.count == 0)
+                        {
+                            node.leftFirst = node.leftFirst - 1 + base;
+                        }
+                        return node;
+                    };
+
+                    nodes[jobs[job].node] = relocate(subtree[0]);
+                    for (size_t i = 1; i < subtree.size(); i++)
+                    {
+                        nodes.push_back(relocate(subtree[i]));
+                    }
+                }
+            }
+
+            indices.resize(referenceCount);
+            for (uint32_t i = 0; i < referenceCount; i++)
+            {
+                indices[i] = references[i].object;
+            }
+            references.clear();
+        }
+
+        updateTopology();
+        buildCost = getCost();
+    }
+
+    void BoundingVolumeHierarchy::updateTopology()
+    {
+        parents.assign(nodes.size(), ~0u);
+        objectLeaves.assign(objectBounds.size(), ~0u);
+        dirtyNodes.assign(nodes.size(), 0);
+        unnormalizedCost = 0.0f;
+
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            const Node& node = nodes[i];
+            unnormalizedCost += nodeCost(node);
+            if (node.count == 0)
+            {
+                parents[node.leftFirst] = i;
+                parents[node.leftFirst + 1] = i;
+            }
+            else
+            {
+                for (uint32_t k = node.leftFirst; k < node.leftFirst + node.count; k++)
+                {
+                    objectLeaves[indices[k]] = i;
+                }
+            }
+        }
+    }
+
+    void BoundingVolumeHierarchy::setObjectBounds(uint32_t object, const Bounds& bounds)
+    {
+        objectBounds[object] = bounds;
+        if (objectLeaves[object] != ~0u)
+        {
+            dirtyObjects.push_back(object);
+        }
+    }
+
+    bool BoundingVolumeHierarchy::refit(ThreadPool* threadPool)
+    {
+        if (dirtyObjects.empty())
+        {
+            return false;
+        }
+
+        // 标记到根的路径，已经标记过的祖先也都标记过了
+        for (uint32_t object : dirtyObjects)
+        {
+            uint32_t node = objectLeaves[object];
+            while (node != ~0u && !dirtyNodes[node])
+            {
+                dirtyNodes[node] = 1;
+                node = parents[node];
+            }
+        }
+        dirtyObjects.clear();
+
+        // 子节点的下标总是比父节点大，倒序就是自底向上
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            if (!dirtyNodes[i])
+            {
+                continue;
+            }
+            dirtyNodes[i] = 0;
+
+            Node& node = nodes[i];
+            unnormalizedCost -= nodeCost(node);
+            if (node.count == 0)
+            {
+                node.bounds = nodes[node.leftFirst].bounds;
+                node.bounds.unionBounds(nodes[node.leftFirst + 1].bounds);
+            }
+            else
+            {
+                node.bounds = computeLeafBounds(node);
+            }
+            unnormalizedCost += nodeCost(node);
+        }
+
+        if (getCost() > buildCost * RebuildCostRatio)
+        {
+            build(std::vector<Bounds>(objectBounds), threadPool);
+            return true;
+        }
+        return false;
+    }
+
+    BoundingVolumeHierarchy::Bounds BoundingVolumeHierarchy::getRootBounds() const
+    {
+        return nodes.empty() ? Bounds() : nodes[0].bounds;
+    }
+
+    float BoundingVolumeHierarchy::getCost() const
+    {
+        float rootArea = nodes.empty() ? 0.0f : nodes[0].bounds.surfaceArea();
+        return rootArea > 0.0f ? unnormalizedCost / rootArea : 0.0f;
+    }
+
+    void BoundingVolumeHierarchy::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& outObjects) const
+    {
+        outObjects.insert(outObjects.end(), unboundedObjects.begin(), unboundedObjects.end());
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        // 返回包围盒还需要测试的平面，完全在某个平面外时返回~0u
+        auto testBounds = [&frustum](const Bounds& bounds, uint32_t planeMask) {
+            glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+            glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+            for (uint32_t p = 0; p < 6; p++)
+            {
+                if ((planeMask & (1u << p)) == 0)
+                {
+                    continue;
+                }
+                const glm::vec4& plane = frustum.planes[p];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if (distance + radius < 0.0f)
+                {
+                    return ~0u;
+                }
+                if (distance - radius >= 0.0f)
+                {
+                    planeMask &= ~(1u << p);
+                }
+            }
+            return planeMask;
+        };
+
+        // 平面掩码为0的子树整个在视锥内
+        std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0x3fu } };
+        while (!stack.empty())
+        {
+            uint32_t nodeIndex = stack.back().first;
+            uint32_t planeMask = stack.back().second;
+            stack.pop_back();
+
+            const Node& node = nodes[nodeIndex];
+            if (planeMask != 0)
+            {
+                planeMask = testBounds(node.bounds, planeMask);
+                if (planeMask == ~0u)
+                {
+                    continue;
+                }
+            }
+
+            if (node.count == 0)
+            {
+                stack.push_back({ node.leftFirst, planeMask });
+                stack.push_back({ node.leftFirst + 1, planeMask });
+                continue;
+            }
+
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+            {
+                uint32_t object = indices[i];
+                if (planeMask == 0 || testBounds(objectBounds[object], planeMask) != ~0u)
+                {
+                    outObjects.push_back(object);
+                }
+            }
+        }
+    }
+
+    void BoundingVolumeHierarchy::queryBounds(const Bounds& bounds, std::vector<uint32_t>& outObjects) const
+    {
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        auto overlaps = [&bounds](const Bounds& other) {
+            return glm::all(glm::lessThanEqual(bounds.min, other.max)) && glm::all(glm::lessThanEqual(other.min, bounds.max));
+        };
+
+        std::vector<uint32_t> stack = { 0u };
+        while (!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+
+            if (!overlaps(node.bounds))
+            {
+                continue;
+            }
+
+            if (node.count == 0)
+            {
+                stack.push_back(node.leftFirst);
+                stack.push_back(node.leftFirst + 1);
+                continue;
+            }
+
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+            {
+                if (overlaps(objectBounds[indices[i]]))
+                {
+                    outObjects.push_back(indices[i]);
+                }
+            }
+        }
+    }
+
+    int32_t BoundingVolumeHierarchy::raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const std::function<bool(uint32_t object, float& t)>& intersect) const
+    {
+        int32_t hitObject = -1;
+        if (nodes.empty())
+        {
+            return hitObject;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        float closestT = t;
+
+        float entryT;
+        if (!intersectBounds(nodes[0].bounds, origin, inverseDirection, closestT, entryT))
+        {
+            return hitObject;
+        }
+
+        // 先近后远，进入距离已经比最近命中远的节点直接跳过
+        std::vector<std::pair<uint32_t, float>> stack = { { 0u, entryT } };
+        while (!stack.empty())
+        {
+            uint32_t nodeIndex = stack.back().first;
+            float nodeEntryT = stack.back().second;
+            stack.pop_back();
+            if (nodeEntryT > closestT)
+            {
+                continue;
+            }
+
+            const Node& node = nodes[nodeIndex];
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+                {
+                    uint32_t object = indices[i];
+                    float objectT = closestT;
+                    bool hit = false;
+                    if (intersect)
+                    {
+                        hit = intersect(object, objectT);
+                    }
+                    else
+                    {
+                        hit = intersectBounds(objectBounds[object], origin, inverseDirection, closestT, objectT);
+                    }
+
+                    if (hit && objectT <= closestT)
+                    {
+                        closestT = objectT;
+                        hitObject = static_cast<int32_t>(object);
+                    }
+                }
+                continue;
+            }
+
+            float leftT, rightT;
+            bool hitLeft = intersectBounds(nodes[node.leftFirst].bounds, origin, inverseDirection, closestT, leftT);
+            bool hitRight = intersectBounds(nodes[node.leftFirst + 1].bounds, origin, inverseDirection, closestT, rightT);
+            if (hitLeft && hitRight)
+            {
+                bool leftFirst = leftT <= rightT;
+                stack.push_back({ leftFirst ? node.leftFirst + 1 : node.leftFirst, leftFirst ? rightT : leftT });
+                stack.push_back({ leftFirst ? node.leftFirst : node.leftFirst + 1, leftFirst ? leftT : rightT });
+            }
+            else if (hitLeft)
+            {
+                stack.push_back({ node.leftFirst, leftT });
+            }
+            else if (hitRight)
+            {
+                stack.push_back({ node.leftFirst + 1, rightT });
+            }
+        }
+
+        t = closestT;
+        return hitObject;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,254 @@
+﻿#include "frustumCulling.hpp"
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define FRUSTUM_CULLING_NEON
+#endif
+
+namespace VulkanEngine
+{
+    Frustum Frustum::fromViewProj(const glm::mat4& viewProj)
+    {
+        // glm是列主序，第i行是(m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+        {
+            rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];      // left
+        frustum.planes[1] = rows[3] - rows[0];      // right
+        frustum.planes[2] = rows[3] + rows[1];      // bottom
+        frustum.planes[3] = rows[3] - rows[1];      // top
+        frustum.planes[4] = rows[2];                // near，z >= 0
+        frustum.planes[5] = rows[3] - rows[2];      // far
+
+        for (auto& plane : frustum.planes)
+        {
+            float length = glm::length(glm::vec3(plane));
+            if (length > 0.0f)
+            {
+                plane /= length;
+            }
+        }
+
+        return frustum;
+    }
+
+    void FrustumCuller::resize(uint32_t count)
+    {
+        this->count = count;
+
+        // 补齐的部分在cull里按下标过滤掉
+        size_t paddedCount = (static_cast<size_t>(count) + Width - 1) / Width * Width;
+        std::vector<float>* arrays[] = { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ };
+        for (auto array : arrays)
+        {
+            array->assign(paddedCount, 0.0f);
+        }
+    }
+
+    void FrustumCuller::setBounds(uint32_t index, const glm::vec3& min, const glm::vec3& max)
+    {
+        glm::vec3 center(0.0f);
+        glm::vec3 extent(1e30f);
+        if (max.x >= min.x && max.y >= min.y && max.z >= min.z)
+        {
+            center = (min + max) * 0.5f;
+            extent = (max - min) * 0.5f;
+        }
+
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        extentX[index] = extent.x;
+        extentY[index] = extent.y;
+        extentZ[index] = extent.z;
+    }
+
+    void FrustumCuller::cullScalar(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visible) const
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            bool inside = true;
+            for (const auto& plane : frustum.planes)
+            {
+                // 包围盒在法线方向上离平面最远的点都在外侧则整个在外侧
+                float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w
+                    + std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+                if (distance < 0.0f)
+                {
+                    inside = false;
+                    break;
+                }
+            }
+            if (inside)
+            {
+                visible.push_back(i);
+            }
+        }
+    }
+
+    void FrustumCuller::cull(const Frustum& frustum, std::vector<uint32_t>& visible, CullingStats& stats) const
+    {
+        visible.clear();
+
+        uint32_t simdEnd = 0;
+
+#if defined(FRUSTUM_CULLING_AVX)
+        __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            planeX[p] = _mm256_set1_ps(plane.x);
+            planeY[p] = _mm256_set1_ps(plane.y);
+            planeZ[p] = _mm256_set1_ps(plane.z);
+            planeW[p] = _mm256_set1_ps(plane.w);
+            absX[p] = _mm256_set1_ps(std::abs(plane.x));
+            absY[p] = _mm256_set1_ps(std::abs(plane.y));
+            absZ[p] = _mm256_set1_ps(std::abs(plane.z));
+        }
+        const __m256 zero = _mm256_setzero_ps();
+
+        simdEnd = static_cast<uint32_t>(centerX.size());
+        for (uint32_t i = 0; i < simdEnd; i += Width)
+        {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&extentZ[i]);
+
+            __m256 outside = zero;
+            for (int p = 0; p < 6; p++)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_mul_ps(cx, planeX[p]), planeW[p]);
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(cy, planeY[p]));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(cz, planeZ[p]));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(ex, absX[p]));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(ey, absY[p]));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(ez, absZ[p]));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+            }
+
+            uint32_t visibleMask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xffu;
+            while (visibleMask != 0)
+            {
+                uint32_t lane = 0;
+                while ((visibleMask & (1u << lane)) == 0)
+                {
+                    lane++;
+                }
+                visibleMask &= visibleMask - 1;
+                if (i + lane < count)
+                {
+                    visible.push_back(i + lane);
+                }
+            }
+        }
+#elif defined(FRUSTUM_CULLING_SSE) || defined(FRUSTUM_CULLING_NEON)
+        // 8个一组，拆成两个4宽的向量
+#if defined(FRUSTUM_CULLING_SSE)
+        using Float4 = __m128;
+        auto splat = [](float value) { return _mm_set1_ps(value); };
+        auto load = [](const float* data) { return _mm_loadu_ps(data); };
+        auto madd = [](Float4 a, Float4 b, Float4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); };
+        auto outsideMask = [](Float4 outside, Float4 distance) { return _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps())); };
+        auto toBits = [](Float4 outside) { return static_cast<uint32_t>(_mm_movemask_ps(outside)); };
+        const Float4 zero = _mm_setzero_ps();
+#else
+        using Float4 = float32x4_t;
+        auto splat = [](float value) { return vdupq_n_f32(value); };
+        auto load = [](const float* data) { return vld1q_f32(data); };
+        auto madd = [](Float4 a, Float4 b, Float4 c) { return vmlaq_f32(c, a, b); };
+        auto outsideMask = [](Float4 outside, Float4 distance)
+        {
+            uint32x4_t mask = vorrq_u32(vreinterpretq_u32_f32(outside), vcltq_f32(distance, vdupq_n_f32(0.0f)));
+            return vreinterpretq_f32_u32(mask);
+        };
+        auto toBits = [](Float4 outside)
+        {
+            // NEON没有movemask，取出每个lane的最高位拼起来
+            uint32_t lanes[4];
+            vst1q_u32(lanes, vreinterpretq_u32_f32(outside));
+            return (lanes[0] >> 31) | ((lanes[1] >> 31) << 1) | ((lanes[2] >> 31) << 2) | ((lanes[3] >> 31) << 3);
+        };
+        const Float4 zero = vdupq_n_f32(0.0f);
+#endif
+        Float4 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            planeX[p] = splat(plane.x);
+            planeY[p] = splat(plane.y);
+            planeZ[p] = splat(plane.z);
+            planeW[p] = splat(plane.w);
+            absX[p] = splat(std::abs(plane.x));
+            absY[p] = splat(std::abs(plane.y));
+            absZ[p] = splat(std::abs(plane.z));
+        }
+
+        simdEnd = static_cast<uint32_t>(centerX.size());
+        for (uint32_t i = 0; i < simdEnd; i += Width)
+        {
+            uint32_t outsideBits = 0;
+            for (uint32_t half = 0; half < 2; half++)
+            {
+                uint32_t base = i + half * 4;
+                Float4 cx = load(&centerX[base]);
+                Float4 cy = load(&centerY[base]);
+                Float4 cz = load(&centerZ[base]);
+                Float4 ex = load(&extentX[base]);
+                Float4 ey = load(&extentY[base]);
+                Float4 ez = load(&extentZ[base]);
+
+                Float4 outside = zero;
+                for (int p = 0; p < 6; p++)
+                {
+                    Float4 distance = madd(cx, planeX[p], planeW[p]);
+                    distance = madd(cy, planeY[p], distance);
+                    distance = madd(cz, planeZ[p], distance);
+                    distance = madd(ex, absX[p], distance);
+                    distance = madd(ey, absY[p], distance);
+                    distance = madd(ez, absZ[p], distance);
+                    outside = outsideMask(outside, distance);
+                }
+                outsideBits |= toBits(outside) << (half * 4);
+            }
+
+            uint32_t visibleMask = ~outsideBits & 0xffu;
+            while (visibleMask != 0)
+            {
+                uint32_t lane = 0;
+                while ((visibleMask & (1u << lane)) == 0)
+                {
+                    lane++;
+                }
+                visibleMask &= visibleMask - 1;
+                if (i + lane < count)
+                {
+                    visible.push_back(i + lane);
+                }
+            }
+        }
+#endif
+
+        if (simdEnd < count)
+        {
+            cullScalar(frustum, simdEnd, count, visible);
+        }
+
+        stats.tested = count;
+        stats.visible = static_cast<uint32_t>(visible.size());
+        stats.culled = count - stats.visible;
+    }
+}
\ No newline at end of file
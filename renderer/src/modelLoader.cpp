@@ -248,6 +248,14 @@ namespace VulkanEngine
 				}
 			}
 
+			// loadModel里请求了aiProcess_GenBoundingBoxes，没有生成时再从顶点计算
+			mesh->localBounds.min = glm::vec3(aiMesh->mAABB.mMin.x, aiMesh->mAABB.mMin.y, aiMesh->mAABB.mMin.z);
+			mesh->localBounds.max = glm::vec3(aiMesh->mAABB.mMax.x, aiMesh->mAABB.mMax.y, aiMesh->mAABB.mMax.z);
+			if (!mesh->localBounds.isValid() || (mesh->localBounds.min == mesh->localBounds.max && aiMesh->mNumVertices > 1))
+			{
+				mesh->computeLocalBounds();
+			}
+
 			if (aiMesh->mMaterialIndex >= 0)
 			{
 				aiMaterial* aiMaterial = scene->mMaterials[aiMesh->mMaterialIndex];
@@ -1,5 +1,6 @@
 ﻿#include "renderPass_UI.hpp"
 #include "macro.hpp"
+#include "vulkanScene.hpp"
 
 #include "imgui.h"
 #include "backends/imgui_impl_vulkan.h"
@@ -8,7 +9,7 @@
 namespace VulkanEngine
 {
 
-	void UIPass::init(VulkanRenderer* vulkanRender, VulkanRenderPass* mainPass, uint32_t subpassIndex, VulkanRenderSceneData* sceneData)
+	void UIPass::init(VulkanRenderer* vulkanRender, VkRenderPass targetRenderPass, uint32_t subpassIndex, VulkanRenderSceneData* sceneData)
 	{
 		VulkanRenderPass::init(vulkanRender, sceneData);
 
@@ -27,7 +28,7 @@ namespace VulkanEngine
 		initInfo.ImageCount = vulkanRender->MAX_FRAMES_IN_FLIGHT;
 
 		initInfo.Subpass = subpassIndex;
-		initInfo.RenderPass = mainPass->renderPass;
+		initInfo.RenderPass = targetRenderPass;
 		initInfo.MSAASamples = vulkanRender->msaaSamples;
 		ImGui_ImplVulkan_Init(&initInfo);
 
@@ -84,11 +85,157 @@ namespace VulkanEngine
 		ImGui::NewFrame();
 
 		ImGui::ShowDemoWindow();
+		drawMemoryPanel();
+		drawCullingPanel();
+		drawLightingPanel();
 		ImGui::Render();
-		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vulkanRender->getCurrentCommandBuffer());
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
 	}
 
-	void UIPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize)
+	void UIPass::drawMemoryPanel()
+	{
+		auto& memoryTracker = vulkanRender->memoryTracker;
+		const float MB = 1024.0f * 1024.0f;
+
+		ImGui::Begin("GPU Memory");
+
+		ImGui::Text("total: %.2f MB", memoryTracker.getTotalBytes() / MB);
+		ImGui::Text("memory budget ext: %s", memoryTracker.isMemoryBudgetSupported() ? "yes" : "no");
+
+		if (ImGui::BeginTable("categories", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+		{
+			ImGui::TableSetupColumn("category");
+			ImGui::TableSetupColumn("MB");
+			ImGui::TableSetupColumn("count");
+			ImGui::TableSetupColumn("budget MB");
+			ImGui::TableHeadersRow();
+
+			for (uint32_t i = 0; i < VulkanMemoryTracker::categoryCount; i++)
+			{
+				MemoryCategory category = static_cast<MemoryCategory>(i);
+				VkDeviceSize budget = memoryTracker.getCategoryBudget(category);
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(VulkanMemoryTracker::getCategoryName(category));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.2f", memoryTracker.getCategoryBytes(category) / MB);
+				ImGui::TableNextColumn();
+				ImGui::Text("%u", memoryTracker.getCategoryAllocationCount(category));
+				ImGui::TableNextColumn();
+				if (budget > 0)
+				{
+					ImGui::Text("%.2f", budget / MB);
+				}
+				else
+				{
+					ImGui::TextUnformatted("-");
+				}
+			}
+			ImGui::EndTable();
+		}
+
+		// heap用量
+		auto heapBudgets = memoryTracker.getHeapBudgets();
+		for (uint32_t i = 0; i < heapBudgets.size(); i++)
+		{
+			const auto& heap = heapBudgets[i];
+			float fraction = heap.budget > 0 ? (float)heap.usage / (float)heap.budget : 0.0f;
+			char overlay[64];
+			snprintf(overlay, sizeof(overlay), "%.0f / %.0f MB", heap.usage / MB, heap.budget / MB);
+			ImGui::Text("heap %u%s", i, (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "");
+			ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay);
+		}
+
+		ImGui::End();
+	}
+
+	void UIPass::drawCullingPanel()
+	{
+		ImGui::Begin("Culling");
+
+		ImGui::Checkbox("frustum culling", &sceneData->frustumCulling);
+
+		const CullingStats& camera = sceneData->cameraCullingStats;
+		ImGui::Text("camera: %u / %u visible, %u culled", camera.visible, camera.tested, camera.culled);
+		for (uint32_t i = 0; i < sceneData->shadowCascadeCount; i++)
+		{
+			const CullingStats& shadow = sceneData->shadowCullingStats[i];
+			ImGui::Text("shadow cascade %u: %u / %u visible, %u culled", i, shadow.visible, shadow.tested, shadow.culled);
+		}
+		ImGui::Checkbox("shadow caching", &sceneData->shadowCaching);
+		const ShadowCacheStats& shadowCache = sceneData->shadowCacheStats;
+		ImGui::Text("shadow cascades: %u redrawn (%u static), %u cached, %u dynamic casters", shadowCache.redrawnCascades, shadowCache.staticRedraws, shadowCache.cachedCascades, shadowCache.dynamicCasters);
+
+		ImGui::Separator();
+		ImGui::Checkbox("gpu occlusion culling", &sceneData->gpuOcclusionCulling);
+
+		const OcclusionCullingStats& occlusion = sceneData->occlusionCullingStats;
+		ImGui::Text("prepass: %u / %u drawn", occlusion.prepassDrawn, occlusion.tested);
+		ImGui::Text("visible: %u, frustum culled: %u, occluded: %u", occlusion.visible, occlusion.frustumCulled, occlusion.occluded);
+
+		ImGui::Separator();
+		ImGui::Checkbox("software occlusion culling", &sceneData->softwareOcclusionCulling);
+		int triangleBudget = static_cast<int>(sceneData->occluderTriangleBudget);
+		if (ImGui::SliderInt("occluder triangles", &triangleBudget, 0, 200000))
+		{
+			sceneData->occluderTriangleBudget = static_cast<uint32_t>(triangleBudget);
+		}
+
+		const SoftwareOcclusionStats& software = sceneData->softwareOcclusionStats;
+		ImGui::Text("occluders: %u meshes, %u triangles", software.occluderMeshes, software.occluderTriangles);
+		ImGui::Text("occluded: %u / %u", software.occluded, software.tested);
+
+		ImGui::End();
+	}
+
+	void UIPass::drawLightingPanel()
+	{
+		ImGui::Begin("Lighting");
+
+		// 修改数量时按固定种子重新放置，同样的数量得到同样的布局
+		int lightCount = static_cast<int>(sceneData->localLights.size());
+		if (ImGui::SliderInt("local lights", &lightCount, 0, static_cast<int>(MaxLocalLights)))
+		{
+			sceneData->scatterLocalLights(static_cast<uint32_t>(lightCount));
+		}
+
+		uint32_t spotCount = 0;
+		for (const LocalLight& light : sceneData->localLights)
+		{
+			spotCount += light.type == LightType::Spot ? 1 : 0;
+		}
+		ImGui::Text("point: %u, spot: %u", static_cast<uint32_t>(sceneData->localLights.size()) - spotCount, spotCount);
+		ImGui::Text("clusters: %ux%ux%u, max %u lights per cluster", ClusterGridX, ClusterGridY, ClusterGridZ, MaxLightsPerCluster);
+
+		// 阴影图集：按重要性选出的光源，每帧最多重画的块数
+		ImGui::Checkbox("local light shadows", &sceneData->localLightShadows);
+		int maxShadowedLights = static_cast<int>(sceneData->maxShadowedLocalLights);
+		if (ImGui::SliderInt("shadowed lights", &maxShadowedLights, 1, static_cast<int>(MaxShadowAtlasTiles / 6)))
+		{
+			sceneData->maxShadowedLocalLights = static_cast<uint32_t>(maxShadowedLights);
+		}
+		int updateBudget = static_cast<int>(sceneData->shadowAtlasUpdateBudget);
+		if (ImGui::SliderInt("atlas tiles per frame", &updateBudget, 6, static_cast<int>(MaxShadowAtlasUpdates)))
+		{
+			sceneData->shadowAtlasUpdateBudget = static_cast<uint32_t>(updateBudget);
+		}
+		const ShadowAtlasStats& atlasStats = sceneData->shadowAtlasStats;
+		ImGui::Text("shadowed: %u lights, %u tiles, atlas %.0f%%", atlasStats.shadowedLights, atlasStats.tiles, atlasStats.usage * 100.0f);
+		ImGui::Text("updated tiles: %u, cached: %u, deferred: %u", atlasStats.updatedTiles, atlasStats.cachedLights, atlasStats.deferredLights);
+
+		ImGui::End();
+	}
+
+	void UIPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+	{
+	}
+
+	void UIPass::drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+	}
+
+	void UIPass::drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
 	{
 	}
 
@@ -2,16 +2,32 @@
 #include "macro.hpp"
 #include "vulkanUtil.hpp"
 #include "vulkanPipeline.hpp"
+#include <cstddef>
 
 namespace VulkanEngine
 {
+	// 和shaders/deferredLightingTiles.h里的TILE_SIZE、dispatchCommands一致
+	static const uint32_t LightingTileSize = 16;
+	static const uint32_t LightingClassCount = static_cast<uint32_t>(DeferredLightingClass::Count);
+	static const VkDeviceSize LightingTileCommandStride = sizeof(uint32_t) * 4;
+
 	void DeferredRenderPass::init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData)
 	{
 		VulkanRenderPass::init(vulkanRender, sceneData);
 
+		// 和分簇一样录制在图形队列里，图形队列不支持compute时仍然用subpass
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(vulkanRender->physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(vulkanRender->physicalDevice, &queueFamilyCount, queueFamilies.data());
+		bool computeSupported = (queueFamilies[vulkanRender->queueIndices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+		computeLighting = sceneData->computeDeferredLighting && computeSupported;
+		LOG_INFO("deferred lighting: {}", computeLighting ? "compute" : "subpass");
+
 		descriptorInfos.resize(2);
 
 		setupAttachments();
+		setupLightingTileBuffer();
 		setupDescriptorSetLayout();
 		setupDescriptorSet();
 		setupRenderPass();
@@ -24,9 +40,19 @@ namespace VulkanEngine
 
 	}
 
-	void DeferredRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize)
+	void DeferredRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+	{
+		vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	}
+
+	void DeferredRenderPass::drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+	}
+
+	void DeferredRenderPass::drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
 	{
-		vkCmdDrawIndexed(commandBuffer, indexSize, 1, 0, 0, 0);
+		vulkanRender->cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
 	}
 
 	void DeferredRenderPass::draw(VkCommandBuffer commandBuffer, uint32_t vertexSize)
@@ -34,44 +60,180 @@ namespace VulkanEngine
 		vkCmdDraw(commandBuffer, vertexSize, 1, 0, 0);
 	}
 
+	void DeferredRenderPass::drawLighting(VkCommandBuffer commandBuffer, float shadowRangeDepth)
+	{
+		// 全屏三角形放在这个深度上，和gbuffer的深度比较
+		// 天空：深度等于清屏值1；有阴影：深度不超过shadowRangeDepth；没有阴影：其余的，天空在shader里丢弃
+		// 只看深度，不看法线，背光但在级联以内的像素仍然走有阴影的管线
+		std::array<float, static_cast<size_t>(DeferredLightingClass::Count)> classDepths = { 1.0f, shadowRangeDepth, shadowRangeDepth };
+		for (size_t i = 0; i < lightingPipelines.size(); i++)
+		{
+			vulkanRender->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipelines[i]);
+			vkCmdPushConstants(commandBuffer, renderPipelines[1].layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float), &classDepths[i]);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+		}
+	}
+
+	void DeferredRenderPass::dispatchLighting(VkCommandBuffer commandBuffer)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = frameBuffers[0].attachments[3].image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.layerCount = 1;
+
+		// 上一帧的FXAA读完之后才能覆盖，旧的内容不需要保留
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		// 上一帧的间接dispatch读完之后才能重置tile的计数
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = 0;
+		memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		std::array<uint32_t, LightingClassCount * 4> dispatchCommands = {};
+		for (uint32_t i = 0; i < LightingClassCount; i++)
+		{
+			dispatchCommands[i * 4 + 1] = 1;
+			dispatchCommands[i * 4 + 2] = 1;
+		}
+		vkCmdUpdateBuffer(commandBuffer, lightingTileBuffer, 0, sizeof(dispatchCommands), dispatchCommands.data());
+
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		// gbuffer和深度的可见性由gbuffer renderPass结束时的dependency保证
+		uint32_t width = vulkanRender->swapChainExtent.width;
+		uint32_t height = vulkanRender->swapChainExtent.height;
+		vulkanRender->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tileClassifyPipeline);
+		vkCmdDispatch(commandBuffer, (width + LightingTileSize - 1) / LightingTileSize, (height + LightingTileSize - 1) / LightingTileSize, 1);
+
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		// 每类只dispatch分到这一类的tile，没有的类x为0
+		for (uint32_t i = 0; i < LightingClassCount; i++)
+		{
+			vulkanRender->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightingPipelines[i]);
+			vkCmdDispatchIndirect(commandBuffer, lightingTileBuffer, LightingTileCommandStride * i);
+		}
+
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	VkFramebuffer DeferredRenderPass::getGBufferFrameBuffer(uint32_t swapChainImageIndex) const
+	{
+		return computeLighting ? frameBuffers[0].frameBuffer : swapChainFrameBuffers[swapChainImageIndex];
+	}
+
+	VkRenderPass DeferredRenderPass::getPostRenderPass() const
+	{
+		return computeLighting ? postRenderPass : renderPass;
+	}
+
+	uint32_t DeferredRenderPass::getPostSubpass() const
+	{
+		return computeLighting ? 0 : 2;
+	}
+
 	void DeferredRenderPass::clear()
 	{
-		vkQueueWaitIdle(vulkanRender->graphicsQueue);
-		for (const auto& frameBuffer : frameBuffers)
+		// 交换链重建时也会调用，资源可能还在被inflight的帧使用，交给延迟销毁队列
+		auto& deletionQueue = vulkanRender->deletionQueue;
+		VkDevice device = vulkanRender->device;
+
+		for (auto& frameBuffer : frameBuffers)
 		{
-			for (const auto& attachment : frameBuffer.attachments)
+			if (frameBuffer.frameBuffer != VK_NULL_HANDLE)
+			{
+				deletionQueue.destroyFramebuffer(frameBuffer.frameBuffer);
+			}
+			for (auto& attachment : frameBuffer.attachments)
 			{
-				vkDestroyImage(vulkanRender->device, attachment.image, nullptr);
-				vkDestroyImageView(vulkanRender->device, attachment.imageView, nullptr);
-				vkFreeMemory(vulkanRender->device, attachment.memory, nullptr);
+				deletionQueue.destroyImage(attachment.image);
+				deletionQueue.destroyImageView(attachment.imageView);
+				deletionQueue.freeMemory(attachment.memory);
 			}
 		}
 		frameBuffers.clear();
 
 		for (const auto& frameBuffer : swapChainFrameBuffers)
 		{
-			vkDestroyFramebuffer(vulkanRender->device, frameBuffer, nullptr);
+			deletionQueue.destroyFramebuffer(frameBuffer);
 		}
 		swapChainFrameBuffers.clear();
 
 		for (uint32_t i = 0; i < renderPipelines.size(); i++)
 		{
-			vkDestroyPipeline(vulkanRender->device, renderPipelines[i].pipeline, nullptr);
-			vkDestroyPipelineLayout(vulkanRender->device, renderPipelines[i].layout, nullptr);
+			VkPipeline pipeline = renderPipelines[i].pipeline;
+			VkPipelineLayout layout = renderPipelines[i].layout;
+			deletionQueue.push([device, pipeline, layout]() {
+				vkDestroyPipeline(device, pipeline, nullptr);
+				vkDestroyPipelineLayout(device, layout, nullptr);
+			});
 		}
 		renderPipelines.clear();
 
+		// Shadowed类已经作为renderPipelines[1]销毁
+		for (size_t i = 0; i < lightingPipelines.size(); i++)
+		{
+			VkPipeline pipeline = lightingPipelines[i];
+			if (i != static_cast<size_t>(DeferredLightingClass::Shadowed) && pipeline != VK_NULL_HANDLE)
+			{
+				deletionQueue.push([device, pipeline]() { vkDestroyPipeline(device, pipeline, nullptr); });
+			}
+		}
+		lightingPipelines = {};
+
+		if (tileClassifyPipeline != VK_NULL_HANDLE)
+		{
+			VkPipeline pipeline = tileClassifyPipeline;
+			deletionQueue.push([device, pipeline]() { vkDestroyPipeline(device, pipeline, nullptr); });
+			tileClassifyPipeline = VK_NULL_HANDLE;
+		}
+
+		if (lightingTileBuffer != VK_NULL_HANDLE)
+		{
+			deletionQueue.destroyBuffer(lightingTileBuffer);
+			deletionQueue.freeMemory(lightingTileMemory);
+			lightingTileBuffer = VK_NULL_HANDLE;
+			lightingTileMemory = VK_NULL_HANDLE;
+		}
+
 		for (uint32_t i = 0; i < descriptorInfos.size(); i++)
 		{
-			vkDestroyDescriptorSetLayout(vulkanRender->device, descriptorInfos[i].layout, nullptr);
-			vkFreeDescriptorSets(vulkanRender->device, vulkanRender->descriptorPool, 1, &descriptorInfos[i].descriptorSet);
+			VkDescriptorSetLayout layout = descriptorInfos[i].layout;
+			deletionQueue.push([device, layout]() { vkDestroyDescriptorSetLayout(device, layout, nullptr); });
+			deletionQueue.freeDescriptorSet(descriptorInfos[i].descriptorSet);
 		}
 
 		descriptorInfos.clear();
 
-		vkDestroyRenderPass(vulkanRender->device, renderPass, nullptr);
+		VkRenderPass oldRenderPass = renderPass;
+		deletionQueue.push([device, oldRenderPass]() { vkDestroyRenderPass(device, oldRenderPass, nullptr); });
+
+		if (postRenderPass != VK_NULL_HANDLE)
+		{
+			VkRenderPass oldPostRenderPass = postRenderPass;
+			deletionQueue.push([device, oldPostRenderPass]() { vkDestroyRenderPass(device, oldPostRenderPass, nullptr); });
+		}
 
 		renderPass = nullptr;
+		postRenderPass = VK_NULL_HANDLE;
 	}
 
 	void DeferredRenderPass::recreate()
@@ -81,6 +243,7 @@ namespace VulkanEngine
 		descriptorInfos.resize(2);
 
 		setupAttachments();
+		setupLightingTileBuffer();
 		setupDescriptorSetLayout();
 		setupDescriptorSet();
 		setupRenderPass();
@@ -91,48 +254,108 @@ namespace VulkanEngine
 	void DeferredRenderPass::setupAttachments()
 	{
 		frameBuffers.resize(1);
-		// 分别为normal，材质相关系数，baseColor，后处理奇偶数image
+		// 分别为normal，材质相关系数，baseColor，后处理奇偶数image，compute光照时后两个是光照结果和深度
 		frameBuffers[0].attachments.resize(5);
 		
 		auto& mainFrameBuffer = frameBuffers[0];
 
-		mainFrameBuffer.attachments[0].format = VK_FORMAT_R8G8B8A8_UNORM;
-		mainFrameBuffer.attachments[1].format = VK_FORMAT_R8G8B8A8_UNORM;
-		mainFrameBuffer.attachments[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+		// 每个通道的含义见shaders/gbufferEncoding.h，三种格式作为颜色附件都是必须支持的
+		mainFrameBuffer.attachments[0].format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;	// 八面体法线，切线角度，shadingModelID
+		mainFrameBuffer.attachments[1].format = VK_FORMAT_R8G8_UNORM;				// roughness，specular
+		mainFrameBuffer.attachments[2].format = VK_FORMAT_R8G8B8A8_UNORM;			// baseColor，metallic
 
-		mainFrameBuffer.attachments[3].format = VK_FORMAT_R8G8B8A8_UNORM;
-		mainFrameBuffer.attachments[4].format = VK_FORMAT_R8G8B8A8_UNORM;
+		if (computeLighting)
+		{
+			mainFrameBuffer.attachments[3].format = VK_FORMAT_R16G16B16A16_SFLOAT;		// storage image必须支持的浮点格式
+			mainFrameBuffer.attachments[4].format = vulkanRender->depthImageFormat;		// 渲染器的深度是transient的，compute读不到
+		}
+		else
+		{
+			mainFrameBuffer.attachments[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+			mainFrameBuffer.attachments[4].format = VK_FORMAT_R8G8B8A8_UNORM;
+		}
 
 		uint32_t width = vulkanRender->swapChainExtent.width;
 		uint32_t height = vulkanRender->swapChainExtent.height;
 
+		// gbuffer和深度只在renderpass内作为input attachment，post0要给FXAA采样
+		std::array<bool, 5> transient = { true, true, true, false, true };
+		if (computeLighting)
+		{
+			// gbuffer和深度在renderPass之外给compute读，光照结果给FXAA采样
+			transient.fill(false);
+		}
+		const std::array<VkImageUsageFlags, 5> computeLightingUsages = {
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+
 		// TODO:VK_IMAGE_USAGE_TRANSFER_SRC_BIT
 		for (size_t i = 0; i < mainFrameBuffer.attachments.size(); i++)
 		{
 			VkImageUsageFlags usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;	// 后续pass，image会作为输入
-			if (i > 2)
+			if (computeLighting)
+			{
+				usage = computeLightingUsages[i] | VK_IMAGE_USAGE_SAMPLED_BIT;
+			}
+			else if (transient[i])
+			{
+				usage |= vulkanRender->getTransientAttachmentUsage();
+			}
+			else
 			{
-				usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;	// 给post采样
+				usage |= VK_IMAGE_USAGE_SAMPLED_BIT;	// 给post采样
 			}
+			// 支持lazily allocated时transient attachment基本不占显存
+			VkMemoryPropertyFlags memoryProperty = (transient[i] && !computeLighting) ? vulkanRender->getTransientAttachmentMemoryProperty() : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 			vulkanRender->createImage(width, height, mainFrameBuffer.attachments[i].format,
 				VK_IMAGE_TILING_OPTIMAL,
-				usage,			
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				usage,
+				memoryProperty,
 				mainFrameBuffer.attachments[i].image,
 				mainFrameBuffer.attachments[i].memory,
-				0, 1, 1);
+				0, 1, 1, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::RenderTarget);
+		}
 
+		for (size_t i = 0; i < mainFrameBuffer.attachments.size(); i++)
+		{
+			VkImageAspectFlags aspect = (computeLighting && i == 4) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 			mainFrameBuffer.attachments[i].imageView = vulkanRender->createImageView(mainFrameBuffer.attachments[i].image,
 				mainFrameBuffer.attachments[i].format,
-				VK_IMAGE_ASPECT_COLOR_BIT,
+				aspect,
 				VK_IMAGE_VIEW_TYPE_2D,
 				1,
 				1);
 		}
 	}
 
+	void DeferredRenderPass::setupLightingTileBuffer()
+	{
+		if (!computeLighting)
+		{
+			return;
+		}
+
+		// 每类一个间接dispatch的参数，后面每类一段能放下整屏tile的列表
+		uint32_t tilesX = (vulkanRender->swapChainExtent.width + LightingTileSize - 1) / LightingTileSize;
+		uint32_t tilesY = (vulkanRender->swapChainExtent.height + LightingTileSize - 1) / LightingTileSize;
+		VkDeviceSize size = LightingTileCommandStride * LightingClassCount + sizeof(uint32_t) * LightingClassCount * tilesX * tilesY;
+
+		vulkanRender->createBuffer(size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			lightingTileBuffer,
+			lightingTileMemory,
+			MemoryCategory::RenderTarget);
+	}
+
 	void DeferredRenderPass::setupRenderPass()
 	{
+		if (computeLighting)
+		{
+			setupComputeLightingRenderPasses();
+			return;
+		}
+
 		auto& mainFrameBuffer = frameBuffers[0];
 
 		// attachments
@@ -143,7 +366,7 @@ namespace VulkanEngine
 			gbufferNormalAttachmentDescription.format = mainFrameBuffer.attachments[0].format;
 			gbufferNormalAttachmentDescription.samples = vulkanRender->msaaSamples;
 			gbufferNormalAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			gbufferNormalAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;		// TODO:STORE
+			gbufferNormalAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;		// gbuffer只在renderpass内使用
 			gbufferNormalAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 			gbufferNormalAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 			gbufferNormalAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -163,7 +386,7 @@ namespace VulkanEngine
 			gbufferAlbedoAttachmentDescription.format = mainFrameBuffer.attachments[2].format;
 			gbufferAlbedoAttachmentDescription.samples = vulkanRender->msaaSamples;
 			gbufferAlbedoAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			gbufferAlbedoAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			gbufferAlbedoAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 			gbufferAlbedoAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 			gbufferAlbedoAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 			gbufferAlbedoAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -173,7 +396,7 @@ namespace VulkanEngine
 			depthAttachmentDescription.format = vulkanRender->depthImageFormat;
 			depthAttachmentDescription.samples = vulkanRender->msaaSamples;
 			depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;	// TODO:STORE
+			depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 			depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 			depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 			depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -256,8 +479,13 @@ namespace VulkanEngine
 			deferredLightingPassInputAttachementReference[2].attachment = 2;
 			deferredLightingPassInputAttachementReference[2].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
+			// 深度同时是input attachment和只读的深度附件，两处的layout要一致
 			deferredLightingPassInputAttachementReference[3].attachment = 3;
-			deferredLightingPassInputAttachementReference[3].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			deferredLightingPassInputAttachementReference[3].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+			VkAttachmentReference deferredLightingDepthAttachmentReference = {};
+			deferredLightingDepthAttachmentReference.attachment = 3;
+			deferredLightingDepthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
 			deferredLightingPassOutputColorAttachmentReference[0].attachment = 4;
 			deferredLightingPassOutputColorAttachmentReference[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -268,7 +496,7 @@ namespace VulkanEngine
 			deferredLighting.pInputAttachments = deferredLightingPassInputAttachementReference.data();
 			deferredLighting.colorAttachmentCount = deferredLightingPassOutputColorAttachmentReference.size();
 			deferredLighting.pColorAttachments = deferredLightingPassOutputColorAttachmentReference.data();
-			deferredLighting.pDepthStencilAttachment = nullptr;			// 以从之前的pass读取，不需要深度操作
+			deferredLighting.pDepthStencilAttachment = &deferredLightingDepthAttachmentReference;		// 只做深度测试给像素分类，不写入
 			deferredLighting.preserveAttachmentCount = 0;
 			deferredLighting.pPreserveAttachments = nullptr;
 
@@ -293,8 +521,8 @@ namespace VulkanEngine
 			VkSubpassDependency& deferredLightingDependOnShadowMapPass = dependencies[0];
 			deferredLightingDependOnShadowMapPass.srcSubpass = VK_SUBPASS_EXTERNAL;
 			deferredLightingDependOnShadowMapPass.dstSubpass = 1;
-			deferredLightingDependOnShadowMapPass.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			deferredLightingDependOnShadowMapPass.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			deferredLightingDependOnShadowMapPass.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			deferredLightingDependOnShadowMapPass.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 			deferredLightingDependOnShadowMapPass.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 			deferredLightingDependOnShadowMapPass.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 			deferredLightingDependOnShadowMapPass.dependencyFlags = 0;
@@ -302,10 +530,10 @@ namespace VulkanEngine
 			VkSubpassDependency& deferredLightingDependOnGbufferPass = dependencies[1];
 			deferredLightingDependOnGbufferPass.srcSubpass = 0;
 			deferredLightingDependOnGbufferPass.dstSubpass = 1;
-			deferredLightingDependOnGbufferPass.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			deferredLightingDependOnGbufferPass.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			deferredLightingDependOnGbufferPass.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-			deferredLightingDependOnGbufferPass.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;				// TODO
+			deferredLightingDependOnGbufferPass.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			deferredLightingDependOnGbufferPass.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			deferredLightingDependOnGbufferPass.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			deferredLightingDependOnGbufferPass.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
 			deferredLightingDependOnGbufferPass.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 			VkSubpassDependency& postFXAADependOnDeferrdLighting = dependencies[2];
@@ -338,6 +566,131 @@ namespace VulkanEngine
 		VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &renderPass));
 	}
 
+	void DeferredRenderPass::setupComputeLightingRenderPasses()
+	{
+		auto& mainFrameBuffer = frameBuffers[0];
+
+		// gbuffer
+		{
+			// 0.normal 1.MR 2.albedo 3.depth，结束时都存下来给compute采样
+			const std::array<uint32_t, 4> imageIndices = { 0, 1, 2, 4 };
+			std::array<VkAttachmentDescription, 4> attachments = {};
+			for (size_t i = 0; i < attachments.size(); i++)
+			{
+				attachments[i].format = mainFrameBuffer.attachments[imageIndices[i]].format;
+				attachments[i].samples = vulkanRender->msaaSamples;
+				attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+				attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+				attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			}
+			attachments[3].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+			std::array<VkAttachmentReference, 3> gbufferAttachmentReference = {};
+			for (uint32_t i = 0; i < gbufferAttachmentReference.size(); i++)
+			{
+				gbufferAttachmentReference[i].attachment = i;
+				gbufferAttachmentReference[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			}
+
+			VkAttachmentReference depthAttachmentReference = {};
+			depthAttachmentReference.attachment = 3;
+			depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+			VkSubpassDescription gbufferPass = {};
+			gbufferPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			gbufferPass.colorAttachmentCount = gbufferAttachmentReference.size();
+			gbufferPass.pColorAttachments = gbufferAttachmentReference.data();
+			gbufferPass.pDepthStencilAttachment = &depthAttachmentReference;
+
+			std::array<VkSubpassDependency, 2> dependencies = {};
+
+			VkSubpassDependency& gbufferDependOnLastLighting = dependencies[0];
+			gbufferDependOnLastLighting.srcSubpass = VK_SUBPASS_EXTERNAL;
+			gbufferDependOnLastLighting.dstSubpass = 0;
+			gbufferDependOnLastLighting.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;			// 上一帧的光照还在读gbuffer
+			gbufferDependOnLastLighting.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			gbufferDependOnLastLighting.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			gbufferDependOnLastLighting.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			gbufferDependOnLastLighting.dependencyFlags = 0;
+
+			VkSubpassDependency& lightingDependOnGbuffer = dependencies[1];
+			lightingDependOnGbuffer.srcSubpass = 0;
+			lightingDependOnGbuffer.dstSubpass = VK_SUBPASS_EXTERNAL;
+			lightingDependOnGbuffer.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			lightingDependOnGbuffer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			lightingDependOnGbuffer.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;				// gbuffer写完，compute才能读
+			lightingDependOnGbuffer.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			lightingDependOnGbuffer.dependencyFlags = 0;
+
+			VkRenderPassCreateInfo renderPassCI = {};
+			renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassCI.attachmentCount = attachments.size();
+			renderPassCI.pAttachments = attachments.data();
+			renderPassCI.subpassCount = 1;
+			renderPassCI.pSubpasses = &gbufferPass;
+			renderPassCI.dependencyCount = dependencies.size();
+			renderPassCI.pDependencies = dependencies.data();
+
+			VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &renderPass));
+		}
+
+		// FXAA，光照结果在compute之后用barrier转换成采样的layout
+		{
+			VkAttachmentDescription swapChainImageAttachmentDescription = {};
+			swapChainImageAttachmentDescription.format = vulkanRender->swapChainImageFormat;
+			swapChainImageAttachmentDescription.samples = vulkanRender->msaaSamples;
+			swapChainImageAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;		// 全屏三角形覆盖所有像素
+			swapChainImageAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			swapChainImageAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			swapChainImageAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			swapChainImageAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			swapChainImageAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+			VkAttachmentReference lastOutputColorAttachmentReference = {};
+			lastOutputColorAttachmentReference.attachment = 0;
+			lastOutputColorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+			VkSubpassDescription postFXAA = {};
+			postFXAA.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			postFXAA.colorAttachmentCount = 1;
+			postFXAA.pColorAttachments = &lastOutputColorAttachmentReference;
+
+			std::array<VkSubpassDependency, 2> dependencies = {};
+
+			VkSubpassDependency& postFXAADependOnAcquire = dependencies[0];
+			postFXAADependOnAcquire.srcSubpass = VK_SUBPASS_EXTERNAL;
+			postFXAADependOnAcquire.dstSubpass = 0;
+			postFXAADependOnAcquire.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;		// 交换链image可用之后才能写
+			postFXAADependOnAcquire.srcAccessMask = 0;
+			postFXAADependOnAcquire.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			postFXAADependOnAcquire.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			postFXAADependOnAcquire.dependencyFlags = 0;
+
+			VkSubpassDependency& presentDependOnLastPass = dependencies[1];
+			presentDependOnLastPass.srcSubpass = 0;
+			presentDependOnLastPass.dstSubpass = VK_SUBPASS_EXTERNAL;
+			presentDependOnLastPass.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			presentDependOnLastPass.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			presentDependOnLastPass.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+			presentDependOnLastPass.dstAccessMask = 0;
+			presentDependOnLastPass.dependencyFlags = 0;
+
+			VkRenderPassCreateInfo renderPassCI = {};
+			renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassCI.attachmentCount = 1;
+			renderPassCI.pAttachments = &swapChainImageAttachmentDescription;
+			renderPassCI.subpassCount = 1;
+			renderPassCI.pSubpasses = &postFXAA;
+			renderPassCI.dependencyCount = dependencies.size();
+			renderPassCI.pDependencies = dependencies.data();
+
+			VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &postRenderPass));
+		}
+	}
+
 	void DeferredRenderPass::setupFrameBuffers()
 	{
 		const std::vector<VkImageView>& imageViews = vulkanRender->swapChainImageViews;
@@ -348,23 +701,57 @@ namespace VulkanEngine
 
 		VkFormat format = vulkanRender->swapChainImageFormat;
 
-		for (size_t i = 0; i < swapChainFrameBuffers.size(); i++)
+		// compute光照时gbuffer的framebuffer和交换链无关，只有一个
+		if (computeLighting)
 		{
-			std::array<VkImageView, 7> frameAttachments =
+			std::array<VkImageView, 4> gbufferAttachments =
 			{
 				frameBuffers[0].attachments[0].imageView,
 				frameBuffers[0].attachments[1].imageView,
 				frameBuffers[0].attachments[2].imageView,
-				vulkanRender->depthImageView,
-				frameBuffers[0].attachments[3].imageView,
-				frameBuffers[0].attachments[4].imageView,
-				vulkanRender->swapChainImageViews[i]
+				frameBuffers[0].attachments[4].imageView
 			};
 
 			VkFramebufferCreateInfo frameBufferCI = {};
 			frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 			frameBufferCI.flags = 0;
 			frameBufferCI.renderPass = renderPass;
+			frameBufferCI.attachmentCount = gbufferAttachments.size();
+			frameBufferCI.pAttachments = gbufferAttachments.data();
+			frameBufferCI.width = swapChainWidth;
+			frameBufferCI.height = swapChainHeight;
+			frameBufferCI.layers = 1;
+
+			VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRender->device, &frameBufferCI, nullptr, &frameBuffers[0].frameBuffer));
+			frameBuffers[0].width = swapChainWidth;
+			frameBuffers[0].height = swapChainHeight;
+		}
+
+		for (size_t i = 0; i < swapChainFrameBuffers.size(); i++)
+		{
+			std::vector<VkImageView> frameAttachments;
+			if (computeLighting)
+			{
+				frameAttachments = { vulkanRender->swapChainImageViews[i] };
+			}
+			else
+			{
+				frameAttachments =
+				{
+					frameBuffers[0].attachments[0].imageView,
+					frameBuffers[0].attachments[1].imageView,
+					frameBuffers[0].attachments[2].imageView,
+					vulkanRender->depthImageView,
+					frameBuffers[0].attachments[3].imageView,
+					frameBuffers[0].attachments[4].imageView,
+					vulkanRender->swapChainImageViews[i]
+				};
+			}
+
+			VkFramebufferCreateInfo frameBufferCI = {};
+			frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			frameBufferCI.flags = 0;
+			frameBufferCI.renderPass = getPostRenderPass();
 			frameBufferCI.attachmentCount = frameAttachments.size();
 			frameBufferCI.pAttachments = frameAttachments.data();
 			frameBufferCI.width = swapChainWidth;
@@ -396,11 +783,8 @@ namespace VulkanEngine
 			auto bindingDescriptions = Vertex::getBindingDescriptions();
 			auto attributeDescriptions = Vertex::getAttributeDescriptions();
 
-			std::vector<VkDynamicState> dynamicStates =
-			{
-				VK_DYNAMIC_STATE_VIEWPORT,
-				VK_DYNAMIC_STATE_SCISSOR
-			};
+			// 视口随交换链重建管线，不用动态状态
+			std::vector<VkDynamicState> dynamicStates;
 
 			std::array<VkPipelineColorBlendAttachmentState, 3> colorBlendAttachmentState = {};
 			colorBlendAttachmentState[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -423,7 +807,27 @@ namespace VulkanEngine
 				dynamicStates, 3, colorBlendAttachmentState.data(), true, true);
 		}
 
+		// 阴影过滤的specialization后面加上像素分类，constant_id为3
+		struct LightingConstants
+		{
+			ShadowFilterConstants shadowFilter;
+			int32_t lightingClass;
+		} lightingConstants;
+
+		const VkSpecializationInfo* shadowFilterSpecializationInfo = sceneData->getShadowFilterSpecializationInfo();
+		lightingConstants.shadowFilter = *static_cast<const ShadowFilterConstants*>(shadowFilterSpecializationInfo->pData);
+
+		std::vector<VkSpecializationMapEntry> mapEntries(shadowFilterSpecializationInfo->pMapEntries, shadowFilterSpecializationInfo->pMapEntries + shadowFilterSpecializationInfo->mapEntryCount);
+		mapEntries.push_back({ 3, offsetof(LightingConstants, lightingClass), sizeof(int32_t) });
+
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+		specializationInfo.pMapEntries = mapEntries.data();
+		specializationInfo.dataSize = sizeof(LightingConstants);
+		specializationInfo.pData = &lightingConstants;
+
 		// lighting
+		if (computeLighting)
 		{
 			std::array<VkDescriptorSetLayout, 4> descriptorSetLayout = { sceneData->directionalLightShadowDescriptor.layout, descriptorInfos[0].layout, sceneData->deferredUniformDescriptor.layout, sceneData->IBLDescriptor.layout };
 			VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
@@ -433,6 +837,35 @@ namespace VulkanEngine
 
 			VK_CHECK_RESULT(vkCreatePipelineLayout(vulkanRender->device, &pipelineLayoutCI, nullptr, &renderPipelines[1].layout));
 
+			// 分类只读gbuffer、深度和级联，和光照共用layout，绑定一次descriptorSet两边都能用
+			tileClassifyPipeline = VulkanPipeline::createComputePipeline(vulkanRender, renderPipelines[1].layout, sceneData->deferredTileClassifyCSFilePath, shadowFilterSpecializationInfo);
+
+			for (size_t i = 0; i < lightingPipelines.size(); i++)
+			{
+				lightingConstants.lightingClass = static_cast<int32_t>(i);
+				lightingPipelines[i] = VulkanPipeline::createComputePipeline(vulkanRender, renderPipelines[1].layout, sceneData->deferredLightingCSFilePath, &specializationInfo);
+			}
+			renderPipelines[1].pipeline = lightingPipelines[static_cast<size_t>(DeferredLightingClass::Shadowed)];
+		}
+		else
+		{
+			std::array<VkDescriptorSetLayout, 4> descriptorSetLayout = { sceneData->directionalLightShadowDescriptor.layout, descriptorInfos[0].layout, sceneData->deferredUniformDescriptor.layout, sceneData->IBLDescriptor.layout };
+
+			// 全屏三角形的深度
+			VkPushConstantRange pushConstantRange = {};
+			pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+			pushConstantRange.offset = 0;
+			pushConstantRange.size = sizeof(float);
+
+			VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+			pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+			pipelineLayoutCI.setLayoutCount = descriptorSetLayout.size();
+			pipelineLayoutCI.pSetLayouts = descriptorSetLayout.data();
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+
+			VK_CHECK_RESULT(vkCreatePipelineLayout(vulkanRender->device, &pipelineLayoutCI, nullptr, &renderPipelines[1].layout));
+
 			auto vertShaderCode = VulkanUtil::readFile(sceneData->deferredLightingVSFilePath);
 			auto fragShaderCode = VulkanUtil::readFile(sceneData->deferredLightingFSFilePath);
 
@@ -445,15 +878,25 @@ namespace VulkanEngine
 			colorBlendAttachmentState[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 			colorBlendAttachmentState[0].blendEnable = VK_FALSE;
 
-			VulkanPipeline::createPipeline(vulkanRender, renderPipelines[1].pipeline,
-				renderPipelines[1].layout,
-				vertShaderCode, fragShaderCode,
-				vertexBindingDescriptions, vertexAttributeDescriptions,
-				renderPass,
-				1,
-				vulkanRender->viewport, vulkanRender->scissor,
-				vulkanRender->msaaSamples,
-				dynamicStates, 1, colorBlendAttachmentState.data(), false, false);
+			// gbuffer读不到，只能按深度分类，见DeferredLightingClass
+			const std::array<VkCompareOp, static_cast<size_t>(DeferredLightingClass::Count)> depthCompareOps = { VK_COMPARE_OP_EQUAL, VK_COMPARE_OP_LESS, VK_COMPARE_OP_GREATER_OR_EQUAL };
+			for (size_t i = 0; i < lightingPipelines.size(); i++)
+			{
+				lightingConstants.lightingClass = static_cast<int32_t>(i);
+
+				// 只测试不写入
+				VulkanPipeline::createPipeline(vulkanRender, lightingPipelines[i],
+					renderPipelines[1].layout,
+					vertShaderCode, fragShaderCode,
+					vertexBindingDescriptions, vertexAttributeDescriptions,
+					renderPass,
+					1,
+					vulkanRender->viewport, vulkanRender->scissor,
+					vulkanRender->msaaSamples,
+					dynamicStates, 1, colorBlendAttachmentState.data(), true, false,
+					0.0f, 0.0f, &specializationInfo, depthCompareOps[i]);
+			}
+			renderPipelines[1].pipeline = lightingPipelines[static_cast<size_t>(DeferredLightingClass::Shadowed)];
 		}
 		// fxaa
 		{
@@ -481,8 +924,8 @@ namespace VulkanEngine
 				renderPipelines[2].layout,
 				vertShaderCode, fragShaderCode,
 				vertexBindingDescriptions, vertexAttributeDescriptions,
-				renderPass,
-				2,
+				getPostRenderPass(),
+				getPostSubpass(),
 				vulkanRender->viewport, vulkanRender->scissor,
 				vulkanRender->msaaSamples,
 				dynamicStates, 1, colorBlendAttachmentState.data(), false, false);
@@ -491,39 +934,65 @@ namespace VulkanEngine
 
 	void DeferredRenderPass::setupDescriptorSetLayout()
 	{
-		std::array<VkDescriptorSetLayoutBinding, 4> gbufferDeferredLightingSetLayoutBinding = {};
-
-		VkDescriptorSetLayoutBinding& gbufferNoramlSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[0];
-		gbufferNoramlSetLayoutBinding.binding = 0;
-		gbufferNoramlSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		gbufferNoramlSetLayoutBinding.descriptorCount = 1;
-		gbufferNoramlSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-		VkDescriptorSetLayoutBinding& gbufferMRSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[1];
-		gbufferMRSetLayoutBinding.binding = 1;
-		gbufferMRSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		gbufferMRSetLayoutBinding.descriptorCount = 1;
-		gbufferMRSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-		VkDescriptorSetLayoutBinding& gbufferAlbedoSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[2];
-		gbufferAlbedoSetLayoutBinding.binding = 2;
-		gbufferAlbedoSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		gbufferAlbedoSetLayoutBinding.descriptorCount = 1;
-		gbufferAlbedoSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-		VkDescriptorSetLayoutBinding& depthSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[3];
-		depthSetLayoutBinding.binding = 3;
-		depthSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		depthSetLayoutBinding.descriptorCount = 1;
-		depthSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-		VkDescriptorSetLayoutCreateInfo gbufferDeferredLightingSetLayoutCI = {};
-		gbufferDeferredLightingSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		gbufferDeferredLightingSetLayoutCI.pNext = nullptr;
-		gbufferDeferredLightingSetLayoutCI.bindingCount = gbufferDeferredLightingSetLayoutBinding.size();
-		gbufferDeferredLightingSetLayoutCI.pBindings = gbufferDeferredLightingSetLayoutBinding.data();
-
-		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRender->device, &gbufferDeferredLightingSetLayoutCI, nullptr, &descriptorInfos[0].layout));
+		if (computeLighting)
+		{
+			// gbuffer和深度采样读取，光照结果写进storage image，tile分类的结果在storage buffer里
+			std::array<VkDescriptorSetLayoutBinding, 6> computeLightingSetLayoutBinding = {};
+			const std::array<VkDescriptorType, 6> computeLightingDescriptorTypes = {
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+			for (uint32_t i = 0; i < computeLightingSetLayoutBinding.size(); i++)
+			{
+				computeLightingSetLayoutBinding[i].binding = i;
+				computeLightingSetLayoutBinding[i].descriptorType = computeLightingDescriptorTypes[i];
+				computeLightingSetLayoutBinding[i].descriptorCount = 1;
+				computeLightingSetLayoutBinding[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			}
+
+			VkDescriptorSetLayoutCreateInfo computeLightingSetLayoutCI = {};
+			computeLightingSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			computeLightingSetLayoutCI.pNext = nullptr;
+			computeLightingSetLayoutCI.bindingCount = computeLightingSetLayoutBinding.size();
+			computeLightingSetLayoutCI.pBindings = computeLightingSetLayoutBinding.data();
+
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRender->device, &computeLightingSetLayoutCI, nullptr, &descriptorInfos[0].layout));
+		}
+		else
+		{
+			std::array<VkDescriptorSetLayoutBinding, 4> gbufferDeferredLightingSetLayoutBinding = {};
+
+			VkDescriptorSetLayoutBinding& gbufferNoramlSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[0];
+			gbufferNoramlSetLayoutBinding.binding = 0;
+			gbufferNoramlSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			gbufferNoramlSetLayoutBinding.descriptorCount = 1;
+			gbufferNoramlSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+			VkDescriptorSetLayoutBinding& gbufferMRSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[1];
+			gbufferMRSetLayoutBinding.binding = 1;
+			gbufferMRSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			gbufferMRSetLayoutBinding.descriptorCount = 1;
+			gbufferMRSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+			VkDescriptorSetLayoutBinding& gbufferAlbedoSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[2];
+			gbufferAlbedoSetLayoutBinding.binding = 2;
+			gbufferAlbedoSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			gbufferAlbedoSetLayoutBinding.descriptorCount = 1;
+			gbufferAlbedoSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+			VkDescriptorSetLayoutBinding& depthSetLayoutBinding = gbufferDeferredLightingSetLayoutBinding[3];
+			depthSetLayoutBinding.binding = 3;
+			depthSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			depthSetLayoutBinding.descriptorCount = 1;
+			depthSetLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+			VkDescriptorSetLayoutCreateInfo gbufferDeferredLightingSetLayoutCI = {};
+			gbufferDeferredLightingSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			gbufferDeferredLightingSetLayoutCI.pNext = nullptr;
+			gbufferDeferredLightingSetLayoutCI.bindingCount = gbufferDeferredLightingSetLayoutBinding.size();
+			gbufferDeferredLightingSetLayoutCI.pBindings = gbufferDeferredLightingSetLayoutBinding.data();
+
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRender->device, &gbufferDeferredLightingSetLayoutCI, nullptr, &descriptorInfos[0].layout));
+		}
 
 		std::array<VkDescriptorSetLayoutBinding, 1> postFXAASetLayoutBinding = {};
 		VkDescriptorSetLayoutBinding& postFXAAInputSetLayoutBinding = postFXAASetLayoutBinding[0];
@@ -544,15 +1013,53 @@ namespace VulkanEngine
 	void DeferredRenderPass::setupDescriptorSet()
 	{
 		// deferredLighting
+		if (computeLighting)
 		{
-			VkDescriptorSetAllocateInfo gbufferLightDescriptorSetAllocateInfo = {};
-			gbufferLightDescriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			gbufferLightDescriptorSetAllocateInfo.pNext = nullptr;
-			gbufferLightDescriptorSetAllocateInfo.descriptorPool = vulkanRender->descriptorPool;
-			gbufferLightDescriptorSetAllocateInfo.descriptorSetCount = 1;
-			gbufferLightDescriptorSetAllocateInfo.pSetLayouts = &descriptorInfos[0].layout;
+			VK_CHECK_RESULT(vulkanRender->descriptorAllocator.allocate(descriptorInfos[0].layout, descriptorInfos[0].descriptorSet));
 
-			VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRender->device, &gbufferLightDescriptorSetAllocateInfo, &descriptorInfos[0].descriptorSet));
+			// normal，MR，albedo，深度，光照结果，最后是tile分类的buffer
+			const std::array<uint32_t, 5> imageIndices = { 0, 1, 2, 4, 3 };
+			std::array<VkDescriptorImageInfo, 5> computeLightingImageInfos = {};
+			std::array<VkWriteDescriptorSet, 6> computeLightingWritesInfo = {};
+			for (uint32_t i = 0; i < computeLightingImageInfos.size(); i++)
+			{
+				computeLightingImageInfos[i].sampler = vulkanRender->getOrCreateNearestSampler();
+				computeLightingImageInfos[i].imageView = frameBuffers[0].attachments[imageIndices[i]].imageView;
+				computeLightingImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+				computeLightingWritesInfo[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				computeLightingWritesInfo[i].pNext = nullptr;
+				computeLightingWritesInfo[i].dstSet = descriptorInfos[0].descriptorSet;
+				computeLightingWritesInfo[i].dstBinding = i;
+				computeLightingWritesInfo[i].dstArrayElement = 0;
+				computeLightingWritesInfo[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				computeLightingWritesInfo[i].descriptorCount = 1;
+				computeLightingWritesInfo[i].pImageInfo = &computeLightingImageInfos[i];
+			}
+			computeLightingImageInfos[3].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+			computeLightingImageInfos[4].sampler = VK_NULL_HANDLE;
+			computeLightingImageInfos[4].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			computeLightingWritesInfo[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+			VkDescriptorBufferInfo lightingTileBufferInfo = {};
+			lightingTileBufferInfo.buffer = lightingTileBuffer;
+			lightingTileBufferInfo.offset = 0;
+			lightingTileBufferInfo.range = VK_WHOLE_SIZE;
+
+			computeLightingWritesInfo[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			computeLightingWritesInfo[5].pNext = nullptr;
+			computeLightingWritesInfo[5].dstSet = descriptorInfos[0].descriptorSet;
+			computeLightingWritesInfo[5].dstBinding = 5;
+			computeLightingWritesInfo[5].dstArrayElement = 0;
+			computeLightingWritesInfo[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			computeLightingWritesInfo[5].descriptorCount = 1;
+			computeLightingWritesInfo[5].pBufferInfo = &lightingTileBufferInfo;
+
+			vkUpdateDescriptorSets(vulkanRender->device, computeLightingWritesInfo.size(), computeLightingWritesInfo.data(), 0, nullptr);
+		}
+		else
+		{
+			VK_CHECK_RESULT(vulkanRender->descriptorAllocator.allocate(descriptorInfos[0].layout, descriptorInfos[0].descriptorSet));
 
 			VkDescriptorImageInfo gbufferNormalInputAttachmentInfo = {};
 			gbufferNormalInputAttachmentInfo.sampler = vulkanRender->getOrCreateNearestSampler();
@@ -621,14 +1128,7 @@ namespace VulkanEngine
 
 		// FXAA
 		{
-			VkDescriptorSetAllocateInfo FXAADescriptorSetAllocateInfo = {};
-			FXAADescriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			FXAADescriptorSetAllocateInfo.pNext = nullptr;
-			FXAADescriptorSetAllocateInfo.descriptorPool = vulkanRender->descriptorPool;
-			FXAADescriptorSetAllocateInfo.descriptorSetCount = 1;
-			FXAADescriptorSetAllocateInfo.pSetLayouts = &descriptorInfos[1].layout;
-
-			VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRender->device, &FXAADescriptorSetAllocateInfo, &descriptorInfos[1].descriptorSet));
+			VK_CHECK_RESULT(vulkanRender->descriptorAllocator.allocate(descriptorInfos[1].layout, descriptorInfos[1].descriptorSet));
 
 			VkDescriptorImageInfo FXAAInputAttachmentInfo = {};
 			FXAAInputAttachmentInfo.sampler = vulkanRender->getOrCreateNearestSampler();
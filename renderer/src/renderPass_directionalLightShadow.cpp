@@ -9,7 +9,11 @@ namespace VulkanEngine
 	{
 		VulkanRenderPass::init(vulkanRender, sceneData);
 
-		descriptorInfos.resize(1);
+		cascadeCount = glm::clamp(sceneData->shadowCascadeCount, 2u, MaxShadowCascades);
+		sceneData->shadowCascadeCount = cascadeCount;
+		shadowMapSize = sceneData->shadowCascadeSize;
+
+		descriptorInfos.resize(cascadeCount);
 		setupAttachments();
 		setupRenderPass();
 		setupFrameBuffers();
@@ -22,9 +26,19 @@ namespace VulkanEngine
 	{
 	}
 
-	void DirectionalLightShadowMapRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize)
+	void DirectionalLightShadowMapRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+	{
+		vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	}
+
+	void DirectionalLightShadowMapRenderPass::drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+	}
+
+	void DirectionalLightShadowMapRenderPass::drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
 	{
-		vkCmdDrawIndexed(commandBuffer, indexSize, 1, 0, 0, 0);
+		vulkanRender->cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
 	}
 
 	void DirectionalLightShadowMapRenderPass::draw(VkCommandBuffer commandBuffer, uint32_t vertexSize)
@@ -33,152 +47,329 @@ namespace VulkanEngine
 
 	void DirectionalLightShadowMapRenderPass::clear()
 	{
-		vkQueueWaitIdle(vulkanRender->graphicsQueue);
-		for (const auto& frameBuffer : frameBuffers)
+		auto& deletionQueue = vulkanRender->deletionQueue;
+		VkDevice device = vulkanRender->device;
+
+		for (auto& frameBuffer : frameBuffers)
+		{
+			deletionQueue.destroyFramebuffer(frameBuffer.frameBuffer);
+		}
+		frameBuffers.clear();
+
+		for (VkImageView cascadeView : cascadeViews)
+		{
+			deletionQueue.destroyImageView(cascadeView);
+		}
+		cascadeViews.clear();
+
+		for (VkFramebuffer staticFrameBuffer : staticFrameBuffers)
+		{
+			deletionQueue.destroyFramebuffer(staticFrameBuffer);
+		}
+		staticFrameBuffers.clear();
+		for (VkImageView staticCacheView : staticCacheViews)
+		{
+			deletionQueue.destroyImageView(staticCacheView);
+		}
+		staticCacheViews.clear();
+		if (staticCacheAttachment.image != VK_NULL_HANDLE)
 		{
-			vkDestroyFramebuffer(vulkanRender->device, frameBuffer.frameBuffer, nullptr);
-			for (const auto& attachment : frameBuffer.attachments)
-			{
-				vkDestroyImage(vulkanRender->device, attachment.image, nullptr);
-				vkDestroyImageView(vulkanRender->device, attachment.imageView, nullptr);
-				vkFreeMemory(vulkanRender->device, attachment.memory, nullptr);
-			}
+			deletionQueue.destroyImage(staticCacheAttachment.image);
+			deletionQueue.freeMemory(staticCacheAttachment.memory);
+			staticCacheAttachment = {};
 		}
 
+		deletionQueue.destroyImage(shadowMapAttachment.image);
+		deletionQueue.destroyImageView(shadowMapAttachment.imageView);
+		deletionQueue.freeMemory(shadowMapAttachment.memory);
+		deletionQueue.destroySampler(shadowSampler);
+		shadowMapAttachment = {};
+		shadowSampler = VK_NULL_HANDLE;
+
 		for (uint32_t i = 0; i < renderPipelines.size(); i++)
 		{
-			vkDestroyPipeline(vulkanRender->device, renderPipelines[i].pipeline, nullptr);
-			vkDestroyPipelineLayout(vulkanRender->device, renderPipelines[i].layout, nullptr);
+			VkPipeline pipeline = renderPipelines[i].pipeline;
+			VkPipelineLayout layout = renderPipelines[i].layout;
+			deletionQueue.push([device, pipeline, layout]() {
+				vkDestroyPipeline(device, pipeline, nullptr);
+				vkDestroyPipelineLayout(device, layout, nullptr);
+			});
 		}
+		renderPipelines.clear();
 
-		vkDestroyDescriptorSetLayout(vulkanRender->device, descriptorInfos[0].layout, nullptr);
-		vkFreeDescriptorSets(vulkanRender->device, vulkanRender->descriptorPool, 1, &descriptorInfos[0].descriptorSet);
+		VkDescriptorSetLayout layout = descriptorInfos[0].layout;
+		deletionQueue.push([device, layout]() { vkDestroyDescriptorSetLayout(device, layout, nullptr); });
+		for (auto& descriptorInfo : descriptorInfos)
+		{
+			deletionQueue.freeDescriptorSet(descriptorInfo.descriptorSet);
+		}
 
-		vkDestroyRenderPass(vulkanRender->device, renderPass, nullptr);
+		VkRenderPass oldRenderPasses[] = { renderPass, staticRenderPass, dynamicRenderPass };
+		for (VkRenderPass oldRenderPass : oldRenderPasses)
+		{
+			deletionQueue.push([device, oldRenderPass]() { vkDestroyRenderPass(device, oldRenderPass, nullptr); });
+		}
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupAttachments()
 	{
-		frameBuffers.resize(1);
-		auto& mainFrameBuffer = frameBuffers[0];
-		mainFrameBuffer.width = shadowMapSize;
-		mainFrameBuffer.height = shadowMapSize;
-		mainFrameBuffer.attachments.resize(2);
-
-		// color
-		mainFrameBuffer.attachments[0].format = VK_FORMAT_R32_SFLOAT;
+		frameBuffers.resize(cascadeCount);
+		for (auto& frameBuffer : frameBuffers)
+		{
+			frameBuffer.width = shadowMapSize;
+			frameBuffer.height = shadowMapSize;
+		}
+
+		// 只有深度，每个级联一层，D16所有设备都支持采样
+		shadowMapAttachment.format = vulkanRender->findSupportedFormat(
+			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 		vulkanRender->createImage(shadowMapSize, shadowMapSize,
-			mainFrameBuffer.attachments[0].format,
+			shadowMapAttachment.format,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mainFrameBuffer.attachments[0].image,
-			mainFrameBuffer.attachments[0].memory,
+			shadowMapAttachment.image,
+			shadowMapAttachment.memory,
 			0,		// 没有特殊用法，就传0
+			cascadeCount,
 			1,
-			1);
+			VK_SAMPLE_COUNT_1_BIT,
+			MemoryCategory::RenderTarget);
+
+		shadowMapAttachment.imageView = vulkanRender->createImageView(shadowMapAttachment.image, shadowMapAttachment.format, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, cascadeCount, 1);
+
+		// framebuffer只能绑定单层的视图
+		cascadeViews.resize(cascadeCount);
+		for (uint32_t i = 0; i < cascadeCount; i++)
+		{
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = shadowMapAttachment.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = shadowMapAttachment.format;
+			viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			viewInfo.subresourceRange.baseMipLevel = 0;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.baseArrayLayer = i;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			VK_CHECK_RESULT(vkCreateImageView(vulkanRender->device, &viewInfo, nullptr, &cascadeViews[i]));
+		}
 
-		mainFrameBuffer.attachments[0].imageView = vulkanRender->createImageView(mainFrameBuffer.attachments[0].image, mainFrameBuffer.attachments[0].format, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, 1);
+		// 比较采样，shader里用sampler2DArrayShadow直接得到可见比例；超出阴影图的地方当作没有遮挡
+		// 格式支持线性过滤时，一次采样就是硬件的2x2 PCF
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(vulkanRender->physicalDevice, shadowMapAttachment.format, &formatProperties);
+		VkFilter filter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+		VkSamplerCreateInfo samplerCI = {};
+		samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerCI.magFilter = filter;
+		samplerCI.minFilter = filter;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.compareEnable = VK_TRUE;
+		samplerCI.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		samplerCI.minLod = 0.0f;
+		samplerCI.maxLod = 1.0f;
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(vulkanRender->device, &samplerCI, nullptr, &shadowSampler));
+	}
 
-		// depth
-		mainFrameBuffer.attachments[1].format = vulkanRender->depthImageFormat;
+	void DirectionalLightShadowMapRenderPass::setupStaticCache()
+	{
+		// 只作为附件和复制源，不会被采样
+		staticCacheAttachment.format = shadowMapAttachment.format;
 		vulkanRender->createImage(shadowMapSize, shadowMapSize,
-			mainFrameBuffer.attachments[1].format,
+			staticCacheAttachment.format,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,	// 用一次就不用了
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mainFrameBuffer.attachments[1].image,
-			mainFrameBuffer.attachments[1].memory,
+			staticCacheAttachment.image,
+			staticCacheAttachment.memory,
 			0,
+			cascadeCount,
 			1,
-			1);
+			VK_SAMPLE_COUNT_1_BIT,
+			MemoryCategory::RenderTarget);
+
+		staticCacheViews.resize(cascadeCount);
+		staticFrameBuffers.resize(cascadeCount);
+		for (uint32_t i = 0; i < cascadeCount; i++)
+		{
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = staticCacheAttachment.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = staticCacheAttachment.format;
+			viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			viewInfo.subresourceRange.baseMipLevel = 0;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.baseArrayLayer = i;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			VK_CHECK_RESULT(vkCreateImageView(vulkanRender->device, &viewInfo, nullptr, &staticCacheViews[i]));
+
+			VkImageView attachments[1] = { staticCacheViews[i] };
+
+			VkFramebufferCreateInfo frameBufferCI = {};
+			frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			frameBufferCI.flags = 0;
+			frameBufferCI.renderPass = staticRenderPass;
+			frameBufferCI.attachmentCount = (sizeof(attachments) / sizeof(attachments[0]));
+			frameBufferCI.pAttachments = attachments;
+			frameBufferCI.width = shadowMapSize;
+			frameBufferCI.height = shadowMapSize;
+			frameBufferCI.layers = 1;
+
+			VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRender->device, &frameBufferCI, nullptr, &staticFrameBuffers[i]));
+		}
+	}
+
+	VkFramebuffer DirectionalLightShadowMapRenderPass::getStaticFrameBuffer(uint32_t cascade)
+	{
+		if (staticFrameBuffers.empty())
+		{
+			setupStaticCache();
+		}
+		return staticFrameBuffers[cascade];
+	}
 
-		mainFrameBuffer.attachments[1].imageView = vulkanRender->createImageView(mainFrameBuffer.attachments[1].image, mainFrameBuffer.attachments[1].format, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, 1);
+	void DirectionalLightShadowMapRenderPass::copyStaticCascade(VkCommandBuffer commandBuffer, uint32_t cascade)
+	{
+		// 阴影图这一层原来的内容不要了，等上一帧的光照读完再覆盖
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = shadowMapAttachment.image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = cascade;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		// 静态缓存和staticRenderPass结束时的可见性由它的subpass依赖保证
+		VkImageCopy region = {};
+		region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		region.srcSubresource.mipLevel = 0;
+		region.srcSubresource.baseArrayLayer = cascade;
+		region.srcSubresource.layerCount = 1;
+		region.dstSubresource = region.srcSubresource;
+		region.extent = { shadowMapSize, shadowMapSize, 1 };
+		vkCmdCopyImage(commandBuffer, staticCacheAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowMapAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupRenderPass()
 	{
-		auto& mainFrameBuffer = frameBuffers[0];
+		VkAttachmentDescription attachment = {};
+		attachment.format = shadowMapAttachment.format;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+		VkSubpassDependency dependency[2] = {};
+		dependency[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency[0].dstSubpass = 0;
+		dependency[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;		// 上一帧的光照还在读阴影图
+		dependency[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependency[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependency[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency[0].dependencyFlags = 0;
 
-		VkAttachmentDescription attachment[2] = {};
+		dependency[1].srcSubpass = 0;
+		dependency[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependency[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;		// 深度写完，之后的光照才能采样
+		dependency[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependency[1].dependencyFlags = 0;
+
+		renderPass = createShadowRenderPass(attachment, dependency);
+
+		// 静态缓存：写完之后作为复制源
+		VkAttachmentDescription staticAttachment = attachment;
+		staticAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
-		attachment[0].format = mainFrameBuffer.attachments[0].format;
-		attachment[0].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachment[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachment[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		attachment[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		attachment[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachment[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkSubpassDependency staticDependency[2] = { dependency[0], dependency[1] };
+		staticDependency[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;				// 之前的复制还在读静态缓存
+		staticDependency[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		staticDependency[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		staticDependency[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
-		attachment[1].format = mainFrameBuffer.attachments[1].format;
-		attachment[1].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachment[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachment[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		attachment[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachment[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;		// 说不定格式有stencil，所以不能只depth optimal
+		staticRenderPass = createShadowRenderPass(staticAttachment, staticDependency);
 
+		// 动态投射物：保留复制过来的静态深度
+		VkAttachmentDescription dynamicAttachment = attachment;
+		dynamicAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		dynamicAttachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
-		VkAttachmentReference colorRef = {};
-		colorRef.attachment = 0;
-		colorRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		VkSubpassDependency dynamicDependency[2] = { dependency[0], dependency[1] };
+		dynamicDependency[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dynamicDependency[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dynamicDependency[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		dynamicDependency[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+		dynamicRenderPass = createShadowRenderPass(dynamicAttachment, dynamicDependency);
+	}
+
+	VkRenderPass DirectionalLightShadowMapRenderPass::createShadowRenderPass(const VkAttachmentDescription& attachment, const VkSubpassDependency* dependencies)
+	{
 		VkAttachmentReference depthRef = {};
-		depthRef.attachment = 1;
+		depthRef.attachment = 0;
 		depthRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 		VkSubpassDescription subPasses[1] = {};
 		subPasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subPasses[0].colorAttachmentCount = 1;
-		subPasses[0].pColorAttachments = &colorRef;
+		subPasses[0].colorAttachmentCount = 0;
+		subPasses[0].pColorAttachments = nullptr;
 		subPasses[0].pDepthStencilAttachment = &depthRef;
 
-		VkSubpassDependency dependency[2] = {};
-		dependency[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency[0].dstSubpass = 0;
-		dependency[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;		// 等待之前的pass哪个阶段执行哪个操作
-		dependency[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;		// 之后我们进行哪个阶段哪个操作
-		dependency[0].srcAccessMask = 0;												// 0代表读写不关心，阶段执行完就行
-		dependency[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		dependency[0].dependencyFlags = 0;
-
-		dependency[1].srcSubpass = 0;
-		dependency[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-		dependency[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;				// color out阶段的写操作结束，管线就结束了
-		dependency[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		dependency[1].dstAccessMask = 0;
-		dependency[1].dependencyFlags = 0;
-
 		VkRenderPassCreateInfo renderPassCI = {};
 		renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassCI.attachmentCount = (sizeof(attachment) / sizeof(attachment[0]));
-		renderPassCI.pAttachments = attachment;
+		renderPassCI.attachmentCount = 1;
+		renderPassCI.pAttachments = &attachment;
 		renderPassCI.subpassCount = (sizeof(subPasses) / sizeof(subPasses[0]));
 		renderPassCI.pSubpasses = subPasses;
-		renderPassCI.dependencyCount = (sizeof(dependency) / sizeof(dependency[0]));
-		renderPassCI.pDependencies = dependency;
+		renderPassCI.dependencyCount = 2;
+		renderPassCI.pDependencies = dependencies;
 
-		VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &renderPass));
+		VkRenderPass newRenderPass;
+		VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &newRenderPass));
+		return newRenderPass;
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupFrameBuffers()
 	{
-		VkImageView attachments[2] = { frameBuffers[0].attachments[0].imageView, frameBuffers[0].attachments[1].imageView };
-
-		VkFramebufferCreateInfo frameBufferCI = {};
-		frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		frameBufferCI.flags = 0;
-		frameBufferCI.renderPass = renderPass;
-		frameBufferCI.attachmentCount = (sizeof(attachments) / sizeof(attachments[0]));
-		frameBufferCI.pAttachments = attachments;
-		frameBufferCI.width = frameBuffers[0].width;
-		frameBufferCI.height = frameBuffers[0].height;
-		frameBufferCI.layers = 1;
-
-		VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRender->device, &frameBufferCI, nullptr, &frameBuffers[0].frameBuffer));
+		for (uint32_t i = 0; i < cascadeCount; i++)
+		{
+			VkImageView attachments[1] = { cascadeViews[i] };
+
+			VkFramebufferCreateInfo frameBufferCI = {};
+			frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			frameBufferCI.flags = 0;
+			frameBufferCI.renderPass = renderPass;
+			frameBufferCI.attachmentCount = (sizeof(attachments) / sizeof(attachments[0]));
+			frameBufferCI.pAttachments = attachments;
+			frameBufferCI.width = frameBuffers[i].width;
+			frameBufferCI.height = frameBuffers[i].height;
+			frameBufferCI.layers = 1;
+
+			VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRender->device, &frameBufferCI, nullptr, &frameBuffers[i].frameBuffer));
+		}
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupDescriptorSetLayout()
@@ -191,7 +382,7 @@ namespace VulkanEngine
 		binding[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 		binding[1].binding = 1;
-		binding[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		binding[1].descriptorCount = 1;
 		binding[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -203,6 +394,12 @@ namespace VulkanEngine
 		layoutCI.pBindings = binding;
 
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRender->device, &layoutCI, nullptr, &descriptorInfos[0].layout));
+
+		// 所有级联共用一个layout，clear时只销毁一次
+		for (auto& descriptorInfo : descriptorInfos)
+		{
+			descriptorInfo.layout = descriptorInfos[0].layout;
+		}
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupPipelines()
@@ -220,8 +417,9 @@ namespace VulkanEngine
 		VK_CHECK_RESULT(vkCreatePipelineLayout(vulkanRender->device, &pipelineLayoutCI, nullptr, &renderPipelines[0].layout));
 
 		// 配置一次subpass的状态，DX内对应PipelineStateObject
+		// 只写深度，不需要片元着色器
 		auto vertShaderCode = VulkanUtil::readFile(sceneData->shadowVSFilePath);
-		auto fragShaderCode = VulkanUtil::readFile(sceneData->shadowFSFilePath);
+		std::vector<char> fragShaderCode;
 
 		// 顶点数据描述
 		auto vertexBindingDescriptions = Vertex::getBindingDescriptions();
@@ -234,10 +432,6 @@ namespace VulkanEngine
 
 		std::vector<VkDynamicState> dynamicStates;
 
-		std::array<VkPipelineColorBlendAttachmentState, 1> colorBlendAttachmentState = {};
-		colorBlendAttachmentState[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachmentState[0].blendEnable = VK_FALSE;
-
 		VulkanPipeline::createPipeline(vulkanRender, renderPipelines[0].pipeline,
 			renderPipelines[0].layout,
 			vertShaderCode, fragShaderCode,
@@ -246,50 +440,68 @@ namespace VulkanEngine
 			0,
 			viewport, scissor,
 			VK_SAMPLE_COUNT_1_BIT,
-			dynamicStates, 1, colorBlendAttachmentState.data(), true, true);
+			dynamicStates, 0, nullptr, true, true,
+			depthBiasConstant, depthBiasSlope);
 	}
 
 	void DirectionalLightShadowMapRenderPass::setupDescriptorSet()
 	{
-		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocateInfo.pNext = nullptr;
-		descriptorSetAllocateInfo.descriptorPool = vulkanRender->descriptorPool;
-		descriptorSetAllocateInfo.descriptorSetCount = 1;
-		descriptorSetAllocateInfo.pSetLayouts = &descriptorInfos[0].layout;
-
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRender->device, &descriptorSetAllocateInfo, &descriptorInfos[0].descriptorSet));
-
-		VkDescriptorBufferInfo uniformBufferInfo[2] = {};
-		uniformBufferInfo[0].offset = 0;
-		uniformBufferInfo[0].buffer = sceneData->uniformShadowResource.buffer;
-		uniformBufferInfo[0].range = sizeof(UnifromBufferObjectShadowProjView);
-
-		uniformBufferInfo[1].offset = 0;
-		uniformBufferInfo[1].buffer = sceneData->uniformDynamicResource.buffer;
-		uniformBufferInfo[1].range = sizeof(UniformBufferDynamicObject);
-		
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].pNext = nullptr;
-		descriptorWrites[0].dstSet = descriptorInfos[0].descriptorSet;
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &uniformBufferInfo[0];
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].pNext = nullptr;
-		descriptorWrites[1].dstSet = descriptorInfos[0].descriptorSet;
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = &uniformBufferInfo[1];
-
-		vkUpdateDescriptorSets(vulkanRender->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		for (uint32_t i = 0; i < cascadeCount; i++)
+		{
+			VK_CHECK_RESULT(vulkanRender->descriptorAllocator.allocate(descriptorInfos[i].layout, descriptorInfos[i].descriptorSet));
+
+			// 每个级联读uniformShadowResource里自己的那一段
+			VkDescriptorBufferInfo uniformBufferInfo[2] = {};
+			uniformBufferInfo[0].offset = i * ShadowCascadeUniformStride;
+			uniformBufferInfo[0].buffer = sceneData->uniformShadowResource.buffer;
+			uniformBufferInfo[0].range = sizeof(UnifromBufferObjectShadowProjView);
+
+			uniformBufferInfo[1].offset = 0;
+			uniformBufferInfo[1].buffer = sceneData->meshDrawDataResource.buffer;
+			uniformBufferInfo[1].range = VK_WHOLE_SIZE;
+
+			std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[0].pNext = nullptr;
+			descriptorWrites[0].dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstArrayElement = 0;
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[0].descriptorCount = 1;
+			descriptorWrites[0].pBufferInfo = &uniformBufferInfo[0];
+
+			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[1].pNext = nullptr;
+			descriptorWrites[1].dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrites[1].dstBinding = 1;
+			descriptorWrites[1].dstArrayElement = 0;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[1].descriptorCount = 1;
+			descriptorWrites[1].pBufferInfo = &uniformBufferInfo[1];
+
+			vkUpdateDescriptorSets(vulkanRender->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+	}
+	void DirectionalLightShadowMapRenderPass::updateMeshDrawDataDescriptors()
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.offset = 0;
+		bufferInfo.buffer = sceneData->meshDrawDataResource.buffer;
+		bufferInfo.range = VK_WHOLE_SIZE;
+
+		for (uint32_t i = 0; i < cascadeCount; i++)
+		{
+			VkWriteDescriptorSet descriptorWrite = {};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrite.dstBinding = 1;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(vulkanRender->device, 1, &descriptorWrite, 0, nullptr);
+		}
 	}
 
 }
\ No newline at end of file
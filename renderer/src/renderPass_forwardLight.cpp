@@ -19,9 +19,19 @@ namespace VulkanEngine
 
 	}
 
-	void MainRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexSize)
+	void MainRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
 	{
-		vkCmdDrawIndexed(commandBuffer, indexSize, 1, 0, 0, 0);
+		vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	}
+
+	void MainRenderPass::drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+	}
+
+	void MainRenderPass::drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
+	{
+		vulkanRender->cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
 	}
 
 	void MainRenderPass::draw(VkCommandBuffer commandBuffer, uint32_t vertexSize)
@@ -31,22 +41,7 @@ namespace VulkanEngine
 
 	void MainRenderPass::recreate()
 	{
-		for (const auto& frameBuffer : frameBuffers)
-		{
-			vkDestroyFramebuffer(vulkanRender->device, frameBuffer.frameBuffer, nullptr);
-		}
-
-		vkDestroyImage(vulkanRender->device, colorAttachment.image, nullptr);
-		vkDestroyImageView(vulkanRender->device, colorAttachment.imageView, nullptr);
-		vkFreeMemory(vulkanRender->device, colorAttachment.memory, nullptr);
-
-		for (uint32_t i = 0; i < renderPipelines.size(); i++)
-		{
-			vkDestroyPipeline(vulkanRender->device, renderPipelines[i].pipeline, nullptr);
-			vkDestroyPipelineLayout(vulkanRender->device, renderPipelines[i].layout, nullptr);
-		}
-
-		vkDestroyRenderPass(vulkanRender->device, renderPass, nullptr);
+		clear();
 
 		setupRenderPass();
 		setupPipelines();
@@ -55,23 +50,34 @@ namespace VulkanEngine
 
 	void MainRenderPass::clear()
 	{
-		vkQueueWaitIdle(vulkanRender->graphicsQueue);
+		// 资源可能还在被inflight的帧使用，交给延迟销毁队列
+		auto& deletionQueue = vulkanRender->deletionQueue;
+		VkDevice device = vulkanRender->device;
+
 		for (const auto& frameBuffer : frameBuffers)
 		{
-			vkDestroyFramebuffer(vulkanRender->device, frameBuffer.frameBuffer, nullptr);
+			deletionQueue.destroyFramebuffer(frameBuffer.frameBuffer);
 		}
+		frameBuffers.clear();
 
-		vkDestroyImage(vulkanRender->device, colorAttachment.image, nullptr);
-		vkDestroyImageView(vulkanRender->device, colorAttachment.imageView, nullptr);
-		vkFreeMemory(vulkanRender->device, colorAttachment.memory, nullptr);
+		deletionQueue.destroyImage(colorAttachment.image);
+		deletionQueue.destroyImageView(colorAttachment.imageView);
+		deletionQueue.freeMemory(colorAttachment.memory);
+		colorAttachment.memory = VK_NULL_HANDLE;
 
 		for (uint32_t i = 0; i < renderPipelines.size(); i++)
 		{
-			vkDestroyPipeline(vulkanRender->device, renderPipelines[i].pipeline, nullptr);
-			vkDestroyPipelineLayout(vulkanRender->device, renderPipelines[i].layout, nullptr);
+			VkPipeline pipeline = renderPipelines[i].pipeline;
+			VkPipelineLayout layout = renderPipelines[i].layout;
+			deletionQueue.push([device, pipeline, layout]() {
+				vkDestroyPipeline(device, pipeline, nullptr);
+				vkDestroyPipelineLayout(device, layout, nullptr);
+			});
 		}
+		renderPipelines.clear();
 
-		vkDestroyRenderPass(vulkanRender->device, renderPass, nullptr);
+		VkRenderPass oldRenderPass = renderPass;
+		deletionQueue.push([device, oldRenderPass]() { vkDestroyRenderPass(device, oldRenderPass, nullptr); });
 	}
 
 	void MainRenderPass::setupRenderPass()
@@ -98,9 +104,9 @@ namespace VulkanEngine
 		VkAttachmentDescription depthAttachment = {};
 		depthAttachment.format = vulkanRender->depthImageFormat;
 		depthAttachment.samples = vulkanRender->msaaSamples;
-		// depth 渲染前清屏，渲染后保留（除非后面不使用depth了，保守一些）
+		// depth 渲染前清屏，renderpass之后不再使用，不需要写回
 		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -178,11 +184,8 @@ namespace VulkanEngine
 		auto bindingDescriptions = Vertex::getBindingDescriptions();
 		auto attributeDescriptions = Vertex::getAttributeDescriptions();
 
-		std::vector<VkDynamicState> dynamicStates =
-		{
-			VK_DYNAMIC_STATE_VIEWPORT,
-			VK_DYNAMIC_STATE_SCISSOR
-		};
+		// 视口随交换链重建管线，不用动态状态
+		std::vector<VkDynamicState> dynamicStates;
 
 		std::array<VkPipelineColorBlendAttachmentState, 1> colorBlendAttachmentState = {};
 		colorBlendAttachmentState[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -196,7 +199,8 @@ namespace VulkanEngine
 			0,
 			vulkanRender->viewport, vulkanRender->scissor,
 			vulkanRender->msaaSamples,
-			dynamicStates, 1, colorBlendAttachmentState.data(), true, true);
+			dynamicStates, 1, colorBlendAttachmentState.data(), true, true,
+			0.0f, 0.0f, sceneData->getShadowFilterSpecializationInfo());
 	}
 
 	void MainRenderPass::setupFrameBuffers()
@@ -217,13 +221,14 @@ namespace VulkanEngine
 			format,
 			VK_IMAGE_TILING_OPTIMAL,
 			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			vulkanRender->getTransientAttachmentMemoryProperty(),
 			colorAttachment.image,
 			colorAttachment.memory,
 			0,
 			1,
 			1,
-			vulkanRender->msaaSamples);
+			vulkanRender->msaaSamples,
+			MemoryCategory::RenderTarget);
 
 		colorAttachment.imageView = vulkanRender->createImageView(colorAttachment.image, format, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, 1);
 
@@ -0,0 +1,360 @@
+﻿#include "renderPass_localLightShadow.hpp"
+#include "macro.hpp"
+#include "vulkanUtil.hpp"
+#include "vulkanPipeline.hpp"
+
+namespace VulkanEngine
+{
+	void LocalLightShadowAtlasRenderPass::init(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData)
+	{
+		VulkanRenderPass::init(vulkanRender, sceneData);
+
+		atlasSize = sceneData->shadowAtlasSize;
+
+		descriptorInfos.resize(MaxShadowAtlasUpdates * VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+		setupAttachments();
+		setupRenderPass();
+		setupFrameBuffers();
+		setupDescriptorSetLayout();
+		setupPipelines();
+		setupDescriptorSet();
+	}
+
+	void LocalLightShadowAtlasRenderPass::postInit()
+	{
+	}
+
+	void LocalLightShadowAtlasRenderPass::drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+	{
+		vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	}
+
+	void LocalLightShadowAtlasRenderPass::drawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+	}
+
+	void LocalLightShadowAtlasRenderPass::drawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
+	{
+		vulkanRender->cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+	}
+
+	void LocalLightShadowAtlasRenderPass::draw(VkCommandBuffer commandBuffer, uint32_t vertexSize)
+	{
+	}
+
+	void LocalLightShadowAtlasRenderPass::clear()
+	{
+		auto& deletionQueue = vulkanRender->deletionQueue;
+		VkDevice device = vulkanRender->device;
+
+		for (auto& frameBuffer : frameBuffers)
+		{
+			deletionQueue.destroyFramebuffer(frameBuffer.frameBuffer);
+		}
+		frameBuffers.clear();
+
+		deletionQueue.destroyImage(atlasAttachment.image);
+		deletionQueue.destroyImageView(atlasAttachment.imageView);
+		deletionQueue.freeMemory(atlasAttachment.memory);
+		deletionQueue.destroySampler(atlasSampler);
+		atlasAttachment = {};
+		atlasSampler = VK_NULL_HANDLE;
+
+		for (uint32_t i = 0; i < renderPipelines.size(); i++)
+		{
+			VkPipeline pipeline = renderPipelines[i].pipeline;
+			VkPipelineLayout layout = renderPipelines[i].layout;
+			deletionQueue.push([device, pipeline, layout]() {
+				vkDestroyPipeline(device, pipeline, nullptr);
+				vkDestroyPipelineLayout(device, layout, nullptr);
+			});
+		}
+		renderPipelines.clear();
+
+		VkDescriptorSetLayout layout = descriptorInfos[0].layout;
+		deletionQueue.push([device, layout]() { vkDestroyDescriptorSetLayout(device, layout, nullptr); });
+		for (auto& descriptorInfo : descriptorInfos)
+		{
+			deletionQueue.freeDescriptorSet(descriptorInfo.descriptorSet);
+		}
+
+		VkRenderPass oldRenderPasses[] = { renderPass, resetRenderPass };
+		for (VkRenderPass oldRenderPass : oldRenderPasses)
+		{
+			deletionQueue.push([device, oldRenderPass]() { vkDestroyRenderPass(device, oldRenderPass, nullptr); });
+		}
+	}
+
+	void LocalLightShadowAtlasRenderPass::beginTile(VkCommandBuffer commandBuffer, const ShadowAtlasAllocator::Tile& tile)
+	{
+		VkViewport viewport = { static_cast<float>(tile.x), static_cast<float>(tile.y), static_cast<float>(tile.size), static_cast<float>(tile.size), 0.0f, 1.0f };
+		VkRect2D scissor = { { static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y) }, { tile.size, tile.size } };
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		VkClearAttachment clearAttachment = {};
+		clearAttachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clearAttachment.clearValue.depthStencil = { 1.0f, 0 };
+
+		VkClearRect clearRect = {};
+		clearRect.rect = scissor;
+		clearRect.baseArrayLayer = 0;
+		clearRect.layerCount = 1;
+		vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, 1, &clearRect);
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupAttachments()
+	{
+		frameBuffers.resize(1);
+		frameBuffers[0].width = atlasSize;
+		frameBuffers[0].height = atlasSize;
+
+		atlasAttachment.format = vulkanRender->findSupportedFormat(
+			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+		vulkanRender->createImage(atlasSize, atlasSize,
+			atlasAttachment.format,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			atlasAttachment.image,
+			atlasAttachment.memory,
+			0,
+			1,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			MemoryCategory::RenderTarget);
+
+		atlasAttachment.imageView = vulkanRender->createImageView(atlasAttachment.image, atlasAttachment.format, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, 1);
+
+		// 比较采样，shader会把uv限制在块内半个像素以内，不会采到相邻的块
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(vulkanRender->physicalDevice, atlasAttachment.format, &formatProperties);
+		VkFilter filter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+		VkSamplerCreateInfo samplerCI = {};
+		samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerCI.magFilter = filter;
+		samplerCI.minFilter = filter;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.compareEnable = VK_TRUE;
+		samplerCI.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		samplerCI.minLod = 0.0f;
+		samplerCI.maxLod = 1.0f;
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(vulkanRender->device, &samplerCI, nullptr, &atlasSampler));
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupRenderPass()
+	{
+		// 没有更新的块保留原来的内容，要重画的块在beginTile里单独清空
+		VkAttachmentDescription attachment = {};
+		attachment.format = atlasAttachment.format;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference depthRef = {};
+		depthRef.attachment = 0;
+		depthRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subPasses[1] = {};
+		subPasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subPasses[0].colorAttachmentCount = 0;
+		subPasses[0].pColorAttachments = nullptr;
+		subPasses[0].pDepthStencilAttachment = &depthRef;
+
+		VkSubpassDependency dependency[2] = {};
+		dependency[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency[0].dstSubpass = 0;
+		dependency[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;		// 上一帧的光照还在读图集
+		dependency[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependency[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency[0].dependencyFlags = 0;
+
+		dependency[1].srcSubpass = 0;
+		dependency[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependency[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;		// 深度写完，之后的光照才能采样
+		dependency[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependency[1].dependencyFlags = 0;
+
+		VkRenderPassCreateInfo renderPassCI = {};
+		renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassCI.attachmentCount = 1;
+		renderPassCI.pAttachments = &attachment;
+		renderPassCI.subpassCount = (sizeof(subPasses) / sizeof(subPasses[0]));
+		renderPassCI.pSubpasses = subPasses;
+		renderPassCI.dependencyCount = 2;
+		renderPassCI.pDependencies = dependency;
+
+		VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &renderPass));
+
+		// 和renderPass兼容，只有load和初始layout不同
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VK_CHECK_RESULT(vkCreateRenderPass(vulkanRender->device, &renderPassCI, nullptr, &resetRenderPass));
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupFrameBuffers()
+	{
+		VkImageView attachments[1] = { atlasAttachment.imageView };
+
+		VkFramebufferCreateInfo frameBufferCI = {};
+		frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		frameBufferCI.flags = 0;
+		frameBufferCI.renderPass = renderPass;
+		frameBufferCI.attachmentCount = (sizeof(attachments) / sizeof(attachments[0]));
+		frameBufferCI.pAttachments = attachments;
+		frameBufferCI.width = frameBuffers[0].width;
+		frameBufferCI.height = frameBuffers[0].height;
+		frameBufferCI.layers = 1;
+
+		VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRender->device, &frameBufferCI, nullptr, &frameBuffers[0].frameBuffer));
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupDescriptorSetLayout()
+	{
+		VkDescriptorSetLayoutBinding binding[2] = {};
+
+		binding[0].binding = 0;
+		binding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		binding[0].descriptorCount = 1;
+		binding[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		binding[1].binding = 1;
+		binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		binding[1].descriptorCount = 1;
+		binding[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutCI = {};
+		layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCI.pNext = nullptr;
+		layoutCI.flags = 0;
+		layoutCI.bindingCount = sizeof(binding) / sizeof(binding[0]);
+		layoutCI.pBindings = binding;
+
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRender->device, &layoutCI, nullptr, &descriptorInfos[0].layout));
+
+		for (auto& descriptorInfo : descriptorInfos)
+		{
+			descriptorInfo.layout = descriptorInfos[0].layout;
+		}
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupPipelines()
+	{
+		renderPipelines.resize(1);
+
+		VkDescriptorSetLayout descriptorSetLayouts[] = { descriptorInfos[0].layout };
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCI.setLayoutCount = sizeof(descriptorSetLayouts) / sizeof(descriptorSetLayouts[0]);
+		pipelineLayoutCI.pSetLayouts = descriptorSetLayouts;
+
+		VK_CHECK_RESULT(vkCreatePipelineLayout(vulkanRender->device, &pipelineLayoutCI, nullptr, &renderPipelines[0].layout));
+
+		// 和方向光阴影共用顶点着色器，只写深度
+		auto vertShaderCode = VulkanUtil::readFile(sceneData->shadowVSFilePath);
+		std::vector<char> fragShaderCode;
+
+		auto vertexBindingDescriptions = Vertex::getBindingDescriptions();
+		auto vertexAttributeDescription = Vertex::getAttributeDescriptions()[0];
+		std::vector<VkVertexInputAttributeDescription> vertexAttributeDescriptions = { vertexAttributeDescription };
+
+		// 视口和裁剪每块不同，在beginTile里设置
+		VkViewport viewport = { 0, 0, static_cast<float>(atlasSize), static_cast<float>(atlasSize), 0.0, 1.0 };
+		VkRect2D scissor = { {0, 0}, { atlasSize, atlasSize } };
+
+		std::vector<VkDynamicState> dynamicStates =
+		{
+			VK_DYNAMIC_STATE_VIEWPORT,
+			VK_DYNAMIC_STATE_SCISSOR
+		};
+
+		VulkanPipeline::createPipeline(vulkanRender, renderPipelines[0].pipeline,
+			renderPipelines[0].layout,
+			vertShaderCode, fragShaderCode,
+			vertexBindingDescriptions, vertexAttributeDescriptions,
+			renderPass,
+			0,
+			viewport, scissor,
+			VK_SAMPLE_COUNT_1_BIT,
+			dynamicStates, 0, nullptr, true, true,
+			depthBiasConstant, depthBiasSlope);
+	}
+
+	void LocalLightShadowAtlasRenderPass::setupDescriptorSet()
+	{
+		// 槽位按帧下标分组，和uniformShadowAtlasResource里的排列一致
+		for (uint32_t i = 0; i < descriptorInfos.size(); i++)
+		{
+			VK_CHECK_RESULT(vulkanRender->descriptorAllocator.allocate(descriptorInfos[i].layout, descriptorInfos[i].descriptorSet));
+
+			VkDescriptorBufferInfo uniformBufferInfo[2] = {};
+			uniformBufferInfo[0].offset = i * ShadowCascadeUniformStride;
+			uniformBufferInfo[0].buffer = sceneData->uniformShadowAtlasResource.buffer;
+			uniformBufferInfo[0].range = sizeof(UnifromBufferObjectShadowProjView);
+
+			uniformBufferInfo[1].offset = 0;
+			uniformBufferInfo[1].buffer = sceneData->meshDrawDataResource.buffer;
+			uniformBufferInfo[1].range = VK_WHOLE_SIZE;
+
+			std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[0].pNext = nullptr;
+			descriptorWrites[0].dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstArrayElement = 0;
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[0].descriptorCount = 1;
+			descriptorWrites[0].pBufferInfo = &uniformBufferInfo[0];
+
+			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[1].pNext = nullptr;
+			descriptorWrites[1].dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrites[1].dstBinding = 1;
+			descriptorWrites[1].dstArrayElement = 0;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[1].descriptorCount = 1;
+			descriptorWrites[1].pBufferInfo = &uniformBufferInfo[1];
+
+			vkUpdateDescriptorSets(vulkanRender->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+	}
+	void LocalLightShadowAtlasRenderPass::updateMeshDrawDataDescriptors()
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.offset = 0;
+		bufferInfo.buffer = sceneData->meshDrawDataResource.buffer;
+		bufferInfo.range = VK_WHOLE_SIZE;
+
+		for (uint32_t i = 0; i < descriptorInfos.size(); i++)
+		{
+			VkWriteDescriptorSet descriptorWrite = {};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = descriptorInfos[i].descriptorSet;
+			descriptorWrite.dstBinding = 1;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(vulkanRender->device, 1, &descriptorWrite, 0, nullptr);
+		}
+	}
+
+}
\ No newline at end of file
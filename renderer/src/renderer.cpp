@@ -11,6 +11,11 @@
 namespace VulkanEngine
 {
     bool forward = false;
+    // 场景pass分给多个线程录制成secondary commandBuffer
+    bool parallelRecording = true;
+    // 场景pass的secondary commandBuffer只在场景内容、mesh缓冲、可见列表、pipeline或交换链变化时重新录制，每帧只更新uniform和UI
+    // 这时队列不按深度排序，录制的内容和相机无关，相机移动只在可见列表变化时才会重新录制
+    bool recordOnce = true;
 
     Renderer::Renderer()
     {
@@ -29,6 +34,17 @@ namespace VulkanEngine
         sceneData = new VulkanRenderSceneData();
         sceneData->init(vulkanRenderer);
 
+        for (uint32_t i = 0; i < MaxShadowCascades; i++)
+        {
+            shadowQueues[i].init(vulkanRenderer);
+            shadowDynamicQueues[i].init(vulkanRenderer);
+        }
+        opaqueQueue.init(vulkanRenderer);
+        for (auto& queue : shadowAtlasQueues)
+        {
+            queue.init(vulkanRenderer);
+        }
+
         //sceneData->shaderName = "PBR";
         sceneData->shaderName = "DisneyPBR";
         //sceneData->shaderName = "blinn";
@@ -68,7 +84,12 @@ namespace VulkanEngine
         directionalLightShadowMapPass = new DirectionalLightShadowMapRenderPass();
         directionalLightShadowMapPass->init(vulkanRenderer, sceneData);
 
-        sceneData->createDirectionalLightShadowDescriptorSet(directionalLightShadowMapPass->frameBuffers[0].attachments[0].imageView);
+        localLightShadowAtlasPass = new LocalLightShadowAtlasRenderPass();
+        localLightShadowAtlasPass->init(vulkanRenderer, sceneData);
+
+        VkImageView shadowMapView = directionalLightShadowMapPass->getShadowMapView();
+        VkImageView shadowAtlasView = localLightShadowAtlasPass->getAtlasView();
+        sceneData->createDirectionalLightShadowDescriptorSet(shadowMapView, directionalLightShadowMapPass->getShadowSampler(), shadowAtlasView, localLightShadowAtlasPass->getAtlasSampler());
         sceneData->createDeferredUniformDescriptorSet();
 
         deferredRenderPass = new DeferredRenderPass();
@@ -80,15 +101,23 @@ namespace VulkanEngine
         UIRenderPass = new UIPass();
         if (forward)
         {
-            UIRenderPass->init(vulkanRenderer, mainRenderPass, 0, sceneData);
+            UIRenderPass->init(vulkanRenderer, mainRenderPass->renderPass, 0, sceneData);
         }
         else
         {
-            UIRenderPass->init(vulkanRenderer, deferredRenderPass, deferredRenderPass->renderPipelines.size() - 1, sceneData);
+            UIRenderPass->init(vulkanRenderer, deferredRenderPass->getPostRenderPass(), deferredRenderPass->getPostSubpass(), sceneData);
         }
 
+        occlusionCuller.init(vulkanRenderer, sceneData);
+        softwareOcclusionCuller.init(&vulkanRenderer->recordThreadPool);
+        lightClusterer.init(vulkanRenderer, sceneData);
+
         sceneData->lookAtSceneCenter();
 
+        recordCacheKeys.fill(~0ull);
+        shadowContentKeys.fill(~0ull);
+        shadowStaticKeys.fill(~0ull);
+
         lastFrmeTime = std::chrono::high_resolution_clock::now();
     }
 
@@ -115,8 +144,26 @@ namespace VulkanEngine
         {
             sceneData->cameraController.processInputEvent(&vulkanRenderer->windowHandler->getEvent(), frameTimer);
         }
+
+        // 运行时加入的mesh超出了SSBO的容量，场景换了更大的buffer，其它引用它的descriptor也要重写
+        if (sceneData->reserveMeshBuffers())
+        {
+            directionalLightShadowMapPass->updateMeshDrawDataDescriptors();
+            localLightShadowAtlasPass->updateMeshDrawDataDescriptors();
+            occlusionCuller.updateMeshDrawDataDescriptor();
+        }
         sceneData->updateUniformRenderData();
 
+        glm::mat4 cameraProjView = sceneData->uniformBufferVSObject.proj * sceneData->uniformBufferVSObject.view;
+
+        // GPU剔除会重新测试整个队列，只在它不可用时在CPU上剔除被挡住的mesh
+        bool gpuOcclusionCulling = sceneData->gpuOcclusionCulling && occlusionCuller.isSupported();
+        if (!gpuOcclusionCulling && sceneData->softwareOcclusionCulling)
+        {
+            softwareOcclusionCuller.cull(sceneData, cameraProjView, sceneData->occluderTriangleBudget, sceneData->cameraVisibleMeshes, sceneData->softwareOcclusionStats);
+        }
+        sceneData->updateVisibilityVersion();
+
         VkCommandBuffer currentCommandBuffer = vulkanRenderer->getCurrentCommandBuffer();
 
         if (vulkanRenderer->beginPresent(passUpdateAfterRecreateSwapchain))
@@ -124,46 +171,201 @@ namespace VulkanEngine
             return;
         }
 
-        // shadow
+        // 这一帧下标的fence已经等过，它上次用过的图集槽位可以重新写入
+        sceneData->uploadLocalLights();
+
+        // 上传新加入的mesh，顺便整理geometryHeap的空洞
+        sceneData->geometryHeap.compact(currentCommandBuffer);
+
+        VkSubpassContents sceneContents = (parallelRecording || recordOnce) ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+
+        // 该帧下标上次录制的场景命令是否还能用，compact之后再判断，因为它可能改变mesh的偏移
+        uint32_t frameIndex = vulkanRenderer->currentFrameIndex;
+        reuseSceneCommands = false;
+        if (recordOnce)
+        {
+            uint64_t recordCacheKey = getRecordCacheKey();
+            reuseSceneCommands = recordCacheKeys[frameIndex] == recordCacheKey;
+            if (!reuseSceneCommands)
+            {
+                // 该帧的fence已经等过，缓存的commandBuffer不会再被GPU使用
+                vulkanRenderer->cachedSecondaryCommandBuffers.resetFrame(frameIndex);
+                recordCacheKeys[frameIndex] = recordCacheKey;
+                for (uint32_t i = 0; i < MaxShadowCascades; i++)
+                {
+                    shadowQueues[i].clearCachedCommandBuffers(frameIndex);
+                    shadowDynamicQueues[i].clearCachedCommandBuffers(frameIndex);
+                }
+                opaqueQueue.clearCachedCommandBuffers(frameIndex);
+            }
+        }
+        else
+        {
+            recordCacheKeys[frameIndex] = ~0ull;
+        }
+
+        // 每个级联只有descriptorSet不同
+        uint32_t cascadeCount = directionalLightShadowMapPass->getCascadeCount();
+        std::array<RenderQueueBindings, MaxShadowCascades> shadowBindings;
+        for (uint32_t i = 0; i < cascadeCount; i++)
+        {
+            shadowBindings[i].pipeline = directionalLightShadowMapPass->renderPipelines[0].pipeline;
+            shadowBindings[i].layout = directionalLightShadowMapPass->renderPipelines[0].layout;
+            shadowBindings[i].descriptorSets = { directionalLightShadowMapPass->descriptorInfos[i].descriptorSet };
+        }
+
+        RenderQueueBindings sceneBindings;
+        sceneBindings.materialSetIndex = 1;
+        if (forward)
+        {
+            sceneBindings.pipeline = mainRenderPass->renderPipelines[0].pipeline;
+            sceneBindings.layout = mainRenderPass->renderPipelines[0].layout;
+            sceneBindings.descriptorSets = { sceneData->uniformDescriptor.descriptorSet[0], VK_NULL_HANDLE, sceneData->directionalLightShadowDescriptor.descriptorSet[frameIndex] };
+        }
+        else
+        {
+            sceneBindings.pipeline = deferredRenderPass->renderPipelines[0].pipeline;
+            sceneBindings.layout = deferredRenderPass->renderPipelines[0].layout;
+            sceneBindings.descriptorSets = { sceneData->uniformDescriptor.descriptorSet[0], VK_NULL_HANDLE };
+        }
+
+        // 阴影图这一层的内容和级联的key一致时跳过；有动态投射物时静态投射物只在静态key变化时重画
+        ShadowCacheStats shadowCacheStats;
+        std::array<bool, MaxShadowCascades> redrawCascades = {};
+        std::array<bool, MaxShadowCascades> redrawStatic = {};
+        for (uint32_t i = 0; i < cascadeCount; i++)
+        {
+            const ShadowCascadeCache& cache = sceneData->shadowCascadeCaches[i];
+            redrawCascades[i] = !sceneData->shadowCaching || shadowContentKeys[i] != cache.contentKey;
+            if (!redrawCascades[i])
+            {
+                shadowCacheStats.cachedCascades++;
+                continue;
+            }
+
+            const glm::mat4& shadowProjView = sceneData->uniformBufferShadowVSObjects[i].projectView;
+            bool hasDynamicCasters = !cache.dynamicCasters.empty();
+            redrawStatic[i] = hasDynamicCasters && shadowStaticKeys[i] != cache.staticKey;
+            // 没有动态投射物时静态投射物直接画进阴影图
+            if (!hasDynamicCasters || redrawStatic[i])
+            {
+                buildRenderQueue(shadowQueues[i], RenderQueuePass::Shadow, shadowProjView, cache.staticCasters, shadowBindings[i]);
+            }
+            if (hasDynamicCasters)
+            {
+                buildRenderQueue(shadowDynamicQueues[i], RenderQueuePass::Shadow, shadowProjView, cache.dynamicCasters, shadowBindings[i]);
+            }
+
+            shadowCacheStats.redrawnCascades++;
+            shadowCacheStats.staticRedraws += redrawStatic[i] ? 1 : 0;
+            shadowCacheStats.dynamicCasters += static_cast<uint32_t>(cache.dynamicCasters.size());
+        }
+        sceneData->shadowCacheStats = shadowCacheStats;
+
+        buildRenderQueue(opaqueQueue, forward ? RenderQueuePass::Forward : RenderQueuePass::GBuffer, cameraProjView, sceneData->cameraVisibleMeshes, sceneBindings);
+
+        // shadow，每个级联画到阴影图的一层
+        auto recordShadowPass = [&](VkRenderPass renderPass, VkFramebuffer framebuffer, VulkanRenderQueue& queue, const RenderQueueBindings& bindings)
         {
             VkRenderPassBeginInfo renderPassInfo{};
             renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = directionalLightShadowMapPass->renderPass;
-            renderPassInfo.framebuffer = directionalLightShadowMapPass->frameBuffers[0].frameBuffer;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = framebuffer;
             renderPassInfo.renderArea.extent.width = directionalLightShadowMapPass->frameBuffers[0].width;
             renderPassInfo.renderArea.extent.height = directionalLightShadowMapPass->frameBuffers[0].height;
-            std::array<VkClearValue, 2> clearValues{};
-            clearValues[0].color = { {1.0f} };
-            clearValues[1].depthStencil = { 1.0f, 0 };
+            std::array<VkClearValue, 1> clearValues{};
+            clearValues[0].depthStencil = { 1.0f, 0 };
             renderPassInfo.clearValueCount = clearValues.size();
             renderPassInfo.pClearValues = clearValues.data();
 
-            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, sceneContents);
 
-            vulkanRenderer->cmdBindPipeline(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, directionalLightShadowMapPass->renderPipelines[0].pipeline);
+            // 三个阴影renderPass兼容，secondary commandBuffer都继承主阴影renderPass
+            recordRenderQueue(currentCommandBuffer, queue, directionalLightShadowMapPass, bindings, 0, renderPassInfo.framebuffer, false);
 
-            VkDeviceSize vertexOffset = 0;
-            VkDeviceSize indexOffset = 0;
-            for (size_t i = 0; i < sceneData->meshes.size(); i++)
-            {
-                uint32_t dynamicOffset = i * sizeof(UniformBufferDynamicObject);
+            vulkanRenderer->cmdEndRenderPass(currentCommandBuffer);
+        };
 
-                VkDescriptorSet set[1] = { directionalLightShadowMapPass->descriptorInfos[0].descriptorSet };
-                vulkanRenderer->cmdBindDescriptorSets(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, directionalLightShadowMapPass->renderPipelines[0].layout, 0, 1, set, 1, &dynamicOffset);
+        for (uint32_t i = 0; i < cascadeCount; i++)
+        {
+            if (!redrawCascades[i])
+            {
+                continue;
+            }
 
-                VkBuffer vertexBuffers[] = { sceneData->vertexResource.buffer };
-                VkDeviceSize vertexOffsets[] = { vertexOffset };
-                vkCmdBindVertexBuffers(currentCommandBuffer, 0, 1, vertexBuffers, vertexOffsets);
+            const ShadowCascadeCache& cache = sceneData->shadowCascadeCaches[i];
+            VkFramebuffer shadowFrameBuffer = directionalLightShadowMapPass->frameBuffers[i].frameBuffer;
+            if (cache.dynamicCasters.empty())
+            {
+                recordShadowPass(directionalLightShadowMapPass->renderPass, shadowFrameBuffer, shadowQueues[i], shadowBindings[i]);
+                shadowStaticKeys[i] = ~0ull;
+            }
+            else
+            {
+                if (redrawStatic[i])
+                {
+                    recordShadowPass(directionalLightShadowMapPass->getStaticRenderPass(), directionalLightShadowMapPass->getStaticFrameBuffer(i), shadowQueues[i], shadowBindings[i]);
+                    shadowStaticKeys[i] = cache.staticKey;
+                }
+                directionalLightShadowMapPass->copyStaticCascade(currentCommandBuffer, i);
+                recordShadowPass(directionalLightShadowMapPass->getDynamicRenderPass(), shadowFrameBuffer, shadowDynamicQueues[i], shadowBindings[i]);
+            }
+            shadowContentKeys[i] = cache.contentKey;
+        }
 
-                vkCmdBindIndexBuffer(currentCommandBuffer, sceneData->indexResource.buffer, indexOffset, VK_INDEX_TYPE_UINT32);
+        // 点光源和聚光灯的阴影图集，只画这一帧要更新的块，其它块保留上一次的内容
+        const std::vector<ShadowAtlasUpdate>& shadowAtlasUpdates = sceneData->shadowAtlasUpdates;
+        if (!shadowAtlasUpdates.empty() || !shadowAtlasInitialized)
+        {
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = shadowAtlasInitialized ? localLightShadowAtlasPass->renderPass : localLightShadowAtlasPass->getResetRenderPass();
+            renderPassInfo.framebuffer = localLightShadowAtlasPass->frameBuffers[0].frameBuffer;
+            renderPassInfo.renderArea.extent.width = localLightShadowAtlasPass->getAtlasSize();
+            renderPassInfo.renderArea.extent.height = localLightShadowAtlasPass->getAtlasSize();
+            std::array<VkClearValue, 1> clearValues{};
+            clearValues[0].depthStencil = { 1.0f, 0 };
+            renderPassInfo.clearValueCount = clearValues.size();
+            renderPassInfo.pClearValues = clearValues.data();
 
-                vertexOffset += sizeof(Vertex) * sceneData->meshes[i]->vertices.size();
-                indexOffset += sizeof(Uint32) * sceneData->meshes[i]->indices.size();
+            // 每块的视口不同，不走secondary commandBuffer和record-once缓存
+            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-                directionalLightShadowMapPass->drawIndexed(currentCommandBuffer, sceneData->meshes[i]->indices.size());
+            for (uint32_t i = 0; i < shadowAtlasUpdates.size(); i++)
+            {
+                const ShadowAtlasUpdate& update = shadowAtlasUpdates[i];
+                RenderQueueBindings atlasBindings;
+                atlasBindings.pipeline = localLightShadowAtlasPass->renderPipelines[0].pipeline;
+                atlasBindings.layout = localLightShadowAtlasPass->renderPipelines[0].layout;
+                atlasBindings.descriptorSets = { localLightShadowAtlasPass->descriptorInfos[frameIndex * MaxShadowAtlasUpdates + i].descriptorSet };
+
+                VulkanRenderQueue& queue = shadowAtlasQueues[i];
+                queue.build(RenderQueuePass::Shadow, 0, sceneData, update.projView, &update.casters);
+                queue.sort();
+                queue.prepare(atlasBindings);
+
+                localLightShadowAtlasPass->beginTile(currentCommandBuffer, update.tile);
+                queue.record(currentCommandBuffer, localLightShadowAtlasPass, atlasBindings);
             }
 
             vulkanRenderer->cmdEndRenderPass(currentCommandBuffer);
+            shadowAtlasInitialized = true;
+        }
+
+        // 在场景pass开始之前剔除，缓存的commandBuffer读的也是这里每帧重新写入的绘制参数
+        if (gpuOcclusionCulling)
+        {
+            occlusionCuller.cull(currentCommandBuffer, opaqueQueue, cameraProjView);
+        }
+        else
+        {
+            opaqueQueue.setGpuDrawSource(VK_NULL_HANDLE, VK_NULL_HANDLE);
+        }
+
+        // compute的延迟光照按屏幕tile自己剔除光源，不读簇列表
+        if (forward || !deferredRenderPass->isComputeLighting())
+        {
+            lightClusterer.dispatch(currentCommandBuffer);
         }
 
         // ForwardLighting
@@ -172,7 +374,7 @@ namespace VulkanEngine
             VkRenderPassBeginInfo renderPassInfo = {};
             renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
             renderPassInfo.renderPass = mainRenderPass->renderPass;
-            renderPassInfo.framebuffer = mainRenderPass->frameBuffers[vulkanRenderer->currentFrameIndex].frameBuffer;
+            renderPassInfo.framebuffer = mainRenderPass->frameBuffers[vulkanRenderer->currentSwapChainImageIndex].frameBuffer;
             renderPassInfo.renderArea.offset = { 0, 0 };
             renderPassInfo.renderArea.extent = vulkanRenderer->swapChainExtent;
             VkClearValue clearColors[2];
@@ -181,31 +383,10 @@ namespace VulkanEngine
             renderPassInfo.clearValueCount = sizeof(clearColors) / sizeof(clearColors[0]);
             renderPassInfo.pClearValues = clearColors;
         
-            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        
-            vulkanRenderer->cmdBindPipeline(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mainRenderPass->renderPipelines[0].pipeline);
-        
-            VkDeviceSize vertexOffset = 0;
-            VkDeviceSize indexOffset = 0;
-            for (size_t i = 0; i < sceneData->meshes.size(); i++)
-            {
-                uint32_t dynamicOffset = i * sizeof(UniformBufferDynamicObject);
-        
-                std::array<VkDescriptorSet, 3> sets = { sceneData->uniformDescriptor.descriptorSet[0], sceneData->meshes[i]->material->descriptorSet, sceneData->directionalLightShadowDescriptor.descriptorSet[0] };
-                vulkanRenderer->cmdBindDescriptorSets(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mainRenderPass->renderPipelines[0].layout, 0, sets.size(), sets.data(), 1, &dynamicOffset);
-        
-                VkBuffer vertexBuffers[] = { sceneData->vertexResource.buffer };
-                VkDeviceSize vertexOffsets[] = { vertexOffset };
-                vkCmdBindVertexBuffers(currentCommandBuffer, 0, 1, vertexBuffers, vertexOffsets);
-        
-                vkCmdBindIndexBuffer(currentCommandBuffer, sceneData->indexResource.buffer, indexOffset, VK_INDEX_TYPE_UINT32);
-        
-                vertexOffset += sizeof(Vertex) * sceneData->meshes[i]->vertices.size();
-                indexOffset += sizeof(Uint32) * sceneData->meshes[i]->indices.size();
-        
-                mainRenderPass->drawIndexed(currentCommandBuffer, sceneData->meshes[i]->indices.size());
-            }
-            UIRenderPass->draw(currentCommandBuffer, 0);
+            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, sceneContents);
+
+            // UI和场景在同一个subpass，一起录制
+            recordRenderQueue(currentCommandBuffer, opaqueQueue, mainRenderPass, sceneBindings, 0, renderPassInfo.framebuffer, true);
         
             vulkanRenderer->cmdEndRenderPass(currentCommandBuffer);
         }
@@ -215,7 +396,7 @@ namespace VulkanEngine
             VkRenderPassBeginInfo renderPassInfo = {};
             renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
             renderPassInfo.renderPass = deferredRenderPass->renderPass;
-            renderPassInfo.framebuffer = deferredRenderPass->swapChainFrameBuffers[vulkanRenderer->currentFrameIndex];
+            renderPassInfo.framebuffer = deferredRenderPass->getGBufferFrameBuffer(vulkanRenderer->currentSwapChainImageIndex);
             renderPassInfo.renderArea.offset = { 0, 0 };
             renderPassInfo.renderArea.extent = vulkanRenderer->swapChainExtent;
 
@@ -232,44 +413,44 @@ namespace VulkanEngine
             renderPassInfo.clearValueCount = sizeof(clearColors) / sizeof(clearColors[0]);
             renderPassInfo.pClearValues = clearColors;
 
-            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-            vulkanRenderer->cmdBindPipeline(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredRenderPass->renderPipelines[0].pipeline);
+            // 只有gbuffer的subpass用secondary，光照、FXAA和UI仍然inline
+            vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, renderPassInfo, sceneContents);
 
-            VkDeviceSize vertexOffset = 0;
-            VkDeviceSize indexOffset = 0;
-            for (size_t i = 0; i < sceneData->meshes.size(); i++)
+            recordRenderQueue(currentCommandBuffer, opaqueQueue, deferredRenderPass, sceneBindings, 0, renderPassInfo.framebuffer, false);
+            
+            if (deferredRenderPass->isComputeLighting())
             {
-                uint32_t dynamicOffset = i * sizeof(UniformBufferDynamicObject);
+                // gbuffer的renderPass结束后用compute算光照，再开始FXAA和UI的renderPass
+                vulkanRenderer->cmdEndRenderPass(currentCommandBuffer);
 
-                std::array<VkDescriptorSet, 2> sets = { sceneData->uniformDescriptor.descriptorSet[0], sceneData->meshes[i]->material->descriptorSet };
-                vulkanRenderer->cmdBindDescriptorSets(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredRenderPass->renderPipelines[0].layout, 0, sets.size(), sets.data(), 1, &dynamicOffset);
+                std::array<VkDescriptorSet, 4> sets = { sceneData->directionalLightShadowDescriptor.descriptorSet[frameIndex], deferredRenderPass->descriptorInfos[0].descriptorSet, sceneData->deferredUniformDescriptor.descriptorSet[0], sceneData->IBLDescriptor.descriptorSet[0] };
+                vulkanRenderer->cmdBindDescriptorSets(currentCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, deferredRenderPass->renderPipelines[1].layout, 0, sets.size(), sets.data(), 0, nullptr);
 
-                VkBuffer vertexBuffers[] = { sceneData->vertexResource.buffer };
-                VkDeviceSize vertexOffsets[] = { vertexOffset };
-                vkCmdBindVertexBuffers(currentCommandBuffer, 0, 1, vertexBuffers, vertexOffsets);
+                deferredRenderPass->dispatchLighting(currentCommandBuffer);
 
-                vkCmdBindIndexBuffer(currentCommandBuffer, sceneData->indexResource.buffer, indexOffset, VK_INDEX_TYPE_UINT32);
+                VkRenderPassBeginInfo postRenderPassInfo = {};
+                postRenderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                postRenderPassInfo.renderPass = deferredRenderPass->getPostRenderPass();
+                postRenderPassInfo.framebuffer = deferredRenderPass->swapChainFrameBuffers[vulkanRenderer->currentSwapChainImageIndex];
+                postRenderPassInfo.renderArea.offset = { 0, 0 };
+                postRenderPassInfo.renderArea.extent = vulkanRenderer->swapChainExtent;
 
-                vertexOffset += sizeof(Vertex) * sceneData->meshes[i]->vertices.size();
-                indexOffset += sizeof(Uint32) * sceneData->meshes[i]->indices.size();
-
-                deferredRenderPass->drawIndexed(currentCommandBuffer, sceneData->meshes[i]->indices.size());
+                vulkanRenderer->cmdBeginRenderPass(currentCommandBuffer, postRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
             }
-            
+            else
             {
                 vkCmdNextSubpass(currentCommandBuffer, VK_SUBPASS_CONTENTS_INLINE);
 
-                vulkanRenderer->cmdBindPipeline(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredRenderPass->renderPipelines[1].pipeline);
-
-                std::array<VkDescriptorSet, 4> sets = { sceneData->directionalLightShadowDescriptor.descriptorSet[0], deferredRenderPass->descriptorInfos[0].descriptorSet, sceneData->deferredUniformDescriptor.descriptorSet[0], sceneData->IBLDescriptor.descriptorSet[0] };
+                std::array<VkDescriptorSet, 4> sets = { sceneData->directionalLightShadowDescriptor.descriptorSet[frameIndex], deferredRenderPass->descriptorInfos[0].descriptorSet, sceneData->deferredUniformDescriptor.descriptorSet[0], sceneData->IBLDescriptor.descriptorSet[0] };
                 vulkanRenderer->cmdBindDescriptorSets(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredRenderPass->renderPipelines[1].layout, 0, sets.size(), sets.data(), 0, nullptr);
 
-                deferredRenderPass->draw(currentCommandBuffer, 3);
+                // 天空、没有阴影、有阴影三类像素各画一次
+                deferredRenderPass->drawLighting(currentCommandBuffer, sceneData->getShadowRangeDepth());
+
+                vkCmdNextSubpass(currentCommandBuffer, VK_SUBPASS_CONTENTS_INLINE);
             }
             // FXAA
             {
-                vkCmdNextSubpass(currentCommandBuffer, VK_SUBPASS_CONTENTS_INLINE);
 
                 vulkanRenderer->cmdBindPipeline(currentCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredRenderPass->renderPipelines[2].pipeline);
 
@@ -287,13 +468,93 @@ namespace VulkanEngine
         vulkanRenderer->endPresent(passUpdateAfterRecreateSwapchain);
     }
 
+    uint64_t Renderer::getRecordCacheKey()
+    {
+        uint64_t key = sceneData->geometryHeap.getLayoutVersion();
+        key = key * 1000003 ^ sceneData->contentVersion;
+        key = key * 1000003 ^ sceneData->meshes.size();
+        // 扩容时重写过descriptor，之前录制的commandBuffer失效
+        key = key * 1000003 ^ sceneData->meshBufferVersion;
+        key = key * 1000003 ^ vulkanRenderer->swapchainVersion;
+        key = key * 1000003 ^ sceneData->visibilityVersion;
+        key = key * 1000003 ^ (forward ? 1 : 0);
+        // 关闭阴影缓存时所有投射物都在shadowQueues里
+        key = key * 1000003 ^ (sceneData->shadowCaching ? 1 : 0);
+        // 录制时选择的绘制来源不同
+        key = key * 1000003 ^ ((sceneData->gpuOcclusionCulling && occlusionCuller.isSupported()) ? 1 : 0);
+        return key;
+    }
+
+    void Renderer::buildRenderQueue(VulkanRenderQueue& queue, RenderQueuePass pass, const glm::mat4& viewProj, const std::vector<uint32_t>& visibleMeshes, const RenderQueueBindings& bindings)
+    {
+        if (reuseSceneCommands && queue.hasCachedCommandBuffers())
+        {
+            return;
+        }
+
+        queue.build(pass, 0, sceneData, viewProj, &visibleMeshes, !recordOnce);
+        queue.sort();
+        queue.prepare(bindings);
+    }
+
+    void Renderer::recordRenderQueue(VkCommandBuffer commandBuffer, VulkanRenderQueue& queue, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, uint32_t subpass, VkFramebuffer framebuffer, bool drawUI)
+    {
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+
+        if (reuseSceneCommands && queue.hasCachedCommandBuffers())
+        {
+            queue.appendCachedCommandBuffers(secondaryCommandBuffers);
+        }
+        else
+        {
+            if (!parallelRecording && !recordOnce)
+            {
+                queue.record(commandBuffer, renderPass, bindings);
+                if (drawUI)
+                {
+                    UIRenderPass->draw(commandBuffer, 0);
+                }
+                return;
+            }
+
+            queue.recordSecondary(secondaryCommandBuffers, renderPass, bindings, subpass, framebuffer, recordOnce);
+        }
+
+        // ImGui不是线程安全的，在主线程录制
+        if (drawUI)
+        {
+            VkCommandBuffer UICommandBuffer = vulkanRenderer->secondaryCommandBuffers.begin(vulkanRenderer->getMainThreadRecordIndex(), renderPass->renderPass, subpass, framebuffer);
+            UIRenderPass->draw(UICommandBuffer, 0);
+            vulkanRenderer->secondaryCommandBuffers.end(UICommandBuffer);
+            secondaryCommandBuffers.push_back(UICommandBuffer);
+        }
+
+        vulkanRenderer->cmdExecuteCommands(commandBuffer, secondaryCommandBuffers);
+    }
+
     void Renderer::quit()
     {
+        // 退出时等待GPU执行完毕，ImGui等资源是立即销毁的
+        vkDeviceWaitIdle(vulkanRenderer->device);
+
         mainRenderPass->clear();
         UIRenderPass->clear();
         directionalLightShadowMapPass->clear();
+        localLightShadowAtlasPass->clear();
         deferredRenderPass->clear();
+        occlusionCuller.cleanup();
+        lightClusterer.cleanup();
         sceneData->clear();
+        for (uint32_t i = 0; i < MaxShadowCascades; i++)
+        {
+            shadowQueues[i].cleanup();
+            shadowDynamicQueues[i].cleanup();
+        }
+        opaqueQueue.cleanup();
+        for (auto& queue : shadowAtlasQueues)
+        {
+            queue.cleanup();
+        }
         delete vulkanRenderer;
     }
 
@@ -0,0 +1,169 @@
+﻿#include "shadowAtlas.hpp"
+
+#include <algorithm>
+
+namespace VulkanEngine
+{
+    void ShadowAtlasAllocator::init(uint32_t atlasSize, uint32_t minTileSize)
+    {
+        // 坐标打包成16位
+        this->atlasSize = std::min(std::max(atlasSize, 1u), 32768u);
+        this->minTileSize = std::min(std::max(minTileSize, 1u), this->atlasSize);
+
+        uint32_t levelCount = 1;
+        while ((this->atlasSize >> levelCount) >= this->minTileSize && (this->atlasSize >> levelCount) > 0)
+        {
+            levelCount++;
+        }
+        freeBlocks.resize(levelCount);
+        reset();
+    }
+
+    void ShadowAtlasAllocator::reset()
+    {
+        for (auto& blocks : freeBlocks)
+        {
+            blocks.clear();
+        }
+        if (!freeBlocks.empty())
+        {
+            freeBlocks[0].push_back(pack(0, 0));
+        }
+        allocatedArea = 0;
+    }
+
+    uint32_t ShadowAtlasAllocator::clampTileSize(uint32_t size) const
+    {
+        uint32_t tileSize = atlasSize;
+        while (tileSize > minTileSize && tileSize > size)
+        {
+            tileSize >>= 1;
+        }
+        return tileSize;
+    }
+
+    uint32_t ShadowAtlasAllocator::getLevel(uint32_t size) const
+    {
+        uint32_t level = 0;
+        while ((atlasSize >> level) > size && level + 1 < freeBlocks.size())
+        {
+            level++;
+        }
+        return level;
+    }
+
+    bool ShadowAtlasAllocator::allocate(uint32_t size, Tile& outTile)
+    {
+        if (freeBlocks.empty())
+        {
+            return false;
+        }
+
+        uint32_t level = getLevel(clampTileSize(size));
+        uint32_t x, y;
+        if (!allocateLevel(level, x, y))
+        {
+            return false;
+        }
+
+        outTile.x = x;
+        outTile.y = y;
+        outTile.size = atlasSize >> level;
+        allocatedArea += static_cast<uint64_t>(outTile.size) * outTile.size;
+        return true;
+    }
+
+    bool ShadowAtlasAllocator::allocateLevel(uint32_t level, uint32_t& outX, uint32_t& outY)
+    {
+        std::vector<uint32_t>& blocks = freeBlocks[level];
+        if (!blocks.empty())
+        {
+            // 优先用坐标最小的块，让分配集中在图集的一角，大块更容易保留下来
+            auto it = std::min_element(blocks.begin(), blocks.end());
+            outX = *it >> 16;
+            outY = *it & 0xffff;
+            blocks.erase(it);
+            return true;
+        }
+
+        if (level == 0)
+        {
+            return false;
+        }
+
+        // 拆分上一级的一块，剩下的三块留作空闲
+        uint32_t parentX, parentY;
+        if (!allocateLevel(level - 1, parentX, parentY))
+        {
+            return false;
+        }
+        uint32_t size = atlasSize >> level;
+        blocks.push_back(pack(parentX + size, parentY));
+        blocks.push_back(pack(parentX, parentY + size));
+        blocks.push_back(pack(parentX + size, parentY + size));
+        outX = parentX;
+        outY = parentY;
+        return true;
+    }
+
+    void ShadowAtlasAllocator::free(const Tile& tile)
+    {
+        if (!tile.isValid() || freeBlocks.empty())
+        {
+            return;
+        }
+
+        freeLevel(getLevel(tile.size), tile.x, tile.y);
+        allocatedArea -= std::min<uint64_t>(allocatedArea, static_cast<uint64_t>(tile.size) * tile.size);
+    }
+
+    void ShadowAtlasAllocator::freeLevel(uint32_t level, uint32_t x, uint32_t y)
+    {
+        std::vector<uint32_t>& blocks = freeBlocks[level];
+        if (level == 0)
+        {
+            blocks.push_back(pack(x, y));
+            return;
+        }
+
+        // 三个兄弟块都空闲时一起合并成上一级的块
+        uint32_t size = atlasSize >> level;
+        uint32_t parentX = x & ~(size * 2 - 1);
+        uint32_t parentY = y & ~(size * 2 - 1);
+        uint32_t siblings[4] = { pack(parentX, parentY), pack(parentX + size, parentY), pack(parentX, parentY + size), pack(parentX + size, parentY + size) };
+
+        uint32_t self = pack(x, y);
+        uint32_t freeSiblings = 0;
+        for (uint32_t sibling : siblings)
+        {
+            if (sibling != self && std::find(blocks.begin(), blocks.end(), sibling) != blocks.end())
+            {
+                freeSiblings++;
+            }
+        }
+
+        if (freeSiblings < 3)
+        {
+            blocks.push_back(self);
+            return;
+        }
+
+        for (uint32_t sibling : siblings)
+        {
+            if (sibling != self)
+            {
+                blocks.erase(std::find(blocks.begin(), blocks.end(), sibling));
+            }
+        }
+        freeLevel(level - 1, parentX, parentY);
+    }
+
+    float ShadowAtlasAllocator::getUsage() const
+    {
+        if (atlasSize == 0)
+        {
+            return 0.0f;
+        }
+        return static_cast<float>(static_cast<double>(allocatedArea) / (static_cast<double>(atlasSize) * atlasSize));
+    }
+}
\ No newline at end of file
@@ -0,0 +1,424 @@
+﻿#include "softwareOcclusionCulling.hpp"
+#include "vulkanScene.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_OCCLUSION_SSE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SOFTWARE_OCCLUSION_NEON
+#endif
+
+namespace VulkanEngine
+{
+    // 一次处理一行里相邻的4个像素
+#if defined(SOFTWARE_OCCLUSION_SSE)
+    using Float4 = __m128;
+    static inline Float4 splat(float value) { return _mm_set1_ps(value); }
+    static inline Float4 load4(const float* data) { return _mm_loadu_ps(data); }
+    static inline void store4(float* data, Float4 value) { _mm_storeu_ps(data, value); }
+    static inline Float4 add4(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+    static inline Float4 madd(Float4 a, Float4 b, Float4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static inline Float4 min4(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+    static inline Float4 max4(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+    static inline Float4 greaterEqual(Float4 a, Float4 b) { return _mm_cmpge_ps(a, b); }
+    static inline Float4 and4(Float4 a, Float4 b) { return _mm_and_ps(a, b); }
+    static inline Float4 select(Float4 mask, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static inline bool anyTrue(Float4 mask) { return _mm_movemask_ps(mask) != 0; }
+    static inline float horizontalMax(Float4 value)
+    {
+        value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+        value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(value);
+    }
+#elif defined(SOFTWARE_OCCLUSION_NEON)
+    using Float4 = float32x4_t;
+    static inline Float4 splat(float value) { return vdupq_n_f32(value); }
+    static inline Float4 load4(const float* data) { return vld1q_f32(data); }
+    static inline void store4(float* data, Float4 value) { vst1q_f32(data, value); }
+    static inline Float4 add4(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+    static inline Float4 madd(Float4 a, Float4 b, Float4 c) { return vmlaq_f32(c, a, b); }
+    static inline Float4 min4(Float4 a, Float4 b) { return vminq_f32(a, b); }
+    static inline Float4 max4(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+    static inline Float4 greaterEqual(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcgeq_f32(a, b)); }
+    static inline Float4 and4(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+    static inline Float4 select(Float4 mask, Float4 a, Float4 b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+    static inline bool anyTrue(Float4 mask)
+    {
+        uint32x4_t bits = vreinterpretq_u32_f32(mask);
+        uint32x2_t half = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+        return (vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) != 0;
+    }
+    static inline float horizontalMax(Float4 value)
+    {
+        float32x2_t half = vpmax_f32(vget_low_f32(value), vget_high_f32(value));
+        half = vpmax_f32(half, half);
+        return vget_lane_f32(half, 0);
+    }
+#else
+    // 没有SIMD时用4个float模拟，掩码用0和1表示
+    struct Float4
+    {
+        float v[4];
+    };
+    static inline Float4 splat(float value) { return { { value, value, value, value } }; }
+    static inline Float4 load4(const float* data) { return { { data[0], data[1], data[2], data[3] } }; }
+    static inline void store4(float* data, Float4 value) { for (int i = 0; i < 4; i++) data[i] = value.v[i]; }
+    static inline Float4 add4(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i]; return r; }
+    static inline Float4 madd(Float4 a, Float4 b, Float4 c) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i] + c.v[i]; return r; }
+    static inline Float4 min4(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = std::min(a.v[i], b.v[i]); return r; }
+    static inline Float4 max4(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = std::max(a.v[i], b.v[i]); return r; }
+    static inline Float4 greaterEqual(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] >= b.v[i] ? 1.0f : 0.0f; return r; }
+    static inline Float4 and4(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = (a.v[i] != 0.0f && b.v[i] != 0.0f) ? 1.0f : 0.0f; return r; }
+    static inline Float4 select(Float4 mask, Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = mask.v[i] != 0.0f ? a.v[i] : b.v[i]; return r; }
+    static inline bool anyTrue(Float4 mask) { return mask.v[0] != 0.0f || mask.v[1] != 0.0f || mask.v[2] != 0.0f || mask.v[3] != 0.0f; }
+    static inline float horizontalMax(Float4 value) { return std::max(std::max(value.v[0], value.v[1]), std::max(value.v[2], value.v[3])); }
+#endif
+
+    // 比这更靠近相机平面的顶点不做裁剪，整个三角形或包围盒按不可靠处理
+    static const float MinClipW = 1e-4f;
+    // 屏幕上小于这个面积（像素）的mesh挡不住什么，不当作遮挡体
+    static const float MinOccluderArea = 64.0f;
+    static const uint32_t TestChunkSize = 64;
+
+    // 包围盒投影到屏幕的矩形和最近的深度，穿过相机平面时返回false
+    static bool projectBox(const Box& box, const glm::mat4& viewProj, glm::vec2& screenMin, glm::vec2& screenMax, float& minDepth)
+    {
+        screenMin = glm::vec2(std::numeric_limits<float>::max());
+        screenMax = glm::vec2(-std::numeric_limits<float>::max());
+        minDepth = std::numeric_limits<float>::max();
+
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+            glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+            if (clip.w <= MinClipW)
+            {
+                return false;
+            }
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            glm::vec2 screen((ndc.x * 0.5f + 0.5f) * SoftwareOcclusionCuller::Width, (ndc.y * 0.5f + 0.5f) * SoftwareOcclusionCuller::Height);
+            screenMin = glm::min(screenMin, screen);
+            screenMax = glm::max(screenMax, screen);
+            minDepth = std::min(minDepth, ndc.z);
+        }
+        return true;
+    }
+
+    void SoftwareOcclusionCuller::init(ThreadPool* threadPool)
+    {
+        this->threadPool = threadPool;
+
+        depth.assign(Width * Height, 1.0f);
+        tileMaxDepth.assign(TilesX * TilesY, 1.0f);
+        tileBins.resize(TilesX * TilesY);
+    }
+
+    uint32_t SoftwareOcclusionCuller::addOccluder(VulkanRenderSceneData* sceneData, uint32_t meshIndex, const glm::mat4& viewProj)
+    {
+        Mesh* mesh = sceneData->meshes[meshIndex];
+        glm::mat4 mvp = viewProj * sceneData->rotate * mesh->node->worldTransform;
+
+        clipPositions.resize(mesh->vertices.size());
+        for (size_t i = 0; i < mesh->vertices.size(); i++)
+        {
+            clipPositions[i] = mvp * glm::vec4(mesh->vertices[i].position, 1.0f);
+        }
+
+        uint32_t triangleCount = 0;
+        for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+        {
+            glm::vec3 v[3];
+            bool valid = true;
+            for (int k = 0; k < 3; k++)
+            {
+                const glm::vec4& clip = clipPositions[mesh->indices[i + k]];
+                // 近平面前面的部分实际不会画出来，遮挡体漏画只会少剔除，不会剔错
+                if (clip.w <= MinClipW || clip.z < 0.0f)
+                {
+                    valid = false;
+                    break;
+                }
+                v[k] = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * Width, (clip.y / clip.w * 0.5f + 0.5f) * Height, clip.z / clip.w);
+            }
+            if (!valid)
+            {
+                continue;
+            }
+
+            // 不区分正反面，统一成逆时针，三条边函数在内部都不小于0
+            float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+            if (std::abs(area) < 1e-6f)
+            {
+                continue;
+            }
+            if (area < 0.0f)
+            {
+                std::swap(v[1], v[2]);
+                area = -area;
+            }
+
+            ScreenTriangle triangle;
+            triangle.minX = std::max(static_cast<int32_t>(std::floor(std::min({ v[0].x, v[1].x, v[2].x }))), 0);
+            triangle.minY = std::max(static_cast<int32_t>(std::floor(std::min({ v[0].y, v[1].y, v[2].y }))), 0);
+            triangle.maxX = std::min(static_cast<int32_t>(std::ceil(std::max({ v[0].x, v[1].x, v[2].x }))), static_cast<int32_t>(Width));
+            triangle.maxY = std::min(static_cast<int32_t>(std::ceil(std::max({ v[0].y, v[1].y, v[2].y }))), static_cast<int32_t>(Height));
+            if (triangle.minX >= triangle.maxX || triangle.minY >= triangle.maxY)
+            {
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                const glm::vec3& a = v[(k + 1) % 3];
+                const glm::vec3& b = v[(k + 2) % 3];
+                triangle.edgeA[k] = a.y - b.y;
+                triangle.edgeB[k] = b.x - a.x;
+                triangle.edgeC[k] = a.x * b.y - a.y * b.x;
+            }
+
+            // 屏幕空间里ndc的z是线性的
+            glm::vec3 d1 = v[1] - v[0];
+            glm::vec3 d2 = v[2] - v[0];
+            triangle.depthA = (d1.z * d2.y - d2.z * d1.y) / area;
+            triangle.depthB = (d2.z * d1.x - d1.z * d2.x) / area;
+            triangle.depthC = v[0].z - triangle.depthA * v[0].x - triangle.depthB * v[0].y;
+
+            uint32_t triangleIndex = static_cast<uint32_t>(triangles.size());
+            triangles.push_back(triangle);
+            triangleCount++;
+
+            for (int32_t tileY = triangle.minY / TileHeight; tileY <= (triangle.maxY - 1) / static_cast<int32_t>(TileHeight); tileY++)
+            {
+                for (int32_t tileX = triangle.minX / TileWidth; tileX <= (triangle.maxX - 1) / static_cast<int32_t>(TileWidth); tileX++)
+                {
+                    tileBins[tileY * TilesX + tileX].push_back(triangleIndex);
+                }
+            }
+        }
+        return triangleCount;
+    }
+
+    void SoftwareOcclusionCuller::rasterizeTile(uint32_t tileIndex)
+    {
+        const int32_t tileX0 = (tileIndex % TilesX) * TileWidth;
+        const int32_t tileY0 = (tileIndex / TilesX) * TileHeight;
+        const int32_t tileX1 = tileX0 + TileWidth;
+        const int32_t tileY1 = tileY0 + TileHeight;
+
+        for (int32_t y = tileY0; y < tileY1; y++)
+        {
+            std::fill_n(&depth[y * Width + tileX0], TileWidth, 1.0f);
+        }
+
+        // 4个lane的像素中心
+        static const float laneOffsets[4] = { 0.5f, 1.5f, 2.5f, 3.5f };
+        const Float4 laneOffset = load4(laneOffsets);
+        const Float4 zero = splat(0.0f);
+
+        for (uint32_t triangleIndex : tileBins[tileIndex])
+        {
+            const ScreenTriangle& triangle = triangles[triangleIndex];
+
+            // TileWidth是4的倍数，按4对齐后不会越出tile
+            int32_t x0 = std::max(triangle.minX, tileX0) & ~3;
+            int32_t x1 = std::min(triangle.maxX, tileX1);
+            int32_t y0 = std::max(triangle.minY, tileY0);
+            int32_t y1 = std::min(triangle.maxY, tileY1);
+
+            Float4 edgeA[3];
+            for (int k = 0; k < 3; k++)
+            {
+                edgeA[k] = splat(triangle.edgeA[k]);
+            }
+            Float4 depthA = splat(triangle.depthA);
+
+            for (int32_t y = y0; y < y1; y++)
+            {
+                // 像素中心
+                float pixelY = y + 0.5f;
+                Float4 rowEdge[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    rowEdge[k] = splat(triangle.edgeB[k] * pixelY + triangle.edgeC[k]);
+                }
+                Float4 rowDepth = splat(triangle.depthB * pixelY + triangle.depthC);
+
+                float* row = &depth[y * Width];
+                for (int32_t x = x0; x < x1; x += 4)
+                {
+                    Float4 pixelX = add4(splat(static_cast<float>(x)), laneOffset);
+                    Float4 inside = greaterEqual(madd(edgeA[0], pixelX, rowEdge[0]), zero);
+                    inside = and4(inside, greaterEqual(madd(edgeA[1], pixelX, rowEdge[1]), zero));
+                    inside = and4(inside, greaterEqual(madd(edgeA[2], pixelX, rowEdge[2]), zero));
+                    if (!anyTrue(inside))
+                    {
+                        continue;
+                    }
+
+                    Float4 pixelDepth = madd(depthA, pixelX, rowDepth);
+                    Float4 current = load4(row + x);
+                    store4(row + x, select(inside, min4(current, pixelDepth), current));
+                }
+            }
+        }
+
+        Float4 maxDepth = splat(0.0f);
+        for (int32_t y = tileY0; y < tileY1; y++)
+        {
+            const float* row = &depth[y * Width];
+            for (int32_t x = tileX0; x < tileX1; x += 4)
+            {
+                maxDepth = max4(maxDepth, load4(row + x));
+            }
+        }
+        tileMaxDepth[tileIndex] = horizontalMax(maxDepth);
+    }
+
+    bool SoftwareOcclusionCuller::isOccluded(const Box& box, const glm::mat4& viewProj) const
+    {
+        if (!box.isValid())
+        {
+            return false;
+        }
+
+        glm::vec2 screenMin, screenMax;
+        float minDepth;
+        if (!projectBox(box, viewProj, screenMin, screenMax, minDepth))
+        {
+            return false;
+        }
+
+        // 矩形碰到的所有像素都参与比较
+        int32_t x0 = std::max(static_cast<int32_t>(std::floor(screenMin.x)), 0);
+        int32_t y0 = std::max(static_cast<int32_t>(std::floor(screenMin.y)), 0);
+        int32_t x1 = std::min(static_cast<int32_t>(std::ceil(screenMax.x)), static_cast<int32_t>(Width));
+        int32_t y1 = std::min(static_cast<int32_t>(std::ceil(screenMax.y)), static_cast<int32_t>(Height));
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return false;
+        }
+
+        const Float4 boxDepth = splat(minDepth);
+
+        for (int32_t tileY = y0 / TileHeight; tileY <= (y1 - 1) / static_cast<int32_t>(TileHeight); tileY++)
+        {
+            for (int32_t tileX = x0 / TileWidth; tileX <= (x1 - 1) / static_cast<int32_t>(TileWidth); tileX++)
+            {
+                // 整个tile最远的遮挡深度都比包围盒近
+                if (tileMaxDepth[tileY * TilesX + tileX] < minDepth)
+                {
+                    continue;
+                }
+
+                // 向外扩到4对齐，多比较的像素只会让结果更保守
+                int32_t px0 = std::max(x0, tileX * static_cast<int32_t>(TileWidth)) & ~3;
+                int32_t px1 = std::min(x1, (tileX + 1) * static_cast<int32_t>(TileWidth));
+                int32_t py0 = std::max(y0, tileY * static_cast<int32_t>(TileHeight));
+                int32_t py1 = std::min(y1, (tileY + 1) * static_cast<int32_t>(TileHeight));
+
+                for (int32_t y = py0; y < py1; y++)
+                {
+                    const float* row = &depth[y * Width];
+                    for (int32_t x = px0; x < px1; x += 4)
+                    {
+                        if (anyTrue(greaterEqual(load4(row + x), boxDepth)))
+                        {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void SoftwareOcclusionCuller::cull(VulkanRenderSceneData* sceneData, const glm::mat4& viewProj, uint32_t triangleBudget, std::vector<uint32_t>& visibleMeshes, SoftwareOcclusionStats& stats)
+    {
+        stats = SoftwareOcclusionStats();
+        stats.tested = static_cast<uint32_t>(visibleMeshes.size());
+
+        // 按屏幕面积从大到小挑遮挡体
+        occluderCandidates.clear();
+        for (uint32_t meshIndex : visibleMeshes)
+        {
+            const Mesh* mesh = sceneData->meshes[meshIndex];
+            glm::vec2 screenMin, screenMax;
+            float minDepth;
+            if (mesh->indices.empty() || !mesh->worldBounds.isValid() || !projectBox(mesh->worldBounds, viewProj, screenMin, screenMax, minDepth))
+            {
+                continue;
+            }
+
+            screenMin = glm::clamp(screenMin, glm::vec2(0.0f), glm::vec2(Width, Height));
+            screenMax = glm::clamp(screenMax, glm::vec2(0.0f), glm::vec2(Width, Height));
+            glm::vec2 size = screenMax - screenMin;
+            float area = size.x * size.y;
+            if (area >= MinOccluderArea)
+            {
+                occluderCandidates.push_back({ area, meshIndex });
+            }
+        }
+        std::sort(occluderCandidates.begin(), occluderCandidates.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+            return a.first > b.first;
+        });
+
+        triangles.clear();
+        for (auto& bin : tileBins)
+        {
+            bin.clear();
+        }
+
+        uint32_t remainingTriangles = triangleBudget;
+        for (const auto& candidate : occluderCandidates)
+        {
+            uint32_t triangleCount = static_cast<uint32_t>(sceneData->meshes[candidate.second]->indices.size() / 3);
+            if (triangleCount > remainingTriangles)
+            {
+                continue;
+            }
+            remainingTriangles -= triangleCount;
+
+            stats.occluderMeshes++;
+            stats.occluderTriangles += addOccluder(sceneData, candidate.second, viewProj);
+        }
+
+        if (triangles.empty())
+        {
+            return;
+        }
+
+        // 每个tile只写自己的像素，不需要同步
+        threadPool->parallelFor(TilesX * TilesY, [this](uint32_t task, uint32_t /*thread*/) {
+            rasterizeTile(task);
+        });
+
+        uint32_t meshCount = static_cast<uint32_t>(visibleMeshes.size());
+        occluded.assign(meshCount, 0);
+        uint32_t chunkCount = (meshCount + TestChunkSize - 1) / TestChunkSize;
+        threadPool->parallelFor(chunkCount, [&](uint32_t chunk, uint32_t /*thread*/) {
+            uint32_t end = std::min(meshCount, (chunk + 1) * TestChunkSize);
+            for (uint32_t i = chunk * TestChunkSize; i < end; i++)
+            {
+                occluded[i] = isOccluded(sceneData->meshes[visibleMeshes[i]]->worldBounds, viewProj) ? 1 : 0;
+            }
+        });
+
+        uint32_t writeIndex = 0;
+        for (uint32_t i = 0; i < meshCount; i++)
+        {
+            if (!occluded[i])
+            {
+                visibleMeshes[writeIndex++] = visibleMeshes[i];
+            }
+        }
+        stats.occluded = meshCount - writeIndex;
+        visibleMeshes.resize(writeIndex);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+﻿#include "threadPool.hpp"
+
+namespace VulkanEngine
+{
+    ThreadPool::~ThreadPool()
+    {
+        shutdown();
+    }
+
+    void ThreadPool::init(uint32_t threadCount)
+    {
+        shutdown();
+
+        stopping = false;
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    void ThreadPool::shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+    void ThreadPool::parallelFor(uint32_t taskCount, const TaskFunction& function)
+    {
+        if (taskCount == 0)
+        {
+            return;
+        }
+
+        // 没有工作线程时直接在调用线程执行
+        if (threads.empty())
+        {
+            for (uint32_t i = 0; i < taskCount; i++)
+            {
+                function(i, 0);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentFunction = &function;
+            this->taskCount = taskCount;
+            nextTask = 0;
+            finishedTasks = 0;
+            jobSerial++;
+        }
+        wakeCondition.notify_all();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [this]() { return finishedTasks == this->taskCount && activeThreads == 0; });
+        currentFunction = nullptr;
+    }
+
+    void ThreadPool::workerLoop(uint32_t threadIndex)
+    {
+        uint64_t handledSerial = 0;
+
+        while (true)
+        {
+            const TaskFunction* function = nullptr;
+            uint32_t count = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&]() { return stopping || (currentFunction != nullptr && jobSerial != handledSerial); });
+                if (stopping)
+                {
+                    return;
+                }
+
+                handledSerial = jobSerial;
+                function = currentFunction;
+                count = taskCount;
+                activeThreads++;
+            }
+
+            uint32_t finished = 0;
+            for (uint32_t task = nextTask++; task < count; task = nextTask++)
+            {
+                (*function)(task, threadIndex);
+                finished++;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finishedTasks += finished;
+                activeThreads--;
+            }
+            doneCondition.notify_one();
+        }
+    }
+}
\ No newline at end of file
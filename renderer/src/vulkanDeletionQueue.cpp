@@ -0,0 +1,166 @@
+﻿#include "vulkanDeletionQueue.hpp"
+#include "vulkanRenderer.hpp"
+#include "macro.hpp"
+
+namespace VulkanEngine
+{
+    void VulkanDeletionQueue::init(VulkanRenderer* vulkanRenderer)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        fenceFrameSerials.assign(VulkanRenderer::MAX_FRAMES_IN_FLIGHT, 0);
+    }
+
+    void VulkanDeletionQueue::destroyBuffer(VkBuffer buffer)
+    {
+        if (buffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VkDevice device = vulkanRenderer->device;
+        push([device, buffer]() { vkDestroyBuffer(device, buffer, nullptr); });
+    }
+
+    void VulkanDeletionQueue::destroyImage(VkImage image)
+    {
+        if (image == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VkDevice device = vulkanRenderer->device;
+        push([device, image]() { vkDestroyImage(device, image, nullptr); });
+    }
+
+    void VulkanDeletionQueue::destroyImageView(VkImageView imageView)
+    {
+        if (imageView == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VkDevice device = vulkanRenderer->device;
+        push([device, imageView]() { vkDestroyImageView(device, imageView, nullptr); });
+    }
+
+    void VulkanDeletionQueue::destroySampler(VkSampler sampler)
+    {
+        if (sampler == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VkDevice device = vulkanRenderer->device;
+        push([device, sampler]() { vkDestroySampler(device, sampler, nullptr); });
+    }
+
+    void VulkanDeletionQueue::destroyFramebuffer(VkFramebuffer framebuffer)
+    {
+        if (framebuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VkDevice device = vulkanRenderer->device;
+        push([device, framebuffer]() { vkDestroyFramebuffer(device, framebuffer, nullptr); });
+    }
+
+    void VulkanDeletionQueue::freeDescriptorSet(VkDescriptorSet descriptorSet)
+    {
+        if (descriptorSet == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        // 由分配器找到所属的pool
+        VulkanRenderer* renderer = vulkanRenderer;
+        push([renderer, descriptorSet]() { renderer->descriptorAllocator.free(descriptorSet); });
+    }
+
+    void VulkanDeletionQueue::freeMemory(VkDeviceMemory memory)
+    {
+        if (memory == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        // 走VulkanRenderer释放，保证显存统计正确
+        VulkanRenderer* renderer = vulkanRenderer;
+        push([renderer, memory]() {
+            VkDeviceMemory releaseMemory = memory;
+            renderer->freeMemory(releaseMemory);
+        });
+    }
+
+    void VulkanDeletionQueue::push(std::function<void()>&& deleter)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingDeletions.push_back({ currentFrameSerial, std::move(deleter) });
+    }
+
+    void VulkanDeletionQueue::onFrameSubmitted(uint32_t frameIndex)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fenceFrameSerials[frameIndex] = currentFrameSerial;
+        currentFrameSerial++;
+    }
+
+    uint64_t VulkanDeletionQueue::getCompletedFrameSerial()
+    {
+        // 所有已提交的帧都完成了，那么完成到当前帧的前一帧
+        uint64_t completedFrameSerial = currentFrameSerial - 1;
+        for (uint32_t i = 0; i < fenceFrameSerials.size(); i++)
+        {
+            if (fenceFrameSerials[i] == 0 || fenceFrameSerials[i] > completedFrameSerial)
+            {
+                continue;
+            }
+
+            // 该fence对应的帧还没执行完，那么它之前的帧才能保证完成
+            if (vkGetFenceStatus(vulkanRenderer->device, vulkanRenderer->isFrameInFlightFences[i]) != VK_SUCCESS)
+            {
+                completedFrameSerial = fenceFrameSerials[i] - 1;
+            }
+        }
+        return completedFrameSerial;
+    }
+
+    void VulkanDeletionQueue::collect()
+    {
+        std::vector<std::function<void()>> deleters;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pendingDeletions.empty())
+            {
+                return;
+            }
+
+            uint64_t completedFrameSerial = getCompletedFrameSerial();
+
+            // 队列按帧序号递增，遇到未完成的就可以停止了
+            while (!pendingDeletions.empty() && pendingDeletions.front().frameSerial <= completedFrameSerial)
+            {
+                deleters.push_back(std::move(pendingDeletions.front().deleter));
+                pendingDeletions.pop_front();
+            }
+        }
+
+        for (auto& deleter : deleters)
+        {
+            deleter();
+        }
+    }
+
+    void VulkanDeletionQueue::flush()
+    {
+        std::deque<PendingDeletion> deletions;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            deletions.swap(pendingDeletions);
+        }
+
+        for (auto& deletion : deletions)
+        {
+            deletion.deleter();
+        }
+    }
+
+    size_t VulkanDeletionQueue::getPendingCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pendingDeletions.size();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,298 @@
+﻿#include "vulkanDescriptorAllocator.hpp"
+#include "vulkanRenderer.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+
+namespace VulkanEngine
+{
+    // 每个set平均需要的各类descriptor数量
+    const std::vector<VulkanDescriptorAllocator::PoolSizeRatio> VulkanDescriptorAllocator::poolSizeRatios =
+    {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+    };
+
+    void VulkanDescriptorAllocator::init(VulkanRenderer* vulkanRenderer)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        device = vulkanRenderer->device;
+
+        nextSetsPerPool = initialSetsPerPool;
+        framePools.resize(VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+    }
+
+    void VulkanDescriptorAllocator::cleanup()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto pool : pools)
+        {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        pools.clear();
+        setOwners.clear();
+
+        for (auto& frame : framePools)
+        {
+            for (auto pool : frame.pools)
+            {
+                vkDestroyDescriptorPool(device, pool, nullptr);
+            }
+            frame.pools.clear();
+            frame.currentPool = 0;
+        }
+
+        cachedSets.clear();
+        cachedSetKeys.clear();
+    }
+
+    VkDescriptorPool VulkanDescriptorAllocator::createPool(uint32_t maxSets, VkDescriptorPoolCreateFlags flags)
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes;
+        for (const auto& ratio : poolSizeRatios)
+        {
+            poolSizes.push_back({ ratio.type, static_cast<uint32_t>(ratio.ratio * maxSets) });
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = maxSets;
+        poolInfo.flags = flags;
+
+        VkDescriptorPool pool;
+        VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+
+        return pool;
+    }
+
+    VkResult VulkanDescriptorAllocator::allocateFromPool(VkDescriptorPool pool, VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet)
+    {
+        VkDescriptorSetAllocateInfo allocateInfo = {};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocateInfo.pNext = nullptr;
+        allocateInfo.descriptorPool = pool;
+        allocateInfo.descriptorSetCount = 1;
+        allocateInfo.pSetLayouts = &layout;
+
+        return vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet);
+    }
+
+    bool VulkanDescriptorAllocator::needNewPool(VkResult result)
+    {
+        return result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL;
+    }
+
+    VkResult VulkanDescriptorAllocator::allocate(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return allocateLocked(layout, descriptorSet);
+    }
+
+    VkResult VulkanDescriptorAllocator::allocateLocked(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet)
+    {
+        VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+        if (!pools.empty())
+        {
+            result = allocateFromPool(pools.back(), layout, descriptorSet);
+        }
+
+        // 当前pool满了，开一个更大的新pool
+        if (needNewPool(result))
+        {
+            pools.push_back(createPool(nextSetsPerPool, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT));
+            LOG_DEBUG("create descriptor pool {} with {} sets", pools.size(), nextSetsPerPool);
+            nextSetsPerPool = std::min(nextSetsPerPool * 2, maxSetsPerPool);
+
+            result = allocateFromPool(pools.back(), layout, descriptorSet);
+        }
+
+        if (VK_SUCCESS != result)
+        {
+            LOG_ERROR("failed to allocate descriptor set: {}", errorString(result));
+            return result;
+        }
+
+        setOwners[descriptorSet] = pools.back();
+        return result;
+    }
+
+    void VulkanDescriptorAllocator::free(VkDescriptorSet descriptorSet)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto iter = setOwners.find(descriptorSet);
+        if (iter == setOwners.end())
+        {
+            LOG_WARN("free descriptor set not allocated by allocator");
+            return;
+        }
+
+        vkFreeDescriptorSets(device, iter->second, 1, &descriptorSet);
+        setOwners.erase(iter);
+    }
+
+    VkResult VulkanDescriptorAllocator::allocateFrame(VkDescriptorSetLayout layout, VkDescriptorSet& descriptorSet, uint32_t frameIndex)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& frame = framePools[frameIndex];
+
+        VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+        while (frame.currentPool < frame.pools.size())
+        {
+            result = allocateFromPool(frame.pools[frame.currentPool], layout, descriptorSet);
+            if (!needNewPool(result))
+            {
+                break;
+            }
+            frame.currentPool++;
+        }
+
+        if (needNewPool(result))
+        {
+            frame.pools.push_back(createPool(framePoolSets, 0));
+            frame.currentPool = static_cast<uint32_t>(frame.pools.size() - 1);
+
+            result = allocateFromPool(frame.pools.back(), layout, descriptorSet);
+        }
+
+        if (VK_SUCCESS != result)
+        {
+            LOG_ERROR("failed to allocate frame descriptor set: {}", errorString(result));
+        }
+        return result;
+    }
+
+    void VulkanDescriptorAllocator::resetFrame(uint32_t frameIndex)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& frame = framePools[frameIndex];
+        for (uint32_t i = 0; i <= frame.currentPool && i < frame.pools.size(); i++)
+        {
+            vkResetDescriptorPool(device, frame.pools[i], 0);
+        }
+        frame.currentPool = 0;
+    }
+
+    size_t VulkanDescriptorAllocator::CacheKeyHash::operator()(const std::vector<uint64_t>& key) const
+    {
+        size_t seed = key.size();
+        for (auto value : key)
+        {
+            seed ^= std::hash<uint64_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+
+    std::vector<uint64_t> VulkanDescriptorAllocator::makeCacheKey(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes)
+    {
+        std::vector<uint64_t> key;
+        key.push_back((uint64_t)layout);
+
+        for (const auto& write : writes)
+        {
+            key.push_back(((uint64_t)write.dstBinding << 32) | write.dstArrayElement);
+            key.push_back(((uint64_t)write.descriptorType << 32) | write.descriptorCount);
+
+            for (uint32_t i = 0; i < write.descriptorCount; i++)
+            {
+                if (write.pImageInfo != nullptr)
+                {
+                    key.push_back((uint64_t)write.pImageInfo[i].sampler);
+                    key.push_back((uint64_t)write.pImageInfo[i].imageView);
+                    key.push_back((uint64_t)write.pImageInfo[i].imageLayout);
+                }
+                else if (write.pBufferInfo != nullptr)
+                {
+                    key.push_back((uint64_t)write.pBufferInfo[i].buffer);
+                    key.push_back(write.pBufferInfo[i].offset);
+                    key.push_back(write.pBufferInfo[i].range);
+                }
+            }
+        }
+        return key;
+    }
+
+    VkDescriptorSet VulkanDescriptorAllocator::getOrCreateCachedSet(VkDescriptorSetLayout layout, std::vector<VkWriteDescriptorSet> writes)
+    {
+        std::vector<uint64_t> key = makeCacheKey(layout, writes);
+
+        // 查找、分配和插入在同一个锁里，避免两个线程同时未命中各自分配一个set
+        std::lock_guard<std::mutex> lock(mutex);
+        auto iter = cachedSets.find(key);
+        if (iter != cachedSets.end())
+        {
+            iter->second.refCount++;
+            return iter->second.descriptorSet;
+        }
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        if (VK_SUCCESS != allocateLocked(layout, descriptorSet))
+        {
+            return VK_NULL_HANDLE;
+        }
+
+        for (auto& write : writes)
+        {
+            write.dstSet = descriptorSet;
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+        cachedSets[key] = { descriptorSet, 1 };
+        cachedSetKeys[descriptorSet] = key;
+
+        return descriptorSet;
+    }
+
+    void VulkanDescriptorAllocator::releaseCachedSet(VkDescriptorSet descriptorSet)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto keyIter = cachedSetKeys.find(descriptorSet);
+            if (keyIter == cachedSetKeys.end())
+            {
+                return;
+            }
+
+            auto setIter = cachedSets.find(keyIter->second);
+            if (--setIter->second.refCount > 0)
+            {
+                return;
+            }
+
+            cachedSets.erase(setIter);
+            cachedSetKeys.erase(keyIter);
+        }
+
+        // 可能还在被inflight的帧使用
+        vulkanRenderer->deletionQueue.freeDescriptorSet(descriptorSet);
+    }
+
+    uint32_t VulkanDescriptorAllocator::getPoolCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t count = static_cast<uint32_t>(pools.size());
+        for (const auto& frame : framePools)
+        {
+            count += static_cast<uint32_t>(frame.pools.size());
+        }
+        return count;
+    }
+
+    uint32_t VulkanDescriptorAllocator::getCachedSetCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<uint32_t>(cachedSets.size());
+    }
+}
\ No newline at end of file
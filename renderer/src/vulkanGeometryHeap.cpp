@@ -0,0 +1,507 @@
+﻿#include "vulkanGeometryHeap.hpp"
+#include "vulkanRenderer.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace VulkanEngine
+{
+    void RangeAllocator::init(uint32_t capacity)
+    {
+        this->capacity = capacity;
+        used = 0;
+        freeByOffset.clear();
+        freeBySize.clear();
+
+        if (capacity > 0)
+        {
+            insertFreeRange(0, capacity);
+        }
+    }
+
+    void RangeAllocator::grow(uint32_t newCapacity)
+    {
+        if (newCapacity <= capacity)
+        {
+            return;
+        }
+
+        uint32_t oldCapacity = capacity;
+        capacity = newCapacity;
+        mergeFreeRange(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    uint32_t RangeAllocator::allocate(uint32_t count)
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        // 能放下的最小区间
+        auto sizeIter = freeBySize.lower_bound(count);
+        if (sizeIter == freeBySize.end())
+        {
+            return InvalidOffset;
+        }
+
+        uint32_t offset = sizeIter->second;
+        takeFromFreeRange(freeByOffset.find(offset), count);
+        return offset;
+    }
+
+    uint32_t RangeAllocator::allocateBelow(uint32_t count, uint32_t limit)
+    {
+        if (count == 0)
+        {
+            return InvalidOffset;
+        }
+
+        // 地址最低的能放下的区间，搬完之后空洞都往后集中
+        for (auto iter = freeByOffset.begin(); iter != freeByOffset.end() && iter->first < limit; iter++)
+        {
+            if (iter->second >= count && iter->first + count <= limit)
+            {
+                uint32_t offset = iter->first;
+                takeFromFreeRange(iter, count);
+                return offset;
+            }
+        }
+        return InvalidOffset;
+    }
+
+    void RangeAllocator::free(uint32_t offset, uint32_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        used -= count;
+        mergeFreeRange(offset, count);
+    }
+
+    uint32_t RangeAllocator::getLargestFreeRange() const
+    {
+        return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+    }
+
+    void RangeAllocator::insertFreeRange(uint32_t offset, uint32_t count)
+    {
+        freeByOffset[offset] = count;
+        freeBySize.insert({ count, offset });
+    }
+
+    void RangeAllocator::mergeFreeRange(uint32_t offset, uint32_t count)
+    {
+        auto next = freeByOffset.lower_bound(offset);
+        if (next != freeByOffset.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                count += prev->second;
+                eraseFreeRange(prev);
+            }
+        }
+
+        next = freeByOffset.lower_bound(offset);
+        if (next != freeByOffset.end() && offset + count == next->first)
+        {
+            count += next->second;
+            eraseFreeRange(next);
+        }
+
+        insertFreeRange(offset, count);
+    }
+
+    void RangeAllocator::eraseFreeRange(std::map<uint32_t, uint32_t>::iterator iter)
+    {
+        auto range = freeBySize.equal_range(iter->second);
+        for (auto sizeIter = range.first; sizeIter != range.second; sizeIter++)
+        {
+            if (sizeIter->second == iter->first)
+            {
+                freeBySize.erase(sizeIter);
+                break;
+            }
+        }
+        freeByOffset.erase(iter);
+    }
+
+    void RangeAllocator::takeFromFreeRange(std::map<uint32_t, uint32_t>::iterator iter, uint32_t count)
+    {
+        uint32_t offset = iter->first;
+        uint32_t size = iter->second;
+        eraseFreeRange(iter);
+
+        if (size > count)
+        {
+            insertFreeRange(offset + count, size - count);
+        }
+        used += count;
+    }
+
+    static const VkBufferUsageFlags vertexHeapUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    static const VkBufferUsageFlags indexHeapUsage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    void VulkanGeometryHeap::init(VulkanRenderer* vulkanRenderer, uint32_t vertexStride, uint32_t vertexCapacity, uint32_t indexCapacity)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        this->vertexStride = vertexStride;
+
+        vertexAllocator = std::make_shared<RangeAllocator>();
+        vertexAllocator->init(vertexCapacity);
+        indexAllocator = std::make_shared<RangeAllocator>();
+        indexAllocator->init(indexCapacity);
+
+        createHeapBuffer(vertexBuffer, static_cast<VkDeviceSize>(vertexCapacity) * vertexStride, vertexHeapUsage);
+        createHeapBuffer(indexBuffer, static_cast<VkDeviceSize>(indexCapacity) * sizeof(uint32_t), indexHeapUsage);
+        vertexBufferCapacity = vertexCapacity;
+        indexBufferCapacity = indexCapacity;
+    }
+
+    void VulkanGeometryHeap::cleanup()
+    {
+        auto& deletionQueue = vulkanRenderer->deletionQueue;
+
+        deletionQueue.destroyBuffer(vertexBuffer.buffer);
+        deletionQueue.freeMemory(vertexBuffer.memory);
+        deletionQueue.destroyBuffer(indexBuffer.buffer);
+        deletionQueue.freeMemory(indexBuffer.memory);
+        vertexBuffer = {};
+        indexBuffer = {};
+        vertexBufferCapacity = 0;
+        indexBufferCapacity = 0;
+
+        vertexAllocator.reset();
+        indexAllocator.reset();
+
+        allocations.clear();
+        allocationUsed.clear();
+        freeHandles.clear();
+        meshCount = 0;
+        layoutVersion++;
+
+        pendingUploads.clear();
+    }
+
+    GeometryHandle VulkanGeometryHeap::addMesh(const void* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount)
+    {
+        // 分配器先扩容，buffer等上传时再扩
+        uint32_t vertexOffset = vertexAllocator->allocate(vertexCount);
+        if (vertexOffset == RangeAllocator::InvalidOffset)
+        {
+            uint32_t capacity = vertexAllocator->getCapacity();
+            vertexAllocator->grow(std::max(capacity * 2, capacity + vertexCount));
+            vertexOffset = vertexAllocator->allocate(vertexCount);
+        }
+
+        uint32_t firstIndex = indexAllocator->allocate(indexCount);
+        if (firstIndex == RangeAllocator::InvalidOffset)
+        {
+            uint32_t capacity = indexAllocator->getCapacity();
+            indexAllocator->grow(std::max(capacity * 2, capacity + indexCount));
+            firstIndex = indexAllocator->allocate(indexCount);
+        }
+
+        GeometryHandle handle;
+        if (!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        }
+        else
+        {
+            handle = static_cast<GeometryHandle>(allocations.size());
+            allocations.push_back({});
+            allocationUsed.push_back(false);
+        }
+
+        GeometryAllocation& allocation = allocations[handle];
+        allocation.vertexOffset = vertexOffset;
+        allocation.vertexCount = vertexCount;
+        allocation.firstIndex = firstIndex;
+        allocation.indexCount = indexCount;
+        allocationUsed[handle] = true;
+        meshCount++;
+        layoutVersion++;
+
+        PendingUpload upload;
+        upload.handle = handle;
+        upload.vertexData.assign((const char*)vertices, (const char*)vertices + static_cast<size_t>(vertexCount) * vertexStride);
+        upload.indexData.assign(indices, indices + indexCount);
+        pendingUploads.push_back(std::move(upload));
+
+        return handle;
+    }
+
+    void VulkanGeometryHeap::removeMesh(GeometryHandle handle)
+    {
+        if (handle >= allocations.size() || !allocationUsed[handle])
+        {
+            LOG_WARN("remove invalid geometry handle {}", handle);
+            return;
+        }
+
+        pendingUploads.erase(std::remove_if(pendingUploads.begin(), pendingUploads.end(),
+            [handle](const PendingUpload& upload) { return upload.handle == handle; }), pendingUploads.end());
+
+        // inflight的帧可能还在读，等它们执行完再回收
+        const GeometryAllocation& allocation = allocations[handle];
+        releaseRange(vertexAllocator, allocation.vertexOffset, allocation.vertexCount);
+        releaseRange(indexAllocator, allocation.firstIndex, allocation.indexCount);
+
+        allocations[handle] = {};
+        allocationUsed[handle] = false;
+        freeHandles.push_back(handle);
+        meshCount--;
+        layoutVersion++;
+    }
+
+    void VulkanGeometryHeap::flushUploads(VkCommandBuffer commandBuffer)
+    {
+        bool needGrowth = vertexAllocator->getCapacity() > vertexBufferCapacity || indexAllocator->getCapacity() > indexBufferCapacity;
+        if (pendingUploads.empty() && !needGrowth)
+        {
+            return;
+        }
+
+        if (commandBuffer != VK_NULL_HANDLE)
+        {
+            recordUploads(commandBuffer);
+            return;
+        }
+
+        VkCommandBuffer singleTimeCommandBuffer = vulkanRenderer->beginSingleTimeCommands();
+        recordUploads(singleTimeCommandBuffer);
+        vulkanRenderer->endSingleTimeCommands(singleTimeCommandBuffer);
+    }
+
+    void VulkanGeometryHeap::compact(VkCommandBuffer commandBuffer)
+    {
+        flushUploads(commandBuffer);
+
+        if (!compactionEnabled)
+        {
+            return;
+        }
+
+        std::vector<VkBufferCopy> vertexRegions;
+        VkDeviceSize movedBytes = compactRanges(true, compactionBytesPerFrame, vertexRegions);
+
+        std::vector<VkBufferCopy> indexRegions;
+        movedBytes += compactRanges(false, compactionBytesPerFrame - std::min(movedBytes, compactionBytesPerFrame), indexRegions);
+
+        if (vertexRegions.empty() && indexRegions.empty())
+        {
+            return;
+        }
+
+        // 目标区间是空闲的，源区间延迟回收，同一个buffer内拷贝不会重叠
+        if (!vertexRegions.empty())
+        {
+            vkCmdCopyBuffer(commandBuffer, vertexBuffer.buffer, vertexBuffer.buffer, static_cast<uint32_t>(vertexRegions.size()), vertexRegions.data());
+        }
+        if (!indexRegions.empty())
+        {
+            vkCmdCopyBuffer(commandBuffer, indexBuffer.buffer, indexBuffer.buffer, static_cast<uint32_t>(indexRegions.size()), indexRegions.data());
+        }
+        recordTransferBarrier(commandBuffer);
+        layoutVersion++;
+
+        LOG_DEBUG("geometry heap compaction moved {} bytes in {} regions", movedBytes, vertexRegions.size() + indexRegions.size());
+    }
+
+    void VulkanGeometryHeap::createHeapBuffer(HeapBuffer& heapBuffer, VkDeviceSize size, VkBufferUsageFlags usage)
+    {
+        vulkanRenderer->createBuffer(std::max<VkDeviceSize>(size, 4), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, heapBuffer.buffer, heapBuffer.memory, MemoryCategory::Geometry);
+    }
+
+    void VulkanGeometryHeap::recordGrowth(VkCommandBuffer commandBuffer, HeapBuffer& heapBuffer, uint32_t& bufferCapacity, uint32_t newCapacity, uint32_t elementSize, VkBufferUsageFlags usage)
+    {
+        HeapBuffer newBuffer;
+        createHeapBuffer(newBuffer, static_cast<VkDeviceSize>(newCapacity) * elementSize, usage);
+
+        if (bufferCapacity > 0)
+        {
+            VkBufferCopy copyRegion = {};
+            copyRegion.srcOffset = 0;
+            copyRegion.dstOffset = 0;
+            copyRegion.size = static_cast<VkDeviceSize>(bufferCapacity) * elementSize;
+            vkCmdCopyBuffer(commandBuffer, heapBuffer.buffer, newBuffer.buffer, 1, &copyRegion);
+        }
+
+        // 旧buffer可能还在被inflight的帧使用
+        vulkanRenderer->deletionQueue.destroyBuffer(heapBuffer.buffer);
+        vulkanRenderer->deletionQueue.freeMemory(heapBuffer.memory);
+
+        LOG_INFO("geometry heap grow from {} to {} elements", bufferCapacity, newCapacity);
+
+        heapBuffer = newBuffer;
+        bufferCapacity = newCapacity;
+    }
+
+    void VulkanGeometryHeap::recordUploads(VkCommandBuffer commandBuffer)
+    {
+        bool needGrowth = vertexAllocator->getCapacity() > vertexBufferCapacity || indexAllocator->getCapacity() > indexBufferCapacity;
+        if (needGrowth)
+        {
+            // 之前录制的拷贝可能还在写旧buffer
+            recordTransferBarrier(commandBuffer);
+
+            if (vertexAllocator->getCapacity() > vertexBufferCapacity)
+            {
+                recordGrowth(commandBuffer, vertexBuffer, vertexBufferCapacity, vertexAllocator->getCapacity(), vertexStride, vertexHeapUsage);
+            }
+            if (indexAllocator->getCapacity() > indexBufferCapacity)
+            {
+                recordGrowth(commandBuffer, indexBuffer, indexBufferCapacity, indexAllocator->getCapacity(), sizeof(uint32_t), indexHeapUsage);
+            }
+        }
+
+        if (pendingUploads.empty())
+        {
+            recordTransferBarrier(commandBuffer);
+            return;
+        }
+
+        VkDeviceSize stagingSize = 0;
+        for (const auto& upload : pendingUploads)
+        {
+            stagingSize += upload.vertexData.size() + upload.indexData.size() * sizeof(uint32_t);
+        }
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        vulkanRenderer->createBuffer(std::max<VkDeviceSize>(stagingSize, 4), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, MemoryCategory::Staging);
+
+        std::vector<VkBufferCopy> vertexRegions;
+        std::vector<VkBufferCopy> indexRegions;
+
+        void* data;
+        vkMapMemory(vulkanRenderer->device, stagingBufferMemory, 0, stagingSize, 0, &data);
+        VkDeviceSize offset = 0;
+        for (const auto& upload : pendingUploads)
+        {
+            const GeometryAllocation& allocation = allocations[upload.handle];
+
+            if (!upload.vertexData.empty())
+            {
+                memcpy((char*)(data) + offset, upload.vertexData.data(), upload.vertexData.size());
+                vertexRegions.push_back({ offset, static_cast<VkDeviceSize>(allocation.vertexOffset) * vertexStride, upload.vertexData.size() });
+                offset += upload.vertexData.size();
+            }
+
+            if (!upload.indexData.empty())
+            {
+                VkDeviceSize indexBytes = upload.indexData.size() * sizeof(uint32_t);
+                memcpy((char*)(data) + offset, upload.indexData.data(), indexBytes);
+                indexRegions.push_back({ offset, static_cast<VkDeviceSize>(allocation.firstIndex) * sizeof(uint32_t), indexBytes });
+                offset += indexBytes;
+            }
+        }
+        vkUnmapMemory(vulkanRenderer->device, stagingBufferMemory);
+
+        if (!vertexRegions.empty())
+        {
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, vertexBuffer.buffer, static_cast<uint32_t>(vertexRegions.size()), vertexRegions.data());
+        }
+        if (!indexRegions.empty())
+        {
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, indexBuffer.buffer, static_cast<uint32_t>(indexRegions.size()), indexRegions.data());
+        }
+        recordTransferBarrier(commandBuffer);
+
+        vulkanRenderer->deletionQueue.destroyBuffer(stagingBuffer);
+        vulkanRenderer->deletionQueue.freeMemory(stagingBufferMemory);
+
+        pendingUploads.clear();
+    }
+
+    void VulkanGeometryHeap::recordTransferBarrier(VkCommandBuffer commandBuffer)
+    {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            1, &barrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+    void VulkanGeometryHeap::releaseRange(const std::shared_ptr<RangeAllocator>& allocator, uint32_t offset, uint32_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        std::shared_ptr<RangeAllocator> rangeAllocator = allocator;
+        vulkanRenderer->deletionQueue.push([rangeAllocator, offset, count]() { rangeAllocator->free(offset, count); });
+    }
+
+    VkDeviceSize VulkanGeometryHeap::compactRanges(bool vertex, VkDeviceSize byteBudget, std::vector<VkBufferCopy>& regions)
+    {
+        auto& allocator = vertex ? vertexAllocator : indexAllocator;
+        if (allocator->getFreeRangeCount() < compactionFreeRangeThreshold)
+        {
+            return 0;
+        }
+
+        uint32_t elementSize = vertex ? vertexStride : sizeof(uint32_t);
+
+        std::vector<GeometryHandle> handles;
+        for (GeometryHandle handle = 0; handle < allocations.size(); handle++)
+        {
+            if (allocationUsed[handle])
+            {
+                handles.push_back(handle);
+            }
+        }
+
+        // 从地址最高的开始往前搬
+        std::sort(handles.begin(), handles.end(), [&](GeometryHandle a, GeometryHandle b) {
+            return vertex ? allocations[a].vertexOffset > allocations[b].vertexOffset : allocations[a].firstIndex > allocations[b].firstIndex;
+        });
+
+        VkDeviceSize movedBytes = 0;
+        for (auto handle : handles)
+        {
+            GeometryAllocation& allocation = allocations[handle];
+            uint32_t& offset = vertex ? allocation.vertexOffset : allocation.firstIndex;
+            uint32_t count = vertex ? allocation.vertexCount : allocation.indexCount;
+            VkDeviceSize bytes = static_cast<VkDeviceSize>(count) * elementSize;
+
+            if (count == 0)
+            {
+                continue;
+            }
+            if (movedBytes + bytes > byteBudget)
+            {
+                break;
+            }
+
+            uint32_t newOffset = allocator->allocateBelow(count, offset);
+            if (newOffset == RangeAllocator::InvalidOffset)
+            {
+                continue;
+            }
+
+            regions.push_back({ static_cast<VkDeviceSize>(offset) * elementSize, static_cast<VkDeviceSize>(newOffset) * elementSize, bytes });
+            releaseRange(allocator, offset, count);
+
+            offset = newOffset;
+            movedBytes += bytes;
+        }
+        return movedBytes;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,543 @@
+﻿#include "vulkanIBLPrecompute.hpp"
+#include "vulkanScene.hpp"
+#include "vulkanPipeline.hpp"
+#include "macro.hpp"
+
+#include <glm/glm.hpp>
+#include <stb_image.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace VulkanEngine
+{
+    // rgba16f的storage image和线性过滤都是必须支持的
+    static const VkFormat IBLFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+    // 和ibl*.comp里的local_size一致
+    static const uint32_t IBLGroupSize = 8;
+
+    // 按pdf选mip之后，这些采样数已经没有明显的噪点
+    static const uint32_t SpecularSampleCount = 512;
+    static const uint32_t IrradianceSampleCount = 1024;
+    static const uint32_t BrdfLUTSampleCount = 1024;
+
+    // 和原来读取cube map时stbi_hdr_to_ldr_scale的2.2一致，亮度不变，只是不再截断到1
+    static const float EnvironmentIntensity = 2.2f;
+
+    static void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t mipCount, uint32_t layers,
+        VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+        VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = baseMip;
+        barrier.subresourceRange.levelCount = mipCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = layers;
+        vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    bool VulkanIBLPrecomputer::precompute(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData, const std::string& environmentPath)
+    {
+        if (!init(vulkanRenderer, sceneData))
+        {
+            return false;
+        }
+
+        int width, height, channels;
+        float* pixels = stbi_loadf(environmentPath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels)
+        {
+            LOG_WARN("IBL precompute: failed to load environment map : {}", environmentPath);
+            return false;
+        }
+
+        // 转成半精度上传，rgba32f不一定支持线性过滤，亮度在转cube map时乘
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        createStagingBuffer(pixelCount * 4 * sizeof(uint16_t));
+        void* data;
+        vkMapMemory(vulkanRenderer->device, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        packHalfPixels(pixels, pixelCount, 1.0f, static_cast<uint32_t*>(data));
+        vkUnmapMemory(vulkanRenderer->device, stagingBufferMemory);
+        stbi_image_free(pixels);
+
+        createPipelines();
+
+        uint32_t environmentMipLevels = static_cast<uint32_t>(std::floor(std::log2(EnvironmentSize))) + 1;
+        createImage(equirectImage, width, height, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        createImage(environmentImage, EnvironmentSize, EnvironmentSize, environmentMipLevels, 6,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+        VkDescriptorSet equirectToCubeSet = createDescriptorSet(equirectImage.view, environmentImage.image, 0, 6);
+
+        VkCommandBuffer commandBuffer = vulkanRenderer->beginSingleTimeCommands();
+
+        // 上传环境图
+        imageBarrier(commandBuffer, equirectImage.image, 0, 1, 1,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, equirectImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        imageBarrier(commandBuffer, equirectImage.image, 0, 1, 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        // 环境cube map：compute写第0级，其余级别在filterEnvironment里逐级blit
+        imageBarrier(commandBuffer, environmentImage.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        PushConstants pushConstants = {};
+        pushConstants.intensity = EnvironmentIntensity;
+        dispatch(commandBuffer, equirectToCubePipeline, equirectToCubeSet, pushConstants, EnvironmentSize, 6);
+
+        imageBarrier(commandBuffer, environmentImage.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        filterEnvironment(commandBuffer, EnvironmentSize, environmentMipLevels);
+
+        LOG_INFO("IBL precompute: {} ({}x{})", environmentPath, width, height);
+        return true;
+    }
+
+    bool VulkanIBLPrecomputer::precomputeFromCube(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData, const std::array<std::string, 6>& facePaths)
+    {
+        if (!init(vulkanRenderer, sceneData))
+        {
+            return false;
+        }
+
+        std::array<float*, 6> faces = {};
+        int faceSize = 0;
+        bool loaded = true;
+        for (uint32_t i = 0; i < 6 && loaded; i++)
+        {
+            int width, height, channels;
+            faces[i] = stbi_loadf(facePaths[i].c_str(), &width, &height, &channels, STBI_rgb_alpha);
+            if (!faces[i] || width != height || (i > 0 && width != faceSize))
+            {
+                LOG_WARN("IBL precompute: failed to load cube face : {}", facePaths[i]);
+                loaded = false;
+            }
+            faceSize = width;
+        }
+        if (!loaded)
+        {
+            for (float* face : faces)
+            {
+                stbi_image_free(face);
+            }
+            return false;
+        }
+
+        // 面直接作为环境cube的第0级，原来按sRGB读取时相当于乘了EnvironmentIntensity，这里在CPU上乘
+        size_t facePixelCount = static_cast<size_t>(faceSize) * faceSize;
+        VkDeviceSize faceBytes = facePixelCount * 4 * sizeof(uint16_t);
+        createStagingBuffer(faceBytes * 6);
+        void* data;
+        vkMapMemory(vulkanRenderer->device, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        for (uint32_t i = 0; i < 6; i++)
+        {
+            packHalfPixels(faces[i], facePixelCount, EnvironmentIntensity, static_cast<uint32_t*>(data) + facePixelCount * 2 * i);
+            stbi_image_free(faces[i]);
+        }
+        vkUnmapMemory(vulkanRenderer->device, stagingBufferMemory);
+
+        createPipelines();
+
+        uint32_t environmentSize = static_cast<uint32_t>(faceSize);
+        uint32_t environmentMipLevels = static_cast<uint32_t>(std::floor(std::log2(environmentSize))) + 1;
+        createImage(environmentImage, environmentSize, environmentSize, environmentMipLevels, 6,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+        VkCommandBuffer commandBuffer = vulkanRenderer->beginSingleTimeCommands();
+
+        imageBarrier(commandBuffer, environmentImage.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        // 六个面在暂存buffer里连续存放，一次拷到各层
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 6;
+        region.imageExtent = { environmentSize, environmentSize, 1 };
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, environmentImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        imageBarrier(commandBuffer, environmentImage.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        filterEnvironment(commandBuffer, environmentSize, environmentMipLevels);
+
+        LOG_INFO("IBL precompute: cube {} ({}x{})", facePaths[0], environmentSize, environmentSize);
+        return true;
+    }
+
+    bool VulkanIBLPrecomputer::init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        this->sceneData = sceneData;
+
+        // 和分簇光照一样在图形队列里执行
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, queueFamilies.data());
+        if ((queueFamilies[vulkanRenderer->queueIndices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0)
+        {
+            LOG_WARN("IBL precompute: graphics queue has no compute support");
+            return false;
+        }
+        return true;
+    }
+
+    void VulkanIBLPrecomputer::createStagingBuffer(VkDeviceSize size)
+    {
+        vulkanRenderer->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, MemoryCategory::Staging);
+    }
+
+    void VulkanIBLPrecomputer::packHalfPixels(const float* pixels, size_t pixelCount, float scale, uint32_t* halfPixels)
+    {
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            halfPixels[i * 2] = glm::packHalf2x16(glm::vec2(pixels[i * 4], pixels[i * 4 + 1]) * scale);
+            halfPixels[i * 2 + 1] = glm::packHalf2x16(glm::vec2(pixels[i * 4 + 2] * scale, 1.0f));
+        }
+    }
+
+    void VulkanIBLPrecomputer::filterEnvironment(VkCommandBuffer commandBuffer, uint32_t environmentSize, uint32_t environmentMipLevels)
+    {
+        // 输出交给sceneData，不在这里销毁
+        Image specular;
+        Image irradiance;
+        Image brdfLUT;
+        createImage(specular, SpecularSize, SpecularSize, SpecularMipLevels, 6, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        createImage(irradiance, IrradianceSize, IrradianceSize, 1, 6, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        createImage(brdfLUT, BrdfLUTSize, BrdfLUTSize, 1, 1, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+
+        std::array<VkDescriptorSet, SpecularMipLevels> prefilterSpecularSets;
+        for (uint32_t mip = 0; mip < SpecularMipLevels; mip++)
+        {
+            prefilterSpecularSets[mip] = createDescriptorSet(environmentImage.view, specular.image, mip, 6);
+        }
+        VkDescriptorSet irradianceSet = createDescriptorSet(environmentImage.view, irradiance.image, 0, 6);
+        VkDescriptorSet brdfLUTSet = createDescriptorSet(VK_NULL_HANDLE, brdfLUT.image, 0, 1);
+
+        // 后面的重要性采样按样本的pdf选mip
+        imageBarrier(commandBuffer, environmentImage.image, 1, environmentMipLevels - 1, 6,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        for (uint32_t mip = 1; mip < environmentMipLevels; mip++)
+        {
+            int32_t srcSize = static_cast<int32_t>(std::max(environmentSize >> (mip - 1), 1u));
+            int32_t dstSize = static_cast<int32_t>(std::max(environmentSize >> mip, 1u));
+
+            VkImageBlit blit = {};
+            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel = mip - 1;
+            blit.srcSubresource.baseArrayLayer = 0;
+            blit.srcSubresource.layerCount = 6;
+            blit.srcOffsets[1] = { srcSize, srcSize, 1 };
+            blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.dstSubresource.mipLevel = mip;
+            blit.dstSubresource.baseArrayLayer = 0;
+            blit.dstSubresource.layerCount = 6;
+            blit.dstOffsets[1] = { dstSize, dstSize, 1 };
+            vkCmdBlitImage(commandBuffer,
+                environmentImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                environmentImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blit, VK_FILTER_LINEAR);
+
+            imageBarrier(commandBuffer, environmentImage.image, mip, 1, 6,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        }
+
+        imageBarrier(commandBuffer, environmentImage.image, 0, environmentMipLevels, 6,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        // 三张输出互不依赖，连续dispatch
+        imageBarrier(commandBuffer, specular.image, 0, SpecularMipLevels, 6,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        imageBarrier(commandBuffer, irradiance.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        imageBarrier(commandBuffer, brdfLUT.image, 0, 1, 1,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        // 第i级的粗糙度为i / 8，和光照shader里的lod = roughness * 8.0对应
+        PushConstants pushConstants = {};
+        for (uint32_t mip = 0; mip < SpecularMipLevels; mip++)
+        {
+            pushConstants = {};
+            pushConstants.roughness = static_cast<float>(mip) / static_cast<float>(SpecularMipLevels - 1);
+            pushConstants.sampleCount = SpecularSampleCount;
+            dispatch(commandBuffer, prefilterSpecularPipeline, prefilterSpecularSets[mip], pushConstants, std::max(SpecularSize >> mip, 1u), 6);
+        }
+
+        pushConstants = {};
+        pushConstants.sampleCount = IrradianceSampleCount;
+        dispatch(commandBuffer, irradiancePipeline, irradianceSet, pushConstants, IrradianceSize, 6);
+
+        pushConstants.sampleCount = BrdfLUTSampleCount;
+        dispatch(commandBuffer, brdfLUTPipeline, brdfLUTSet, pushConstants, BrdfLUTSize, 1);
+
+        VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        imageBarrier(commandBuffer, specular.image, 0, SpecularMipLevels, 6,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readStages);
+        imageBarrier(commandBuffer, irradiance.image, 0, 1, 6,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readStages);
+        imageBarrier(commandBuffer, brdfLUT.image, 0, 1, 1,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readStages);
+
+        // 阻塞到执行完毕，之后中间资源可以直接销毁
+        vulkanRenderer->endSingleTimeCommands(commandBuffer);
+        destroyResources();
+
+        CubeMap* specularBox = new CubeMap();
+        specularBox->cubeImage = specular.image;
+        specularBox->cubeImageView = specular.view;
+        specularBox->cubeImageMemory = specular.memory;
+        specularBox->mipLevels = SpecularMipLevels;
+        vulkanRenderer->createLinearSampler(specularBox->sampler, specularBox->mipLevels);
+        sceneData->IBLSpecularBox = specularBox;
+
+        CubeMap* irradianceBox = new CubeMap();
+        irradianceBox->cubeImage = irradiance.image;
+        irradianceBox->cubeImageView = irradiance.view;
+        irradianceBox->cubeImageMemory = irradiance.memory;
+        irradianceBox->mipLevels = 1;
+        vulkanRenderer->createLinearSampler(irradianceBox->sampler, irradianceBox->mipLevels);
+        sceneData->IBLIrradianceBox = irradianceBox;
+
+        Texture* brdfLUTTexture = new Texture();
+        brdfLUTTexture->textureImage = brdfLUT.image;
+        brdfLUTTexture->textureImageView = brdfLUT.view;
+        brdfLUTTexture->textureImageMemory = brdfLUT.memory;
+        brdfLUTTexture->mipLevels = 1;
+        brdfLUTTexture->oneLevel = true;
+        brdfLUTTexture->sampler = vulkanRenderer->getOrCreateMipmapSampler(1);
+        sceneData->brdfLUTTexture = brdfLUTTexture;
+    }
+
+    void VulkanIBLPrecomputer::createPipelines()
+    {
+        VkDevice device = vulkanRenderer->device;
+
+        // 0：输入的环境图，1：输出的一级mip
+        VkDescriptorSetLayoutBinding binding[2] = {};
+        binding[0].binding = 0;
+        binding[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        binding[0].descriptorCount = 1;
+        binding[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        binding[1].binding = 1;
+        binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        binding[1].descriptorCount = 1;
+        binding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutCI = {};
+        layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutCI.bindingCount = sizeof(binding) / sizeof(binding[0]);
+        layoutCI.pBindings = binding;
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutCI, nullptr, &setLayout));
+
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+        pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCI.setLayoutCount = 1;
+        pipelineLayoutCI.pSetLayouts = &setLayout;
+        pipelineLayoutCI.pushConstantRangeCount = 1;
+        pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
+
+        equirectToCubePipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, pipelineLayout, sceneData->iblEquirectToCubeCSFilePath);
+        prefilterSpecularPipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, pipelineLayout, sceneData->iblPrefilterSpecularCSFilePath);
+        irradiancePipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, pipelineLayout, sceneData->iblIrradianceCSFilePath);
+        brdfLUTPipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, pipelineLayout, sceneData->iblBrdfLUTCSFilePath);
+
+        // 等距柱状投影的经度方向首尾相接
+        VkSamplerCreateInfo samplerCI = {};
+        samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerCI.magFilter = VK_FILTER_LINEAR;
+        samplerCI.minFilter = VK_FILTER_LINEAR;
+        samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCI.minLod = 0.0f;
+        samplerCI.maxLod = VK_LOD_CLAMP_NONE;
+        samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+        VK_CHECK_RESULT(vkCreateSampler(device, &samplerCI, nullptr, &environmentSampler));
+    }
+
+    void VulkanIBLPrecomputer::destroyResources()
+    {
+        VkDevice device = vulkanRenderer->device;
+
+        for (auto descriptorSet : descriptorSets)
+        {
+            vulkanRenderer->descriptorAllocator.free(descriptorSet);
+        }
+        descriptorSets.clear();
+
+        for (auto view : storageViews)
+        {
+            vkDestroyImageView(device, view, nullptr);
+        }
+        storageViews.clear();
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vulkanRenderer->freeMemory(stagingBufferMemory);
+        stagingBuffer = VK_NULL_HANDLE;
+
+        for (Image* image : { &equirectImage, &environmentImage })
+        {
+            vkDestroyImageView(device, image->view, nullptr);
+            vkDestroyImage(device, image->image, nullptr);
+            vulkanRenderer->freeMemory(image->memory);
+            *image = Image();
+        }
+
+        for (VkPipeline pipeline : { equirectToCubePipeline, prefilterSpecularPipeline, irradiancePipeline, brdfLUTPipeline })
+        {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        vkDestroySampler(device, environmentSampler, nullptr);
+
+        equirectToCubePipeline = VK_NULL_HANDLE;
+        prefilterSpecularPipeline = VK_NULL_HANDLE;
+        irradiancePipeline = VK_NULL_HANDLE;
+        brdfLUTPipeline = VK_NULL_HANDLE;
+        pipelineLayout = VK_NULL_HANDLE;
+        setLayout = VK_NULL_HANDLE;
+        environmentSampler = VK_NULL_HANDLE;
+    }
+
+    void VulkanIBLPrecomputer::createImage(Image& image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layers, VkImageUsageFlags usage)
+    {
+        bool cube = layers == 6;
+        vulkanRenderer->createImage(width, height,
+            IBLFormat,
+            VK_IMAGE_TILING_OPTIMAL,
+            usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            image.image,
+            image.memory,
+            cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
+            layers,
+            mipLevels,
+            VK_SAMPLE_COUNT_1_BIT,
+            MemoryCategory::Texture);
+
+        image.view = vulkanRenderer->createImageView(image.image, IBLFormat, VK_IMAGE_ASPECT_COLOR_BIT, cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D, layers, mipLevels);
+    }
+
+    VkDescriptorSet VulkanIBLPrecomputer::createDescriptorSet(VkImageView sampledView, VkImage storageImage, uint32_t mip, uint32_t layers)
+    {
+        // storage image不能用cube的view，按数组写
+        VkImageViewCreateInfo imageViewCI = {};
+        imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCI.image = storageImage;
+        imageViewCI.viewType = layers == 6 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCI.format = IBLFormat;
+        imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCI.subresourceRange.baseMipLevel = mip;
+        imageViewCI.subresourceRange.levelCount = 1;
+        imageViewCI.subresourceRange.baseArrayLayer = 0;
+        imageViewCI.subresourceRange.layerCount = layers;
+        VkImageView storageView;
+        VK_CHECK_RESULT(vkCreateImageView(vulkanRenderer->device, &imageViewCI, nullptr, &storageView));
+        storageViews.push_back(storageView);
+
+        VkDescriptorSet descriptorSet;
+        VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(setLayout, descriptorSet));
+        descriptorSets.push_back(descriptorSet);
+
+        VkDescriptorImageInfo imageInfos[2] = {};
+        imageInfos[0].sampler = environmentSampler;
+        imageInfos[0].imageView = sampledView;
+        imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfos[1].imageView = storageView;
+        imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+        for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+        {
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = descriptorSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[i].pImageInfo = &imageInfos[i];
+        }
+
+        // BRDF LUT不读环境图
+        if (sampledView == VK_NULL_HANDLE)
+        {
+            vkUpdateDescriptorSets(vulkanRenderer->device, 1, &descriptorWrites[1], 0, nullptr);
+        }
+        else
+        {
+            vkUpdateDescriptorSets(vulkanRenderer->device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        }
+        return descriptorSet;
+    }
+
+    void VulkanIBLPrecomputer::dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet descriptorSet, const PushConstants& pushConstants, uint32_t size, uint32_t layers)
+    {
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+
+        uint32_t groupCount = (size + IBLGroupSize - 1) / IBLGroupSize;
+        vkCmdDispatch(commandBuffer, groupCount, groupCount, layers);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+﻿#include "vulkanLightClustering.hpp"
+#include "vulkanScene.hpp"
+#include "vulkanPipeline.hpp"
+#include "macro.hpp"
+
+#include <array>
+#include <vector>
+
+namespace VulkanEngine
+{
+    // 和lightClustering.comp里的GROUP_SIZE一致
+    static const uint32_t ClusterGroupSize = 64;
+
+    void VulkanLightClusterer::init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        this->sceneData = sceneData;
+
+        // 和遮挡剔除一样录制在图形队列里
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, queueFamilies.data());
+        supported = (queueFamilies[vulkanRenderer->queueIndices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+
+        if (!supported)
+        {
+            LOG_INFO("clustered lighting: unavailable");
+            return;
+        }
+
+        VkDevice device = vulkanRenderer->device;
+
+        VkDescriptorSetLayoutBinding binding[3] = {};
+        binding[0].binding = 0;
+        binding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        binding[0].descriptorCount = 1;
+        binding[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        binding[1].binding = 1;
+        binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding[1].descriptorCount = 1;
+        binding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        binding[2].binding = 2;
+        binding[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding[2].descriptorCount = 1;
+        binding[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutCI = {};
+        layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutCI.bindingCount = sizeof(binding) / sizeof(binding[0]);
+        layoutCI.pBindings = binding;
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutCI, nullptr, &setLayout));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+        pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCI.setLayoutCount = 1;
+        pipelineLayoutCI.pSetLayouts = &setLayout;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
+
+        pipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, pipelineLayout, sceneData->lightClusteringCSFilePath);
+
+        VkDescriptorBufferInfo bufferInfos[3] = {};
+        bufferInfos[0].buffer = sceneData->uniformClustersResource.buffer;
+        bufferInfos[0].range = sizeof(UniformBufferObjectClusters);
+        bufferInfos[1].buffer = sceneData->lightResource.buffer;
+        bufferInfos[1].range = LightBufferStride;
+        bufferInfos[2].buffer = sceneData->clusterGridResource.buffer;
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+
+        for (uint32_t frame = 0; frame < VulkanRenderer::MAX_FRAMES_IN_FLIGHT; frame++)
+        {
+            VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(setLayout, descriptorSets[frame]));
+
+            bufferInfos[0].offset = frame * ClusterUniformStride;
+            bufferInfos[1].offset = frame * LightBufferStride;
+
+            std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+            for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+            {
+                descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[i].dstSet = descriptorSets[frame];
+                descriptorWrites[i].dstBinding = i;
+                descriptorWrites[i].descriptorCount = 1;
+                descriptorWrites[i].descriptorType = binding[i].descriptorType;
+                descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+            }
+            vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        }
+
+        LOG_INFO("clustered lighting: {}x{}x{} clusters", ClusterGridX, ClusterGridY, ClusterGridZ);
+    }
+
+    void VulkanLightClusterer::cleanup()
+    {
+        if (!supported)
+        {
+            return;
+        }
+
+        auto& deletionQueue = vulkanRenderer->deletionQueue;
+        VkDevice device = vulkanRenderer->device;
+
+        for (auto& descriptorSet : descriptorSets)
+        {
+            deletionQueue.freeDescriptorSet(descriptorSet);
+            descriptorSet = VK_NULL_HANDLE;
+        }
+        VkPipeline pipeline = this->pipeline;
+        VkPipelineLayout pipelineLayout = this->pipelineLayout;
+        VkDescriptorSetLayout setLayout = this->setLayout;
+        deletionQueue.push([device, pipeline, pipelineLayout, setLayout]() {
+            vkDestroyPipeline(device, pipeline, nullptr);
+            vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        });
+
+        this->pipeline = VK_NULL_HANDLE;
+        this->pipelineLayout = VK_NULL_HANDLE;
+        this->setLayout = VK_NULL_HANDLE;
+        supported = false;
+    }
+
+    void VulkanLightClusterer::dispatch(VkCommandBuffer commandBuffer)
+    {
+        // 上一帧的光照shader读完之后才能覆盖簇列表
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = 0;
+
+        if (!supported)
+        {
+            memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+            vkCmdFillBuffer(commandBuffer, sceneData->clusterGridResource.buffer, 0, sizeof(uint32_t) * ClusterCount, 0);
+
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            return;
+        }
+
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[vulkanRenderer->currentFrameIndex], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (ClusterCount + ClusterGroupSize - 1) / ClusterGroupSize, 1, 1);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+}
\ No newline at end of file
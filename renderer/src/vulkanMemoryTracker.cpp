@@ -0,0 +1,268 @@
+﻿#include "vulkanMemoryTracker.hpp"
+#include "macro.hpp"
+
+namespace VulkanEngine
+{
+    static double toMB(VkDeviceSize bytes)
+    {
+        return static_cast<double>(bytes) / (1024.0 * 1024.0);
+    }
+
+    void VulkanMemoryTracker::init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetSupported)
+    {
+        this->physicalDevice = physicalDevice;
+        this->device = device;
+
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        // 需要instance开启VK_KHR_get_physical_device_properties2
+        if (memoryBudgetSupported)
+        {
+            _vkGetPhysicalDeviceMemoryProperties2KHR =
+                (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+        }
+        this->memoryBudgetSupported = memoryBudgetSupported && _vkGetPhysicalDeviceMemoryProperties2KHR != nullptr;
+
+        heapBudgets.resize(memoryProperties.memoryHeapCount);
+        heapOverBudget.resize(memoryProperties.memoryHeapCount, false);
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+        {
+            heapBudgets[i].flags = memoryProperties.memoryHeaps[i].flags;
+            heapBudgets[i].size = memoryProperties.memoryHeaps[i].size;
+        }
+
+        queryHeapBudgets();
+
+        LOG_INFO("memory budget extension: {}", this->memoryBudgetSupported ? "enabled" : "unavailable");
+    }
+
+    VkResult VulkanMemoryTracker::allocate(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory, MemoryCategory category)
+    {
+        VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+        if (VK_SUCCESS != result)
+        {
+            LOG_ERROR("failed to allocate {:.2f} MB for {}!", toMB(allocInfo.allocationSize), getCategoryName(category));
+            return result;
+        }
+
+        uint32_t categoryIndex = static_cast<uint32_t>(category);
+        uint32_t heapIndex = memoryProperties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        allocations[memory] = { allocInfo.allocationSize, category, heapIndex };
+        categoryBytes[categoryIndex] += allocInfo.allocationSize;
+        categoryAllocationCounts[categoryIndex]++;
+        heapBudgets[heapIndex].trackedBytes += allocInfo.allocationSize;
+
+        return result;
+    }
+
+    void VulkanMemoryTracker::free(VkDeviceMemory& memory)
+    {
+        if (memory == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto iter = allocations.find(memory);
+            if (iter != allocations.end())
+            {
+                uint32_t categoryIndex = static_cast<uint32_t>(iter->second.category);
+                categoryBytes[categoryIndex] -= iter->second.size;
+                categoryAllocationCounts[categoryIndex]--;
+                heapBudgets[iter->second.heapIndex].trackedBytes -= iter->second.size;
+                allocations.erase(iter);
+            }
+            else
+            {
+                LOG_WARN("free untracked memory");
+            }
+        }
+
+        vkFreeMemory(device, memory, nullptr);
+        memory = VK_NULL_HANDLE;
+    }
+
+    void VulkanMemoryTracker::update()
+    {
+        frameCount++;
+
+        queryHeapBudgets();
+
+        std::vector<MemoryBudgetExceededInfo> exceededInfos;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // 只在状态从未超出变为超出时回调一次
+            for (uint32_t i = 0; i < categoryCount; i++)
+            {
+                bool overBudget = categoryBudgets[i] > 0 && categoryBytes[i] > categoryBudgets[i];
+                if (overBudget && !categoryOverBudget[i])
+                {
+                    MemoryBudgetExceededInfo info;
+                    info.category = static_cast<MemoryCategory>(i);
+                    info.usage = categoryBytes[i];
+                    info.budget = categoryBudgets[i];
+                    exceededInfos.push_back(info);
+                }
+                categoryOverBudget[i] = overBudget;
+            }
+
+            for (uint32_t i = 0; i < heapBudgets.size(); i++)
+            {
+                const auto& heap = heapBudgets[i];
+                bool overBudget = heap.budget > 0 && heap.usage > static_cast<VkDeviceSize>(heap.budget * heapBudgetThreshold);
+                if (overBudget && !heapOverBudget[i])
+                {
+                    MemoryBudgetExceededInfo info;
+                    info.heapIndex = static_cast<int32_t>(i);
+                    info.usage = heap.usage;
+                    info.budget = heap.budget;
+                    exceededInfos.push_back(info);
+                }
+                heapOverBudget[i] = overBudget;
+            }
+        }
+
+        // 回调里可能会释放资源，所以放在锁外
+        for (const auto& info : exceededInfos)
+        {
+            if (info.heapIndex >= 0)
+            {
+                LOG_WARN("memory heap {} over budget: {:.2f} MB / {:.2f} MB", info.heapIndex, toMB(info.usage), toMB(info.budget));
+            }
+            else
+            {
+                LOG_WARN("{} memory over budget: {:.2f} MB / {:.2f} MB", getCategoryName(info.category), toMB(info.usage), toMB(info.budget));
+            }
+
+            if (budgetExceededCallback)
+            {
+                budgetExceededCallback(info);
+            }
+        }
+
+        if (logIntervalFrames > 0 && frameCount % logIntervalFrames == 0)
+        {
+            logSummary();
+        }
+    }
+
+    void VulkanMemoryTracker::logSummary()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkDeviceSize totalBytes = 0;
+        for (uint32_t i = 0; i < categoryCount; i++)
+        {
+            totalBytes += categoryBytes[i];
+        }
+
+        LOG_INFO("gpu memory: {:.2f} MB in {} allocations", toMB(totalBytes), allocations.size());
+        for (uint32_t i = 0; i < categoryCount; i++)
+        {
+            LOG_INFO("\t {}: {:.2f} MB ({})", getCategoryName(static_cast<MemoryCategory>(i)), toMB(categoryBytes[i]), categoryAllocationCounts[i]);
+        }
+        for (uint32_t i = 0; i < heapBudgets.size(); i++)
+        {
+            const auto& heap = heapBudgets[i];
+            LOG_INFO("\t heap {}{}: usage {:.2f} MB, budget {:.2f} MB, tracked {:.2f} MB", i,
+                (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "",
+                toMB(heap.usage), toMB(heap.budget), toMB(heap.trackedBytes));
+        }
+    }
+
+    void VulkanMemoryTracker::setCategoryBudget(MemoryCategory category, VkDeviceSize budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        categoryBudgets[static_cast<uint32_t>(category)] = budget;
+    }
+
+    VkDeviceSize VulkanMemoryTracker::getCategoryBytes(MemoryCategory category)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return categoryBytes[static_cast<uint32_t>(category)];
+    }
+
+    uint32_t VulkanMemoryTracker::getCategoryAllocationCount(MemoryCategory category)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return categoryAllocationCounts[static_cast<uint32_t>(category)];
+    }
+
+    VkDeviceSize VulkanMemoryTracker::getCategoryBudget(MemoryCategory category)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return categoryBudgets[static_cast<uint32_t>(category)];
+    }
+
+    VkDeviceSize VulkanMemoryTracker::getTotalBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        VkDeviceSize totalBytes = 0;
+        for (uint32_t i = 0; i < categoryCount; i++)
+        {
+            totalBytes += categoryBytes[i];
+        }
+        return totalBytes;
+    }
+
+    std::vector<MemoryHeapBudget> VulkanMemoryTracker::getHeapBudgets()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return heapBudgets;
+    }
+
+    const char* VulkanMemoryTracker::getCategoryName(MemoryCategory category)
+    {
+        switch (category)
+        {
+        case MemoryCategory::Texture:
+            return "texture";
+        case MemoryCategory::Geometry:
+            return "geometry";
+        case MemoryCategory::RenderTarget:
+            return "render target";
+        case MemoryCategory::Uniform:
+            return "uniform";
+        case MemoryCategory::Staging:
+            return "staging";
+        default:
+            return "unknown";
+        }
+    }
+
+    void VulkanMemoryTracker::queryHeapBudgets()
+    {
+        if (memoryBudgetSupported)
+        {
+            VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+            budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+            VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+            memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+            memoryProperties2.pNext = &budgetProperties;
+
+            _vkGetPhysicalDeviceMemoryProperties2KHR(physicalDevice, &memoryProperties2);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t i = 0; i < heapBudgets.size(); i++)
+            {
+                heapBudgets[i].budget = budgetProperties.heapBudget[i];
+                heapBudgets[i].usage = budgetProperties.heapUsage[i];
+            }
+        }
+        else
+        {
+            // 没有扩展时只能按自身统计，预算取heap大小的80%，其他进程的占用无从得知
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& heap : heapBudgets)
+            {
+                heap.budget = heap.size * 8 / 10;
+                heap.usage = heap.trackedBytes;
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,720 @@
+﻿#include "vulkanOcclusionCulling.hpp"
+#include "vulkanRenderQueue.hpp"
+#include "vulkanScene.hpp"
+#include "vulkanPipeline.hpp"
+#include "vulkanUtil.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace VulkanEngine
+{
+    // 和occlusionCulling.comp里stats的顺序一致
+    static const uint32_t StatsCount = 5;
+    static const uint32_t CullGroupSize = 64;
+    static const uint32_t HiZGroupSize = 8;
+
+    void VulkanOcclusionCuller::init(VulkanRenderer* vulkanRenderer, VulkanRenderSceneData* sceneData)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+        this->sceneData = sceneData;
+
+        // 剔除结果通过firstInstance找mesh，并且一个材质段要一次提交
+        supported = vulkanRenderer->multiDrawIndirectSupported && vulkanRenderer->drawIndirectFirstInstanceSupported;
+
+        // dispatch录制在图形队列的commandBuffer里，结果当帧就要用，不值得为此跨队列同步
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(vulkanRenderer->physicalDevice, &queueFamilyCount, queueFamilies.data());
+        if ((queueFamilies[vulkanRenderer->queueIndices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0)
+        {
+            supported = false;
+        }
+
+        if (!supported)
+        {
+            LOG_INFO("gpu occlusion culling: unavailable");
+            return;
+        }
+
+        compact = vulkanRenderer->drawIndirectCountSupported;
+        LOG_INFO("gpu occlusion culling: {}", compact ? "compacted draws" : "zero instance draws");
+
+        createHiZResources();
+        createPrepass();
+        createComputePipelines();
+    }
+
+    void VulkanOcclusionCuller::cleanup()
+    {
+        if (!supported)
+        {
+            return;
+        }
+
+        auto& deletionQueue = vulkanRenderer->deletionQueue;
+        VkDevice device = vulkanRenderer->device;
+
+        for (auto& frame : frames)
+        {
+            destroyBuffer(frame.prepassCommands);
+            destroyBuffer(frame.outputCommands);
+            destroyBuffer(frame.drawCounts);
+            destroyBuffer(frame.itemBatches);
+            destroyBuffer(frame.stats);
+            frame = {};
+        }
+        destroyBuffer(visibility);
+
+        deletionQueue.freeDescriptorSet(prepassSet);
+        for (auto descriptorSet : hizBuildSets)
+        {
+            deletionQueue.freeDescriptorSet(descriptorSet);
+        }
+        hizBuildSets.clear();
+
+        VkPipeline pipelines[] = { prepassPipeline, hizBuildPipeline, cullPipeline };
+        VkPipelineLayout pipelineLayouts[] = { prepassPipelineLayout, hizBuildPipelineLayout, cullPipelineLayout };
+        VkDescriptorSetLayout setLayouts[] = { prepassSetLayout, hizBuildSetLayout, cullSetLayout };
+        VkRenderPass renderPass = prepassRenderPass;
+        std::vector<VkPipeline> pipelineList(std::begin(pipelines), std::end(pipelines));
+        std::vector<VkPipelineLayout> pipelineLayoutList(std::begin(pipelineLayouts), std::end(pipelineLayouts));
+        std::vector<VkDescriptorSetLayout> setLayoutList(std::begin(setLayouts), std::end(setLayouts));
+        deletionQueue.push([device, pipelineList, pipelineLayoutList, setLayoutList, renderPass]() {
+            for (auto pipeline : pipelineList)
+            {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
+            for (auto layout : pipelineLayoutList)
+            {
+                vkDestroyPipelineLayout(device, layout, nullptr);
+            }
+            for (auto layout : setLayoutList)
+            {
+                vkDestroyDescriptorSetLayout(device, layout, nullptr);
+            }
+            vkDestroyRenderPass(device, renderPass, nullptr);
+        });
+
+        deletionQueue.destroyFramebuffer(prepassFramebuffer);
+        for (auto view : hizMipViews)
+        {
+            deletionQueue.destroyImageView(view);
+        }
+        hizMipViews.clear();
+        deletionQueue.destroyImageView(hizView);
+        deletionQueue.destroyImage(hizImage);
+        deletionQueue.freeMemory(hizMemory);
+        deletionQueue.destroySampler(hizSampler);
+        deletionQueue.destroyImageView(depthView);
+        deletionQueue.destroyImage(depthImage);
+        deletionQueue.freeMemory(depthMemory);
+
+        supported = false;
+    }
+
+    void VulkanOcclusionCuller::createHiZResources()
+    {
+        hizMipCount = static_cast<uint32_t>(std::floor(std::log2(std::max(HiZWidth, HiZHeight)))) + 1;
+
+        vulkanRenderer->createImage(HiZWidth, HiZHeight,
+            VK_FORMAT_R32_SFLOAT,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            hizImage,
+            hizMemory,
+            0,
+            1,
+            hizMipCount,
+            VK_SAMPLE_COUNT_1_BIT,
+            MemoryCategory::RenderTarget);
+
+        hizView = vulkanRenderer->createImageView(hizImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, hizMipCount);
+
+        // 每一级单独一个view，生成时读上一级写下一级
+        hizMipViews.resize(hizMipCount);
+        for (uint32_t mip = 0; mip < hizMipCount; mip++)
+        {
+            VkImageViewCreateInfo imageViewCI = {};
+            imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            imageViewCI.image = hizImage;
+            imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            imageViewCI.format = VK_FORMAT_R32_SFLOAT;
+            imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            imageViewCI.subresourceRange.baseMipLevel = mip;
+            imageViewCI.subresourceRange.levelCount = 1;
+            imageViewCI.subresourceRange.baseArrayLayer = 0;
+            imageViewCI.subresourceRange.layerCount = 1;
+            VK_CHECK_RESULT(vkCreateImageView(vulkanRenderer->device, &imageViewCI, nullptr, &hizMipViews[mip]));
+        }
+
+        // 只用texelFetch和textureLod取指定级别，不做过滤
+        VkSamplerCreateInfo samplerCI = {};
+        samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerCI.magFilter = VK_FILTER_NEAREST;
+        samplerCI.minFilter = VK_FILTER_NEAREST;
+        samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCI.minLod = 0.0f;
+        samplerCI.maxLod = static_cast<float>(hizMipCount);
+        samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        VK_CHECK_RESULT(vkCreateSampler(vulkanRenderer->device, &samplerCI, nullptr, &hizSampler));
+
+        vulkanRenderer->createImage(HiZWidth, HiZHeight,
+            vulkanRenderer->depthImageFormat,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | vulkanRenderer->getTransientAttachmentUsage(),
+            vulkanRenderer->getTransientAttachmentMemoryProperty(),
+            depthImage,
+            depthMemory,
+            0,
+            1,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            MemoryCategory::RenderTarget);
+
+        depthView = vulkanRenderer->createImageView(depthImage, vulkanRenderer->depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, 1);
+    }
+
+    void VulkanOcclusionCuller::createPrepass()
+    {
+        VkAttachmentDescription attachment[2] = {};
+
+        attachment[0].format = VK_FORMAT_R32_SFLOAT;
+        attachment[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachment[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachment[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachment[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachment[0].finalLayout = VK_IMAGE_LAYOUT_GENERAL;       // 之后compute读写整个mip链
+
+        attachment[1].format = vulkanRenderer->depthImageFormat;
+        attachment[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachment[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachment[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachment[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorRef = {};
+        colorRef.attachment = 0;
+        colorRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthRef = {};
+        depthRef.attachment = 1;
+        depthRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorRef;
+        subpass.pDepthStencilAttachment = &depthRef;
+
+        VkSubpassDependency dependency[2] = {};
+        // 上一帧的compute还在读写Hi-Z
+        dependency[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency[0].dstSubpass = 0;
+        dependency[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependency[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency[0].srcAccessMask = 0;
+        dependency[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency[0].dependencyFlags = 0;
+
+        dependency[1].srcSubpass = 0;
+        dependency[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependency[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependency[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependency[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependency[1].dependencyFlags = 0;
+
+        VkRenderPassCreateInfo renderPassCI = {};
+        renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassCI.attachmentCount = sizeof(attachment) / sizeof(attachment[0]);
+        renderPassCI.pAttachments = attachment;
+        renderPassCI.subpassCount = 1;
+        renderPassCI.pSubpasses = &subpass;
+        renderPassCI.dependencyCount = sizeof(dependency) / sizeof(dependency[0]);
+        renderPassCI.pDependencies = dependency;
+
+        VK_CHECK_RESULT(vkCreateRenderPass(vulkanRenderer->device, &renderPassCI, nullptr, &prepassRenderPass));
+
+        VkImageView attachments[2] = { hizMipViews[0], depthView };
+
+        VkFramebufferCreateInfo frameBufferCI = {};
+        frameBufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        frameBufferCI.renderPass = prepassRenderPass;
+        frameBufferCI.attachmentCount = sizeof(attachments) / sizeof(attachments[0]);
+        frameBufferCI.pAttachments = attachments;
+        frameBufferCI.width = HiZWidth;
+        frameBufferCI.height = HiZHeight;
+        frameBufferCI.layers = 1;
+
+        VK_CHECK_RESULT(vkCreateFramebuffer(vulkanRenderer->device, &frameBufferCI, nullptr, &prepassFramebuffer));
+
+        // 和阴影pass相同的布局，projView换成相机的
+        VkDescriptorSetLayoutBinding binding[2] = {};
+
+        binding[0].binding = 0;
+        binding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        binding[0].descriptorCount = 1;
+        binding[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        binding[1].binding = 1;
+        binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding[1].descriptorCount = 1;
+        binding[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutCI = {};
+        layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutCI.bindingCount = sizeof(binding) / sizeof(binding[0]);
+        layoutCI.pBindings = binding;
+
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRenderer->device, &layoutCI, nullptr, &prepassSetLayout));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+        pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCI.setLayoutCount = 1;
+        pipelineLayoutCI.pSetLayouts = &prepassSetLayout;
+
+        VK_CHECK_RESULT(vkCreatePipelineLayout(vulkanRenderer->device, &pipelineLayoutCI, nullptr, &prepassPipelineLayout));
+
+        // 阴影的shader输出的就是gl_FragCoord.z
+        auto vertShaderCode = VulkanUtil::readFile(sceneData->shadowVSFilePath);
+        auto fragShaderCode = VulkanUtil::readFile(sceneData->shadowFSFilePath);
+
+        auto vertexBindingDescriptions = Vertex::getBindingDescriptions();
+        std::vector<VkVertexInputAttributeDescription> vertexAttributeDescriptions = { Vertex::getAttributeDescriptions()[0] };
+
+        VkViewport viewport = { 0, 0, static_cast<float>(HiZWidth), static_cast<float>(HiZHeight), 0.0, 1.0 };
+        VkRect2D scissor = { {0, 0}, { HiZWidth, HiZHeight } };
+
+        std::vector<VkDynamicState> dynamicStates;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachmentState = {};
+        colorBlendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+        colorBlendAttachmentState.blendEnable = VK_FALSE;
+
+        VulkanPipeline::createPipeline(vulkanRenderer, prepassPipeline,
+            prepassPipelineLayout,
+            vertShaderCode, fragShaderCode,
+            vertexBindingDescriptions, vertexAttributeDescriptions,
+            prepassRenderPass,
+            0,
+            viewport, scissor,
+            VK_SAMPLE_COUNT_1_BIT,
+            dynamicStates, 1, &colorBlendAttachmentState, true, true);
+
+        VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(prepassSetLayout, prepassSet));
+
+        // DeferredUniformBufferObject的第一个成员就是相机的projView
+        VkDescriptorBufferInfo bufferInfo[2] = {};
+        bufferInfo[0].buffer = sceneData->deferredUniformResource.buffer;
+        bufferInfo[0].offset = 0;
+        bufferInfo[0].range = sizeof(glm::mat4);
+
+        bufferInfo[1].buffer = sceneData->meshDrawDataResource.buffer;
+        bufferInfo[1].offset = 0;
+        bufferInfo[1].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+        for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+        {
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = prepassSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pBufferInfo = &bufferInfo[i];
+        }
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+        vkUpdateDescriptorSets(vulkanRenderer->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void VulkanOcclusionCuller::createComputePipelines()
+    {
+        VkDevice device = vulkanRenderer->device;
+
+        // Hi-Z生成：上一级取2x2的最大深度写到下一级
+        {
+            VkDescriptorSetLayoutBinding binding[2] = {};
+            binding[0].binding = 0;
+            binding[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            binding[0].descriptorCount = 1;
+            binding[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+            binding[1].binding = 1;
+            binding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            binding[1].descriptorCount = 1;
+            binding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+            VkDescriptorSetLayoutCreateInfo layoutCI = {};
+            layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutCI.bindingCount = sizeof(binding) / sizeof(binding[0]);
+            layoutCI.pBindings = binding;
+            VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutCI, nullptr, &hizBuildSetLayout));
+
+            VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+            pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutCI.setLayoutCount = 1;
+            pipelineLayoutCI.pSetLayouts = &hizBuildSetLayout;
+            VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &hizBuildPipelineLayout));
+
+            hizBuildPipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, hizBuildPipelineLayout, sceneData->hizBuildCSFilePath);
+
+            hizBuildSets.resize(hizMipCount - 1);
+            for (uint32_t mip = 1; mip < hizMipCount; mip++)
+            {
+                VkDescriptorSet& descriptorSet = hizBuildSets[mip - 1];
+                VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(hizBuildSetLayout, descriptorSet));
+
+                VkDescriptorImageInfo imageInfo[2] = {};
+                imageInfo[0].sampler = hizSampler;
+                imageInfo[0].imageView = hizMipViews[mip - 1];
+                imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                imageInfo[1].imageView = hizMipViews[mip];
+                imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+                for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+                {
+                    descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    descriptorWrites[i].dstSet = descriptorSet;
+                    descriptorWrites[i].dstBinding = i;
+                    descriptorWrites[i].descriptorCount = 1;
+                    descriptorWrites[i].pImageInfo = &imageInfo[i];
+                }
+                descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+                vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+            }
+        }
+
+        // 剔除：两个阶段共用一个pipeline，用push constant区分
+        {
+            VkDescriptorType types[] = {
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // mesh包围盒
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // 队列写好的绘制参数
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // 每个draw的材质段
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // 输出的绘制参数
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // 材质段的draw数量
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // mesh可见性
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // 统计
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,  // Hi-Z
+            };
+
+            std::vector<VkDescriptorSetLayoutBinding> bindings(sizeof(types) / sizeof(types[0]));
+            for (uint32_t i = 0; i < bindings.size(); i++)
+            {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = types[i];
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+
+            VkDescriptorSetLayoutCreateInfo layoutCI = {};
+            layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutCI.bindingCount = static_cast<uint32_t>(bindings.size());
+            layoutCI.pBindings = bindings.data();
+            VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutCI, nullptr, &cullSetLayout));
+
+            VkPushConstantRange pushConstantRange = {};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.offset = 0;
+            pushConstantRange.size = sizeof(CullPushConstants);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+            pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutCI.setLayoutCount = 1;
+            pipelineLayoutCI.pSetLayouts = &cullSetLayout;
+            pipelineLayoutCI.pushConstantRangeCount = 1;
+            pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+            VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &cullPipelineLayout));
+
+            cullPipeline = VulkanPipeline::createComputePipeline(vulkanRenderer, cullPipelineLayout, sceneData->occlusionCullingCSFilePath);
+
+            for (auto& frame : frames)
+            {
+                reserveBuffer(frame.stats, sizeof(uint32_t) * StatsCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, true);
+            }
+        }
+    }
+
+    bool VulkanOcclusionCuller::reserveBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible)
+    {
+        if (size <= buffer.size)
+        {
+            return false;
+        }
+
+        destroyBuffer(buffer);
+
+        buffer.size = std::max(size, buffer.size * 2);
+        VkMemoryPropertyFlags properties = hostVisible ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        vulkanRenderer->createBuffer(buffer.size, usage, properties, buffer.buffer, buffer.memory, MemoryCategory::Geometry);
+
+        if (hostVisible)
+        {
+            VK_CHECK_RESULT(vkMapMemory(vulkanRenderer->device, buffer.memory, 0, buffer.size, 0, &buffer.mapped));
+        }
+        return true;
+    }
+
+    void VulkanOcclusionCuller::destroyBuffer(Buffer& buffer)
+    {
+        // 旧buffer可能还在被之前的帧使用
+        if (buffer.buffer != VK_NULL_HANDLE)
+        {
+            vulkanRenderer->deletionQueue.destroyBuffer(buffer.buffer);
+            vulkanRenderer->deletionQueue.freeMemory(buffer.memory);
+        }
+        buffer = {};
+    }
+
+    void VulkanOcclusionCuller::updateMeshDrawDataDescriptor()
+    {
+        if (prepassSet == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = sceneData->meshDrawDataResource.buffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet descriptorWrite = {};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = prepassSet;
+        descriptorWrite.dstBinding = 1;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(vulkanRenderer->device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    void VulkanOcclusionCuller::updateCullSet(VkDescriptorSet descriptorSet, VkBuffer inputCommands, const FrameResources& frame, VkBuffer outputCommands)
+    {
+        VkBuffer buffers[] = {
+            sceneData->meshBoundsResource.buffer,
+            inputCommands,
+            frame.itemBatches.buffer,
+            outputCommands,
+            frame.drawCounts.buffer,
+            visibility.buffer,
+            frame.stats.buffer,
+        };
+        const uint32_t bufferCount = sizeof(buffers) / sizeof(buffers[0]);
+
+        std::array<VkDescriptorBufferInfo, bufferCount> bufferInfos = {};
+        std::array<VkWriteDescriptorSet, bufferCount + 1> descriptorWrites = {};
+        for (uint32_t i = 0; i < bufferCount; i++)
+        {
+            bufferInfos[i].buffer = buffers[i];
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = descriptorSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.sampler = hizSampler;
+        imageInfo.imageView = hizView;
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet& imageWrite = descriptorWrites[bufferCount];
+        imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        imageWrite.dstSet = descriptorSet;
+        imageWrite.dstBinding = bufferCount;
+        imageWrite.descriptorCount = 1;
+        imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        imageWrite.pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(vulkanRenderer->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void VulkanOcclusionCuller::cull(VkCommandBuffer commandBuffer, VulkanRenderQueue& queue, const glm::mat4& viewProj)
+    {
+        const std::vector<DrawItem>& items = queue.getItems();
+        const std::vector<DrawBatch>& batches = queue.getBatches();
+        VkBuffer inputCommands = queue.getIndirectBuffer();
+
+        if (!supported || items.empty() || inputCommands == VK_NULL_HANDLE)
+        {
+            queue.setGpuDrawSource(VK_NULL_HANDLE, VK_NULL_HANDLE);
+            return;
+        }
+
+        FrameResources& frame = frames[vulkanRenderer->currentFrameIndex];
+
+        // 该帧的fence已经等过，上一次写入的统计可以直接读
+        if (frame.statsValid)
+        {
+            const uint32_t* stats = static_cast<const uint32_t*>(frame.stats.mapped);
+            OcclusionCullingStats& result = sceneData->occlusionCullingStats;
+            result.tested = stats[0];
+            result.prepassDrawn = stats[1];
+            result.frustumCulled = stats[2];
+            result.occluded = stats[3];
+            result.visible = stats[4];
+        }
+
+        const uint32_t itemCount = static_cast<uint32_t>(items.size());
+        const uint32_t batchCount = static_cast<uint32_t>(batches.size());
+        const VkDeviceSize commandsSize = sizeof(VkDrawIndexedIndirectCommand) * itemCount;
+        const VkBufferUsageFlags commandUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+        reserveBuffer(frame.prepassCommands, commandsSize, commandUsage, false);
+        reserveBuffer(frame.outputCommands, commandsSize, commandUsage, false);
+        reserveBuffer(frame.drawCounts, sizeof(uint32_t) * batchCount, commandUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+        reserveBuffer(frame.itemBatches, sizeof(uint32_t) * 2 * itemCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true);
+
+        // 可见性按mesh下标存，mesh变多时重新创建并全部当作可见
+        uint32_t meshCount = static_cast<uint32_t>(std::max<size_t>(sceneData->meshes.size(), 1));
+        if (reserveBuffer(visibility, sizeof(uint32_t) * meshCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false))
+        {
+            visibilityReset = true;
+        }
+
+        uint32_t* itemBatches = static_cast<uint32_t*>(frame.itemBatches.mapped);
+        for (uint32_t batchIndex = 0; batchIndex < batchCount; batchIndex++)
+        {
+            const DrawBatch& batch = batches[batchIndex];
+            for (uint32_t i = batch.itemBegin; i < batch.itemBegin + batch.itemCount; i++)
+            {
+                itemBatches[i * 2] = batchIndex;
+                itemBatches[i * 2 + 1] = batch.itemBegin;
+            }
+        }
+
+        // 绑定的buffer每帧都可能重新创建，set从帧pool分配，帧pool在该帧的fence之后整体reset
+        uint32_t frameIndex = vulkanRenderer->currentFrameIndex;
+        VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocateFrame(cullSetLayout, frame.prepassSet, frameIndex));
+        VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocateFrame(cullSetLayout, frame.cullSet, frameIndex));
+        updateCullSet(frame.prepassSet, inputCommands, frame, frame.prepassCommands.buffer);
+        updateCullSet(frame.cullSet, inputCommands, frame, frame.outputCommands.buffer);
+
+        vkCmdFillBuffer(commandBuffer, frame.drawCounts.buffer, 0, sizeof(uint32_t) * batchCount, 0);
+        vkCmdFillBuffer(commandBuffer, frame.stats.buffer, 0, sizeof(uint32_t) * StatsCount, 0);
+        if (visibilityReset)
+        {
+            vkCmdFillBuffer(commandBuffer, visibility.buffer, 0, VK_WHOLE_SIZE, 1);
+            visibilityReset = false;
+        }
+
+        // 清零，以及上一帧第二阶段写入的可见性
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        CullPushConstants pushConstants = {};
+        pushConstants.viewProj = viewProj;
+        pushConstants.itemCount = itemCount;
+        pushConstants.compact = compact ? 1 : 0;
+        pushConstants.mipCount = hizMipCount;
+        pushConstants.hizSize = glm::vec2(HiZWidth, HiZHeight);
+
+        const uint32_t cullGroupCount = (itemCount + CullGroupSize - 1) / CullGroupSize;
+
+        // 第一阶段：上一帧可见的draw
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+        vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame.prepassSet, 0, nullptr);
+        pushConstants.phase = 0;
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, cullGroupCount, 1, 1);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        {
+            VkRenderPassBeginInfo renderPassInfo = {};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = prepassRenderPass;
+            renderPassInfo.framebuffer = prepassFramebuffer;
+            renderPassInfo.renderArea.extent.width = HiZWidth;
+            renderPassInfo.renderArea.extent.height = HiZHeight;
+            std::array<VkClearValue, 2> clearValues{};
+            clearValues[0].color = { {1.0f} };
+            clearValues[1].depthStencil = { 1.0f, 0 };
+            renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+            renderPassInfo.pClearValues = clearValues.data();
+
+            vulkanRenderer->cmdBeginRenderPass(commandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, prepassPipeline);
+            vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, prepassPipelineLayout, 0, 1, &prepassSet, 0, nullptr);
+            sceneData->bindGeometry(commandBuffer);
+            vkCmdDrawIndexedIndirect(commandBuffer, frame.prepassCommands.buffer, 0, itemCount, sizeof(VkDrawIndexedIndirectCommand));
+
+            vulkanRenderer->cmdEndRenderPass(commandBuffer);
+        }
+
+        // 第0级以外的内容每帧重新生成，旧内容不需要保留
+        VkImageMemoryBarrier imageBarrier = {};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = 0;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = hizImage;
+        imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageBarrier.subresourceRange.baseMipLevel = 1;
+        imageBarrier.subresourceRange.levelCount = hizMipCount - 1;
+        imageBarrier.subresourceRange.baseArrayLayer = 0;
+        imageBarrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizBuildPipeline);
+        for (uint32_t mip = 1; mip < hizMipCount; mip++)
+        {
+            uint32_t width = std::max(HiZWidth >> mip, 1u);
+            uint32_t height = std::max(HiZHeight >> mip, 1u);
+
+            vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizBuildPipelineLayout, 0, 1, &hizBuildSets[mip - 1], 0, nullptr);
+            vkCmdDispatch(commandBuffer, (width + HiZGroupSize - 1) / HiZGroupSize, (height + HiZGroupSize - 1) / HiZGroupSize, 1);
+
+            imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageBarrier.subresourceRange.baseMipLevel = mip;
+            imageBarrier.subresourceRange.levelCount = 1;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+        }
+
+        // 第二阶段：所有draw用当帧的Hi-Z重新测试
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+        vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame.cullSet, 0, nullptr);
+        pushConstants.phase = 1;
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, cullGroupCount, 1, 1);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        frame.statsValid = true;
+
+        queue.setGpuDrawSource(frame.outputCommands.buffer, compact ? frame.drawCounts.buffer : VK_NULL_HANDLE);
+    }
+}
\ No newline at end of file
@@ -1,14 +1,15 @@
 ﻿#include "vulkanPipeline.hpp"
 #include "macro.hpp"
+#include "vulkanUtil.hpp"
 
 namespace VulkanEngine
 {
-	void VulkanPipeline::createPipeline(VulkanRenderer* vulkanRender, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, std::vector<char>& vertShaderCode, std::vector<char>& fragShaderCode, std::vector<VkVertexInputBindingDescription>& bindingDescriptions, std::vector<VkVertexInputAttributeDescription>& attributeDescriptions, VkRenderPass& renderPass, uint32_t subpassIndex, VkViewport& viewport, VkRect2D& scissor, VkSampleCountFlagBits samples, std::vector<VkDynamicState>& dynamicStates, uint32_t attachmentCount, VkPipelineColorBlendAttachmentState* colorBlendAttachmentState, bool depthTest, bool depthWrite)
+	void VulkanPipeline::createPipeline(VulkanRenderer* vulkanRender, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, std::vector<char>& vertShaderCode, std::vector<char>& fragShaderCode, std::vector<VkVertexInputBindingDescription>& bindingDescriptions, std::vector<VkVertexInputAttributeDescription>& attributeDescriptions, VkRenderPass& renderPass, uint32_t subpassIndex, VkViewport& viewport, VkRect2D& scissor, VkSampleCountFlagBits samples, std::vector<VkDynamicState>& dynamicStates, uint32_t attachmentCount, VkPipelineColorBlendAttachmentState* colorBlendAttachmentState, bool depthTest, bool depthWrite, float depthBiasConstant, float depthBiasSlope, const VkSpecializationInfo* fragSpecializationInfo, VkCompareOp depthCompareOp)
 	{
 		// shader
 		// shaderModule只是字节码的容器，仅在渲染管线处理过程中需要，设置完就可以销毁
 		VkShaderModule vertShaderModule = vulkanRender->createShaderModule(vertShaderCode);
-		VkShaderModule fragShaderModule = vulkanRender->createShaderModule(fragShaderCode);
+		VkShaderModule fragShaderModule = fragShaderCode.empty() ? VK_NULL_HANDLE : vulkanRender->createShaderModule(fragShaderCode);
 
 		VkPipelineShaderStageCreateInfo vertShaderStageCI = {};
 		vertShaderStageCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -22,7 +23,7 @@ namespace VulkanEngine
 		fragShaderStageCI.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		fragShaderStageCI.module = fragShaderModule;
 		fragShaderStageCI.pName = "main";
-		fragShaderStageCI.pSpecializationInfo = nullptr;
+		fragShaderStageCI.pSpecializationInfo = fragSpecializationInfo;
 
 		VkPipelineShaderStageCreateInfo shaderStageCI[] = { vertShaderStageCI, fragShaderStageCI };
 
@@ -66,10 +67,10 @@ namespace VulkanEngine
 		//rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
 		rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
 		rasterizationStateCI.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-		rasterizationStateCI.depthBiasEnable = VK_FALSE;
-		rasterizationStateCI.depthBiasConstantFactor = 0.0f;
+		rasterizationStateCI.depthBiasEnable = (depthBiasConstant != 0.0f || depthBiasSlope != 0.0f) ? VK_TRUE : VK_FALSE;
+		rasterizationStateCI.depthBiasConstantFactor = depthBiasConstant;
 		rasterizationStateCI.depthBiasClamp = 0.0f;
-		rasterizationStateCI.depthBiasSlopeFactor = 0.0f;
+		rasterizationStateCI.depthBiasSlopeFactor = depthBiasSlope;
 
 		// 多重采样
 		VkPipelineMultisampleStateCreateInfo multisampleStateCI = {};
@@ -116,7 +117,7 @@ namespace VulkanEngine
 		depthStencilStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 		depthStencilStateCI.depthTestEnable = depthTest;
 		depthStencilStateCI.depthWriteEnable = depthWrite;
-		depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS;
+		depthStencilStateCI.depthCompareOp = depthCompareOp;
 		
 		if (depthTest == false && depthWrite == false)
 		{
@@ -129,18 +130,13 @@ namespace VulkanEngine
 		// 动态项设置
 		VkPipelineDynamicStateCreateInfo dynamicStateCI = {};
 		dynamicStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		//dynamicStateCI.dynamicStateCount = dynamicStates.size();		// TODO:暂不启用
-		//dynamicStateCI.pDynamicStates = dynamicStates.data();
-		//if (dynamicStates.empty())
-		//{
-		//	dynamicStateCI.pDynamicStates = nullptr;
-		//}
-		dynamicStateCI.dynamicStateCount = 0;
-		dynamicStateCI.pDynamicStates = nullptr;
+		// 声明为动态的状态录制时必须设置，视口和裁剪固定的管线传空列表
+		dynamicStateCI.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicStateCI.pDynamicStates = dynamicStates.empty() ? nullptr : dynamicStates.data();
 
 		VkGraphicsPipelineCreateInfo pipelineCI = {};
 		pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineCI.stageCount = sizeof(shaderStageCI) / sizeof(shaderStageCI[0]);
+		pipelineCI.stageCount = fragShaderModule != VK_NULL_HANDLE ? sizeof(shaderStageCI) / sizeof(shaderStageCI[0]) : 1;
 		pipelineCI.pStages = shaderStageCI;
 		pipelineCI.pVertexInputState = &vertexInputStateCI;
 		pipelineCI.pInputAssemblyState = &inputAssemblyCI;
@@ -158,6 +154,30 @@ namespace VulkanEngine
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(vulkanRender->device, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
 
 		vkDestroyShaderModule(vulkanRender->device, vertShaderModule, nullptr);
-		vkDestroyShaderModule(vulkanRender->device, fragShaderModule, nullptr);
+		if (fragShaderModule != VK_NULL_HANDLE)
+		{
+			vkDestroyShaderModule(vulkanRender->device, fragShaderModule, nullptr);
+		}
+	}
+
+	VkPipeline VulkanPipeline::createComputePipeline(VulkanRenderer* vulkanRender, VkPipelineLayout layout, const std::string& path, const VkSpecializationInfo* specializationInfo)
+	{
+		auto shaderCode = VulkanUtil::readFile(path);
+		VkShaderModule shaderModule = vulkanRender->createShaderModule(shaderCode);
+
+		VkComputePipelineCreateInfo pipelineCI = {};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineCI.stage.module = shaderModule;
+		pipelineCI.stage.pName = "main";
+		pipelineCI.stage.pSpecializationInfo = specializationInfo;
+		pipelineCI.layout = layout;
+
+		VkPipeline pipeline;
+		VK_CHECK_RESULT(vkCreateComputePipelines(vulkanRender->device, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+
+		vkDestroyShaderModule(vulkanRender->device, shaderModule, nullptr);
+		return pipeline;
 	}
 }
\ No newline at end of file
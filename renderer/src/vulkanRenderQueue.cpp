@@ -0,0 +1,385 @@
+﻿#include "vulkanRenderQueue.hpp"
+#include "vulkanRenderPass.hpp"
+#include "vulkanScene.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace VulkanEngine
+{
+    void VulkanRenderQueue::init(VulkanRenderer* vulkanRenderer)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+    }
+
+    void VulkanRenderQueue::cleanup()
+    {
+        for (auto& indirectBuffer : indirectBuffers)
+        {
+            vulkanRenderer->deletionQueue.destroyBuffer(indirectBuffer.buffer);
+            vulkanRenderer->deletionQueue.freeMemory(indirectBuffer.memory);
+            indirectBuffer = {};
+        }
+        items.clear();
+        sortBuffer.clear();
+        materialIDs.clear();
+        for (auto& frameCache : cachedCommandBuffers)
+        {
+            frameCache.clear();
+        }
+        cachedFrames.fill(false);
+    }
+
+    uint64_t VulkanRenderQueue::makeSortKey(RenderQueuePass pass, uint32_t pipeline, uint32_t material, uint32_t depth, uint32_t mesh)
+    {
+        uint64_t key = static_cast<uint64_t>(pass) & ((1ull << PassBits) - 1);
+        key = (key << PipelineBits) | (pipeline & ((1ull << PipelineBits) - 1));
+        key = (key << MaterialBits) | (material & ((1ull << MaterialBits) - 1));
+        key = (key << DepthBits) | (depth & ((1ull << DepthBits) - 1));
+        key = (key << MeshBits) | (mesh & ((1ull << MeshBits) - 1));
+        return key;
+    }
+
+    uint32_t VulkanRenderQueue::getMaterialID(VkDescriptorSet materialSet)
+    {
+        auto iter = materialIDs.find(materialSet);
+        if (iter != materialIDs.end())
+        {
+            return iter->second;
+        }
+
+        // 编号用完了就重新分配，只影响排序不影响正确性
+        if (materialIDs.size() >= (1ull << MaterialBits))
+        {
+            materialIDs.clear();
+        }
+
+        uint32_t id = static_cast<uint32_t>(materialIDs.size());
+        materialIDs[materialSet] = id;
+        return id;
+    }
+
+    void VulkanRenderQueue::build(RenderQueuePass pass, uint32_t pipeline, VulkanRenderSceneData* sceneData, const glm::mat4& viewProj, const std::vector<uint32_t>* visibleMeshes, bool sortByDepth)
+    {
+        this->sceneData = sceneData;
+        items.clear();
+        depths.clear();
+
+        const std::vector<MeshDrawInfo>& drawInfos = sceneData->getMeshDrawInfos();
+
+        // 用mesh节点的原点近似物体位置
+        float minDepth = std::numeric_limits<float>::max();
+        float maxDepth = 0.0f;
+        size_t candidateCount = visibleMeshes != nullptr ? visibleMeshes->size() : drawInfos.size();
+        for (size_t candidate = 0; candidate < candidateCount; candidate++)
+        {
+            size_t i = visibleMeshes != nullptr ? (*visibleMeshes)[candidate] : candidate;
+            // 超出meshDrawDatas的mesh在shader里读不到自己的数据，不能绘制
+            if (i >= drawInfos.size() || i >= sceneData->meshDrawDatas.size() || drawInfos[i].indexCount == 0)
+            {
+                continue;
+            }
+
+            float depth = 0.0f;
+            if (sortByDepth)
+            {
+                glm::vec4 position = viewProj * sceneData->rotate * sceneData->meshes[i]->node->worldTransform[3];
+                depth = std::max(position.w, 0.0f);
+            }
+            minDepth = std::min(minDepth, depth);
+            maxDepth = std::max(maxDepth, depth);
+
+            DrawItem item;
+            item.meshIndex = static_cast<uint32_t>(i);
+            items.push_back(item);
+            depths.push_back(depth);
+        }
+
+        const float maxBucket = static_cast<float>((1u << DepthBits) - 1);
+        float depthScale = maxDepth > minDepth ? maxBucket / (maxDepth - minDepth) : 0.0f;
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            Mesh* mesh = sceneData->meshes[items[i].meshIndex];
+            uint32_t material = mesh->material != nullptr ? getMaterialID(mesh->material->descriptorSet) : 0;
+            uint32_t depthBucket = static_cast<uint32_t>(std::min((depths[i] - minDepth) * depthScale, maxBucket));
+
+            items[i].sortKey = makeSortKey(pass, pipeline, material, depthBucket, items[i].meshIndex);
+        }
+    }
+
+    void VulkanRenderQueue::sort()
+    {
+        const uint32_t radixBits = 16;
+        const uint32_t bucketCount = 1u << radixBits;
+
+        if (items.size() < 2)
+        {
+            return;
+        }
+
+        std::vector<uint32_t> counts(bucketCount);
+        sortBuffer.resize(items.size());
+
+        for (uint32_t shift = 0; shift < 64; shift += radixBits)
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            for (const auto& item : items)
+            {
+                counts[(item.sortKey >> shift) & (bucketCount - 1)]++;
+            }
+
+            // 这一轮所有键都一样，顺序不变
+            if (counts[(items[0].sortKey >> shift) & (bucketCount - 1)] == items.size())
+            {
+                continue;
+            }
+
+            uint32_t offset = 0;
+            for (uint32_t i = 0; i < bucketCount; i++)
+            {
+                uint32_t count = counts[i];
+                counts[i] = offset;
+                offset += count;
+            }
+
+            for (const auto& item : items)
+            {
+                sortBuffer[counts[(item.sortKey >> shift) & (bucketCount - 1)]++] = item;
+            }
+            items.swap(sortBuffer);
+        }
+    }
+
+    VkDescriptorSet VulkanRenderQueue::getMaterialSet(const DrawItem& item) const
+    {
+        PBRMaterial* material = sceneData->meshes[item.meshIndex]->material;
+        return material != nullptr ? material->descriptorSet : VK_NULL_HANDLE;
+    }
+
+    void VulkanRenderQueue::reserveIndirectBuffer(IndirectBuffer& indirectBuffer, uint32_t commandCount)
+    {
+        if (commandCount <= indirectBuffer.capacity)
+        {
+            return;
+        }
+
+        // 旧buffer可能还在被之前的帧读取
+        vulkanRenderer->deletionQueue.destroyBuffer(indirectBuffer.buffer);
+        vulkanRenderer->deletionQueue.freeMemory(indirectBuffer.memory);
+
+        uint32_t capacity = std::max(commandCount, std::max(indirectBuffer.capacity * 2, 256u));
+        VkDeviceSize size = sizeof(VkDrawIndexedIndirectCommand) * capacity;
+        // GPU剔除时作为compute shader的输入
+        vulkanRenderer->createBuffer(size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indirectBuffer.buffer, indirectBuffer.memory, MemoryCategory::Geometry);
+
+        void* data;
+        VK_CHECK_RESULT(vkMapMemory(vulkanRenderer->device, indirectBuffer.memory, 0, size, 0, &data));
+        indirectBuffer.commands = static_cast<VkDrawIndexedIndirectCommand*>(data);
+        indirectBuffer.capacity = capacity;
+    }
+
+    void VulkanRenderQueue::prepare(const RenderQueueBindings& bindings)
+    {
+        drawInfos = &sceneData->getMeshDrawInfos();
+        batches.clear();
+
+        if (items.empty())
+        {
+            return;
+        }
+
+        // 排序后同材质是连续的，没有材质set的pass整个队列是一段
+        const bool bindMaterial = bindings.materialSetIndex >= 0;
+        for (uint32_t i = 0; i < items.size(); i++)
+        {
+            VkDescriptorSet materialSet = bindMaterial ? getMaterialSet(items[i]) : VK_NULL_HANDLE;
+            if (batches.empty() || batches.back().materialSet != materialSet)
+            {
+                DrawBatch batch;
+                batch.itemBegin = i;
+                batch.materialSet = materialSet;
+                batches.push_back(batch);
+            }
+            batches.back().itemCount++;
+        }
+
+        // 不支持非0的firstInstance时直接绘制，用不到indirect buffer
+        if (!vulkanRenderer->drawIndirectFirstInstanceSupported)
+        {
+            currentIndirectBuffer = nullptr;
+            return;
+        }
+
+        currentIndirectBuffer = &indirectBuffers[vulkanRenderer->currentFrameIndex];
+        reserveIndirectBuffer(*currentIndirectBuffer, static_cast<uint32_t>(items.size()));
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const MeshDrawInfo& drawInfo = (*drawInfos)[items[i].meshIndex];
+
+            VkDrawIndexedIndirectCommand& command = currentIndirectBuffer->commands[i];
+            command.indexCount = drawInfo.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = drawInfo.firstIndex;
+            command.vertexOffset = drawInfo.vertexOffset;
+            command.firstInstance = items[i].meshIndex;
+        }
+    }
+
+    void VulkanRenderQueue::recordBatches(VkCommandBuffer commandBuffer, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, size_t batchBegin, size_t batchEnd, RecordStats& stats) const
+    {
+        vulkanRenderer->cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.pipeline);
+        sceneData->bindGeometry(commandBuffer);
+
+        // 不随mesh变化的set只绑定一次
+        std::vector<VkDescriptorSet> sets = bindings.descriptorSets;
+        for (uint32_t setIndex = 0; setIndex < sets.size(); setIndex++)
+        {
+            if (static_cast<int32_t>(setIndex) == bindings.materialSetIndex)
+            {
+                continue;
+            }
+            vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.layout, setIndex, 1, &sets[setIndex], 0, nullptr);
+        }
+
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+        for (size_t batchIndex = batchBegin; batchIndex < batchEnd; batchIndex++)
+        {
+            const DrawBatch& batch = batches[batchIndex];
+
+            if (bindings.materialSetIndex >= 0)
+            {
+                VkDescriptorSet materialSet = batch.materialSet;
+                vulkanRenderer->cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.layout, bindings.materialSetIndex, 1, &materialSet, 0, nullptr);
+                stats.materialBindCount++;
+            }
+            stats.drawCount += batch.itemCount;
+
+            if (currentIndirectBuffer == nullptr)
+            {
+                for (uint32_t i = batch.itemBegin; i < batch.itemBegin + batch.itemCount; i++)
+                {
+                    const MeshDrawInfo& drawInfo = (*drawInfos)[items[i].meshIndex];
+                    renderPass->drawIndexed(commandBuffer, drawInfo.indexCount, 1, drawInfo.firstIndex, drawInfo.vertexOffset, items[i].meshIndex);
+                    stats.drawCallCount++;
+                }
+            }
+            else if (gpuCommandBuffer != VK_NULL_HANDLE && gpuCountBuffer != VK_NULL_HANDLE)
+            {
+                renderPass->drawIndexedIndirectCount(commandBuffer, gpuCommandBuffer, batch.itemBegin * stride, gpuCountBuffer, batchIndex * sizeof(uint32_t), batch.itemCount, stride);
+                stats.drawCallCount++;
+            }
+            else if (gpuCommandBuffer != VK_NULL_HANDLE)
+            {
+                renderPass->drawIndexedIndirect(commandBuffer, gpuCommandBuffer, batch.itemBegin * stride, batch.itemCount, stride);
+                stats.drawCallCount++;
+            }
+            else if (vulkanRenderer->multiDrawIndirectSupported)
+            {
+                renderPass->drawIndexedIndirect(commandBuffer, currentIndirectBuffer->buffer, batch.itemBegin * stride, batch.itemCount, stride);
+                stats.drawCallCount++;
+            }
+            else
+            {
+                for (uint32_t i = batch.itemBegin; i < batch.itemBegin + batch.itemCount; i++)
+                {
+                    renderPass->drawIndexedIndirect(commandBuffer, currentIndirectBuffer->buffer, i * stride, 1, stride);
+                    stats.drawCallCount++;
+                }
+            }
+        }
+    }
+
+    void VulkanRenderQueue::applyStats(const RecordStats& stats)
+    {
+        drawCount = stats.drawCount;
+        materialBindCount = stats.materialBindCount;
+        drawCallCount = stats.drawCallCount;
+    }
+
+    void VulkanRenderQueue::setGpuDrawSource(VkBuffer commandBuffer, VkBuffer countBuffer)
+    {
+        gpuCommandBuffer = commandBuffer;
+        gpuCountBuffer = countBuffer;
+    }
+
+    void VulkanRenderQueue::record(VkCommandBuffer commandBuffer, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings)
+    {
+        RecordStats stats;
+        if (!batches.empty())
+        {
+            recordBatches(commandBuffer, renderPass, bindings, 0, batches.size(), stats);
+        }
+        applyStats(stats);
+    }
+
+    void VulkanRenderQueue::recordSecondary(std::vector<VkCommandBuffer>& outCommandBuffers, VulkanRenderPass* renderPass, const RenderQueueBindings& bindings, uint32_t subpass, VkFramebuffer framebuffer, bool cache)
+    {
+        std::vector<VkCommandBuffer>& frameCache = cachedCommandBuffers[vulkanRenderer->currentFrameIndex];
+        frameCache.clear();
+        cachedFrames[vulkanRenderer->currentFrameIndex] = cache;
+
+        if (batches.empty())
+        {
+            applyStats(RecordStats());
+            return;
+        }
+
+        // 缓存的commandBuffer会在不同的交换链图像上执行，不能继承具体的framebuffer
+        VulkanSecondaryCommandBuffers& commandBuffers = cache ? vulkanRenderer->cachedSecondaryCommandBuffers : vulkanRenderer->secondaryCommandBuffers;
+        if (cache)
+        {
+            framebuffer = VK_NULL_HANDLE;
+        }
+
+        ThreadPool& threadPool = vulkanRenderer->recordThreadPool;
+        uint32_t batchCount = static_cast<uint32_t>(batches.size());
+        uint32_t chunkCount = std::max(1u, std::min(std::max(threadPool.getThreadCount(), 1u), batchCount / std::max(minBatchesPerThread, 1u)));
+        uint32_t batchesPerChunk = (batchCount + chunkCount - 1) / chunkCount;
+
+        std::vector<VkCommandBuffer> chunkCommandBuffers(chunkCount, VK_NULL_HANDLE);
+        std::vector<RecordStats> chunkStats(chunkCount);
+
+        threadPool.parallelFor(chunkCount, [&](uint32_t chunk, uint32_t thread) {
+            size_t batchBegin = static_cast<size_t>(chunk) * batchesPerChunk;
+            size_t batchEnd = std::min<size_t>(batchBegin + batchesPerChunk, batchCount);
+
+            VkCommandBuffer commandBuffer = commandBuffers.begin(thread, renderPass->renderPass, subpass, framebuffer);
+            recordBatches(commandBuffer, renderPass, bindings, batchBegin, batchEnd, chunkStats[chunk]);
+            commandBuffers.end(commandBuffer);
+
+            chunkCommandBuffers[chunk] = commandBuffer;
+        });
+
+        // 按分段顺序执行，保持排序结果
+        RecordStats stats;
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            outCommandBuffers.push_back(chunkCommandBuffers[chunk]);
+            stats.drawCount += chunkStats[chunk].drawCount;
+            stats.materialBindCount += chunkStats[chunk].materialBindCount;
+            stats.drawCallCount += chunkStats[chunk].drawCallCount;
+        }
+        applyStats(stats);
+
+        if (cache)
+        {
+            frameCache = chunkCommandBuffers;
+        }
+    }
+
+    void VulkanRenderQueue::appendCachedCommandBuffers(std::vector<VkCommandBuffer>& outCommandBuffers) const
+    {
+        const std::vector<VkCommandBuffer>& frameCache = cachedCommandBuffers[vulkanRenderer->currentFrameIndex];
+        outCommandBuffers.insert(outCommandBuffers.end(), frameCache.begin(), frameCache.end());
+    }
+
+    void VulkanRenderQueue::clearCachedCommandBuffers(uint32_t frameIndex)
+    {
+        cachedCommandBuffers[frameIndex].clear();
+        cachedFrames[frameIndex] = false;
+    }
+}
\ No newline at end of file
@@ -53,6 +53,10 @@ namespace VulkanEngine
     {
         vkDeviceWaitIdle(device);
 
+        deletionQueue.flush();
+
+        descriptorAllocator.cleanup();
+
         clearSwapChain();
 
         for (auto& iter = mipmapSamplerMap.begin(); iter != mipmapSamplerMap.end(); iter++)
@@ -75,6 +79,10 @@ namespace VulkanEngine
             vkDestroyFence(device, isFrameInFlightFences[i], nullptr);
         }
 
+        recordThreadPool.shutdown();
+        secondaryCommandBuffers.cleanup();
+        cachedSecondaryCommandBuffers.cleanup();
+
         vkDestroyCommandPool(device, mainCommandPool, nullptr);
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
@@ -112,6 +120,8 @@ namespace VulkanEngine
             enableDebugUtilsLabel = false;
         }
 
+        deletionQueue.init(this);
+
         createInstance();
 
         setupDebugMessenger();
@@ -126,6 +136,8 @@ namespace VulkanEngine
 
         createCommandBuffers();
 
+        createRecordThreads();
+
         createDescriptorPool();
 
         createSyncPrimitives();
@@ -141,9 +153,19 @@ namespace VulkanEngine
     {
         // 等待上次commandBuffer执行完毕，否则会出现命令堆积
         vkWaitForFences(device, 1, &isFrameInFlightFences[currentFrameIndex], VK_TRUE, UINT64_MAX);
+
+        // 释放fence已经signal的资源
+        deletionQueue.collect();
+
+        // 显存统计和预算检查
+        memoryTracker.update();
+
+        // 该帧的临时descriptor set可以整体回收了
+        descriptorAllocator.resetFrame(currentFrameIndex);
         
         // 重置commandPool，进行重新录制
         VK_CHECK_RESULT(vkResetCommandPool(device, commandPools[currentFrameIndex], 0));
+        secondaryCommandBuffers.resetFrame(currentFrameIndex);
 
         // 第三个参数指定获取有效图像的操作timeout，单位纳秒。我们使用64位无符号最大值禁止timeout。
         VkResult acquireNextImageResult = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableForRenderSemaphores[currentFrameIndex], VK_NULL_HANDLE, &currentSwapChainImageIndex);
@@ -186,6 +208,7 @@ namespace VulkanEngine
                 LOG_ERROR("failed to queue submit!");
                 return false;
             }
+            deletionQueue.onFrameSubmitted(currentFrameIndex);
             currentFrameIndex = (currentFrameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
             return true;
         }
@@ -198,7 +221,7 @@ namespace VulkanEngine
             }
         }
 
-        // TODO:这里每次都重新录制，对于未修改的情况是否可以优化？
+        // primary每帧重新录制，场景命令在record-once模式下缓存在secondary里复用，见Renderer::getRecordCacheKey
         // 开始录制
         VkCommandBufferBeginInfo commandBufferBeginInfo = {};
         commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -249,6 +272,7 @@ namespace VulkanEngine
 
         // 可以一次性做大量提交
         VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, isFrameInFlightFences[currentFrameIndex]));
+        deletionQueue.onFrameSubmitted(currentFrameIndex);
 
         VkPresentInfoKHR presentInfo = {};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -423,6 +447,29 @@ namespace VulkanEngine
             queueCIs.push_back(queueCI);
         }
 
+        // 可选扩展
+        std::vector<const char*> enabledDeviceExtensions = deviceExtensions;
+        {
+            uint32_t extensionCount;
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+            for (const auto& extension : availableExtensions)
+            {
+                // VK_EXT_memory_budget需要vkGetPhysicalDeviceMemoryProperties2
+                if (physicalDeviceProperties2Supported && strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+                {
+                    memoryBudgetSupported = true;
+                    enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+                }
+                else if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+                {
+                    drawIndirectCountSupported = true;
+                    enabledDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+                }
+            }
+        }
+
         // physical device features
         VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
 
@@ -437,6 +484,14 @@ namespace VulkanEngine
 
         // 支持geometry shader
         physicalDeviceFeatures.geometryShader = VK_TRUE;
+
+        // 间接绘制，不支持时退回逐个draw
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+        drawIndirectFirstInstanceSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+        physicalDeviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+        physicalDeviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
         
         // deviceCI
         VkDeviceCreateInfo deviceCI{};
@@ -444,8 +499,8 @@ namespace VulkanEngine
         deviceCI.pQueueCreateInfos = queueCIs.data();
         deviceCI.queueCreateInfoCount = static_cast<uint32_t>(queueCIs.size());
         deviceCI.pEnabledFeatures = &physicalDeviceFeatures;
-        deviceCI.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        deviceCI.ppEnabledExtensionNames = deviceExtensions.data();
+        deviceCI.enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions.size());
+        deviceCI.ppEnabledExtensionNames = enabledDeviceExtensions.data();
         deviceCI.enabledLayerCount = 0;
 
         VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCI, nullptr, &device));
@@ -457,8 +512,30 @@ namespace VulkanEngine
 
         vkGetDeviceQueue(device, queueIndices.computeFamily.value(), 0, &computeQueue);
 
+        if (drawIndirectCountSupported)
+        {
+            _vkCmdDrawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+            drawIndirectCountSupported = _vkCmdDrawIndexedIndirectCountKHR != nullptr;
+        }
+        LOG_INFO("draw indirect count: {}", drawIndirectCountSupported ? "supported" : "unavailable");
+
         // 查询深度支持的格式
         depthImageFormat = findDepthFormat();
+
+        memoryTracker.init(instance, physicalDevice, device, memoryBudgetSupported);
+
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        {
+            VkMemoryPropertyFlags lazyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            if ((memoryProperties.memoryTypes[i].propertyFlags & lazyFlags) == lazyFlags)
+            {
+                lazilyAllocatedMemorySupported = true;
+                break;
+            }
+        }
+        LOG_INFO("lazily allocated memory: {}", lazilyAllocatedMemorySupported ? "supported" : "unavailable");
     }
 
     void VulkanRenderer::createCommandPool()
@@ -503,31 +580,33 @@ namespace VulkanEngine
         }
     }
 
+    void VulkanRenderer::createRecordThreads()
+    {
+        // 主线程也要录制，工作线程留一个核给它
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        uint32_t threadCount = hardwareThreads > 1 ? std::min(hardwareThreads - 1, maxRecordThreads) : 1;
+
+        recordThreadPool.init(threadCount);
+        secondaryCommandBuffers.init(this, threadCount + 1);
+        cachedSecondaryCommandBuffers.init(this, threadCount + 1, true);
+
+        LOG_INFO("command record threads: {}", threadCount);
+    }
+
     void VulkanRenderer::createDescriptorPool()
     {
-        // TODO:DescriptorSet作为一种资源，应该想内存那样进行复用管理，不过暂时开足够大，以免不够用
-        VkDescriptorPoolSize poolSizes[7];
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC; // 多pass
-        poolSizes[0].descriptorCount = 3 + 2 + 2 + 2 + 1 + 1 + 3 + 3;
-        poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;         // 粒子系统、骨骼动画
-        poolSizes[1].descriptorCount = 1 + 1 + 1 * maxVertexBlendingMeshCount;
-        poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[2].descriptorCount = 1 * maxMaterialCount;
-        poolSizes[3].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[3].descriptorCount = 3 + 5 * maxMaterialCount + 1 + 1; // ImGui_ImplVulkan_CreateDeviceObjects
-        poolSizes[4].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-        poolSizes[4].descriptorCount = 4 + 1 + 1 + 2;
-        poolSizes[5].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        poolSizes[5].descriptorCount = 3;
-        poolSizes[6].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-        poolSizes[6].descriptorCount = 1;
+        // 场景和pass的descriptor set都由descriptorAllocator按需分配，这里只保留给ImGui用的pool
+        descriptorAllocator.init(this);
+
+        VkDescriptorPoolSize poolSizes[1];
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = 1; // ImGui_ImplVulkan_CreateDeviceObjects
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
         poolInfo.pPoolSizes = poolSizes;
-        poolInfo.maxSets =
-            1 + 1 + 1 + maxMaterialCount + maxVertexBlendingMeshCount + 1 + 1; // +skybox + axis descriptor set
+        poolInfo.maxSets = 1;
         poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 
         VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool));
@@ -552,7 +631,7 @@ namespace VulkanEngine
         }
     }
 
-    void VulkanRenderer::createSwapchain()
+    void VulkanRenderer::createSwapchain(VkSwapchainKHR oldSwapchain)
     {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
@@ -600,7 +679,7 @@ namespace VulkanEngine
         createInfo.preTransform = swapChainSupport.capabilities.currentTransform;	// 这里不需要进行图像的旋转或者翻转操作
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;				// 也不需要与其他窗体进行混合
         createInfo.clipped = VK_TRUE;												// 如果有像素被其他窗体遮挡，可以进行优化，不对图像进行回读，所以不关心
-        createInfo.oldSwapchain = VK_NULL_HANDLE;									// swapChain在窗口调整大小时需要被替换，这里不考虑，指定oldSwapChain用来进行回收
+        createInfo.oldSwapchain = oldSwapchain;										// swapChain在窗口调整大小时需要被替换，指定oldSwapChain用来进行回收
 
         VK_CHECK_RESULT(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain));
 
@@ -621,7 +700,7 @@ namespace VulkanEngine
     {
         vkDestroyImage(device, depthImage, nullptr);
         vkDestroyImageView(device, depthImageView, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        freeMemory(depthImageMemory);
 
         for (size_t i = 0; i < swapChainImageViews.size(); i++)
         {
@@ -634,32 +713,31 @@ namespace VulkanEngine
     void VulkanRenderer::recreateSwapchain()
     {
         windowWidth = windowHandler->getWindowSize()[0];
-        windowWidth = windowHandler->getWindowSize()[1];
-
-        vkDeviceWaitIdle(device);
-
-        VkResult resWaitForFences = vkWaitForFences(device, MAX_FRAMES_IN_FLIGHT, isFrameInFlightFences, VK_TRUE, UINT64_MAX);
-        if (VK_SUCCESS != resWaitForFences)
-        {
-            LOG_ERROR("WaitForFences failed");
-            return;
-        }
+        windowHeight = windowHandler->getWindowSize()[1];
 
-        currentFrameIndex = 0;
-
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        // 旧资源可能还在被inflight的帧使用，放入延迟销毁队列，不再等待整个设备空闲
+        deletionQueue.destroyImageView(depthImageView);
+        deletionQueue.destroyImage(depthImage);
+        deletionQueue.freeMemory(depthImageMemory);
+        depthImageView = VK_NULL_HANDLE;
+        depthImage = VK_NULL_HANDLE;
+        depthImageMemory = VK_NULL_HANDLE;
 
         for (auto imageview : swapChainImageViews)
         {
-            vkDestroyImageView(device, imageview, nullptr);
+            deletionQueue.destroyImageView(imageview);
         }
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        swapChainImageViews.clear();
 
-        createSwapchain();
+        VkSwapchainKHR oldSwapChain = swapChain;
+        VkDevice logicalDevice = device;
+        deletionQueue.push([logicalDevice, oldSwapChain]() { vkDestroySwapchainKHR(logicalDevice, oldSwapChain, nullptr); });
+
+        createSwapchain(oldSwapChain);
         createSwapchainImageViews();
         createFramebufferImageAndView();
+
+        swapchainVersion++;
     }
 
     void VulkanRenderer::createSwapchainImageViews()
@@ -696,14 +774,15 @@ namespace VulkanEngine
             swapChainExtent.height,
             depthImageFormat,
             VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | getTransientAttachmentUsage(),     // 深度只在renderpass内使用
+            getTransientAttachmentMemoryProperty(),
             depthImage,
             depthImageMemory,
             0,
             1,
             1,
-            msaaSamples);
+            msaaSamples,
+            MemoryCategory::RenderTarget);
 
         depthImageView = createImageView(
             depthImage,
@@ -766,6 +845,21 @@ namespace VulkanEngine
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
 
+        // VK_EXT_memory_budget需要vkGetPhysicalDeviceMemoryProperties2
+        uint32_t instanceExtensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, nullptr);
+        std::vector<VkExtensionProperties> instanceExtensions(instanceExtensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, instanceExtensions.data());
+        for (const auto& extension : instanceExtensions)
+        {
+            if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+            {
+                physicalDeviceProperties2Supported = true;
+                extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+                break;
+            }
+        }
+
         return extensions;
     }
 
@@ -1079,6 +1173,20 @@ namespace VulkanEngine
         vkCmdBindDescriptorSets(commandBuffer, pipelineBindPoint, pipelineLayout, firstSet, descriptorSetCount, descriptorSets, dynamicOffsetCount, pDynamicOffsets);
     }
 
+    void VulkanRenderer::cmdExecuteCommands(VkCommandBuffer commandBuffer, const std::vector<VkCommandBuffer>& secondaryCommandBuffers)
+    {
+        if (secondaryCommandBuffers.empty())
+        {
+            return;
+        }
+        vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+    }
+
+    void VulkanRenderer::cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
+    {
+        _vkCmdDrawIndexedIndirectCountKHR(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+    }
+
     VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
     {
         VkShaderModuleCreateInfo createInfo = {};
@@ -1113,7 +1221,28 @@ namespace VulkanEngine
         return 0;
     }
 
-    void VulkanRenderer::createImage(uint32_t imageWidth, uint32_t imageHeight, VkFormat format, VkImageTiling imageTiling, VkImageUsageFlags imageUsageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& memory, VkImageCreateFlags imageCreateFlags, uint32_t arrayLayers, uint32_t miplevels, VkSampleCountFlagBits numSamples)
+    void VulkanRenderer::createImage(uint32_t imageWidth, uint32_t imageHeight, VkFormat format, VkImageTiling imageTiling, VkImageUsageFlags imageUsageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkImage& image, VkDeviceMemory& memory, VkImageCreateFlags imageCreateFlags, uint32_t arrayLayers, uint32_t miplevels, VkSampleCountFlagBits numSamples, MemoryCategory memoryCategory)
+    {
+        createImageHandle(imageWidth, imageHeight, format, imageTiling, imageUsageFlags, image, imageCreateFlags, arrayLayers, miplevels, numSamples);
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memoryPropertyFlags);
+
+        if (allocateMemory(allocInfo, memory, memoryCategory) != VK_SUCCESS)
+        {
+            LOG_ERROR("failed to allocate image memory!");
+            return;
+        }
+
+        vkBindImageMemory(device, image, memory, 0);
+    }
+
+    void VulkanRenderer::createImageHandle(uint32_t imageWidth, uint32_t imageHeight, VkFormat format, VkImageTiling imageTiling, VkImageUsageFlags imageUsageFlags, VkImage& image, VkImageCreateFlags imageCreateFlags, uint32_t arrayLayers, uint32_t miplevels, VkSampleCountFlagBits numSamples)
     {
         VkImageCreateInfo imageCI{};
         imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1133,22 +1262,20 @@ namespace VulkanEngine
         imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
         VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &image));
+    }
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memoryPropertyFlags);
+    VkImageUsageFlags VulkanRenderer::getTransientAttachmentUsage() const
+    {
+        return lazilyAllocatedMemorySupported ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0;
+    }
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    VkMemoryPropertyFlags VulkanRenderer::getTransientAttachmentMemoryProperty() const
+    {
+        if (lazilyAllocatedMemorySupported)
         {
-            LOG_ERROR("failed to allocate image memory!");
-            return;
+            return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
         }
-
-        vkBindImageMemory(device, image, memory, 0);
+        return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     }
 
     void VulkanRenderer::createTextureImage(VkImage& image, VkImageView& imageView, VkDeviceMemory& imageMemory, uint32_t width, uint32_t height, void* pixels, uint32_t miplevels)
@@ -1162,7 +1289,7 @@ namespace VulkanEngine
         VkBuffer stagingBuffer;
         VkDeviceMemory stagingBufferMemory;
 
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, MemoryCategory::Staging);
 
         void* data;
         vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
@@ -1172,7 +1299,7 @@ namespace VulkanEngine
         VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 
         // 要生成mipmap，image既是目标又是源
-        createImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory, 0, 1, miplevels);
+        createImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory, 0, 1, miplevels, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::Texture);
 
         transitionImageLayout(image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, 1, VK_IMAGE_ASPECT_COLOR_BIT);
         copyBufferToImage(stagingBuffer, image, width, height, 1);
@@ -1181,7 +1308,7 @@ namespace VulkanEngine
         generateMipmaps(image, format, width, height, miplevels, 1);
 
         vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        freeMemory(stagingBufferMemory);
 
         imageView = createImageView(image, format, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 1, miplevels);
     }
@@ -1192,7 +1319,7 @@ namespace VulkanEngine
 
         VkBuffer stagingBuffer;
         VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize * 6, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(imageSize * 6, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, MemoryCategory::Staging);
 
         for (int i = 0; i < 6; ++i) 
         {
@@ -1232,7 +1359,7 @@ namespace VulkanEngine
             allocInfo.allocationSize = memRequirements.size;
             allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-            if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
+            if (allocateMemory(allocInfo, imageMemory, MemoryCategory::Texture) != VK_SUCCESS) {
                 throw std::runtime_error("failed to allocate image memory!");
             }
 
@@ -1390,7 +1517,7 @@ namespace VulkanEngine
             endSingleTimeCommands(commandBuffer);
         }
         vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        freeMemory(stagingBufferMemory);
 
         // createImageView
         {
@@ -1711,7 +1838,7 @@ namespace VulkanEngine
         }
     }
 
-    void VulkanRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    void VulkanRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, MemoryCategory memoryCategory)
     {
         VkBufferCreateInfo bufferInfo = {};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1730,11 +1857,21 @@ namespace VulkanEngine
         allocInfo.allocationSize = memRequirements.size;		// 查询真正大小，具体看对齐情况
         allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
 
-        VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory));
+        VK_CHECK_RESULT(allocateMemory(allocInfo, bufferMemory, memoryCategory));
 
         vkBindBufferMemory(device, buffer, bufferMemory, 0);		// 如果偏移量non-zero，需要能够被memRequirements.alignment整除
     }
 
+    VkResult VulkanRenderer::allocateMemory(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory, MemoryCategory memoryCategory)
+    {
+        return memoryTracker.allocate(allocInfo, memory, memoryCategory);
+    }
+
+    void VulkanRenderer::freeMemory(VkDeviceMemory& memory)
+    {
+        memoryTracker.free(memory);
+    }
+
     void VulkanRenderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
     {
         VkCommandBuffer commandBuffer = beginSingleTimeCommands();
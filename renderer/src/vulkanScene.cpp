@@ -1,12 +1,37 @@
 ﻿#include "vulkanScene.hpp"
 #include <include/macro.hpp>
 #include "vulkanUtil.hpp"
+#include "vulkanIBLPrecompute.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <random>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 namespace VulkanEngine
 {
+	// 阴影缓存的key
+	static uint64_t mixKey(uint64_t key, uint64_t value)
+	{
+		return key * 1000003 ^ value;
+	}
+
+	static uint64_t mixMatrixKey(uint64_t key, const glm::mat4& matrix)
+	{
+		const float* values = &matrix[0][0];
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			uint32_t bits;
+			memcpy(&bits, &values[i], sizeof(bits));
+			key = mixKey(key, bits);
+		}
+		return key;
+	}
+
 	std::vector<VkVertexInputBindingDescription> Vertex::getBindingDescriptions()
 	{
 		std::vector<VkVertexInputBindingDescription> bindingDescriptions = { {} };
@@ -66,33 +91,6 @@ namespace VulkanEngine
 		Texture* metallicRoughness = new Texture();
 		metallicRoughness->fullPath = defaultPath + "/default_mr.jpg";
 
-		std::string sky = defaultPath + "/sky/";
-		IBLSpecularBox = new CubeMap();
-
-		IBLSpecularBox->fullPaths[0] = sky + "skybox_specular_X+.hdr";
-		IBLSpecularBox->fullPaths[1] = sky + "skybox_specular_X-.hdr";
-		IBLSpecularBox->fullPaths[2] = sky + "skybox_specular_Z+.hdr";
-		IBLSpecularBox->fullPaths[3] = sky + "skybox_specular_Z-.hdr";
-		IBLSpecularBox->fullPaths[4] = sky + "skybox_specular_Y+.hdr";
-		IBLSpecularBox->fullPaths[5] = sky + "skybox_specular_Y-.hdr";
-
-		IBLSpecularBox->createCubeMap(vulkanRenderer);
-
-		IBLIrradianceBox = new CubeMap();
-
-		IBLIrradianceBox->fullPaths[0] = sky + "skybox_irradiance_X+.hdr";
-		IBLIrradianceBox->fullPaths[1] = sky + "skybox_irradiance_X-.hdr";
-		IBLIrradianceBox->fullPaths[2] = sky + "skybox_irradiance_Z+.hdr";
-		IBLIrradianceBox->fullPaths[3] = sky + "skybox_irradiance_Z-.hdr";
-		IBLIrradianceBox->fullPaths[4] = sky + "skybox_irradiance_Y+.hdr";
-		IBLIrradianceBox->fullPaths[5] = sky + "skybox_irradiance_Y-.hdr";
-
-		IBLIrradianceBox->createCubeMap(vulkanRenderer);
-
-		brdfLUTTexture = new Texture();
-		brdfLUTTexture->fullPath = defaultPath + "/brdf_schilk.hdr";
-		brdfLUTTexture->oneLevel = true;
-		brdfLUTTexture->createTextureImage(vulkanRenderer);
 
 		textures.resize(3);
 		textures[0] = diffuse;
@@ -113,6 +111,7 @@ namespace VulkanEngine
 
 		std::string vertSPV = ".vert.spv";
 		std::string fragSPV = ".frag.spv";
+		std::string compSPV = ".comp.spv";
 
 		shaderVSFliePath = shaderDir + "vs" + vertSPV;
 		shaderFSFilePath = shaderDir + shaderName + fragSPV;
@@ -121,6 +120,8 @@ namespace VulkanEngine
 
 		deferredLightingVSFilePath = shaderDir + "deferredLighting" + vertSPV;
 		deferredLightingFSFilePath = shaderDir + "deferredLighting" + fragSPV;
+		deferredLightingCSFilePath = shaderDir + "deferredLighting" + compSPV;
+		deferredTileClassifyCSFilePath = shaderDir + "deferredTileClassify" + compSPV;
 
 		FXAAVSFilePath = shaderDir + "fxaa" + vertSPV;
 		FXAAFSFilePath = shaderDir + "fxaa" + fragSPV;
@@ -128,16 +129,20 @@ namespace VulkanEngine
 		shadowVSFilePath = shaderDir + "directionalLightShadow" + vertSPV;
 		shadowFSFilePath = shaderDir + "directionalLightShadow" + fragSPV;
 
-		uniformBufferDynamicObjects.resize(meshes.size());
-		for (size_t i = 0; i < meshes.size(); i++)
-		{
-			uniformBufferDynamicObjects[i].model = meshes[i]->node->worldTransform;
-		}
-		createVertexData();
-		createIndexData();
+		hizBuildCSFilePath = shaderDir + "hizBuild" + compSPV;
+		occlusionCullingCSFilePath = shaderDir + "occlusionCulling" + compSPV;
+		lightClusteringCSFilePath = shaderDir + "lightClustering" + compSPV;
+
+		iblEquirectToCubeCSFilePath = shaderDir + "iblEquirectToCube" + compSPV;
+		iblPrefilterSpecularCSFilePath = shaderDir + "iblPrefilterSpecular" + compSPV;
+		iblIrradianceCSFilePath = shaderDir + "iblIrradiance" + compSPV;
+		iblBrdfLUTCSFilePath = shaderDir + "iblBrdfLUT" + compSPV;
+
+		createGeometryData();
 		createUniformBufferData();
 		createUniformDescriptorSet();
 		createPBRDescriptorLayout();
+		createIBLTextures();
 		createIBLDescriptor();
 
 		for (size_t i = 0; i < textures.size(); i++)
@@ -149,96 +154,131 @@ namespace VulkanEngine
 		{
 			materials[i]->createDescriptorSet(vulkanRenderer, this);
 		}
+
+		contentVersion++;
 	}
 
 	void VulkanRenderSceneData::clear()
 	{
-		vkQueueWaitIdle(vulkanRenderer->graphicsQueue);
-		auto& device = vulkanRenderer->device;
+		// 不再等待队列空闲，资源交给延迟销毁队列，等使用它们的帧执行完再释放
+		auto& deletionQueue = vulkanRenderer->deletionQueue;
+		VkDevice device = vulkanRenderer->device;
 
-		vkDestroyBuffer(device, vertexResource.buffer, nullptr);
-		vkFreeMemory(device, vertexResource.memory, nullptr);
-		vkDestroyBuffer(device, indexResource.buffer, nullptr);
-		vkFreeMemory(device, indexResource.memory, nullptr);
+		geometryHeap.cleanup();
+		meshDrawInfos.clear();
+		meshDrawInfoVersion = ~0ull;
+		contentVersion++;
 
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
 			delete meshes[i];
 		}
+		meshes.clear();
 
 		for (size_t i = 0; i < textures.size(); i++)
 		{
-			vkDestroyImage(device, textures[i]->textureImage, nullptr);
-			vkDestroyImageView(device, textures[i]->textureImageView, nullptr);
-			vkFreeMemory(device, textures[i]->textureImageMemory, nullptr);
+			deletionQueue.destroyImage(textures[i]->textureImage);
+			deletionQueue.destroyImageView(textures[i]->textureImageView);
+			deletionQueue.freeMemory(textures[i]->textureImageMemory);
 			delete textures[i];
 		}
+		textures.clear();
 
 		if (IBLSpecularBox != nullptr)
 		{
-			vkDestroyImage(device, IBLSpecularBox->cubeImage, nullptr);
-			vkDestroyImageView(device, IBLSpecularBox->cubeImageView, nullptr);
-			vkDestroySampler(device, IBLSpecularBox->sampler, nullptr);
-			vkFreeMemory(device, IBLSpecularBox->cubeImageMemory, nullptr);
+			deletionQueue.destroyImage(IBLSpecularBox->cubeImage);
+			deletionQueue.destroyImageView(IBLSpecularBox->cubeImageView);
+			deletionQueue.destroySampler(IBLSpecularBox->sampler);
+			deletionQueue.freeMemory(IBLSpecularBox->cubeImageMemory);
 			delete IBLSpecularBox;
+			IBLSpecularBox = nullptr;
 		}
 
 		if (IBLIrradianceBox != nullptr)
 		{
-			vkDestroyImage(device, IBLIrradianceBox->cubeImage, nullptr);
-			vkDestroyImageView(device, IBLIrradianceBox->cubeImageView, nullptr);
-			vkDestroySampler(device, IBLIrradianceBox->sampler, nullptr);
-			vkFreeMemory(device, IBLIrradianceBox->cubeImageMemory, nullptr);
+			deletionQueue.destroyImage(IBLIrradianceBox->cubeImage);
+			deletionQueue.destroyImageView(IBLIrradianceBox->cubeImageView);
+			deletionQueue.destroySampler(IBLIrradianceBox->sampler);
+			deletionQueue.freeMemory(IBLIrradianceBox->cubeImageMemory);
 			delete IBLIrradianceBox;
+			IBLIrradianceBox = nullptr;
 		}
 
 		if (brdfLUTTexture != nullptr)
 		{
-			vkDestroyImage(device, brdfLUTTexture->textureImage, nullptr);
-			vkDestroyImageView(device, brdfLUTTexture->textureImageView, nullptr);
-			vkFreeMemory(device, brdfLUTTexture->textureImageMemory, nullptr);
+			deletionQueue.destroyImage(brdfLUTTexture->textureImage);
+			deletionQueue.destroyImageView(brdfLUTTexture->textureImageView);
+			deletionQueue.freeMemory(brdfLUTTexture->textureImageMemory);
 			delete brdfLUTTexture;
+			brdfLUTTexture = nullptr;
 		}
 
 		for (size_t i = 0; i < materials.size(); i++)
 		{
-			vkFreeDescriptorSets(device, vulkanRenderer->descriptorPool, 1, &materials[i]->descriptorSet);
+			vulkanRenderer->descriptorAllocator.releaseCachedSet(materials[i]->descriptorSet);
 			delete materials[i];
 		}
+		materials.clear();
 
 		for (size_t i = 0; i < nodes.size(); i++)
 		{
 			delete nodes[i];
 		}
-
-		vkDestroyBuffer(device, uniformResource.buffer, nullptr);
-		vkFreeMemory(device, uniformResource.memory, nullptr);
-		vkDestroyBuffer(device, uniformDynamicResource.buffer, nullptr);
-		vkFreeMemory(device, uniformDynamicResource.memory, nullptr);
-		vkDestroyBuffer(device, uniformShadowResource.buffer, nullptr);
-		vkFreeMemory(device, uniformShadowResource.memory, nullptr);
-		vkDestroyBuffer(device, deferredUniformResource.buffer, nullptr);
-		vkFreeMemory(device, deferredUniformResource.memory, nullptr);
-
-		vkDestroyDescriptorSetLayout(device, uniformDescriptor.layout, nullptr);
-		vkFreeDescriptorSets(device, vulkanRenderer->descriptorPool, uniformDescriptor.descriptorSet.size(), uniformDescriptor.descriptorSet.data());
-		vkDestroyDescriptorSetLayout(device, PBRMaterialDescriptor.layout, nullptr);
-		if (directionalLightShadowDescriptor.layout != VK_NULL_HANDLE)
-		{
-			vkDestroyDescriptorSetLayout(device, directionalLightShadowDescriptor.layout, nullptr);
-			vkFreeDescriptorSets(device, vulkanRenderer->descriptorPool, directionalLightShadowDescriptor.descriptorSet.size(), directionalLightShadowDescriptor.descriptorSet.data());
-		}
-
-		if (deferredUniformDescriptor.layout != VK_NULL_HANDLE)
-		{
-			vkDestroyDescriptorSetLayout(device, deferredUniformDescriptor.layout, nullptr);
-			vkFreeDescriptorSets(device, vulkanRenderer->descriptorPool, deferredUniformDescriptor.descriptorSet.size(), deferredUniformDescriptor.descriptorSet.data());
-		}
-
-		if (IBLDescriptor.layout != VK_NULL_HANDLE)
+		nodes.clear();
+
+		deletionQueue.destroyBuffer(uniformResource.buffer);
+		deletionQueue.freeMemory(uniformResource.memory);
+		deletionQueue.destroyBuffer(meshDrawDataResource.buffer);
+		deletionQueue.freeMemory(meshDrawDataResource.memory);
+		deletionQueue.destroyBuffer(meshBoundsResource.buffer);
+		deletionQueue.freeMemory(meshBoundsResource.memory);
+		meshBufferCapacity = 0;
+		deletionQueue.destroyBuffer(uniformShadowResource.buffer);
+		deletionQueue.freeMemory(uniformShadowResource.memory);
+		deletionQueue.destroyBuffer(uniformShadowCascadesResource.buffer);
+		deletionQueue.freeMemory(uniformShadowCascadesResource.memory);
+		deletionQueue.destroyBuffer(deferredUniformResource.buffer);
+		deletionQueue.freeMemory(deferredUniformResource.memory);
+		deletionQueue.destroyBuffer(lightResource.buffer);
+		deletionQueue.freeMemory(lightResource.memory);
+		deletionQueue.destroyBuffer(uniformClustersResource.buffer);
+		deletionQueue.freeMemory(uniformClustersResource.memory);
+		deletionQueue.destroyBuffer(clusterGridResource.buffer);
+		deletionQueue.freeMemory(clusterGridResource.memory);
+		deletionQueue.destroyBuffer(shadowAtlasTileResource.buffer);
+		deletionQueue.freeMemory(shadowAtlasTileResource.memory);
+		deletionQueue.destroyBuffer(uniformShadowAtlasResource.buffer);
+		deletionQueue.freeMemory(uniformShadowAtlasResource.memory);
+		uniformResource = {};
+		meshDrawDataResource = {};
+		meshBoundsResource = {};
+		uniformShadowResource = {};
+		uniformShadowCascadesResource = {};
+		deferredUniformResource = {};
+		lightResource = {};
+		uniformClustersResource = {};
+		clusterGridResource = {};
+		shadowAtlasTileResource = {};
+		uniformShadowAtlasResource = {};
+		localLights.clear();
+		localLightShadowStates.clear();
+		shadowAtlasUpdates.clear();
+		shadowAtlasAllocator.reset();
+
+		std::vector<VulkanDescriptor*> descriptors = { &uniformDescriptor, &PBRMaterialDescriptor, &directionalLightShadowDescriptor, &deferredUniformDescriptor, &IBLDescriptor };
+		for (auto descriptor : descriptors)
 		{
-			vkDestroyDescriptorSetLayout(device, IBLDescriptor.layout, nullptr);
-			vkFreeDescriptorSets(device, vulkanRenderer->descriptorPool, IBLDescriptor.descriptorSet.size(), IBLDescriptor.descriptorSet.data());
+			if (descriptor->layout != VK_NULL_HANDLE)
+			{
+				VkDescriptorSetLayout layout = descriptor->layout;
+				deletionQueue.push([device, layout]() { vkDestroyDescriptorSetLayout(device, layout, nullptr); });
+				descriptor->layout = VK_NULL_HANDLE;
+			}
+			for (auto descriptorSet : descriptor->descriptorSet)
+			{
+				deletionQueue.freeDescriptorSet(descriptorSet);
+			}
+			descriptor->descriptorSet.clear();
 		}
 	}
 
@@ -256,27 +296,20 @@ namespace VulkanEngine
 		uniformBufferFSObject.viewPos = cameraController.camera.position;
 		uniformBufferFSObject.directionalLightPos = glm::rotate(glm::mat4(1.0f), 5.6f * glm::radians(90.0f / 5.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
 
-		float sceneSphereRadius = glm::length(getSceneBounds().getSize()) / 2.0f;
-		glm::vec3 sceneSphereCenter = getSceneBounds().getCenter();
-		glm::vec3 directionalLightPos = uniformBufferFSObject.directionalLightPos;
-		glm::vec3 shadowCameraPos = sceneSphereCenter + glm::normalize(directionalLightPos) * sceneSphereRadius * 4.0f;
-		float near = glm::length(shadowCameraPos - sceneSphereCenter) - sceneSphereRadius;
-		float far = near + sceneSphereRadius * 2.0f;
-
-		glm::mat4 shadowView = glm::lookAtRH(shadowCameraPos, sceneSphereCenter, glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 shadowProj = glm::perspective(glm::radians(45.0f), 1.0f, near, far);
-		shadowProj[1][1] *= -1;
+		updateShadowCascades();
 
-		uniformBufferShadowVSObject.projectView = shadowProj * shadowView;
+		uniformBufferFSObject.directionalLightProjView = uniformBufferShadowVSObjects[0].projectView;
 
-		uniformBufferFSObject.directionalLightProjView = uniformBufferShadowVSObject.projectView;
+		cullMeshes();
 
-		std::vector<UniformBufferDynamicObject> transforms;
-		transforms.resize(meshes.size());
-		for (int i = 0; i < meshes.size(); i++)
+		const std::vector<MeshDrawInfo>& drawInfos = getMeshDrawInfos();
+		for (int i = 0; i < meshDrawDatas.size(); i++)
 		{
-			transforms[i].model =  rotate * meshes[i]->node->worldTransform;
-			//transforms[i].model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f / 20.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * transforms[i].model;
+			meshDrawDatas[i].model = rotate * meshes[i]->node->worldTransform;
+			//meshDrawDatas[i].model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f / 20.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * meshDrawDatas[i].model;
+			meshDrawDatas[i].firstIndex = drawInfos[i].firstIndex;
+			meshDrawDatas[i].indexCount = drawInfos[i].indexCount;
+			meshDrawDatas[i].vertexOffset = drawInfos[i].vertexOffset;
 		}
 
 		{
@@ -289,16 +322,23 @@ namespace VulkanEngine
 
 		{
 			void* data;
-			vkMapMemory(vulkanRenderer->device, uniformDynamicResource.memory, 0, sizeof(transforms), 0, &data);
-			memcpy(data, transforms.data(), sizeof(UniformBufferDynamicObject) * transforms.size());
-			vkUnmapMemory(vulkanRenderer->device, uniformDynamicResource.memory);
+			vkMapMemory(vulkanRenderer->device, meshDrawDataResource.memory, 0, VK_WHOLE_SIZE, 0, &data);
+			memcpy(data, meshDrawDatas.data(), sizeof(MeshDrawData) * meshDrawDatas.size());
+			vkUnmapMemory(vulkanRenderer->device, meshDrawDataResource.memory);
 		}
 
 		{
 			void* data;
-			vkMapMemory(vulkanRenderer->device, uniformShadowResource.memory, 0, sizeof(uniformBufferShadowVSObject), 0, &data);
-			memcpy(data, &uniformBufferShadowVSObject, sizeof(uniformBufferShadowVSObject));
+			vkMapMemory(vulkanRenderer->device, uniformShadowResource.memory, 0, VK_WHOLE_SIZE, 0, &data);
+			for (uint32_t i = 0; i < MaxShadowCascades; i++)
+			{
+				memcpy((char*)(data) + i * ShadowCascadeUniformStride, &uniformBufferShadowVSObjects[i], sizeof(UnifromBufferObjectShadowProjView));
+			}
 			vkUnmapMemory(vulkanRenderer->device, uniformShadowResource.memory);
+
+			vkMapMemory(vulkanRenderer->device, uniformShadowCascadesResource.memory, 0, sizeof(uniformBufferShadowCascadesObject), 0, &data);
+			memcpy(data, &uniformBufferShadowCascadesObject, sizeof(uniformBufferShadowCascadesObject));
+			vkUnmapMemory(vulkanRenderer->device, uniformShadowCascadesResource.memory);
 		}
 
 		{
@@ -310,22 +350,752 @@ namespace VulkanEngine
 			memcpy(data, &deferredUniformObject, sizeof(deferredUniformObject));
 			vkUnmapMemory(vulkanRenderer->device, deferredUniformResource.memory);
 		}
+
+		updateLocalLightShadows();
 	}
 
-	Box VulkanRenderSceneData::getSceneBounds()
+	void VulkanRenderSceneData::uploadLocalLights()
 	{
-		Box box;
+		uint32_t lightCount = static_cast<uint32_t>(std::min<size_t>(localLights.size(), MaxLocalLights));
+		Camera& camera = cameraController.camera;
+		float tanHalfFovY = std::tan(glm::radians(camera.zoom) * 0.5f);
+		float sliceScale = ClusterGridZ / std::log(camera.far / camera.near);
+
+		uniformBufferClustersObject.view = uniformBufferVSObject.view;
+		uniformBufferClustersObject.projParams = glm::vec4(tanHalfFovY * vulkanRenderer->windowWidth / (float)(vulkanRenderer->windowHeight), tanHalfFovY, camera.near, camera.far);
+		uniformBufferClustersObject.sliceParams = glm::vec4(sliceScale, -std::log(camera.near) * sliceScale, 1.0f / vulkanRenderer->swapChainExtent.width, 1.0f / vulkanRenderer->swapChainExtent.height);
+		uniformBufferClustersObject.gridSize = glm::uvec4(ClusterGridX, ClusterGridY, ClusterGridZ, lightCount);
+
+		// 前面的帧可能还在读它们自己的那一段，只写这一帧下标的
+		uint32_t frameIndex = vulkanRenderer->currentFrameIndex;
+
+		void* data;
+		vkMapMemory(vulkanRenderer->device, uniformClustersResource.memory, frameIndex * ClusterUniformStride, sizeof(uniformBufferClustersObject), 0, &data);
+		memcpy(data, &uniformBufferClustersObject, sizeof(uniformBufferClustersObject));
+		vkUnmapMemory(vulkanRenderer->device, uniformClustersResource.memory);
+
+		if (lightCount > 0)
+		{
+			vkMapMemory(vulkanRenderer->device, lightResource.memory, frameIndex * LightBufferStride, sizeof(LightData) * lightCount, 0, &data);
+			LightData* lightDatas = static_cast<LightData*>(data);
+			for (uint32_t i = 0; i < lightCount; i++)
+			{
+				const LocalLight& light = localLights[i];
+				LightData& lightData = lightDatas[i];
+				lightData.positionRange = glm::vec4(light.position, light.range);
+				lightData.colorType = glm::vec4(light.color * light.intensity, static_cast<float>(light.type));
+
+				// 点光源的角度衰减恒为1
+				float cosOuter = -1.0f;
+				float sinOuter = 0.0f;
+				float spotScale = 0.0f;
+				float spotOffset = 1.0f;
+				if (light.type == LightType::Spot)
+				{
+					float outer = glm::clamp(light.outerConeAngle, 0.0f, glm::radians(89.0f));
+					float inner = glm::clamp(light.innerConeAngle, 0.0f, outer);
+					cosOuter = std::cos(outer);
+					sinOuter = std::sin(outer);
+					spotScale = 1.0f / std::max(std::cos(inner) - cosOuter, 0.001f);
+					spotOffset = -cosOuter * spotScale;
+				}
+				lightData.directionCosOuter = glm::vec4(glm::normalize(light.direction), cosOuter);
+				lightData.spotParams = glm::vec4(spotScale, spotOffset, sinOuter, static_cast<float>(localLightFirstTiles[i]));
+			}
+			vkUnmapMemory(vulkanRenderer->device, lightResource.memory);
+		}
+
+		if (!shadowAtlasTileDatas.empty())
+		{
+			vkMapMemory(vulkanRenderer->device, shadowAtlasTileResource.memory, frameIndex * ShadowAtlasTileBufferStride, sizeof(ShadowAtlasTileData) * shadowAtlasTileDatas.size(), 0, &data);
+			memcpy(data, shadowAtlasTileDatas.data(), sizeof(ShadowAtlasTileData) * shadowAtlasTileDatas.size());
+			vkUnmapMemory(vulkanRenderer->device, shadowAtlasTileResource.memory);
+		}
+
+		if (!shadowAtlasUpdates.empty())
+		{
+			VkDeviceSize frameOffset = static_cast<VkDeviceSize>(frameIndex) * MaxShadowAtlasUpdates * ShadowCascadeUniformStride;
+			vkMapMemory(vulkanRenderer->device, uniformShadowAtlasResource.memory, frameOffset, MaxShadowAtlasUpdates * ShadowCascadeUniformStride, 0, &data);
+			for (size_t i = 0; i < shadowAtlasUpdates.size(); i++)
+			{
+				memcpy((char*)(data) + i * ShadowCascadeUniformStride, &shadowAtlasUpdates[i].projView, sizeof(glm::mat4));
+			}
+			vkUnmapMemory(vulkanRenderer->device, uniformShadowAtlasResource.memory);
+		}
+	}
+
+	void VulkanRenderSceneData::updateMeshBounds()
+	{
+		if (meshBoundsVersion == contentVersion && meshBoundsTransformVersion == transformVersion
+			&& meshBoundsRotate == rotate && meshCuller.getCount() == meshes.size())
+		{
+			return;
+		}
 
+		// mesh增删后重新构建BVH，只有变换变化时更新变化了的mesh再refit
+		bool rebuildBVH = meshBoundsVersion != contentVersion || meshBVH.getObjectCount() != meshes.size();
+
+		// 每个mesh只变换导入时的局部包围盒，不再遍历顶点
+		std::vector<BoundingVolumeHierarchy::Bounds> bvhBounds(meshes.size());
+		meshCuller.resize(static_cast<uint32_t>(meshes.size()));
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
 			Mesh* mesh = meshes[i];
-			for (size_t vertexIndex = 0; vertexIndex < mesh->vertices.size(); vertexIndex++)
+			mesh->worldBounds = mesh->localBounds.transform(rotate * mesh->node->worldTransform);
+			meshCuller.setBounds(static_cast<uint32_t>(i), mesh->worldBounds.min, mesh->worldBounds.max);
+
+			if (mesh->worldBounds.isValid())
+			{
+				bvhBounds[i].min = mesh->worldBounds.min;
+				bvhBounds[i].max = mesh->worldBounds.max;
+			}
+			if (!rebuildBVH)
 			{
-				box.addPoint(mesh->node->worldTransform * glm::vec4(mesh->vertices[vertexIndex].position, 1.0f));
+				const BoundingVolumeHierarchy::Bounds& previous = meshBVH.getObjectBounds(static_cast<uint32_t>(i));
+				if (previous.isValid() != bvhBounds[i].isValid())
+				{
+					rebuildBVH = true;
+				}
+				else if (previous.min != bvhBounds[i].min || previous.max != bvhBounds[i].max)
+				{
+					meshBVH.setObjectBounds(static_cast<uint32_t>(i), bvhBounds[i]);
+				}
 			}
 		}
 
-		return box;
+		if (rebuildBVH)
+		{
+			meshBVH.build(bvhBounds, &vulkanRenderer->recordThreadPool);
+		}
+		else
+		{
+			meshBVH.refit(&vulkanRenderer->recordThreadPool);
+		}
+
+		sceneBounds = Box();
+		BoundingVolumeHierarchy::Bounds rootBounds = meshBVH.getRootBounds();
+		if (rootBounds.isValid())
+		{
+			sceneBounds.min = rootBounds.min;
+			sceneBounds.max = rootBounds.max;
+		}
+		meshBoundsVersion = contentVersion;
+		meshBoundsTransformVersion = transformVersion;
+		meshBoundsRotate = rotate;
+
+		// reserveMeshBuffers保证容量足够，这里只是防止在它之前调用
+		size_t uploadCount = std::min<size_t>(meshes.size(), meshBufferCapacity);
+		if (meshBoundsResource.memory != VK_NULL_HANDLE && uploadCount > 0)
+		{
+			void* data;
+			vkMapMemory(vulkanRenderer->device, meshBoundsResource.memory, 0, sizeof(MeshBoundsData) * uploadCount, 0, &data);
+			MeshBoundsData* bounds = static_cast<MeshBoundsData*>(data);
+			for (size_t i = 0; i < uploadCount; i++)
+			{
+				// w为0代表包围盒无效，shader里当作总是可见
+				const Box& worldBounds = meshes[i]->worldBounds;
+				bool valid = worldBounds.isValid();
+				bounds[i].min = valid ? glm::vec4(worldBounds.min, 1.0f) : glm::vec4(0.0f);
+				bounds[i].max = valid ? glm::vec4(worldBounds.max, 1.0f) : glm::vec4(0.0f);
+			}
+			vkUnmapMemory(vulkanRenderer->device, meshBoundsResource.memory);
+		}
+	}
+
+	void VulkanRenderSceneData::updateWorldTransform(Node* node)
+	{
+		node->worldTransform = node->parent != nullptr ? node->parent->worldTransform * node->localTransform : node->localTransform;
+		for (Node* child : node->children)
+		{
+			updateWorldTransform(child);
+		}
+	}
+
+	void VulkanRenderSceneData::setNodeTransform(Node* node, const glm::mat4& localTransform)
+	{
+		node->localTransform = localTransform;
+		updateWorldTransform(node);
+		transformVersion++;
+
+		// 静态投射物的划分变了，队列内容和静态阴影缓存都要更新
+		bool castersChanged = false;
+		for (Mesh* mesh : meshes)
+		{
+			if (mesh->dynamicShadowCaster)
+			{
+				continue;
+			}
+			for (Node* ancestor = mesh->node; ancestor != nullptr; ancestor = ancestor->parent)
+			{
+				if (ancestor == node)
+				{
+					mesh->dynamicShadowCaster = true;
+					castersChanged = true;
+					break;
+				}
+			}
+		}
+		if (castersChanged)
+		{
+			contentVersion++;
+		}
+	}
+
+	void VulkanRenderSceneData::cullMeshes()
+	{
+		updateMeshBounds();
+
+		auto cullView = [this](const glm::mat4& viewProj, std::vector<uint32_t>& visibleMeshes, CullingStats& stats)
+		{
+			if (frustumCulling && meshes.size() >= BVHCullingMeshCount)
+			{
+				// BVH返回的顺序不固定，排好序才能和上一帧比较
+				visibleMeshes.clear();
+				meshBVH.queryFrustum(Frustum::fromViewProj(viewProj), visibleMeshes);
+				std::sort(visibleMeshes.begin(), visibleMeshes.end());
+				stats.tested = static_cast<uint32_t>(meshes.size());
+				stats.visible = static_cast<uint32_t>(visibleMeshes.size());
+				stats.culled = stats.tested - stats.visible;
+			}
+			else if (frustumCulling)
+			{
+				meshCuller.cull(Frustum::fromViewProj(viewProj), visibleMeshes, stats);
+			}
+			else
+			{
+				visibleMeshes.resize(meshes.size());
+				for (uint32_t i = 0; i < visibleMeshes.size(); i++)
+				{
+					visibleMeshes[i] = i;
+				}
+				stats.tested = stats.visible = static_cast<uint32_t>(meshes.size());
+				stats.culled = 0;
+			}
+		};
+
+		cullView(uniformBufferVSObject.proj * uniformBufferVSObject.view, cameraVisibleMeshes, cameraCullingStats);
+		// 每个级联的正交视锥在光源方向上覆盖整个场景，视锥外的投射物也会留下
+		for (uint32_t i = 0; i < MaxShadowCascades; i++)
+		{
+			if (i < shadowCascadeCount)
+			{
+				cullView(uniformBufferShadowVSObjects[i].projectView, shadowVisibleMeshes[i], shadowCullingStats[i]);
+			}
+			else
+			{
+				shadowVisibleMeshes[i].clear();
+				shadowCullingStats[i] = {};
+			}
+		}
+
+		updateShadowCascadeCaches();
+	}
+
+	void VulkanRenderSceneData::updateShadowCascadeCaches()
+	{
+		// 静态投射物不会移动，只有内容、rotate和投影会让它们的阴影变化
+		uint64_t staticBase = mixMatrixKey(mixKey(contentVersion, meshes.size()), rotate);
+
+		for (uint32_t i = 0; i < MaxShadowCascades; i++)
+		{
+			ShadowCascadeCache& cache = shadowCascadeCaches[i];
+			cache.staticCasters.clear();
+			cache.dynamicCasters.clear();
+			for (uint32_t meshIndex : shadowVisibleMeshes[i])
+			{
+				// 关闭缓存时每帧都重画，全部当作静态投射物直接画进阴影图
+				bool dynamicCaster = shadowCaching && meshes[meshIndex]->dynamicShadowCaster;
+				(dynamicCaster ? cache.dynamicCasters : cache.staticCasters).push_back(meshIndex);
+			}
+
+			uint64_t staticKey = mixMatrixKey(staticBase, uniformBufferShadowVSObjects[i].projectView);
+			staticKey = mixKey(staticKey, cache.staticCasters.size());
+			for (uint32_t meshIndex : cache.staticCasters)
+			{
+				staticKey = mixKey(staticKey, meshIndex);
+			}
+
+			uint64_t contentKey = mixKey(staticKey, cache.dynamicCasters.size());
+			for (uint32_t meshIndex : cache.dynamicCasters)
+			{
+				contentKey = mixKey(contentKey, meshIndex);
+			}
+			// 动态投射物的变换没有单独的版本，任一节点移动都重画有动态投射物的级联
+			if (!cache.dynamicCasters.empty())
+			{
+				contentKey = mixKey(contentKey, transformVersion);
+			}
+
+			cache.staticKey = staticKey;
+			cache.contentKey = contentKey;
+		}
+	}
+
+	void VulkanRenderSceneData::updateLocalLightShadows()
+	{
+		uint32_t lightCount = static_cast<uint32_t>(std::min<size_t>(localLights.size(), MaxLocalLights));
+		shadowAtlasUpdates.clear();
+		shadowAtlasTileDatas.clear();
+		localLightFirstTiles.assign(lightCount, -1);
+		shadowAtlasStats = {};
+
+		// 最小的块是图集的1/64
+		if (shadowAtlasAllocator.getAtlasSize() != shadowAtlasSize)
+		{
+			shadowAtlasAllocator.init(shadowAtlasSize, std::max(shadowAtlasSize / 64, 32u));
+			localLightShadowStates.clear();
+		}
+
+		auto freeShadow = [this](LocalLightShadow& shadow)
+		{
+			for (uint32_t i = 0; i < shadow.tileCount; i++)
+			{
+				shadowAtlasAllocator.free(shadow.tiles[i]);
+			}
+			shadow = LocalLightShadow();
+		};
+
+		for (size_t i = lightCount; i < localLightShadowStates.size(); i++)
+		{
+			freeShadow(localLightShadowStates[i]);
+		}
+		localLightShadowStates.resize(lightCount);
+
+		// 和相机视锥相交的光源按包围球在屏幕上的高度占比排序，相机在球内时为1
+		Camera& camera = cameraController.camera;
+		Frustum frustum = Frustum::fromViewProj(uniformBufferVSObject.proj * uniformBufferVSObject.view);
+		float tanHalfFovY = std::tan(glm::radians(camera.zoom) * 0.5f);
+		std::vector<std::pair<float, uint32_t>> candidates;
+		for (uint32_t i = 0; localLightShadows && i < lightCount; i++)
+		{
+			const LocalLight& light = localLights[i];
+			if (!light.castShadows || light.range <= 0.0f)
+			{
+				continue;
+			}
+
+			bool visible = true;
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				if (glm::dot(glm::vec3(plane), light.position) + plane.w < -light.range * glm::length(glm::vec3(plane)))
+				{
+					visible = false;
+					break;
+				}
+			}
+			if (!visible)
+			{
+				continue;
+			}
+
+			float distance = glm::length(light.position - camera.position);
+			float importance = std::min(light.range / (std::max(distance, light.range) * tanHalfFovY), 1.0f);
+			candidates.push_back({ importance, i });
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b)
+		{
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+		candidates.resize(std::min<size_t>(candidates.size(), std::min(maxShadowedLocalLights, MaxShadowAtlasTiles / 6)));
+
+		// 最重要的光源占图集边长的1/4，点光源每个面再减半
+		std::vector<uint32_t> desiredSizes(lightCount, 0);
+		for (const auto& candidate : candidates)
+		{
+			float size = candidate.first * shadowAtlasSize * 0.25f;
+			if (localLights[candidate.second].type == LightType::Point)
+			{
+				size *= 0.5f;
+			}
+			desiredSizes[candidate.second] = shadowAtlasAllocator.clampTileSize(static_cast<uint32_t>(size));
+		}
+
+		// 没选中的光源和大小差了一级以上的光源先释放，差一级以内的保留，避免在两级之间来回重画
+		for (uint32_t i = 0; i < lightCount; i++)
+		{
+			LocalLightShadow& shadow = localLightShadowStates[i];
+			if (shadow.tileCount == 0)
+			{
+				continue;
+			}
+			uint32_t tileCount = localLights[i].type == LightType::Point ? 6 : 1;
+			uint32_t size = shadow.tiles[0].size;
+			bool keep = desiredSizes[i] > 0 && shadow.tileCount == tileCount && size <= desiredSizes[i] * 2 && size * 2 >= desiredSizes[i];
+			if (!keep)
+			{
+				freeShadow(shadow);
+			}
+		}
+
+		// 重要的光源先分配，空间不够时逐级缩小，最小的块也放不下时这一帧没有阴影
+		for (const auto& candidate : candidates)
+		{
+			LocalLightShadow& shadow = localLightShadowStates[candidate.second];
+			if (shadow.tileCount > 0)
+			{
+				continue;
+			}
+
+			uint32_t tileCount = localLights[candidate.second].type == LightType::Point ? 6 : 1;
+			for (uint32_t size = desiredSizes[candidate.second]; ; size /= 2)
+			{
+				uint32_t allocated = 0;
+				while (allocated < tileCount && shadowAtlasAllocator.allocate(size, shadow.tiles[allocated]))
+				{
+					allocated++;
+				}
+				if (allocated == tileCount)
+				{
+					shadow.tileCount = tileCount;
+					break;
+				}
+				for (uint32_t i = 0; i < allocated; i++)
+				{
+					shadowAtlasAllocator.free(shadow.tiles[i]);
+				}
+				if (size <= shadowAtlasAllocator.getMinTileSize())
+				{
+					break;
+				}
+			}
+		}
+
+		// 每块的投影和投射物，和图集里的内容一致时不用重画
+		struct ShadowRequest
+		{
+			uint32_t lightIndex;
+			std::array<glm::mat4, 6> projViews;
+			std::vector<uint32_t> casters;
+			uint64_t contentKey;
+		};
+		std::vector<ShadowRequest> requests;
+		uint64_t staticBase = mixMatrixKey(mixKey(contentVersion, meshes.size()), rotate);
+		for (const auto& candidate : candidates)
+		{
+			LocalLightShadow& shadow = localLightShadowStates[candidate.second];
+			if (shadow.tileCount == 0)
+			{
+				continue;
+			}
+
+			const LocalLight& light = localLights[candidate.second];
+			ShadowRequest request;
+			request.lightIndex = candidate.second;
+
+			// 投影和相机一样翻转y，深度0到1
+			float nearPlane = std::max(light.range * 0.01f, 0.05f);
+			if (light.type == LightType::Spot)
+			{
+				float outer = glm::clamp(light.outerConeAngle, 0.0f, glm::radians(89.0f));
+				glm::vec3 direction = glm::normalize(light.direction);
+				glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+				glm::mat4 proj = glm::perspective(std::min(outer * 2.0f + glm::radians(2.0f), glm::radians(179.0f)), 1.0f, nearPlane, light.range);
+				proj[1][1] *= -1;
+				request.projViews[0] = proj * glm::lookAtRH(light.position, light.position + direction, up);
+			}
+			else
+			{
+				// 立方体的六个面：+x、-x、+y、-y、+z、-z，和shader里选面的顺序一致
+				const glm::vec3 faceDirections[6] = {
+					glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+					glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+					glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+				glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, light.range);
+				proj[1][1] *= -1;
+				for (uint32_t face = 0; face < 6; face++)
+				{
+					glm::vec3 up = face == 2 || face == 3 ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+					request.projViews[face] = proj * glm::lookAtRH(light.position, light.position + faceDirections[face], up);
+				}
+			}
+
+			BoundingVolumeHierarchy::Bounds bounds;
+			bounds.min = light.position - glm::vec3(light.range);
+			bounds.max = light.position + glm::vec3(light.range);
+			meshBVH.queryBounds(bounds, request.casters);
+			std::sort(request.casters.begin(), request.casters.end());
+
+			uint64_t contentKey = mixKey(staticBase, request.casters.size());
+			bool dynamicCasters = false;
+			for (uint32_t meshIndex : request.casters)
+			{
+				contentKey = mixKey(contentKey, meshIndex);
+				dynamicCasters = dynamicCasters || meshes[meshIndex]->dynamicShadowCaster;
+			}
+			if (dynamicCasters)
+			{
+				contentKey = mixKey(contentKey, transformVersion);
+			}
+			for (uint32_t i = 0; i < shadow.tileCount; i++)
+			{
+				const ShadowAtlasAllocator::Tile& tile = shadow.tiles[i];
+				contentKey = mixMatrixKey(mixKey(contentKey, (uint64_t(tile.x) << 32) | (uint64_t(tile.y) << 16) | tile.size), request.projViews[i]);
+			}
+			request.contentKey = contentKey;
+
+			if (shadowCaching && shadow.valid && shadow.contentKey == contentKey)
+			{
+				shadowAtlasStats.cachedLights++;
+				continue;
+			}
+			requests.push_back(std::move(request));
+		}
+
+		// 还没有内容的光源优先，其次按重要性，超出预算的保留图集里旧的内容
+		std::stable_sort(requests.begin(), requests.end(), [this](const ShadowRequest& a, const ShadowRequest& b)
+		{
+			return !localLightShadowStates[a.lightIndex].valid && localLightShadowStates[b.lightIndex].valid;
+		});
+		// 至少能放下一个点光源的六个面
+		uint32_t updateBudget = glm::clamp(shadowAtlasUpdateBudget, 6u, MaxShadowAtlasUpdates);
+		for (ShadowRequest& request : requests)
+		{
+			LocalLightShadow& shadow = localLightShadowStates[request.lightIndex];
+			if (shadowAtlasUpdates.size() + shadow.tileCount > updateBudget)
+			{
+				shadowAtlasStats.deferredLights++;
+				continue;
+			}
+
+			for (uint32_t i = 0; i < shadow.tileCount; i++)
+			{
+				ShadowAtlasUpdate update;
+				update.tile = shadow.tiles[i];
+				update.projView = request.projViews[i];
+				update.casters = request.casters;
+				shadowAtlasUpdates.push_back(std::move(update));
+			}
+			shadow.projViews = request.projViews;
+			shadow.contentKey = request.contentKey;
+			shadow.valid = true;
+		}
+		shadowAtlasStats.updatedTiles = static_cast<uint32_t>(shadowAtlasUpdates.size());
+
+		// 光照shader用的每块数据，只包含图集里有内容的光源
+		float invAtlasSize = 1.0f / shadowAtlasSize;
+		for (uint32_t i = 0; i < lightCount; i++)
+		{
+			const LocalLightShadow& shadow = localLightShadowStates[i];
+			if (!shadow.valid)
+			{
+				continue;
+			}
+
+			localLightFirstTiles[i] = static_cast<int32_t>(shadowAtlasTileDatas.size());
+			for (uint32_t tileIndex = 0; tileIndex < shadow.tileCount; tileIndex++)
+			{
+				const ShadowAtlasAllocator::Tile& tile = shadow.tiles[tileIndex];
+				ShadowAtlasTileData tileData;
+				tileData.projView = shadow.projViews[tileIndex];
+				tileData.rect = glm::vec4(tile.x, tile.y, tile.size, tile.size) * invAtlasSize;
+				shadowAtlasTileDatas.push_back(tileData);
+			}
+			shadowAtlasStats.shadowedLights++;
+			shadowAtlasStats.tiles += shadow.tileCount;
+		}
+		shadowAtlasStats.usage = shadowAtlasAllocator.getUsage();
+	}
+
+	void VulkanRenderSceneData::updateShadowCascades()
+	{
+		Camera& camera = cameraController.camera;
+		uint32_t cascadeCount = glm::clamp(shadowCascadeCount, 1u, MaxShadowCascades);
+		float aspect = vulkanRenderer->windowWidth / (float)(vulkanRenderer->windowHeight);
+		float tanHalfFovY = glm::tan(glm::radians(camera.zoom) / 2.0f);
+		float tanHalfFovX = tanHalfFovY * aspect;
+		float nearClip = camera.near;
+		float farClip = glm::max(glm::min(shadowDistance, camera.far), nearClip * 2.0f);
+
+		// directionalLightPos是指向光源的方向
+		glm::vec3 lightDirection = glm::normalize(uniformBufferFSObject.directionalLightPos);
+		glm::vec3 lightUp = glm::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		Box bounds = getSceneBounds();
+
+		float splitNear = nearClip;
+		for (uint32_t i = 0; i < MaxShadowCascades; i++)
+		{
+			if (i >= cascadeCount)
+			{
+				uniformBufferShadowVSObjects[i].projectView = uniformBufferShadowVSObjects[cascadeCount - 1].projectView;
+				uniformBufferShadowCascadesObject.cascadeProjView[i] = uniformBufferShadowVSObjects[i].projectView;
+				uniformBufferShadowCascadesObject.cascadeSplits[i] = splitNear;
+				uniformBufferShadowCascadesObject.cascadeWorldSizes[i] = uniformBufferShadowCascadesObject.cascadeWorldSizes[cascadeCount - 1];
+				uniformBufferShadowCascadesObject.cascadeDepthRanges[i] = uniformBufferShadowCascadesObject.cascadeDepthRanges[cascadeCount - 1];
+				continue;
+			}
+
+			// practical split：对数和均匀划分插值
+			float ratio = (i + 1) / (float)cascadeCount;
+			float logSplit = nearClip * glm::pow(farClip / nearClip, ratio);
+			float uniformSplit = nearClip + (farClip - nearClip) * ratio;
+			float splitFar = shadowCascadeSplitLambda * logSplit + (1.0f - shadowCascadeSplitLambda) * uniformSplit;
+
+			glm::vec3 corners[8];
+			for (uint32_t j = 0; j < 2; j++)
+			{
+				float distance = j == 0 ? splitNear : splitFar;
+				glm::vec3 center = camera.position + camera.forward * distance;
+				glm::vec3 x = camera.right * (tanHalfFovX * distance);
+				glm::vec3 y = camera.up * (tanHalfFovY * distance);
+				corners[j * 4 + 0] = center - x - y;
+				corners[j * 4 + 1] = center + x - y;
+				corners[j * 4 + 2] = center - x + y;
+				corners[j * 4 + 3] = center + x + y;
+			}
+
+			// 用包围球而不是包围盒，投影大小不随相机旋转变化
+			glm::vec3 sphereCenter = glm::vec3(0.0f);
+			for (const glm::vec3& corner : corners)
+			{
+				sphereCenter += corner / 8.0f;
+			}
+			float radius = 0.0f;
+			for (const glm::vec3& corner : corners)
+			{
+				radius = glm::max(radius, glm::length(corner - sphereCenter));
+			}
+			radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+			// 深度范围取场景在光源方向上的整个范围，视锥外的投射物也能画进来
+			glm::mat4 lightView = glm::lookAtRH(sphereCenter, sphereCenter - lightDirection, lightUp);
+			float minDepth = -radius;
+			float maxDepth = radius;
+			if (bounds.isValid())
+			{
+				for (uint32_t j = 0; j < 8; j++)
+				{
+					glm::vec3 corner((j & 1) ? bounds.max.x : bounds.min.x, (j & 2) ? bounds.max.y : bounds.min.y, (j & 4) ? bounds.max.z : bounds.min.z);
+					float depth = -(lightView * glm::vec4(corner, 1.0f)).z;
+					minDepth = glm::min(minDepth, depth);
+					maxDepth = glm::max(maxDepth, depth);
+				}
+			}
+
+			glm::mat4 lightProj = glm::orthoRH(-radius, radius, -radius, radius, minDepth, maxDepth);
+			lightProj[1][1] *= -1;
+
+			// 世界原点对齐到texel，相机平移时阴影边缘不闪烁
+			float halfSize = shadowCascadeSize / 2.0f;
+			glm::vec4 origin = lightProj * lightView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec2 texelOrigin = glm::vec2(origin) * halfSize;
+			glm::vec2 offset = (glm::round(texelOrigin) - texelOrigin) / halfSize;
+			lightProj[3][0] += offset.x;
+			lightProj[3][1] += offset.y;
+
+			uniformBufferShadowVSObjects[i].projectView = lightProj * lightView;
+			uniformBufferShadowCascadesObject.cascadeProjView[i] = uniformBufferShadowVSObjects[i].projectView;
+			uniformBufferShadowCascadesObject.cascadeSplits[i] = splitFar;
+			uniformBufferShadowCascadesObject.cascadeWorldSizes[i] = radius * 2.0f;
+			uniformBufferShadowCascadesObject.cascadeDepthRanges[i] = maxDepth - minDepth;
+
+			splitNear = splitFar;
+		}
+
+		uniformBufferShadowCascadesObject.viewDepthPlane = glm::vec4(camera.forward, -glm::dot(camera.forward, camera.position));
+		uniformBufferShadowCascadesObject.cascadeCount = static_cast<int32_t>(cascadeCount);
+	}
+
+	float VulkanRenderSceneData::getShadowRangeDepth() const
+	{
+		int32_t cascadeCount = uniformBufferShadowCascadesObject.cascadeCount;
+		if (cascadeCount <= 0)
+		{
+			return 0.0f;
+		}
+
+		// 透视投影的深度只和观察空间的z有关
+		float shadowDistance = uniformBufferShadowCascadesObject.cascadeSplits[cascadeCount - 1];
+		glm::vec4 clip = uniformBufferVSObject.proj * glm::vec4(0.0f, 0.0f, -shadowDistance, 1.0f);
+		return glm::clamp(clip.z / clip.w, 0.0f, std::nextafter(1.0f, 0.0f));
+	}
+
+	const VkSpecializationInfo* VulkanRenderSceneData::getShadowFilterSpecializationInfo()
+	{
+		shadowFilterConstants.filter = static_cast<int32_t>(shadowFilter);
+		shadowFilterConstants.tapCount = shadowFilterTaps > 8 ? 16 : 8;
+		shadowFilterConstants.lightSize = shadowLightSize;
+
+		shadowFilterMapEntries[0] = { 0, offsetof(ShadowFilterConstants, filter), sizeof(int32_t) };
+		shadowFilterMapEntries[1] = { 1, offsetof(ShadowFilterConstants, tapCount), sizeof(int32_t) };
+		shadowFilterMapEntries[2] = { 2, offsetof(ShadowFilterConstants, lightSize), sizeof(float) };
+
+		shadowFilterSpecializationInfo.mapEntryCount = static_cast<uint32_t>(shadowFilterMapEntries.size());
+		shadowFilterSpecializationInfo.pMapEntries = shadowFilterMapEntries.data();
+		shadowFilterSpecializationInfo.dataSize = sizeof(ShadowFilterConstants);
+		shadowFilterSpecializationInfo.pData = &shadowFilterConstants;
+		return &shadowFilterSpecializationInfo;
+	}
+
+	void VulkanRenderSceneData::updateVisibilityVersion()
+	{
+		if (cameraVisibleMeshes != submittedCameraMeshes || shadowVisibleMeshes != submittedShadowMeshes)
+		{
+			submittedCameraMeshes = cameraVisibleMeshes;
+			submittedShadowMeshes = shadowVisibleMeshes;
+			visibilityVersion++;
+		}
+	}
+
+	Box VulkanRenderSceneData::getSceneBounds()
+	{
+		updateMeshBounds();
+		return sceneBounds;
+	}
+
+	int32_t VulkanRenderSceneData::pickMesh(const glm::vec3& origin, const glm::vec3& direction, float& distance)
+	{
+		updateMeshBounds();
+
+		distance = std::numeric_limits<float>::max();
+		return meshBVH.raycast(origin, direction, distance, [&](uint32_t meshIndex, float& t)
+		{
+			// 射线变换到模型空间，参数t不变
+			Mesh* mesh = meshes[meshIndex];
+			glm::mat4 inverseModel = glm::inverse(rotate * mesh->node->worldTransform);
+			glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(origin, 1.0f));
+			glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(direction, 0.0f));
+
+			// Moller-Trumbore，不剔除背面
+			bool hit = false;
+			for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+			{
+				const glm::vec3& p0 = mesh->vertices[mesh->indices[i]].position;
+				const glm::vec3& p1 = mesh->vertices[mesh->indices[i + 1]].position;
+				const glm::vec3& p2 = mesh->vertices[mesh->indices[i + 2]].position;
+
+				glm::vec3 edge1 = p1 - p0;
+				glm::vec3 edge2 = p2 - p0;
+				glm::vec3 p = glm::cross(localDirection, edge2);
+				float determinant = glm::dot(edge1, p);
+				if (std::abs(determinant) < 1e-12f)
+				{
+					continue;
+				}
+
+				float inverseDeterminant = 1.0f / determinant;
+				glm::vec3 s = localOrigin - p0;
+				float u = glm::dot(s, p) * inverseDeterminant;
+				if (u < 0.0f || u > 1.0f)
+				{
+					continue;
+				}
+
+				glm::vec3 q = glm::cross(s, edge1);
+				float v = glm::dot(localDirection, q) * inverseDeterminant;
+				if (v < 0.0f || u + v > 1.0f)
+				{
+					continue;
+				}
+
+				float triangleT = glm::dot(edge2, q) * inverseDeterminant;
+				if (triangleT >= 0.0f && triangleT < t)
+				{
+					t = triangleT;
+					hit = true;
+				}
+			}
+			return hit;
+		});
 	}
 
 	void VulkanRenderSceneData::lookAtSceneCenter()
@@ -337,64 +1107,184 @@ namespace VulkanEngine
 		cameraController.setCenterAndRadius(box.getCenter(), radius);
 	}
 
-	void VulkanRenderSceneData::createVertexData()
+	void VulkanRenderSceneData::scatterLocalLights(uint32_t count, uint32_t seed)
+	{
+		localLights.clear();
+		count = std::min(count, MaxLocalLights);
+
+		Box box = getSceneBounds();
+		if (!box.isValid())
+		{
+			return;
+		}
+		glm::vec3 size = box.getSize();
+		// 半径随场景大小变化，保证光源之间有重叠又不会覆盖整个场景
+		float range = std::max(glm::length(size), 1.0f) * 0.08f;
+
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			LocalLight light;
+			light.position = box.min + glm::vec3(unit(random), unit(random), unit(random)) * size;
+			light.color = glm::vec3(unit(random), unit(random), unit(random)) * 0.8f + 0.2f;
+			light.intensity = 4.0f;
+			light.range = range;
+			if (i % 4 == 3)
+			{
+				light.type = LightType::Spot;
+				light.range = range * 2.0f;
+				light.intensity = 8.0f;
+				light.innerConeAngle = 0.3f;
+				light.outerConeAngle = 0.5f;
+			}
+			localLights.push_back(light);
+		}
+	}
+
+	void VulkanRenderSceneData::createGeometryData()
 	{
-		VkDeviceSize bufferSize = 0;
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
-			bufferSize += meshes[i]->vertices.size() * sizeof(Vertex);
+			vertexCount += static_cast<uint32_t>(meshes[i]->vertices.size());
+			indexCount += static_cast<uint32_t>(meshes[i]->indices.size());
 		}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		vulkanRenderer->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		// 预留一部分空间给运行时加入的mesh，不够时再扩容
+		geometryHeap.init(vulkanRenderer, sizeof(Vertex), vertexCount + vertexCount / 4 + 1024, indexCount + indexCount / 4 + 3072);
 
-		void* data;
-		vkMapMemory(vulkanRenderer->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		uint32_t offset = 0;
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
-			memcpy((char*)(data) + offset, meshes[i]->vertices.data(), sizeof(Vertex) * meshes[i]->vertices.size());
-			offset += sizeof(Vertex) * meshes[i]->vertices.size();
+			addMeshGeometry(meshes[i]);
 		}
-		vkUnmapMemory(vulkanRenderer->device, stagingBufferMemory);
 
-		vulkanRenderer->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexResource.buffer, vertexResource.memory);
+		geometryHeap.flushUploads();
+	}
 
-		vulkanRenderer->copyBuffer(stagingBuffer, vertexResource.buffer, bufferSize);
+	void VulkanRenderSceneData::addMeshGeometry(Mesh* mesh)
+	{
+		if (mesh->geometry != InvalidGeometryHandle)
+		{
+			return;
+		}
 
-		vkDestroyBuffer(vulkanRenderer->device, stagingBuffer, nullptr);
-		vkFreeMemory(vulkanRenderer->device, stagingBufferMemory, nullptr);
+		mesh->geometry = geometryHeap.addMesh(mesh->vertices.data(), static_cast<uint32_t>(mesh->vertices.size()),
+			mesh->indices.data(), static_cast<uint32_t>(mesh->indices.size()));
+		contentVersion++;
 	}
 
-	void VulkanRenderSceneData::createIndexData()
+	void VulkanRenderSceneData::removeMeshGeometry(Mesh* mesh)
 	{
-		VkDeviceSize bufferSize = 0;
-		for (size_t i = 0; i < meshes.size(); i++)
+		if (mesh->geometry == InvalidGeometryHandle)
 		{
-			bufferSize += meshes[i]->indices.size() * sizeof(uint32_t);
+			return;
 		}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		vulkanRenderer->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		geometryHeap.removeMesh(mesh->geometry);
+		mesh->geometry = InvalidGeometryHandle;
+		contentVersion++;
+	}
 
-		void* data;
-		vkMapMemory(vulkanRenderer->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		uint32_t offset = 0;
+	void VulkanRenderSceneData::bindGeometry(VkCommandBuffer commandBuffer)
+	{
+		VkBuffer vertexBuffers[] = { geometryHeap.getVertexBuffer() };
+		VkDeviceSize vertexOffsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, vertexOffsets);
+
+		vkCmdBindIndexBuffer(commandBuffer, geometryHeap.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+	}
+
+	const std::vector<MeshDrawInfo>& VulkanRenderSceneData::getMeshDrawInfos()
+	{
+		if (meshDrawInfoVersion == geometryHeap.getLayoutVersion() && meshDrawInfos.size() == meshes.size())
+		{
+			return meshDrawInfos;
+		}
+
+		meshDrawInfos.resize(meshes.size());
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
-			memcpy((char*)(data) + offset, meshes[i]->indices.data(), sizeof(uint32_t) * meshes[i]->indices.size());
-			offset += sizeof(uint32_t) * meshes[i]->indices.size();
+			MeshDrawInfo& drawInfo = meshDrawInfos[i];
+
+			if (meshes[i]->geometry == InvalidGeometryHandle)
+			{
+				drawInfo.indexCount = 0;
+				continue;
+			}
+
+			const GeometryAllocation& geometry = geometryHeap.getAllocation(meshes[i]->geometry);
+			drawInfo.indexCount = geometry.indexCount;
+			drawInfo.firstIndex = geometry.firstIndex;
+			drawInfo.vertexOffset = static_cast<int32_t>(geometry.vertexOffset);
+		}
+		meshDrawInfoVersion = geometryHeap.getLayoutVersion();
+
+		return meshDrawInfos;
+	}
+
+	void VulkanRenderSceneData::createMeshBuffers(uint32_t capacity)
+	{
+		vulkanRenderer->createBuffer(sizeof(MeshDrawData) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, meshDrawDataResource.buffer, meshDrawDataResource.memory, MemoryCategory::Uniform);
+		vulkanRenderer->createBuffer(sizeof(MeshBoundsData) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, meshBoundsResource.buffer, meshBoundsResource.memory, MemoryCategory::Uniform);
+		meshBufferCapacity = capacity;
+		meshBoundsVersion = ~0ull;
+	}
+
+	bool VulkanRenderSceneData::reserveMeshBuffers()
+	{
+		// 运行时加入的mesh补上材质编号，变换和绘制参数每帧在updateUniformRenderData里写
+		if (meshDrawDatas.size() != meshes.size())
+		{
+			size_t first = meshDrawDatas.size();
+			meshDrawDatas.resize(meshes.size());
+			for (size_t i = first; i < meshes.size(); i++)
+			{
+				auto material = std::find(materials.begin(), materials.end(), meshes[i]->material);
+				meshDrawDatas[i].materialIndex = material != materials.end() ? static_cast<uint32_t>(material - materials.begin()) : 0;
+			}
+		}
+
+		if (meshes.size() <= meshBufferCapacity)
+		{
+			return false;
 		}
-		vkUnmapMemory(vulkanRenderer->device, stagingBufferMemory);
 
-		vulkanRenderer->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexResource.buffer, indexResource.memory);
+		// 之前的帧录制的commandBuffer引用着这些descriptor，更新前要等GPU空闲，只在扩容时发生
+		vkDeviceWaitIdle(vulkanRenderer->device);
 
-		vulkanRenderer->copyBuffer(stagingBuffer, indexResource.buffer, bufferSize);
+		auto& deletionQueue = vulkanRenderer->deletionQueue;
+		deletionQueue.destroyBuffer(meshDrawDataResource.buffer);
+		deletionQueue.freeMemory(meshDrawDataResource.memory);
+		deletionQueue.destroyBuffer(meshBoundsResource.buffer);
+		deletionQueue.freeMemory(meshBoundsResource.memory);
 
-		vkDestroyBuffer(vulkanRenderer->device, stagingBuffer, nullptr);
-		vkFreeMemory(vulkanRenderer->device, stagingBufferMemory, nullptr);
+		createMeshBuffers(static_cast<uint32_t>(std::max<size_t>(meshes.size(), meshBufferCapacity * 2)));
+		writeMeshDrawDataDescriptor();
+		meshBufferVersion++;
+		return true;
+	}
+
+	void VulkanRenderSceneData::writeMeshDrawDataDescriptor()
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = meshDrawDataResource.buffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = VK_WHOLE_SIZE;
+
+		for (auto descriptorSet : uniformDescriptor.descriptorSet)
+		{
+			VkWriteDescriptorSet descriptorWrite = {};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = descriptorSet;
+			descriptorWrite.dstBinding = 2;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(vulkanRenderer->device, 1, &descriptorWrite, 0, nullptr);
+		}
 	}
 
 	void VulkanRenderSceneData::createUniformBufferData()
@@ -402,26 +1292,47 @@ namespace VulkanEngine
 		uint32_t uniformBufferSize = sizeof(UniformBufferObjectVS) + sizeof(UniformBufferObjectFS); 
 		if (uniformBufferSize > 0)
 		{
-			vulkanRenderer->createBuffer(uniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformResource.buffer, uniformResource.memory);
+			vulkanRenderer->createBuffer(uniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformResource.buffer, uniformResource.memory, MemoryCategory::Uniform);
 		}
 
-		uint32_t uniformDynamicBufferSize = sizeof(UniformBufferDynamicObject) * uniformBufferDynamicObjects.size();
-		if (uniformDynamicBufferSize > 0)
+		// 材质编号先按materials里的下标给出，shader还是通过材质set采样
+		std::map<PBRMaterial*, uint32_t> materialIndices;
+		for (size_t i = 0; i < materials.size(); i++)
 		{
-			vulkanRenderer->createBuffer(uniformDynamicBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformDynamicResource.buffer, uniformDynamicResource.memory);
+			materialIndices[materials[i]] = static_cast<uint32_t>(i);
 		}
 
-		uint32_t uniformBufferShadowSize = sizeof(uniformBufferShadowVSObject);
-		if (uniformBufferShadowSize > 0)
+		meshDrawDatas.resize(meshes.size());
+		for (size_t i = 0; i < meshes.size(); i++)
 		{
-			vulkanRenderer->createBuffer(uniformBufferShadowSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformShadowResource.buffer, uniformShadowResource.memory);
+			meshDrawDatas[i].model = rotate * meshes[i]->node->worldTransform;
+			meshDrawDatas[i].materialIndex = materialIndices[meshes[i]->material];
 		}
 
+		// 空场景也创建一个元素，保证descriptor可以写入
+		createMeshBuffers(static_cast<uint32_t>(std::max<size_t>(meshDrawDatas.size(), 1)));
+
+		uint32_t uniformBufferShadowSize = ShadowCascadeUniformStride * MaxShadowCascades;
+		vulkanRenderer->createBuffer(uniformBufferShadowSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformShadowResource.buffer, uniformShadowResource.memory, MemoryCategory::Uniform);
+
+		uint32_t uniformBufferShadowCascadesSize = sizeof(UniformBufferObjectShadowCascades);
+		vulkanRenderer->createBuffer(uniformBufferShadowCascadesSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformShadowCascadesResource.buffer, uniformShadowCascadesResource.memory, MemoryCategory::Uniform);
+
 		uint32_t deferredUniformBufferSize = sizeof(DeferredUniformBufferObject);
 		if (deferredUniformBufferSize > 0)
 		{
-			vulkanRenderer->createBuffer(uniformDynamicBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, deferredUniformResource.buffer, deferredUniformResource.memory);
+			vulkanRenderer->createBuffer(deferredUniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, deferredUniformResource.buffer, deferredUniformResource.memory, MemoryCategory::Uniform);
 		}
+
+		vulkanRenderer->createBuffer(LightBufferStride * VulkanRenderer::MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, lightResource.buffer, lightResource.memory, MemoryCategory::Uniform);
+		vulkanRenderer->createBuffer(ClusterUniformStride * VulkanRenderer::MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformClustersResource.buffer, uniformClustersResource.memory, MemoryCategory::Uniform);
+
+		// compute不可用时用vkCmdFillBuffer把数量清零
+		uint32_t clusterGridSize = sizeof(uint32_t) * (ClusterCount + ClusterCount * MaxLightsPerCluster);
+		vulkanRenderer->createBuffer(clusterGridSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterGridResource.buffer, clusterGridResource.memory, MemoryCategory::Uniform);
+
+		vulkanRenderer->createBuffer(ShadowAtlasTileBufferStride * VulkanRenderer::MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowAtlasTileResource.buffer, shadowAtlasTileResource.memory, MemoryCategory::Uniform);
+		vulkanRenderer->createBuffer(ShadowCascadeUniformStride * MaxShadowAtlasUpdates * VulkanRenderer::MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformShadowAtlasResource.buffer, uniformShadowAtlasResource.memory, MemoryCategory::Uniform);
 	}
 
 	void VulkanRenderSceneData::createPBRDescriptorLayout()
@@ -453,25 +1364,76 @@ namespace VulkanEngine
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRenderer->device, &layoutInfo, nullptr, &PBRMaterialDescriptor.layout));
 	}
 
+	void VulkanRenderSceneData::createIBLTextures()
+	{
+		std::string defaultPath = vulkanRenderer->basePath + "/resources/models/default/";
+		std::string sky = defaultPath + "/sky/";
+
+		// 设置了等距柱状投影的环境图就用它，否则从sky目录里的天空盒六个面生成，只需要读六张图
+		// 层的顺序和CubeMap::createCubeMap一致
+		VulkanIBLPrecomputer precomputer;
+		if (!environmentMapPath.empty() && precomputer.precompute(vulkanRenderer, this, environmentMapPath))
+		{
+			return;
+		}
+		std::array<std::string, 6> skyFaces = {
+			sky + "skybox_specular_X+.hdr", sky + "skybox_specular_X-.hdr",
+			sky + "skybox_specular_Z+.hdr", sky + "skybox_specular_Z-.hdr",
+			sky + "skybox_specular_Y+.hdr", sky + "skybox_specular_Y-.hdr" };
+		if (precomputer.precomputeFromCube(vulkanRenderer, this, skyFaces))
+		{
+			return;
+		}
+
+		// compute不可用时读预先烘焙好的cube map和LUT
+		LOG_WARN("IBL precompute: unavailable, using prebaked IBL maps");
+		IBLSpecularBox = new CubeMap();
+
+		IBLSpecularBox->fullPaths[0] = sky + "skybox_specular_X+.hdr";
+		IBLSpecularBox->fullPaths[1] = sky + "skybox_specular_X-.hdr";
+		IBLSpecularBox->fullPaths[2] = sky + "skybox_specular_Z+.hdr";
+		IBLSpecularBox->fullPaths[3] = sky + "skybox_specular_Z-.hdr";
+		IBLSpecularBox->fullPaths[4] = sky + "skybox_specular_Y+.hdr";
+		IBLSpecularBox->fullPaths[5] = sky + "skybox_specular_Y-.hdr";
+
+		IBLSpecularBox->createCubeMap(vulkanRenderer);
+
+		IBLIrradianceBox = new CubeMap();
+
+		IBLIrradianceBox->fullPaths[0] = sky + "skybox_irradiance_X+.hdr";
+		IBLIrradianceBox->fullPaths[1] = sky + "skybox_irradiance_X-.hdr";
+		IBLIrradianceBox->fullPaths[2] = sky + "skybox_irradiance_Z+.hdr";
+		IBLIrradianceBox->fullPaths[3] = sky + "skybox_irradiance_Z-.hdr";
+		IBLIrradianceBox->fullPaths[4] = sky + "skybox_irradiance_Y+.hdr";
+		IBLIrradianceBox->fullPaths[5] = sky + "skybox_irradiance_Y-.hdr";
+
+		IBLIrradianceBox->createCubeMap(vulkanRenderer);
+
+		brdfLUTTexture = new Texture();
+		brdfLUTTexture->fullPath = defaultPath + "/brdf_schilk.hdr";
+		brdfLUTTexture->oneLevel = true;
+		brdfLUTTexture->createTextureImage(vulkanRenderer);
+	}
+
 	void VulkanRenderSceneData::createIBLDescriptor()
 	{
 		VkDescriptorSetLayoutBinding IBLLayoutBinding[3] = {};
 		IBLLayoutBinding[0].binding = 0;
 		IBLLayoutBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		IBLLayoutBinding[0].descriptorCount = 1;
-		IBLLayoutBinding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		IBLLayoutBinding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 		IBLLayoutBinding[0].pImmutableSamplers = nullptr;
 
 		IBLLayoutBinding[1].binding = 1;
 		IBLLayoutBinding[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		IBLLayoutBinding[1].descriptorCount = 1;
-		IBLLayoutBinding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		IBLLayoutBinding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 		IBLLayoutBinding[1].pImmutableSamplers = nullptr;
 
 		IBLLayoutBinding[2].binding = 2;
 		IBLLayoutBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		IBLLayoutBinding[2].descriptorCount = 1;
-		IBLLayoutBinding[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		IBLLayoutBinding[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 		IBLLayoutBinding[2].pImmutableSamplers = nullptr;
 
 		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -483,14 +1445,7 @@ namespace VulkanEngine
 
 		IBLDescriptor.descriptorSet.resize(1);
 
-		VkDescriptorSetAllocateInfo allocateInfo = {};
-		allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocateInfo.pNext = nullptr;
-		allocateInfo.descriptorPool = vulkanRenderer->descriptorPool;
-		allocateInfo.descriptorSetCount = 1;
-		allocateInfo.pSetLayouts = &IBLDescriptor.layout;
-
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRenderer->device, &allocateInfo, &IBLDescriptor.descriptorSet[0]));
+		VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(IBLDescriptor.layout, IBLDescriptor.descriptorSet[0]));
 
 		std::array<VkDescriptorImageInfo, 3> imageInfo = {};
 		imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -505,7 +1460,7 @@ namespace VulkanEngine
 		imageInfo[2].imageView = brdfLUTTexture->textureImageView;
 		imageInfo[2].sampler = brdfLUTTexture->sampler;
 
-		std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+		std::vector<VkWriteDescriptorSet> descriptorWrites(3);
 
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		descriptorWrites[0].dstSet = IBLDescriptor.descriptorSet[0];
@@ -550,7 +1505,7 @@ namespace VulkanEngine
 		uboLayoutBinding[1].pImmutableSamplers = nullptr;
 
 		uboLayoutBinding[2].binding = 2;
-		uboLayoutBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		uboLayoutBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		uboLayoutBinding[2].descriptorCount = 1;
 		uboLayoutBinding[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 		uboLayoutBinding[2].pImmutableSamplers = nullptr;
@@ -566,14 +1521,7 @@ namespace VulkanEngine
 		uniformDescriptor.descriptorSet.resize(1);
 		for (size_t i = 0; i < uniformDescriptor.descriptorSet.size(); i++)
 		{
-			VkDescriptorSetAllocateInfo allocateInfo = {};
-			allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			allocateInfo.pNext = nullptr;
-			allocateInfo.descriptorPool = vulkanRenderer->descriptorPool;
-			allocateInfo.descriptorSetCount = 1;
-			allocateInfo.pSetLayouts = &uniformDescriptor.layout;
-
-			VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRenderer->device, &allocateInfo, &uniformDescriptor.descriptorSet[i]));
+			VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(uniformDescriptor.layout, uniformDescriptor.descriptorSet[i]));
 		}
 
 		for (size_t i = 0; i < uniformDescriptor.descriptorSet.size(); i++)
@@ -587,11 +1535,11 @@ namespace VulkanEngine
 			bufferInfo[1].offset = sizeof(UniformBufferObjectVS);
 			bufferInfo[1].range = sizeof(UniformBufferObjectFS);
 
-			bufferInfo[2].buffer = uniformDynamicResource.buffer;
+			bufferInfo[2].buffer = meshDrawDataResource.buffer;
 			bufferInfo[2].offset = 0;
-			bufferInfo[2].range = sizeof(UniformBufferDynamicObject);
+			bufferInfo[2].range = VK_WHOLE_SIZE;
 
-			std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+			std::vector<VkWriteDescriptorSet> descriptorWrites(3);
 			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 			descriptorWrites[0].dstSet = uniformDescriptor.descriptorSet[i];
 			descriptorWrites[0].dstBinding = 0;
@@ -616,7 +1564,7 @@ namespace VulkanEngine
 			descriptorWrites[2].dstSet = uniformDescriptor.descriptorSet[i];
 			descriptorWrites[2].dstBinding = 2;
 			descriptorWrites[2].dstArrayElement = 0;
-			descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 			descriptorWrites[2].descriptorCount = 1;
 			descriptorWrites[2].pBufferInfo = &bufferInfo[2];
 			descriptorWrites[2].pImageInfo = nullptr;
@@ -666,6 +1614,38 @@ namespace VulkanEngine
 		return max.x >= min.x && max.y >= min.y && max.z >= min.z;
 	}
 
+	Box Box::transform(const glm::mat4& matrix) const
+	{
+		if (!isValid())
+		{
+			return Box();
+		}
+
+		// 按矩阵每一项的正负分别取min/max，比变换8个角点少做一半乘法
+		Box box;
+		box.min = box.max = glm::vec3(matrix[3]);
+		for (int column = 0; column < 3; column++)
+		{
+			for (int row = 0; row < 3; row++)
+			{
+				float a = matrix[column][row] * min[column];
+				float b = matrix[column][row] * max[column];
+				box.min[row] += glm::min(a, b);
+				box.max[row] += glm::max(a, b);
+			}
+		}
+		return box;
+	}
+
+	void Mesh::computeLocalBounds()
+	{
+		localBounds = Box();
+		for (const auto& vertex : vertices)
+		{
+			localBounds.addPoint(vertex.position);
+		}
+	}
+
 	void Texture::createTextureImage(VulkanRenderer* vulkanRender)
 	{
 		int texWidth, texHeight, texChannels;
@@ -721,16 +1701,6 @@ namespace VulkanEngine
 
 	void PBRMaterial::createDescriptorSet(VulkanRenderer* vulkanRender, VulkanRenderSceneData* sceneData)
 	{
-		VkDescriptorSetAllocateInfo PBRMaterialDescriptorSetAllocInfo = {};
-
-		PBRMaterialDescriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		PBRMaterialDescriptorSetAllocInfo.pNext = nullptr;
-		PBRMaterialDescriptorSetAllocInfo.descriptorPool = vulkanRender->descriptorPool;		// 最多256种材质
-		PBRMaterialDescriptorSetAllocInfo.descriptorSetCount = 1;
-		PBRMaterialDescriptorSetAllocInfo.pSetLayouts = &sceneData->PBRMaterialDescriptor.layout;
-
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRender->device, &PBRMaterialDescriptorSetAllocInfo, &descriptorSet));
-
 		VkDescriptorImageInfo baseColorInfo = {};
 		baseColorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		baseColorInfo.imageView = baseColor->textureImageView;
@@ -746,10 +1716,9 @@ namespace VulkanEngine
 		metallicRoughnessInfo.imageView = metallicRoughness->textureImageView;
 		metallicRoughnessInfo.sampler = metallicRoughness->sampler;
 
-		std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+		std::vector<VkWriteDescriptorSet> descriptorWrites(3);
 
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = descriptorSet;
 		descriptorWrites[0].dstBinding = 0;
 		descriptorWrites[0].dstArrayElement = 0;
 		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -759,7 +1728,6 @@ namespace VulkanEngine
 		descriptorWrites[0].pTexelBufferView = nullptr;
 
 		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = descriptorSet;
 		descriptorWrites[1].dstBinding = 1;
 		descriptorWrites[1].dstArrayElement = 0;
 		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -769,7 +1737,6 @@ namespace VulkanEngine
 		descriptorWrites[1].pTexelBufferView = nullptr;
 
 		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2].dstSet = descriptorSet;
 		descriptorWrites[2].dstBinding = 2;
 		descriptorWrites[2].dstArrayElement = 0;
 		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -778,22 +1745,60 @@ namespace VulkanEngine
 		descriptorWrites[2].pImageInfo = &metallicRoughnessInfo;
 		descriptorWrites[2].pTexelBufferView = nullptr;
 
-		vkUpdateDescriptorSets(vulkanRender->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		// 贴图组合相同的材质共用一个set
+		descriptorSet = vulkanRender->descriptorAllocator.getOrCreateCachedSet(sceneData->PBRMaterialDescriptor.layout, descriptorWrites);
+		if (descriptorSet == VK_NULL_HANDLE)
+		{
+			LOG_ERROR("failed to create material descriptor set");
+		}
 	}
 
-	void VulkanRenderSceneData::createDirectionalLightShadowDescriptorSet(VkImageView& directionalLightShadowView)
+	void VulkanRenderSceneData::createDirectionalLightShadowDescriptorSet(VkImageView& directionalLightShadowView, VkSampler directionalLightShadowSampler, VkImageView& localLightShadowAtlasView, VkSampler localLightShadowAtlasSampler)
 	{
-		VkDescriptorSetLayoutBinding binding[2] = {};
+		// 光照可能在片元着色器或者deferred的compute里
+		VkDescriptorSetLayoutBinding binding[8] = {};
 
 		binding[0].binding = 0;
 		binding[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		binding[0].descriptorCount = 1;
-		binding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		binding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
 		binding[1].binding = 1;
 		binding[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 		binding[1].descriptorCount = 1;
-		binding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		binding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		binding[2].binding = 2;
+		binding[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		binding[2].descriptorCount = 1;
+		binding[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		// 分簇光照：簇参数、光源、每个簇的光源列表
+		binding[3].binding = 3;
+		binding[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		binding[3].descriptorCount = 1;
+		binding[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		binding[4].binding = 4;
+		binding[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		binding[4].descriptorCount = 1;
+		binding[4].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		binding[5].binding = 5;
+		binding[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		binding[5].descriptorCount = 1;
+		binding[5].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		// 点光源和聚光灯的阴影图集，每块的投影和在图集里的范围
+		binding[6].binding = 6;
+		binding[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		binding[6].descriptorCount = 1;
+		binding[6].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		binding[7].binding = 7;
+		binding[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		binding[7].descriptorCount = 1;
+		binding[7].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
 		VkDescriptorSetLayoutCreateInfo layoutCI = {};
 		layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -804,28 +1809,44 @@ namespace VulkanEngine
 
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(vulkanRenderer->device, &layoutCI, nullptr, &directionalLightShadowDescriptor.layout));
 
-		directionalLightShadowDescriptor.descriptorSet.resize(1);
-
-		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocateInfo.pNext = nullptr;
-		descriptorSetAllocateInfo.descriptorPool = vulkanRenderer->descriptorPool;
-		descriptorSetAllocateInfo.descriptorSetCount = 1;
-		descriptorSetAllocateInfo.pSetLayouts = &directionalLightShadowDescriptor.layout;
-
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRenderer->device, &descriptorSetAllocateInfo, &directionalLightShadowDescriptor.descriptorSet[0]));
+		// 每个飞行帧一个set，只有图集每块的数据指向各自的那一段
+		directionalLightShadowDescriptor.descriptorSet.resize(VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+		for (auto& descriptorSet : directionalLightShadowDescriptor.descriptorSet)
+		{
+			VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(directionalLightShadowDescriptor.layout, descriptorSet));
+		}
 
 		VkDescriptorImageInfo shadowImageInfo = {};
-		shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 		shadowImageInfo.imageView = directionalLightShadowView;
-		shadowImageInfo.sampler = vulkanRenderer->getOrCreateNearestSampler();
+		shadowImageInfo.sampler = directionalLightShadowSampler;
+
+		VkDescriptorImageInfo shadowDepthImageInfo = shadowImageInfo;
+		shadowDepthImageInfo.sampler = vulkanRenderer->getOrCreateNearestSampler();
 
 		VkDescriptorBufferInfo bufferInfo = {};
 		bufferInfo.offset = 0;
-		bufferInfo.buffer = uniformShadowResource.buffer;
-		bufferInfo.range = sizeof(UnifromBufferObjectShadowProjView);
-
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+		bufferInfo.buffer = uniformShadowCascadesResource.buffer;
+		bufferInfo.range = sizeof(UniformBufferObjectShadowCascades);
+
+		VkDescriptorBufferInfo clusterBufferInfos[3] = {};
+		clusterBufferInfos[0].buffer = uniformClustersResource.buffer;
+		clusterBufferInfos[0].range = sizeof(UniformBufferObjectClusters);
+		clusterBufferInfos[1].buffer = lightResource.buffer;
+		clusterBufferInfos[1].range = LightBufferStride;
+		clusterBufferInfos[2].buffer = clusterGridResource.buffer;
+		clusterBufferInfos[2].range = VK_WHOLE_SIZE;
+
+		VkDescriptorImageInfo atlasImageInfo = {};
+		atlasImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		atlasImageInfo.imageView = localLightShadowAtlasView;
+		atlasImageInfo.sampler = localLightShadowAtlasSampler;
+
+		VkDescriptorBufferInfo atlasTileBufferInfo = {};
+		atlasTileBufferInfo.buffer = shadowAtlasTileResource.buffer;
+		atlasTileBufferInfo.range = ShadowAtlasTileBufferStride;
+
+		std::array<VkWriteDescriptorSet, 8> descriptorWrites = {};
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		descriptorWrites[0].dstSet = directionalLightShadowDescriptor.descriptorSet[0];
 		descriptorWrites[0].dstBinding = 0;
@@ -845,7 +1866,53 @@ namespace VulkanEngine
 		descriptorWrites[1].descriptorCount = 1;
 		descriptorWrites[1].pBufferInfo = &bufferInfo;
 
-		vkUpdateDescriptorSets(vulkanRenderer->device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[2].dstSet = directionalLightShadowDescriptor.descriptorSet[0];
+		descriptorWrites[2].dstBinding = 2;
+		descriptorWrites[2].dstArrayElement = 0;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pImageInfo = &shadowDepthImageInfo;
+
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			VkWriteDescriptorSet& write = descriptorWrites[3 + i];
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = directionalLightShadowDescriptor.descriptorSet[0];
+			write.dstBinding = 3 + i;
+			write.dstArrayElement = 0;
+			write.descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			write.descriptorCount = 1;
+			write.pBufferInfo = &clusterBufferInfos[i];
+		}
+
+		descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[6].dstSet = directionalLightShadowDescriptor.descriptorSet[0];
+		descriptorWrites[6].dstBinding = 6;
+		descriptorWrites[6].dstArrayElement = 0;
+		descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[6].descriptorCount = 1;
+		descriptorWrites[6].pImageInfo = &atlasImageInfo;
+
+		descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[7].dstSet = directionalLightShadowDescriptor.descriptorSet[0];
+		descriptorWrites[7].dstBinding = 7;
+		descriptorWrites[7].dstArrayElement = 0;
+		descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[7].descriptorCount = 1;
+		descriptorWrites[7].pBufferInfo = &atlasTileBufferInfo;
+
+		for (uint32_t frame = 0; frame < VulkanRenderer::MAX_FRAMES_IN_FLIGHT; frame++)
+		{
+			clusterBufferInfos[0].offset = frame * ClusterUniformStride;
+			clusterBufferInfos[1].offset = frame * LightBufferStride;
+			atlasTileBufferInfo.offset = frame * ShadowAtlasTileBufferStride;
+			for (auto& write : descriptorWrites)
+			{
+				write.dstSet = directionalLightShadowDescriptor.descriptorSet[frame];
+			}
+			vkUpdateDescriptorSets(vulkanRenderer->device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+		}
 	}
 
 	void VulkanRenderSceneData::createDeferredUniformDescriptorSet()
@@ -855,7 +1922,7 @@ namespace VulkanEngine
 		binding[0].binding = 0;
 		binding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 		binding[0].descriptorCount = 1;
-		binding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		binding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
 		VkDescriptorSetLayoutCreateInfo layoutCI = {};
 		layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -868,14 +1935,7 @@ namespace VulkanEngine
 
 		deferredUniformDescriptor.descriptorSet.resize(1);
 
-		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocateInfo.pNext = nullptr;
-		descriptorSetAllocateInfo.descriptorPool = vulkanRenderer->descriptorPool;
-		descriptorSetAllocateInfo.descriptorSetCount = 1;
-		descriptorSetAllocateInfo.pSetLayouts = &deferredUniformDescriptor.layout;
-
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(vulkanRenderer->device, &descriptorSetAllocateInfo, &deferredUniformDescriptor.descriptorSet[0]));
+		VK_CHECK_RESULT(vulkanRenderer->descriptorAllocator.allocate(deferredUniformDescriptor.layout, deferredUniformDescriptor.descriptorSet[0]));
 
 		VkDescriptorBufferInfo bufferInfo = {};
 		bufferInfo.offset = 0;
@@ -959,6 +2019,8 @@ namespace VulkanEngine
 		   32,31,30,35,34,33
 		};
 
+		mesh->computeLocalBounds();
+
 		return mesh;
 	}
 
@@ -0,0 +1,110 @@
+﻿#include "vulkanSecondaryCommandBuffers.hpp"
+#include "vulkanRenderer.hpp"
+#include "macro.hpp"
+
+namespace VulkanEngine
+{
+    void VulkanSecondaryCommandBuffers::init(VulkanRenderer* vulkanRenderer, uint32_t threadCount, bool reusable)
+    {
+        this->vulkanRenderer = vulkanRenderer;
+
+        usageFlags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        if (!reusable)
+        {
+            usageFlags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        }
+
+        VkCommandPoolCreateInfo commandPoolCI{};
+        commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCI.pNext = nullptr;
+        commandPoolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        commandPoolCI.queueFamilyIndex = vulkanRenderer->queueIndices.graphicsFamily.value();
+
+        threadPools.resize(threadCount);
+        for (auto& framePools : threadPools)
+        {
+            framePools.resize(VulkanRenderer::MAX_FRAMES_IN_FLIGHT);
+            for (auto& framePool : framePools)
+            {
+                VK_CHECK_RESULT(vkCreateCommandPool(vulkanRenderer->device, &commandPoolCI, nullptr, &framePool.commandPool));
+            }
+        }
+    }
+
+    void VulkanSecondaryCommandBuffers::cleanup()
+    {
+        for (auto& framePools : threadPools)
+        {
+            for (auto& framePool : framePools)
+            {
+                // 销毁pool时其中的commandBuffer一起释放
+                vkDestroyCommandPool(vulkanRenderer->device, framePool.commandPool, nullptr);
+            }
+        }
+        threadPools.clear();
+    }
+
+    void VulkanSecondaryCommandBuffers::resetFrame(uint32_t frameIndex)
+    {
+        for (auto& framePools : threadPools)
+        {
+            FramePool& framePool = framePools[frameIndex];
+            if (framePool.usedCount == 0)
+            {
+                continue;
+            }
+            VK_CHECK_RESULT(vkResetCommandPool(vulkanRenderer->device, framePool.commandPool, 0));
+            framePool.usedCount = 0;
+        }
+    }
+
+    VkCommandBuffer VulkanSecondaryCommandBuffers::begin(uint32_t threadIndex, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+    {
+        FramePool& framePool = threadPools[threadIndex][vulkanRenderer->currentFrameIndex];
+
+        if (framePool.usedCount == framePool.commandBuffers.size())
+        {
+            VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+            commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            commandBufferAllocateInfo.commandPool = framePool.commandPool;
+            commandBufferAllocateInfo.commandBufferCount = 1U;
+
+            VkCommandBuffer commandBuffer;
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanRenderer->device, &commandBufferAllocateInfo, &commandBuffer));
+            framePool.commandBuffers.push_back(commandBuffer);
+        }
+
+        VkCommandBuffer commandBuffer = framePool.commandBuffers[framePool.usedCount++];
+
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = subpass;
+        inheritanceInfo.framebuffer = framebuffer;
+
+        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        commandBufferBeginInfo.flags = usageFlags;
+        commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+
+        return commandBuffer;
+    }
+
+    void VulkanSecondaryCommandBuffers::end(VkCommandBuffer commandBuffer)
+    {
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+    }
+
+    uint32_t VulkanSecondaryCommandBuffers::getRecordedCount(uint32_t frameIndex) const
+    {
+        uint32_t count = 0;
+        for (const auto& framePools : threadPools)
+        {
+            count += framePools[frameIndex].usedCount;
+        }
+        return count;
+    }
+}
\ No newline at end of file
@@ -3,8 +3,11 @@
 #extension GL_EXT_shader_texture_lod: enable
 #extension GL_OES_standard_derivatives : enable
 
+#define CLUSTERED_LIGHTING_SET 2
+
 #include "common.h"
 #include "DisneyBRDF.h"
+#include "clusteredLighting.h"
 
 layout(set = 0, binding = 1) uniform UniformBufferObject
 {
@@ -27,11 +30,12 @@ layout(set = 1, binding = 0) uniform sampler2D baseColorTextureSampler;
 layout(set = 1, binding = 1) uniform sampler2D normalTextureSampler;
 layout(set = 1, binding = 2) uniform sampler2D metallicRoughnessTextureSampler;
 
-layout(set = 2, binding = 0) uniform sampler2D directionalLightShadowMapSampler;
-layout(set = 2, binding = 1) uniform ShadowProjView
+layout(set = 2, binding = 0) uniform sampler2DArrayShadow directionalLightShadowMapSampler;
+layout(set = 2, binding = 1) uniform ShadowCascades
 {
-    mat4x4 shadowProjView;
+    ShadowCascadeData cascades;
 } shadowUbo;
+layout(set = 2, binding = 2) uniform sampler2DArray directionalLightShadowDepthSampler;
 
 // layout(location = 0)修饰符明确framebuffer的索引
 layout(location = 0) out highp vec4 outColor;
@@ -75,7 +79,7 @@ void main()
         {
             highp float shadow = 0.0;
             
-            shadow = calculateShadow(directionalLightShadowMapSampler, inWorldPos, shadowUbo.shadowProjView);
+            shadow = calculateShadow(directionalLightShadowMapSampler, directionalLightShadowDepthSampler, inWorldPos, shadowUbo.cascades);
 
             //if (shadow > 0.0f)
             {
@@ -86,6 +90,25 @@ void main()
         }
     }
 
+    // 所在簇的点光源和聚光灯
+    {
+        uint listBegin;
+        uint localLightCount = getClusterLights(gl_FragCoord.xy, inWorldPos, listBegin);
+        for (uint i = 0; i < localLightCount; i++)
+        {
+            highp vec3 L;
+            highp vec3 radiance;
+            if (evaluateClusterLight(listBegin + i, inWorldPos, L, radiance))
+            {
+                highp float NoL = dot(N, L);
+                if (NoL > 0.0)
+                {
+                    Lo += BRDF(L, V, N, T, B) * radiance * NoL;
+                }
+            }
+        }
+    }
+
     highp vec3 result = Lo + La;
 
     highp vec3 color = result;
@@ -3,7 +3,10 @@
 #extension GL_OES_standard_derivatives : enable
 #extension GL_EXT_shader_texture_lod: enable
 
+#define CLUSTERED_LIGHTING_SET 2
+
 #include "common.h"
+#include "clusteredLighting.h"
 
 layout(set = 0, binding = 1) uniform UniformBufferObject
 {
@@ -24,11 +27,12 @@ layout(set = 1, binding = 0) uniform sampler2D baseColorTextureSampler;
 layout(set = 1, binding = 1) uniform sampler2D normalTextureSampler;
 layout(set = 1, binding = 2) uniform sampler2D metallicRoughnessTextureSampler;
 
-layout(set = 2, binding = 0) uniform sampler2D directionalLightShadowMapSampler;
-layout(set = 2, binding = 1) uniform ShadowProjView
+layout(set = 2, binding = 0) uniform sampler2DArrayShadow directionalLightShadowMapSampler;
+layout(set = 2, binding = 1) uniform ShadowCascades
 {
-    mat4x4 shadowProjView;
+    ShadowCascadeData cascades;
 } shadowUbo;
+layout(set = 2, binding = 2) uniform sampler2DArray directionalLightShadowDepthSampler;
 
 // layout(location = 0)修饰符明确framebuffer的索引
 layout(location = 0) out highp vec4 outColor;
@@ -53,13 +57,27 @@ void main()
 
     highp float shadow = 0.0;
             
-    shadow = calculateShadow(directionalLightShadowMapSampler, inWorldPos, shadowUbo.shadowProjView);
+    shadow = calculateShadow(directionalLightShadowMapSampler, directionalLightShadowDepthSampler, inWorldPos, shadowUbo.cascades);
 
     vec3 result = diffuse * vec3(0.5);
     vec3 specular = spec * vec3(0.2);
 
     result = (result + specular) * shadow + ambient;
 
+    // 所在簇的点光源和聚光灯
+    uint listBegin;
+    uint localLightCount = getClusterLights(gl_FragCoord.xy, inWorldPos, listBegin);
+    for (uint i = 0; i < localLightCount; i++)
+    {
+        vec3 L;
+        vec3 radiance;
+        if (evaluateClusterLight(listBegin + i, inWorldPos, L, radiance))
+        {
+            float localSpec = pow(max(dot(normalize(L + viewDir), normal), 0.0), 5);
+            result += (max(dot(normal, L), 0.0) * baseColor * 0.5 + localSpec * 0.2) * radiance;
+        }
+    }
+
     highp vec3 color = result;
 
     outColor = vec4(result, 1.0);
@@ -0,0 +1,188 @@
+
+// 分簇光照，和C++里的ClusterGrid*、MaxLightsPerCluster、LightData、UniformBufferObjectClusters一致
+// 片元着色器、分簇和延迟光照的compute都会包含，这里不能用只有片元阶段才有的内置函数
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+#define LIGHT_TYPE_POINT 0
+#define LIGHT_TYPE_SPOT 1
+
+struct LightData
+{
+    vec4 positionRange;         // 世界空间位置，影响半径
+    vec4 colorType;             // 颜色乘强度，光源类型
+    vec4 directionCosOuter;     // 聚光灯照射方向，外角的cos，点光源为-1
+    vec4 spotParams;            // 角度衰减 = saturate(cos * x + y)，z是外角的sin，w是阴影图集里的第一块，没有阴影时为-1
+};
+
+struct ClusterData
+{
+    mat4 view;
+    vec4 projParams;            // tan(半视角)的x和y，near，far
+    vec4 sliceParams;           // 深度切片 = log(viewDepth) * x + y，zw是屏幕尺寸的倒数
+    uvec4 gridSize;             // xyz是网格尺寸，w是光源数量
+};
+
+// 屏幕上按比例分块，深度按对数分片，近处的簇更薄
+uint getClusterIndex(highp vec2 fragCoord, highp vec3 worldPos, ClusterData clusters)
+{
+    highp float viewDepth = -(clusters.view * vec4(worldPos, 1.0)).z;
+    highp float slice = floor(log(max(viewDepth, clusters.projParams.z)) * clusters.sliceParams.x + clusters.sliceParams.y);
+    uint z = uint(clamp(slice, 0.0, float(CLUSTER_GRID_Z - 1)));
+    uvec2 tile = uvec2(fragCoord * clusters.sliceParams.zw * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y));
+    tile = min(tile, uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    return (z * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// 簇和tile的光源剔除共用，都在观察空间里做
+// ndc的xy在[-1, 1]，depth是相机前方的距离，投影矩阵翻转了y，屏幕上方是ndc的-1
+vec3 clusterCorner(vec2 ndc, float depth, vec2 tanHalfFov)
+{
+    return vec3(ndc.x * tanHalfFov.x * depth, -ndc.y * tanHalfFov.y * depth, -depth);
+}
+
+bool sphereIntersectsAabb(vec3 center, float radius, vec3 aabbMin, vec3 aabbMax)
+{
+    vec3 offset = center - clamp(center, aabbMin, aabbMax);
+    return dot(offset, offset) <= radius * radius;
+}
+
+// 聚光灯的圆锥和簇或tile的包围球：球心到圆锥表面的距离大于球半径，或者在圆锥前后之外时不相交
+bool coneIntersectsSphere(vec3 apex, vec3 direction, float range, float cosOuter, float sinOuter, vec3 center, float radius)
+{
+    vec3 toCenter = center - apex;
+    float axial = dot(toCenter, direction);
+    float radial = sqrt(max(dot(toCenter, toCenter) - axial * axial, 0.0));
+    float distanceToCone = cosOuter * radial - sinOuter * axial;
+    return !(distanceToCone > radius || axial > radius + range || axial < -radius);
+}
+
+// 光源方向L和到达表面的辐照度，超出半径时返回false
+bool evaluateLocalLight(LightData light, highp vec3 worldPos, out highp vec3 L, out highp vec3 radiance)
+{
+    highp vec3 toLight = light.positionRange.xyz - worldPos;
+    highp float distanceSquared = dot(toLight, toLight);
+    highp float range = light.positionRange.w;
+    if (distanceSquared >= range * range)
+    {
+        return false;
+    }
+
+    L = toLight * inversesqrt(max(distanceSquared, 1e-8));
+
+    // 平方反比，在半径处平滑地衰减到0
+    highp float ratio = distanceSquared / (range * range);
+    highp float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+    highp float attenuation = window * window / (distanceSquared + 1.0);
+
+    highp float cosAngle = dot(-L, light.directionCosOuter.xyz);
+    highp float spot = clamp(cosAngle * light.spotParams.x + light.spotParams.y, 0.0, 1.0);
+    attenuation *= spot * spot;
+
+    radiance = light.colorType.rgb * attenuation;
+    return attenuation > 0.0;
+}
+
+// 光照shader在包含之前定义CLUSTERED_LIGHTING_SET，簇数据放在阴影所在的set的binding 3~5，阴影图集在binding 6~7
+#ifdef CLUSTERED_LIGHTING_SET
+layout(set = CLUSTERED_LIGHTING_SET, binding = 3) uniform ClusterParams
+{
+    ClusterData clusters;
+} clusterUbo;
+
+layout(std430, set = CLUSTERED_LIGHTING_SET, binding = 4) readonly buffer LightBuffer
+{
+    LightData lights[];
+} lightBuffer;
+
+layout(std430, set = CLUSTERED_LIGHTING_SET, binding = 5) readonly buffer ClusterGridBuffer
+{
+    uint lightCounts[CLUSTER_COUNT];
+    uint lightIndices[];
+} clusterGrid;
+
+// 像素所在簇的光源数量和列表起点
+uint getClusterLights(highp vec2 fragCoord, highp vec3 worldPos, out uint listBegin)
+{
+    uint clusterIndex = getClusterIndex(fragCoord, worldPos, clusterUbo.clusters);
+    listBegin = clusterIndex * MAX_LIGHTS_PER_CLUSTER;
+    return min(clusterGrid.lightCounts[clusterIndex], uint(MAX_LIGHTS_PER_CLUSTER));
+}
+
+LightData getClusterLight(uint listIndex)
+{
+    return lightBuffer.lights[clusterGrid.lightIndices[listIndex]];
+}
+
+// 和C++里的ShadowAtlasTileData一致，rect是块在图集里的起点和大小，单位是uv
+struct ShadowAtlasTile
+{
+    mat4 projView;
+    vec4 rect;
+};
+
+layout(set = CLUSTERED_LIGHTING_SET, binding = 6) uniform sampler2DShadow localLightShadowAtlas;
+
+layout(std430, set = CLUSTERED_LIGHTING_SET, binding = 7) readonly buffer ShadowAtlasTileBuffer
+{
+    ShadowAtlasTile tiles[];
+} shadowAtlasTiles;
+
+// 点光源按光源到表面的主轴选立方体的面，顺序是+x、-x、+y、-y、+z、-z
+float calculateLocalLightShadow(LightData light, highp vec3 worldPos)
+{
+    int firstTile = int(light.spotParams.w);
+    if (firstTile < 0)
+    {
+        return 1.0;
+    }
+
+    int tileIndex = firstTile;
+    if (int(light.colorType.w) == LIGHT_TYPE_POINT)
+    {
+        highp vec3 fromLight = worldPos - light.positionRange.xyz;
+        highp vec3 axis = abs(fromLight);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+        {
+            tileIndex += fromLight.x >= 0.0 ? 0 : 1;
+        }
+        else if (axis.y >= axis.z)
+        {
+            tileIndex += fromLight.y >= 0.0 ? 2 : 3;
+        }
+        else
+        {
+            tileIndex += fromLight.z >= 0.0 ? 4 : 5;
+        }
+    }
+
+    ShadowAtlasTile tile = shadowAtlasTiles.tiles[tileIndex];
+    highp vec4 positionClip = tile.projView * vec4(worldPos, 1.0);
+    if (positionClip.w <= 0.0)
+    {
+        return 1.0;
+    }
+    highp vec3 positionNdc = positionClip.xyz / positionClip.w;
+
+    // 限制在块内半个像素以内，双线性比较不会读到相邻的块
+    highp vec2 halfTexel = 0.5 / vec2(textureSize(localLightShadowAtlas, 0));
+    highp vec2 uv = ndcxyToUv(positionNdc.xy) * tile.rect.zw + tile.rect.xy;
+    uv = clamp(uv, tile.rect.xy + halfTexel, tile.rect.xy + tile.rect.zw - halfTexel);
+    return texture(localLightShadowAtlas, vec3(uv, positionNdc.z));
+}
+
+// 取出列表里的光源，算出方向、辐照度和阴影
+bool evaluateClusterLight(uint listIndex, highp vec3 worldPos, out highp vec3 L, out highp vec3 radiance)
+{
+    LightData light = getClusterLight(listIndex);
+    if (!evaluateLocalLight(light, worldPos, L, radiance))
+    {
+        return false;
+    }
+    radiance *= calculateLocalLightShadow(light, worldPos);
+    return true;
+}
+#endif
\ No newline at end of file
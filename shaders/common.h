@@ -11,6 +11,8 @@ highp vec3 DecodeNormal(highp vec3 N) { return N * 2.0 - 1.0; }
 vec3 T;
 vec3 B;
 
+// compute里没有导数和gl_FragCoord，包含之前定义COMPUTE_SHADER去掉只有片元阶段能用的部分
+#ifndef COMPUTE_SHADER
 highp vec3 calculateNormal(sampler2D normalTex, vec2 uv, vec3 worldPos, vec3 tangent, vec3 normal)
 {
     highp vec3 tangent_normal = texture(normalTex, uv).xyz * 2.0 - 1.0;
@@ -30,6 +32,7 @@ highp vec3 calculateNormal(sampler2D normalTex, vec2 uv, vec3 worldPos, vec3 tan
     highp mat3 TBN = mat3(T, B, N);
     return normalize(TBN * tangent_normal);
 }
+#endif
 
 highp vec3 Uncharted2Tonemap(highp vec3 x)
 {
@@ -59,34 +62,132 @@ highp vec2 ndcxyToUv(highp vec2 ndcxy) { return ndcxy * vec2(0.5, 0.5) + vec2(0.
 
 highp vec2 uvToNdcxy(highp vec2 uv) { return uv * vec2(2.0, 2.0) + vec2(-1.0, -1.0); }
 
-float calculateShadow(sampler2D shadowMap, vec3 worldPos, mat4 shadowProjView)
+// 方向光阴影的级联数上限，和C++里的MaxShadowCascades一致
+#define MAX_SHADOW_CASCADES 4
+
+// 和C++里的UniformBufferObjectShadowCascades一致
+struct ShadowCascadeData
+{
+    mat4 projView[MAX_SHADOW_CASCADES];
+    vec4 splits;            // 每个级联在相机前方的最远距离
+    vec4 viewDepthPlane;    // 到相机的前向距离 = dot(xyz, worldPos) + w
+    vec4 worldSizes;        // 每个级联正交投影覆盖的宽度
+    vec4 depthRanges;       // 每个级联深度0到1对应的世界距离
+    int count;
+};
+
+// 阴影过滤方式，创建管线时用specialization constant选择，没选中的分支会被编译掉
+#define SHADOW_FILTER_HARDWARE_PCF 0    // 一次比较采样，硬件做2x2双线性PCF
+#define SHADOW_FILTER_POISSON 1         // 旋转的泊松圆盘，每次采样都是2x2 PCF
+#define SHADOW_FILTER_PCSS 2            // 先搜索遮挡体平均深度，再按半影大小做泊松采样
+
+layout(constant_id = 0) const int shadowFilter = SHADOW_FILTER_POISSON;
+layout(constant_id = 1) const int shadowTapCount = 16;     // 8或16
+layout(constant_id = 2) const float shadowLightSize = 0.02; // 光源角半径的正切，PCSS用
+
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790));
+
+// viewDepth是到相机的前向距离，超出最后一个级联时返回-1
+int selectShadowCascade(highp float viewDepth, ShadowCascadeData cascades)
+{
+    for (int i = 0; i < cascades.count; i++)
+    {
+        if (viewDepth <= cascades.splits[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 每个像素不同的旋转角，把采样图案的规律打散成噪点
+// 间接dispatch的compute里线程编号不是像素坐标，包含之前自己定义SHADOW_NOISE_PIXEL
+#ifndef SHADOW_NOISE_PIXEL
+#ifdef COMPUTE_SHADER
+#define SHADOW_NOISE_PIXEL vec2(gl_GlobalInvocationID.xy)
+#else
+#define SHADOW_NOISE_PIXEL gl_FragCoord.xy
+#endif
+#endif
+
+highp float interleavedGradientNoise(highp vec2 pixel)
+{
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+highp float sampleShadowPoisson(sampler2DArrayShadow shadowMap, highp vec2 uv, float layer, highp float depth, highp float radius, highp mat2 rotation)
 {
-    float shadow = 0.0;
-    highp vec4 positionClip = shadowProjView * vec4(worldPos, 1.0);
+    highp float shadowFactor = 0.0;
+    for (int i = 0; i < shadowTapCount; i++)
+    {
+        highp vec2 offset = rotation * poissonDisk[i] * radius;
+        shadowFactor += texture(shadowMap, vec4(uv + offset, layer, depth));
+    }
+    return shadowFactor / float(shadowTapCount);
+}
+
+// shadowMap是比较采样，shadowDepthMap是同一张图的原始深度，只有PCSS会读
+float calculateShadow(sampler2DArrayShadow shadowMap, sampler2DArray shadowDepthMap, vec3 worldPos, ShadowCascadeData cascades)
+{
+    highp float viewDepth = dot(cascades.viewDepthPlane.xyz, worldPos) + cascades.viewDepthPlane.w;
+    int cascade = selectShadowCascade(viewDepth, cascades);
+    if (cascade < 0)
+    {
+        return 1.0;
+    }
+
+    highp vec4 positionClip = cascades.projView[cascade] * vec4(worldPos, 1.0);
     highp vec3 positionNdc  = positionClip.xyz / positionClip.w;
     highp vec2 uv = ndcxyToUv(positionNdc.xy);
-    // PCF
-    ivec2 texDim = textureSize(shadowMap, 0);
-    float scale = 1.5;
-    float dx = scale * 1.0 / float(texDim.x);
-    float dy = scale * 1.0 / float(texDim.y);
-    float shadowFactor = 0.0;
-    int count = 0;
-    int r = 3;
-
-    for (int x = -r; x <= r; x++)
+    float layer = float(cascade);
+    // 偏移已经在阴影pass光栅化时加上，比较采样器返回positionNdc.z <= 阴影图深度的比例
+    highp float depth = positionNdc.z;
+
+    if (shadowFilter == SHADOW_FILTER_HARDWARE_PCF)
     {
-        for (int y = -r; y <= r; y++)
+        return texture(shadowMap, vec4(uv, layer, depth));
+    }
+
+    highp float texelSize = 1.0 / float(textureSize(shadowMap, 0).x);
+    highp float angle = 6.28318530 * interleavedGradientNoise(SHADOW_NOISE_PIXEL);
+    highp mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+    if (shadowFilter == SHADOW_FILTER_POISSON)
+    {
+        return sampleShadowPoisson(shadowMap, uv, layer, depth, 3.0 * texelSize, rotation);
+    }
+
+    // PCSS：深度差换算成世界距离，乘光源大小得到半影宽度
+    highp float worldToUv = 1.0 / cascades.worldSizes[cascade];
+    highp float depthToWorld = cascades.depthRanges[cascade];
+    highp float searchRadius = clamp(shadowLightSize * depth * depthToWorld * worldToUv, texelSize, 16.0 * texelSize);
+
+    highp float blockerDepth = 0.0;
+    int blockerCount = 0;
+    for (int i = 0; i < shadowTapCount; i++)
+    {
+        highp vec2 offset = rotation * poissonDisk[i] * searchRadius;
+        highp float sampleDepth = texture(shadowDepthMap, vec3(uv + offset, layer)).r;
+        if (sampleDepth < depth)
         {
-            highp float closestDepth = texture(shadowMap, uv + vec2(dx * float(x), dy * float(y))).x + 0.003;
-            highp float currentDepth = positionNdc.z;
-            highp float tempShadow = (closestDepth >= currentDepth) ? 1.0f : 0.0f;
-            shadowFactor += tempShadow;
-            count++;
+            blockerDepth += sampleDepth;
+            blockerCount++;
         }
-    
-        shadow = shadowFactor / float(count);
     }
+    if (blockerCount == 0)
+    {
+        return 1.0;
+    }
+    blockerDepth /= float(blockerCount);
 
-    return shadow;
+    highp float penumbra = clamp(shadowLightSize * (depth - blockerDepth) * depthToWorld * worldToUv, texelSize, 32.0 * texelSize);
+    return sampleShadowPoisson(shadowMap, uv, layer, depth, penumbra, rotation);
 }
\ No newline at end of file
@@ -5,21 +5,33 @@
 
 #extension GL_GOOGLE_include_directive : enable
 
+#define CLUSTERED_LIGHTING_SET 0
+
 #include "common.h"
 #include "DisneyBRDF.h"
+#include "clusteredLighting.h"
+#include "gbufferEncoding.h"
+
+// 像素分类，和C++里的DeferredLightingClass一致，每类一个管线，没用到的分支会被编译掉
+#define LIGHTING_CLASS_SKY 0
+#define LIGHTING_CLASS_UNSHADOWED 1
+#define LIGHTING_CLASS_SHADOWED 2
+
+layout(constant_id = 3) const int lightingClass = LIGHTING_CLASS_SHADOWED;
 
 layout(location = 0) out highp vec4 outColor;
 
 layout(location = 0) in highp vec2 inTexCoord;
 
-layout(set = 0, binding = 0) uniform sampler2D directionalLightShadowMapSampler;
-layout(set = 0, binding = 1) uniform ShadowProjView
+layout(set = 0, binding = 0) uniform sampler2DArrayShadow directionalLightShadowMapSampler;
+layout(set = 0, binding = 1) uniform ShadowCascades
 {
-    mat4x4 shadowProjView;
+    ShadowCascadeData cascades;
 } shadowUbo;
+layout(set = 0, binding = 2) uniform sampler2DArray directionalLightShadowDepthSampler;
 
 layout(input_attachment_index = 0, set = 1, binding = 0) uniform highp subpassInput inGbufferNormal;
-layout(input_attachment_index = 1, set = 1, binding = 1) uniform highp subpassInput inGbufferMR;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform highp subpassInput inGbufferRoughnessSpecular;
 layout(input_attachment_index = 2, set = 1, binding = 2) uniform highp subpassInput inGbufferAlbedo;
 layout(input_attachment_index = 3, set = 1, binding = 3) uniform highp subpassInput inSceneDepth;
 
@@ -52,29 +64,45 @@ highp vec3 F_SchlickR(highp float cosTheta, highp vec3 F0, highp float roughness
 
 void main()
 {
+    // 每个attachment只读一次
+    highp float sceneDepth = subpassLoad(inSceneDepth).r;
+
     highp vec3 inWorldPos;
     {
-        highp float sceneDepth               = subpassLoad(inSceneDepth).r;
         highp vec4  ndc                      = vec4(uvToNdcxy(inTexCoord), sceneDepth, 1.0);
         highp mat4  inverseProjViewMatrix    = inverse(ubo.projView);
         highp vec4  inWorldPositionWithW     = inverseProjViewMatrix * ndc;
         inWorldPos                           = inWorldPositionWithW.xyz / inWorldPositionWithW.www;
     }
 
+    // 天空只采样天空盒
+    if (lightingClass == LIGHTING_CLASS_SKY)
+    {
+        highp vec3 inUVW = normalize(inWorldPos - ubo.viewPos);
+        outColor = vec4(gamma(textureLod(specularSampler, inUVW, 0.0).rgb), 1.0);
+        return;
+    }
+
+    // 深度测试只能限制一侧，没有阴影的这一类也包含天空
+    if (sceneDepth == 1.0)
+    {
+        discard;
+    }
+
     highp float ambientStrength = ubo.ambientStrength;
     highp vec3 ambientLight = vec3(ambientStrength);
     highp vec3 directionalLightDirection = normalize(ubo.directionalLightPos);
     highp vec3 directionalLightColor = vec3(ubo.directionalLightColor);
 
-    highp vec3 N = subpassLoad(inGbufferNormal).rgb * 2.0 - 1.0;
-    T = vec3(subpassLoad(inGbufferNormal).a, subpassLoad(inGbufferMR).a, subpassLoad(inGbufferAlbedo).a);
-    T = T * 2.0 - 1.0;
+    GBufferData gbuffer = decodeGBuffer(subpassLoad(inGbufferNormal), subpassLoad(inGbufferRoughnessSpecular), subpassLoad(inGbufferAlbedo));
+    highp vec3 N = gbuffer.N;
+    T = gbuffer.T;
     B = normalize(cross(N, T));
 
-    baseColor = subpassLoad(inGbufferAlbedo).rgb;
-    metallic = subpassLoad(inGbufferMR).r;
-    roughness = subpassLoad(inGbufferMR).b;
-    specular = subpassLoad(inGbufferMR).g;
+    baseColor = gbuffer.baseColor;
+    metallic = gbuffer.metallic;
+    roughness = gbuffer.roughness;
+    specular = gbuffer.specular;
 
     highp vec3 V = normalize(ubo.viewPos - inWorldPos);
 
@@ -111,9 +139,11 @@ void main()
 
         if (NoL > 0.0)
         {
-            highp float shadow = 0.0;
-            
-            shadow = calculateShadow(directionalLightShadowMapSampler, inWorldPos, shadowUbo.shadowProjView);
+            highp float shadow = 1.0;
+            if (lightingClass == LIGHTING_CLASS_SHADOWED)
+            {
+                shadow = calculateShadow(directionalLightShadowMapSampler, directionalLightShadowDepthSampler, inWorldPos, shadowUbo.cascades);
+            }
 
             //if (shadow > 0.0f)
             {
@@ -124,18 +154,29 @@ void main()
         }
     }
 
+    // 所在簇的点光源和聚光灯
+    {
+        uint listBegin;
+        uint localLightCount = getClusterLights(gl_FragCoord.xy, inWorldPos, listBegin);
+        for (uint i = 0; i < localLightCount; i++)
+        {
+            highp vec3 L;
+            highp vec3 radiance;
+            if (evaluateClusterLight(listBegin + i, inWorldPos, L, radiance))
+            {
+                highp float NoL = dot(N, L);
+                if (NoL > 0.0)
+                {
+                    Lo += BRDF(L, V, N, T, B) * radiance * NoL;
+                }
+            }
+        }
+    }
+
     highp vec3 result = Lo + La + Libl;
     
     highp vec3 color = result;
 
-    if(subpassLoad(inSceneDepth).r == 1.0)
-    {
-        // skybox
-        highp vec3 inUVW            = normalize(inWorldPos - ubo.viewPos);
-        highp vec3 originSampleUVW  = vec3(inUVW.x, inUVW.y, inUVW.z);
-        color = textureLod(specularSampler, originSampleUVW, 0.0).rgb;
-    }
-
     // tone mapping
     //color = toneMapping(color);
     
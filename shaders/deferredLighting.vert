@@ -7,9 +7,16 @@
 
 layout(location = 0) out vec2 out_texcoord;
 
+// 三角形的深度，和gbuffer的深度比较来给像素分类，见DeferredRenderPass::drawLighting
+layout(push_constant) uniform PushConstants
+{
+    float depth;
+} pushConstants;
+
 void main()
 {
-    vec3 fullscreen_triangle_positions[3] = vec3[3](vec3(3.0, 1.0, 0.5), vec3(-1.0, 1.0, 0.5), vec3(-1.0, -3.0, 0.5));
+    float depth = pushConstants.depth;
+    vec3 fullscreen_triangle_positions[3] = vec3[3](vec3(3.0, 1.0, depth), vec3(-1.0, 1.0, depth), vec3(-1.0, -3.0, depth));
 
     vec2 fullscreen_triangle_uvs[3] = vec2[3](vec2(2.0, 1.0), vec2(0.0, 1.0), vec2(0.0, -1.0));
 
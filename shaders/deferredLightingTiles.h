@@ -0,0 +1,32 @@
+// compute延迟光照的tile分类，deferredTileClassify.comp写入，deferredLighting.comp按类读取
+// 和C++里的LightingTileSize、DeferredLightingClass一致，分类的含义和deferredLighting.frag的LIGHTING_CLASS_*相同
+#define TILE_SIZE 16
+
+#define LIGHTING_CLASS_SKY 0
+#define LIGHTING_CLASS_UNSHADOWED 1
+#define LIGHTING_CLASS_SHADOWED 2
+#define LIGHTING_CLASS_COUNT 3
+
+// 开头是每类一个VkDispatchIndirectCommand，w不用，录制时重置为(0, 1, 1)
+// 后面每类一段tile列表，每段的长度都是整屏的tile数，tile坐标打包成一个uint
+layout(set = 1, binding = 5) buffer LightingTiles
+{
+    uvec4 dispatchCommands[LIGHTING_CLASS_COUNT];
+    uint tiles[];
+} lightingTiles;
+
+uint lightingTileCapacity(ivec2 outputSize)
+{
+    ivec2 tileCount = (outputSize + TILE_SIZE - 1) / TILE_SIZE;
+    return uint(tileCount.x * tileCount.y);
+}
+
+uint packLightingTile(uvec2 tile)
+{
+    return tile.x | (tile.y << 16);
+}
+
+uvec2 unpackLightingTile(uint packedTile)
+{
+    return uvec2(packedTile & 0xFFFFu, packedTile >> 16);
+}
\ No newline at end of file
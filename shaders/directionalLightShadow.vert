@@ -7,10 +7,20 @@ layout(set = 0, binding = 0) uniform UniformBufferObject
     mat4 projView;
 } ubo;
 
-layout(set = 0, binding = 1) uniform UniformBufferDynamicObject
+// 间接绘制时firstInstance填的是mesh下标
+struct MeshDrawData
 {
     mat4 model;
-} uboDynamic;
+    uint materialIndex;
+    uint firstIndex;
+    uint indexCount;
+    int vertexOffset;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer MeshDrawDataBuffer
+{
+    MeshDrawData draws[];
+} meshDrawData;
 
 layout(location = 0) in vec3 inPosition;
 
@@ -21,5 +31,5 @@ out gl_PerVertex
 
 void main() 
 {
-    gl_Position = ubo.projView * uboDynamic.model * vec4(inPosition, 1.0);
+    gl_Position = ubo.projView * meshDrawData.draws[gl_InstanceIndex].model * vec4(inPosition, 1.0);
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "common.h"
+#include "gbufferEncoding.h"
 
 layout(location = 0) out highp vec4 out_gbuffer0;
 layout(location = 1) out highp vec4 out_gbuffer1;
@@ -23,14 +24,15 @@ layout(set = 1, binding = 2) uniform sampler2D metallicRoughnessTextureSampler;
 
 void main()
 {
-    vec3 worldNormal = calculateNormal(normalTextureSampler, inTexCoord, inWorldPos, inTangent, inNormal);
-    vec3 albedo = texture(baseColorTextureSampler, inTexCoord).xyz;
-    float metalic = texture(metallicRoughnessTextureSampler, inTexCoord).z;
-    float specular = 0.5;
-    float roughness = texture(metallicRoughnessTextureSampler, inTexCoord).y;
-    float shadingModelID = 1.0;
+    GBufferData data;
+    data.N = calculateNormal(normalTextureSampler, inTexCoord, inWorldPos, inTangent, inNormal);
+    data.T = T;
+    data.baseColor = texture(baseColorTextureSampler, inTexCoord).xyz;
+    highp vec3 metallicRoughness = texture(metallicRoughnessTextureSampler, inTexCoord).xyz;
+    data.metallic = metallicRoughness.z;
+    data.specular = 0.5;
+    data.roughness = metallicRoughness.y;
+    data.shadingModelID = 1.0;
 
-    out_gbuffer0 = vec4(EncodeNormal(worldNormal), (T.x + 1.0) / 2.0);
-    out_gbuffer1 = vec4(metalic, specular, roughness, (T.y + 1.0) / 2.0);
-    out_gbuffer2 = vec4(albedo, (T.z + 1.0) / 2.0);
+    encodeGBuffer(data, out_gbuffer0, out_gbuffer1, out_gbuffer2);
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+
+// IBL预计算的compute共用，cube map的方向都在世界空间，和光照shader采样时的方向一致
+// 和C++里的VulkanIBLPrecomputer::PushConstants一致
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+
+layout(push_constant) uniform PushConstants
+{
+    float roughness;        // 预过滤specular当前mip的粗糙度
+    float intensity;        // 环境图转换成cube map时乘上的亮度
+    uint sampleCount;
+    uint padding;
+} params;
+
+// cube map第face个面上uv在[-1, 1]的点对应的方向，面的顺序和朝向按Vulkan的规定：+x、-x、+y、-y、+z、-z
+vec3 cubeFaceDirection(uint face, vec2 uv)
+{
+    vec3 direction;
+    if (face == 0)
+    {
+        direction = vec3(1.0, -uv.y, -uv.x);
+    }
+    else if (face == 1)
+    {
+        direction = vec3(-1.0, -uv.y, uv.x);
+    }
+    else if (face == 2)
+    {
+        direction = vec3(uv.x, 1.0, uv.y);
+    }
+    else if (face == 3)
+    {
+        direction = vec3(uv.x, -1.0, -uv.y);
+    }
+    else if (face == 4)
+    {
+        direction = vec3(uv.x, -uv.y, 1.0);
+    }
+    else
+    {
+        direction = vec3(-uv.x, -uv.y, -1.0);
+    }
+    return normalize(direction);
+}
+
+// 写入的texel中心对应的方向，z是面
+vec3 cubeTexelDirection(ivec3 texel, int size)
+{
+    vec2 uv = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    return cubeFaceDirection(uint(texel.z), uv);
+}
+
+// Hammersley低差异序列
+vec2 hammersley(uint i, uint count)
+{
+    return vec2(float(i) / float(count), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+// 以N为z轴的切线空间转到世界空间
+vec3 tangentToWorld(vec3 v, vec3 N)
+{
+    vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangentX = normalize(cross(up, N));
+    vec3 tangentY = cross(N, tangentX);
+    return tangentX * v.x + tangentY * v.y + N * v.z;
+}
+
+// 和光照shader一致，alpha = roughness^2
+float D_GGX(float NoH, float roughness)
+{
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float d = NoH * NoH * (a2 - 1.0) + 1.0;
+    return a2 / (PI * d * d);
+}
+
+// 按GGX法线分布采样半程向量
+vec3 importanceSampleGGX(vec2 xi, vec3 N, float roughness)
+{
+    float a = roughness * roughness;
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    return tangentToWorld(vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta), N);
+}
+
+// 每个样本覆盖的立体角和环境图一个texel的立体角之比决定读哪一级mip，样本少时也不会出现亮点
+float environmentSampleLod(float pdf, samplerCube environmentMap)
+{
+    float size = float(textureSize(environmentMap, 0).x);
+    float texelSolidAngle = 4.0 * PI / (6.0 * size * size);
+    float sampleSolidAngle = 1.0 / (float(params.sampleCount) * pdf + 1e-4);
+    return max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+}
\ No newline at end of file
@@ -7,10 +7,20 @@ layout(set = 0, binding = 0) uniform UniformBufferObject
     mat4 proj;
 } ubo;
 
-layout(set = 0, binding = 2) uniform UniformBufferDynamicObject
+// 间接绘制时firstInstance填的是mesh下标
+struct MeshDrawData
 {
     mat4 model;
-} uboDynamic;
+    uint materialIndex;
+    uint firstIndex;
+    uint indexCount;
+    int vertexOffset;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer MeshDrawDataBuffer
+{
+    MeshDrawData draws[];
+} meshDrawData;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
@@ -31,14 +41,16 @@ out gl_PerVertex
 
 void main() 
 {
-    gl_Position = ubo.proj * ubo.view * uboDynamic.model * vec4(inPosition, 1.0);
+    mat4 model = meshDrawData.draws[gl_InstanceIndex].model;
+
+    gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 1.0);
     outColor = inColor;
 
-    mat3x3 tangentMatrix = mat3x3(uboDynamic.model[0].xyz, uboDynamic.model[1].xyz, uboDynamic.model[2].xyz);
+    mat3x3 tangentMatrix = mat3x3(model[0].xyz, model[1].xyz, model[2].xyz);
     outNormal            = normalize(tangentMatrix * inNormal);
     outTangent           = normalize(tangentMatrix * inTangent);
 
     outTexCoord = inTexCoord;
 
-    outWorldPos = vec3(uboDynamic.model * vec4(inPosition, 1.0));
+    outWorldPos = vec3(model * vec4(inPosition, 1.0));
 }
@@ -0,0 +1,232 @@
+﻿#include "boundingVolumeHierarchy.hpp"
+#include "frustumCulling.hpp"
+#include "threadPool.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace VulkanEngine;
+using Bounds = BoundingVolumeHierarchy::Bounds;
+
+namespace
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    double elapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // 和BVH里的平面测试一致，包围盒完全在某个平面外才剔除
+    bool bruteForceFrustum(const Frustum& frustum, const Bounds& bounds)
+    {
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+            float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+            if (distance + radius < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool bruteForceRay(const Bounds& bounds, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxT, float& entryT)
+    {
+        glm::vec3 t0 = (bounds.min - origin) * inverseDirection;
+        glm::vec3 t1 = (bounds.max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+        entryT = enter;
+        return enter <= exit;
+    }
+
+    Bounds randomBounds(std::mt19937& random, float worldSize)
+    {
+        std::uniform_real_distribution<float> position(-worldSize, worldSize);
+        std::uniform_real_distribution<float> size(0.25f, 2.0f);
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        Bounds bounds;
+        bounds.min = center - extent;
+        bounds.max = center + extent;
+        return bounds;
+    }
+
+    // 返回不一致的次数
+    uint32_t runBenchmark(uint32_t objectCount, ThreadPool& threadPool)
+    {
+        const uint32_t frustumQueryCount = 64;
+        const uint32_t rayCount = 1024;
+
+        // 保持物体密度不变，场景边长随数量的立方根增长
+        float worldSize = 4.0f * std::cbrt(static_cast<float>(objectCount));
+        std::mt19937 random(objectCount);
+        std::vector<Bounds> objectBounds(objectCount);
+        for (auto& bounds : objectBounds)
+        {
+            bounds = randomBounds(random, worldSize);
+        }
+
+        uint32_t mismatches = 0;
+        printf("objects: %u\n", objectCount);
+
+        BoundingVolumeHierarchy bvh;
+        auto start = Clock::now();
+        bvh.build(objectBounds);
+        printf("  build (1 thread):    %10.3f ms, cost %.1f\n", elapsedMs(start), bvh.getCost());
+
+        start = Clock::now();
+        bvh.build(objectBounds, &threadPool);
+        printf("  build (%2u threads):  %10.3f ms, cost %.1f\n", threadPool.getThreadCount(), elapsedMs(start), bvh.getCost());
+
+        // 移动十分之一的物体后refit
+        std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+        for (uint32_t i = 0; i < objectCount; i += 10)
+        {
+            glm::vec3 delta(offset(random), offset(random), offset(random));
+            objectBounds[i].min += delta;
+            objectBounds[i].max += delta;
+            bvh.setObjectBounds(i, objectBounds[i]);
+        }
+        start = Clock::now();
+        bool rebuilt = bvh.refit(&threadPool);
+        printf("  refit (10%% moved):   %10.3f ms, cost %.1f%s\n", elapsedMs(start), bvh.getCost(), rebuilt ? " (rebuilt)" : "");
+
+        std::vector<glm::mat4> viewProjs(frustumQueryCount);
+        std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+        for (auto& viewProj : viewProjs)
+        {
+            glm::vec3 eye = randomBounds(random, worldSize).min;
+            float yaw = angle(random);
+            glm::vec3 forward(std::cos(yaw), 0.0f, std::sin(yaw));
+            glm::mat4 view = glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, worldSize);
+            viewProj = proj * view;
+        }
+
+        std::vector<std::vector<uint32_t>> results(frustumQueryCount);
+        size_t visibleCount = 0;
+        start = Clock::now();
+        for (uint32_t q = 0; q < frustumQueryCount; q++)
+        {
+            bvh.queryFrustum(Frustum::fromViewProj(viewProjs[q]), results[q]);
+            visibleCount += results[q].size();
+        }
+        double queryTime = elapsedMs(start);
+
+        std::vector<uint32_t> expected;
+        start = Clock::now();
+        for (uint32_t q = 0; q < frustumQueryCount; q++)
+        {
+            Frustum frustum = Frustum::fromViewProj(viewProjs[q]);
+            expected.clear();
+            for (uint32_t i = 0; i < objectCount; i++)
+            {
+                if (bruteForceFrustum(frustum, objectBounds[i]))
+                {
+                    expected.push_back(i);
+                }
+            }
+            std::sort(results[q].begin(), results[q].end());
+            if (results[q] != expected)
+            {
+                mismatches++;
+            }
+        }
+        double bruteForceTime = elapsedMs(start);
+        printf("  frustum query:       %10.3f ms / query, brute force %.3f ms, avg visible %zu\n",
+            queryTime / frustumQueryCount, bruteForceTime / frustumQueryCount, visibleCount / frustumQueryCount);
+
+        std::vector<glm::vec3> origins(rayCount);
+        std::vector<glm::vec3> directions(rayCount);
+        std::uniform_real_distribution<float> component(-1.0f, 1.0f);
+        for (uint32_t r = 0; r < rayCount; r++)
+        {
+            origins[r] = randomBounds(random, worldSize).min;
+            directions[r] = glm::normalize(glm::vec3(component(random), component(random), component(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        }
+
+        std::vector<float> hitTs(rayCount);
+        std::vector<int32_t> hitObjects(rayCount);
+        start = Clock::now();
+        for (uint32_t r = 0; r < rayCount; r++)
+        {
+            hitTs[r] = worldSize * 4.0f;
+            hitObjects[r] = bvh.raycast(origins[r], directions[r], hitTs[r]);
+        }
+        double rayTime = elapsedMs(start);
+
+        start = Clock::now();
+        uint32_t hitCount = 0;
+        for (uint32_t r = 0; r < rayCount; r++)
+        {
+            glm::vec3 inverseDirection = 1.0f / directions[r];
+            float closestT = worldSize * 4.0f;
+            int32_t closestObject = -1;
+            for (uint32_t i = 0; i < objectCount; i++)
+            {
+                float entryT;
+                if (bruteForceRay(objectBounds[i], origins[r], inverseDirection, closestT, entryT) && entryT <= closestT)
+                {
+                    closestT = entryT;
+                    closestObject = static_cast<int32_t>(i);
+                }
+            }
+            // 距离相同的物体可能命中不同的那个，只比较是否命中和距离
+            if ((closestObject < 0) != (hitObjects[r] < 0) || (closestObject >= 0 && hitTs[r] != closestT))
+            {
+                mismatches++;
+            }
+            hitCount += closestObject >= 0 ? 1 : 0;
+        }
+        double rayBruteForceTime = elapsedMs(start);
+        printf("  raycast:             %10.3f us / ray, brute force %.3f us, hits %u/%u\n",
+            rayTime * 1000.0 / rayCount, rayBruteForceTime * 1000.0 / rayCount, hitCount, rayCount);
+
+        printf("  %s\n", mismatches == 0 ? "ok" : "MISMATCH");
+        return mismatches;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // 可以在命令行指定物体数量，默认跑10k、100k、1M
+    std::vector<uint32_t> objectCounts;
+    for (int i = 1; i < argc; i++)
+    {
+        objectCounts.push_back(static_cast<uint32_t>(std::strtoul(argv[i], nullptr, 10)));
+    }
+    if (objectCounts.empty())
+    {
+        objectCounts = { 10000, 100000, 1000000 };
+    }
+
+    ThreadPool threadPool;
+    threadPool.init(std::max(1u, std::thread::hardware_concurrency()));
+
+    uint32_t mismatches = 0;
+    for (uint32_t objectCount : objectCounts)
+    {
+        mismatches += runBenchmark(objectCount, threadPool);
+    }
+
+    threadPool.shutdown();
+    return mismatches == 0 ? 0 : 1;
+}
\ No newline at end of file